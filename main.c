@@ -3,28 +3,142 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "sdcloner_engine.h"
 
-// forward decl from engine
-int sdcloner_clone(const char* src_disk, const char* dest_disk, uint64_t dest_capacity_hint);
+// One status line on stderr, redrawn in place (like dd status=progress).
+static void print_progress(const sdcloner_progress* p, void* user) {
+    (void)user;
+    double mb = (double)p->bytes_done / (1024.0 * 1024.0);
+    if (p->phase == SDCLONER_PHASE_DONE) { fputc('\n', stderr); return; }
+    if (p->bytes_total) {
+        double pct = 100.0 * (double)p->bytes_done / (double)p->bytes_total;
+        fprintf(stderr, "\r%-9s %6.1f%%  %9.1f MB  %6.1f MB/s (avg %.1f)  ETA %4.0fs   ",
+                sdcloner_phase_name(p->phase), pct, mb, p->rate_mbps, p->avg_mbps,
+                p->eta_s < 0 ? 0.0 : p->eta_s);
+    } else {
+        fprintf(stderr, "\r%-9s %9.1f MB  %6.1f MB/s   ",
+                sdcloner_phase_name(p->phase), mb, p->rate_mbps);
+    }
+}
+
+static int usage(const char* argv0) {
+    fprintf(stderr,"Usage:\n"
+            "  %s <SRC_DISK>                # save image locally (raw, compressed)\n"
+            "  %s <SRC_DISK> <DEST_DISK>    # clone to destination\n"
+            "  %s <SRC_DISK> --hint <GB>    # image sized for smaller future card\n"
+            "  %s --burn <IMAGE> <DEST>...  # write one image to one or more cards\n"
+            "  %s --convert <IN> <OUT>      # convert any image to .img/.img.gz/.sdimg/.sdref (by OUT suffix)\n"
+            "  %s --gc                      # drop store chunks no .sdref image uses any more\n"
+            "  %s --rescue <SRC_DISK> [IMG] # image a failing card, mapping unreadable ranges\n"
+            "                               # (IMG with an existing IMG.bad: retry those only)\n"
+            "Options:\n"
+            "  --no-archive     direct raw clone without a local image copy\n"
+            "  --alloc-aware    raw mode: read only allocated FAT/ext blocks, zero free space\n"
+            "  --sdimg          write images as seekable .sdimg instead of .img.gz\n"
+            "  --store          write images as .sdref into the deduplicating chunk store\n"
+            "  --base IMAGE     incremental backup: .sdimg delta holding only blocks changed\n"
+            "                   since IMAGE (an .sdimg or earlier delta)\n"
+            "  --verify MODE    after burning: full, sampled (default) or skip read-back\n"
+            "  --diff           burning: write only blocks that differ from the card\n"
+            "  --no-discard     burning: write zero blocks instead of zero-out\n"
+            "  --io BACKEND     device I/O: auto (default), uring, threads or sync\n"
+            "  --io-depth N     device requests in flight (default 4, max 64)\n"
+            "  --checkpoint MB  imaging: checkpoint interval for resuming (default 1024, 0 = off)\n"
+            "  --trace          write a timing / I/O latency report to ~/SDCloner/traces\n"
+            "  --trace-timeline same, plus a Chrome trace (chrome://tracing, Perfetto)\n",
+            argv0, argv0, argv0, argv0, argv0, argv0, argv0);
+    return 1;
+}
 
 int main(int argc, char** argv) {
-    if (argc < 2) {
-        fprintf(stderr,"Usage:\n"
-                "  %s <SRC_DISK>                # save image locally (raw, compressed)\n"
-                "  %s <SRC_DISK> <DEST_DISK>    # clone to destination\n"
-                "  %s <SRC_DISK> --hint <GB>    # image sized for smaller future card\n", argv[0], argv[0], argv[0]);
-        return 1;
-    }
-    const char* src = argv[1];
+    const char* src = NULL;
     const char* dest = NULL;
+    const char* image = NULL;
+    const char** dests = calloc((size_t)argc, sizeof(char*));
+    int ndest = 0;
     uint64_t hint=0;
+    int rescue = 0;
+    sdcloner_options opt; sdcloner_options_init(&opt);
 
-    if (argc >= 3 && strcmp(argv[2],"--hint")==0 && argc>=4) {
-        hint = (uint64_t)atoll(argv[3]) * 1024ULL*1024ULL*1024ULL;
-    } else if (argc >= 3) {
-        dest = argv[2];
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i],"--hint")==0 && i+1 < argc) {
+            hint = (uint64_t)atoll(argv[++i]) * 1024ULL*1024ULL*1024ULL;
+        } else if (strcmp(argv[i],"--burn")==0 && i+1 < argc) {
+            image = argv[++i];
+        } else if (strcmp(argv[i],"--convert")==0 && i+2 < argc) {
+            if (isatty(STDERR_FILENO)) opt.progress = print_progress;
+            int rc = sdcloner_convert_image(argv[i+1], argv[i+2], &opt);
+            free(dests);
+            return rc;
+        } else if (strcmp(argv[i],"--verify")==0 && i+1 < argc) {
+            const char* m = argv[++i];
+            if (strcmp(m,"full")==0) opt.verify = SDCLONER_VERIFY_FULL;
+            else if (strcmp(m,"sampled")==0) opt.verify = SDCLONER_VERIFY_SAMPLED;
+            else if (strcmp(m,"skip")==0) opt.verify = SDCLONER_VERIFY_SKIP;
+            else return usage(argv[0]);
+        } else if (strcmp(argv[i],"--base")==0 && i+1 < argc) {
+            opt.base_image = argv[++i];
+        } else if (strcmp(argv[i],"--diff")==0) {
+            opt.diff_burn = 1;
+        } else if (strcmp(argv[i],"--no-discard")==0) {
+            opt.zero_discard = 0;
+        } else if (strcmp(argv[i],"--io")==0 && i+1 < argc) {
+            const char* m = argv[++i];
+            if (strcmp(m,"auto")==0) opt.io = SDCLONER_IO_AUTO;
+            else if (strcmp(m,"uring")==0) opt.io = SDCLONER_IO_URING;
+            else if (strcmp(m,"threads")==0) opt.io = SDCLONER_IO_THREADS;
+            else if (strcmp(m,"sync")==0) opt.io = SDCLONER_IO_SYNC;
+            else return usage(argv[0]);
+        } else if (strcmp(argv[i],"--io-depth")==0 && i+1 < argc) {
+            int n = atoi(argv[++i]);
+            if (n < 1 || n > 64) return usage(argv[0]);
+            opt.io_depth = (unsigned)n;
+        } else if (strcmp(argv[i],"--checkpoint")==0 && i+1 < argc) {
+            int n = atoi(argv[++i]);
+            if (n < 0) return usage(argv[0]);
+            opt.checkpoint_mb = (unsigned)n;
+        } else if (strcmp(argv[i],"--trace")==0) {
+            opt.trace = SDCLONER_TRACE_SUMMARY;
+        } else if (strcmp(argv[i],"--trace-timeline")==0) {
+            opt.trace = SDCLONER_TRACE_TIMELINE;
+        } else if (strcmp(argv[i],"--gc")==0) {
+            free(dests);
+            return sdcloner_store_gc(NULL);
+        } else if (strcmp(argv[i],"--rescue")==0) {
+            rescue = 1;
+        } else if (strcmp(argv[i],"--sdimg")==0) {
+            opt.format = SDCLONER_FMT_SDIMG;
+        } else if (strcmp(argv[i],"--store")==0) {
+            opt.format = SDCLONER_FMT_STORE;
+        } else if (strcmp(argv[i],"--no-archive")==0) {
+            opt.keep_archive = 0;
+        } else if (strcmp(argv[i],"--alloc-aware")==0) {
+            opt.alloc_aware = 1;
+        } else if (argv[i][0]=='-') {
+            return usage(argv[0]);
+        } else if (image) {
+            dests[ndest++] = argv[i];
+        } else if (!src) {
+            src = argv[i];
+        } else if (!dest) {
+            dest = argv[i];
+        } else {
+            return usage(argv[0]);
+        }
+    }
+    if (isatty(STDERR_FILENO)) opt.progress = print_progress;
+    if (image) {
+        if (!ndest) return usage(argv[0]);
+        int* results = calloc((size_t)ndest, sizeof(int));
+        int rc = sdcloner_burn_multi(image, dests, ndest, &opt, results);
+        free(results);
+        free(dests);
+        return rc;
     }
+    free(dests);
+    if (!src) return usage(argv[0]);
+    if (rescue) return sdcloner_rescue(src, dest, &opt);
 
-    return sdcloner_clone(src, dest, hint);
+    return sdcloner_clone_ex(src, dest, hint, &opt);
 }
-
@@ -0,0 +1,365 @@
+// sdcloner_aio.c
+// io_uring and thread-pool backends behind sdcloner_aio.h.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+#include "sdcloner_internal.h"
+#include "sdcloner_aio.h"
+
+#define AIO_THREADS_MAX 16
+
+enum { REQ_FREE, REQ_QUEUED, REQ_RUNNING, REQ_DONE };
+
+typedef struct {
+    int            state;
+    bool           write;
+    int            fd;
+    unsigned char* buf;
+    int            fixed;       // registered buffer index, -1 if none
+    size_t         len, done;
+    uint64_t       off, tag;
+    ssize_t        res;         // final result once REQ_DONE
+} aio_req;
+
+struct sdc_aio {
+    sdc_aio_backend kind;
+    unsigned        depth, pending;
+    aio_req*        req;
+    unsigned char** bufs;
+    unsigned        nbufs;
+    size_t          buf_len;
+
+    // io_uring
+    int             ring_fd;
+    bool            fixed;      // buffers registered
+    void*           sq_ptr;  size_t sq_sz;
+    void*           cq_ptr;  size_t cq_sz;
+    struct io_uring_sqe* sqes; size_t sqes_sz;
+    unsigned       *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned       *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe* cqes;
+
+    // thread pool
+    pthread_mutex_t mu;
+    pthread_cond_t  work, done;
+    pthread_t*      tw;
+    unsigned        nthreads;
+    bool            stop;
+};
+
+const char* sdc_aio_name(sdc_aio_backend b) {
+    switch (b) {
+    case SDC_AIO_AUTO:    return "auto";
+    case SDC_AIO_URING:   return "io_uring";
+    case SDC_AIO_THREADS: return "threads";
+    case SDC_AIO_SYNC:    return "sync";
+    }
+    return "?";
+}
+
+// ---------------- io_uring ----------------------------
+static int uring_enter(int fd, unsigned submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_init(sdc_aio* a) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    a->ring_fd = (int)syscall(__NR_io_uring_setup, a->depth, &p);
+    if (a->ring_fd < 0) return -1;
+    a->sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    a->cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (a->cq_sz > a->sq_sz) a->sq_sz = a->cq_sz;
+        a->cq_sz = a->sq_sz;
+    }
+    a->sq_ptr = mmap(NULL, a->sq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                     a->ring_fd, IORING_OFF_SQ_RING);
+    if (a->sq_ptr == MAP_FAILED) { a->sq_ptr = NULL; return -1; }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        a->cq_ptr = a->sq_ptr;
+    } else {
+        a->cq_ptr = mmap(NULL, a->cq_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                         a->ring_fd, IORING_OFF_CQ_RING);
+        if (a->cq_ptr == MAP_FAILED) { a->cq_ptr = NULL; return -1; }
+    }
+    a->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    a->sqes = mmap(NULL, a->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   a->ring_fd, IORING_OFF_SQES);
+    if (a->sqes == MAP_FAILED) { a->sqes = NULL; return -1; }
+    char* sq = a->sq_ptr;
+    char* cq = a->cq_ptr;
+    a->sq_head  = (unsigned*)(sq + p.sq_off.head);
+    a->sq_tail  = (unsigned*)(sq + p.sq_off.tail);
+    a->sq_mask  = (unsigned*)(sq + p.sq_off.ring_mask);
+    a->sq_array = (unsigned*)(sq + p.sq_off.array);
+    a->cq_head  = (unsigned*)(cq + p.cq_off.head);
+    a->cq_tail  = (unsigned*)(cq + p.cq_off.tail);
+    a->cq_mask  = (unsigned*)(cq + p.cq_off.ring_mask);
+    a->cqes     = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    // Fixed buffers save the per-request page pinning; optional, since
+    // RLIMIT_MEMLOCK can refuse them on older kernels.
+    struct iovec* iov = calloc(a->nbufs ? a->nbufs : 1, sizeof(struct iovec));
+    if (iov && a->nbufs) {
+        for (unsigned i = 0; i < a->nbufs; i++) { iov[i].iov_base = a->bufs[i]; iov[i].iov_len = a->buf_len; }
+        a->fixed = syscall(__NR_io_uring_register, a->ring_fd, IORING_REGISTER_BUFFERS, iov, a->nbufs) == 0;
+    }
+    free(iov);
+    return 0;
+}
+
+static void uring_free(sdc_aio* a) {
+    if (a->sqes) munmap(a->sqes, a->sqes_sz);
+    if (a->cq_ptr && a->cq_ptr != a->sq_ptr) munmap(a->cq_ptr, a->cq_sz);
+    if (a->sq_ptr) munmap(a->sq_ptr, a->sq_sz);
+    if (a->ring_fd >= 0) close(a->ring_fd);
+}
+
+// Queue the remainder of request i and submit it.
+static int uring_submit(sdc_aio* a, unsigned i) {
+    aio_req* r = &a->req[i];
+    unsigned tail = *a->sq_tail;
+    unsigned idx = tail & *a->sq_mask;
+    struct io_uring_sqe* sqe = &a->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    if (r->fixed >= 0) {
+        sqe->opcode = r->write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = (uint16_t)r->fixed;
+    } else {
+        sqe->opcode = r->write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = r->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(r->buf + r->done);
+    sqe->len = (uint32_t)(r->len - r->done);
+    sqe->off = r->off + r->done;
+    sqe->user_data = i;
+    a->sq_array[idx] = idx;
+    __atomic_store_n(a->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    int n;
+    do n = uring_enter(a->ring_fd, 1, 0, 0); while (n < 0 && errno == EINTR);
+    return n == 1 ? 0 : -1;
+}
+
+// Reap one completion; 1 when request *i finished, 0 when it was resubmitted.
+static int uring_reap(sdc_aio* a, unsigned* i) {
+    unsigned head = *a->cq_head;
+    while (head == __atomic_load_n(a->cq_tail, __ATOMIC_ACQUIRE)) {
+        if (uring_enter(a->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) return -1;
+    }
+    struct io_uring_cqe* cqe = &a->cqes[head & *a->cq_mask];
+    *i = (unsigned)cqe->user_data;
+    int res = cqe->res;
+    __atomic_store_n(a->cq_head, head + 1, __ATOMIC_RELEASE);
+    aio_req* r = &a->req[*i];
+    if (res == -EINTR || res == -EAGAIN) return uring_submit(a, *i) == 0 ? 0 : (r->res = -EIO, 1);
+    if (res < 0) { r->res = res; return 1; }
+    if (res == 0) { r->res = r->write ? -EIO : (ssize_t)r->done; return 1; }
+    r->done += (size_t)res;
+    if (r->done < r->len) return uring_submit(a, *i) == 0 ? 0 : (r->res = -EIO, 1);
+    r->res = (ssize_t)r->done;
+    return 1;
+}
+
+// ---------------- Thread pool -------------------------
+static ssize_t transfer(aio_req* r) {
+    while (r->done < r->len) {
+        ssize_t n = r->write ? pwrite(r->fd, r->buf + r->done, r->len - r->done, (off_t)(r->off + r->done))
+                             : pread(r->fd, r->buf + r->done, r->len - r->done, (off_t)(r->off + r->done));
+        if (n < 0) { if (errno == EINTR) continue; return -errno; }
+        if (n == 0) return r->write ? -EIO : (ssize_t)r->done;
+        r->done += (size_t)n;
+    }
+    return (ssize_t)r->done;
+}
+
+static void* pool_main(void* arg) {
+    sdc_aio* a = arg;
+    pthread_mutex_lock(&a->mu);
+    for (;;) {
+        aio_req* r = NULL;
+        for (unsigned i = 0; i < a->depth && !r; i++)
+            if (a->req[i].state == REQ_QUEUED) r = &a->req[i];
+        if (!r) {
+            if (a->stop) break;
+            pthread_cond_wait(&a->work, &a->mu);
+            continue;
+        }
+        r->state = REQ_RUNNING;
+        pthread_mutex_unlock(&a->mu);
+        ssize_t res = transfer(r);
+        pthread_mutex_lock(&a->mu);
+        r->res = res;
+        r->state = REQ_DONE;
+        pthread_cond_broadcast(&a->done);
+    }
+    pthread_mutex_unlock(&a->mu);
+    return NULL;
+}
+
+static int pool_init(sdc_aio* a) {
+    a->nthreads = a->depth < AIO_THREADS_MAX ? a->depth : AIO_THREADS_MAX;
+    a->tw = calloc(a->nthreads, sizeof(pthread_t));
+    if (!a->tw) return -1;
+    pthread_mutex_init(&a->mu, NULL);
+    pthread_cond_init(&a->work, NULL);
+    pthread_cond_init(&a->done, NULL);
+    for (unsigned i = 0; i < a->nthreads; i++) {
+        if (sdc_thread_create(&a->tw[i], pool_main, a) != 0) { a->nthreads = i; break; }
+    }
+    return a->nthreads ? 0 : -1;
+}
+
+// ---------------- Public ------------------------------
+sdc_aio* sdc_aio_open(sdc_aio_backend want, unsigned depth, unsigned char* const* bufs,
+                      unsigned nbufs, size_t buf_len) {
+    if (want == SDC_AIO_SYNC) return NULL;
+    if (depth < 1) depth = 1;
+    if (depth > SDC_AIO_DEPTH_MAX) depth = SDC_AIO_DEPTH_MAX;
+    sdc_aio* a = calloc(1, sizeof(*a));
+    if (!a) return NULL;
+    a->ring_fd = -1;
+    a->depth = depth;
+    a->req = calloc(depth, sizeof(aio_req));
+    a->bufs = calloc(nbufs ? nbufs : 1, sizeof(unsigned char*));
+    if (!a->req || !a->bufs) { free(a->req); free(a->bufs); free(a); return NULL; }
+    if (nbufs) memcpy(a->bufs, bufs, nbufs * sizeof(unsigned char*));
+    a->nbufs = nbufs;
+    a->buf_len = buf_len;
+
+    if (want != SDC_AIO_THREADS) {
+        if (uring_init(a) == 0) {
+            a->kind = SDC_AIO_URING;
+            sdc_logi("[AIO] io_uring, depth %u%s", depth, a->fixed ? ", registered buffers" : "");
+            return a;
+        }
+        int err = errno;
+        uring_free(a);
+        a->ring_fd = -1;
+        a->sq_ptr = a->cq_ptr = NULL;
+        a->sqes = NULL;
+        if (want == SDC_AIO_URING) {
+            sdc_loge("[AIO] io_uring unavailable: %s", strerror(err));
+            free(a->req); free(a->bufs); free(a);
+            return NULL;
+        }
+        sdc_logi("[AIO] io_uring unavailable (%s), using thread pool", strerror(err));
+    }
+    if (pool_init(a) != 0) {
+        sdc_loge("[AIO] cannot start I/O threads");
+        free(a->tw); free(a->req); free(a->bufs); free(a);
+        return NULL;
+    }
+    a->kind = SDC_AIO_THREADS;
+    sdc_logi("[AIO] thread pool, depth %u", depth);
+    return a;
+}
+
+sdc_aio_backend sdc_aio_kind(const sdc_aio* a) { return a->kind; }
+unsigned sdc_aio_depth(const sdc_aio* a) { return a->depth; }
+unsigned sdc_aio_pending(const sdc_aio* a) { return a->pending; }
+
+static int aio_queue(sdc_aio* a, bool write, int fd, unsigned char* buf, size_t len, uint64_t off,
+                     uint64_t tag) {
+    unsigned i = 0;
+    if (a->kind == SDC_AIO_THREADS) pthread_mutex_lock(&a->mu);
+    while (i < a->depth && a->req[i].state != REQ_FREE) i++;
+    if (i == a->depth) {
+        if (a->kind == SDC_AIO_THREADS) pthread_mutex_unlock(&a->mu);
+        return -1;
+    }
+    aio_req* r = &a->req[i];
+    memset(r, 0, sizeof(*r));
+    r->write = write; r->fd = fd; r->buf = buf; r->len = len; r->off = off; r->tag = tag;
+    r->fixed = -1;
+    for (unsigned b = 0; a->fixed && b < a->nbufs; b++)
+        if (buf >= a->bufs[b] && buf + len <= a->bufs[b] + a->buf_len) { r->fixed = (int)b; break; }
+    a->pending++;
+    if (a->kind == SDC_AIO_THREADS) {
+        r->state = REQ_QUEUED;
+        pthread_cond_signal(&a->work);
+        pthread_mutex_unlock(&a->mu);
+        return 0;
+    }
+    r->state = REQ_RUNNING;
+    if (uring_submit(a, i) != 0) {   // reported through sdc_aio_wait()
+        r->res = -(errno ? errno : EIO);
+        r->state = REQ_DONE;
+    }
+    return 0;
+}
+
+int sdc_aio_read(sdc_aio* a, int fd, unsigned char* buf, size_t len, uint64_t off, uint64_t tag) {
+    return aio_queue(a, false, fd, buf, len, off, tag);
+}
+
+int sdc_aio_write(sdc_aio* a, int fd, const unsigned char* buf, size_t len, uint64_t off, uint64_t tag) {
+    return aio_queue(a, true, fd, (unsigned char*)buf, len, off, tag);
+}
+
+static void take(sdc_aio* a, aio_req* r, uint64_t* tag, ssize_t* res) {
+    *tag = r->tag;
+    *res = r->res;
+    r->state = REQ_FREE;
+    a->pending--;
+}
+
+int sdc_aio_wait(sdc_aio* a, uint64_t* tag, ssize_t* res) {
+    if (!a->pending) return -1;
+    if (a->kind == SDC_AIO_THREADS) {
+        pthread_mutex_lock(&a->mu);
+        for (;;) {
+            for (unsigned i = 0; i < a->depth; i++) {
+                if (a->req[i].state != REQ_DONE) continue;
+                take(a, &a->req[i], tag, res);
+                pthread_mutex_unlock(&a->mu);
+                return 0;
+            }
+            pthread_cond_wait(&a->done, &a->mu);
+        }
+    }
+    for (unsigned i = 0; i < a->depth; i++)   // failed at submission
+        if (a->req[i].state == REQ_DONE) { take(a, &a->req[i], tag, res); return 0; }
+    for (;;) {
+        unsigned i;
+        int rc = uring_reap(a, &i);
+        if (rc < 0) return -1;
+        if (rc == 1) { take(a, &a->req[i], tag, res); return 0; }
+    }
+}
+
+void sdc_aio_close(sdc_aio* a) {
+    if (!a) return;
+    uint64_t tag; ssize_t res;
+    while (a->pending && sdc_aio_wait(a, &tag, &res) == 0) {}
+    if (a->kind == SDC_AIO_THREADS) {
+        pthread_mutex_lock(&a->mu);
+        a->stop = true;
+        pthread_cond_broadcast(&a->work);
+        pthread_mutex_unlock(&a->mu);
+        for (unsigned i = 0; i < a->nthreads; i++) pthread_join(a->tw[i], NULL);
+        pthread_cond_destroy(&a->work);
+        pthread_cond_destroy(&a->done);
+        pthread_mutex_destroy(&a->mu);
+        free(a->tw);
+    } else {
+        uring_free(a);
+    }
+    free(a->req);
+    free(a->bufs);
+    free(a);
+}
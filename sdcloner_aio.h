@@ -0,0 +1,55 @@
+// sdcloner_aio.h
+// Asynchronous block I/O for the pipeline's device reader and burn writers:
+// up to `depth` aligned reads / writes in flight on one queue.
+//
+// Backends: io_uring (raw syscalls, no liburing needed) with the pipeline's
+// block buffers registered as fixed buffers when the kernel allows it, or a
+// pool of threads doing pread/pwrite. AUTO takes io_uring and falls back to
+// the thread pool when io_uring_setup() is refused (old kernel, seccomp,
+// io_uring disabled by sysctl). SYNC keeps the previous one-request-at-a-time
+// path in the callers.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef enum {
+    SDC_AIO_AUTO = 0,
+    SDC_AIO_URING,
+    SDC_AIO_THREADS,
+    SDC_AIO_SYNC,
+} sdc_aio_backend;
+
+#define SDC_AIO_DEPTH_MAX 64
+
+const char* sdc_aio_name(sdc_aio_backend b);
+
+typedef struct sdc_aio sdc_aio;
+
+// Queue for up to depth requests. bufs[0..nbufs) (buf_len bytes each) are
+// the buffers requests will use; io_uring registers them. Returns NULL for
+// SDC_AIO_SYNC or on failure (logged).
+sdc_aio* sdc_aio_open(sdc_aio_backend want, unsigned depth, unsigned char* const* bufs,
+                      unsigned nbufs, size_t buf_len);
+sdc_aio_backend sdc_aio_kind(const sdc_aio* a);
+// Requests that may be in flight at once (depth after clamping).
+unsigned sdc_aio_depth(const sdc_aio* a);
+// Requests in flight.
+unsigned sdc_aio_pending(const sdc_aio* a);
+
+// Queue a transfer of len bytes between buf (inside one of the buffers given
+// to sdc_aio_open) and fd at off. Short transfers are continued internally;
+// a read stops early only at end of file. tag comes back on completion.
+// Returns 0, or -1 if depth requests are already in flight.
+int sdc_aio_read(sdc_aio* a, int fd, unsigned char* buf, size_t len, uint64_t off, uint64_t tag);
+int sdc_aio_write(sdc_aio* a, int fd, const unsigned char* buf, size_t len, uint64_t off, uint64_t tag);
+
+// Wait for a request to finish. Returns 0 with its tag and result (bytes
+// transferred or -errno) in *tag / *res, or -1 if nothing is in flight.
+int sdc_aio_wait(sdc_aio* a, uint64_t* tag, ssize_t* res);
+
+// Waits for anything still in flight, then frees a.
+void sdc_aio_close(sdc_aio* a);
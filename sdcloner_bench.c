@@ -0,0 +1,787 @@
+// sdcloner_bench.c
+// Throughput benchmark for the engine stages, plus a generator for
+// deterministic synthetic card images to run it against.
+//
+//   sdcloner_bench fixture OUT.img [options]   build a test card image
+//   sdcloner_bench run SRC [options]           time each stage on SRC
+//
+// Every stage runs in a child process, so CPU time and peak RSS are its own.
+// Results go to stdout (or --json FILE) as JSON lines: one header object
+// describing the run, then one object per stage and repetition. Engine logs
+// go to stderr.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <linux/fs.h>     // BLKGETSIZE64
+
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_ptable.h"
+#include "sdcloner_fsmap.h"
+#include "sdcloner_shrink.h"
+#include "sdcloner_verify.h"
+
+#ifndef SDC_VERSION
+#define SDC_VERSION "dev"
+#endif
+
+#define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
+
+// Fixed timestamp (2020-01-01) for everything a fixture contains.
+#define FIXTURE_EPOCH 1577836800
+
+// ---------------- Fixtures ----------------------------
+typedef enum { DATA_RANDOM, DATA_ZERO, DATA_MIXED } data_kind;
+
+typedef struct {
+    uint64_t  size;       // image bytes
+    bool      fat, ext;   // partitions to create, in this order
+    unsigned  fill_pct;   // file data as a share of each partition
+    bool      small;      // many small files instead of a few large ones
+    data_kind data;
+    uint64_t  seed;
+} fixture_opts;
+
+static uint64_t rng_next(uint64_t* s) {   // splitmix64
+    uint64_t z = (*s += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Random bytes, zeros, or 64 KiB runs of either chosen at random.
+static void fill_data(unsigned char* buf, size_t len, data_kind k, uint64_t* rng) {
+    if (k == DATA_ZERO) { memset(buf, 0, len); return; }
+    for (size_t i = 0; i < len; i += 65536) {
+        size_t n = len - i < 65536 ? len - i : 65536;
+        if (k == DATA_MIXED && (rng_next(rng) & 1)) { memset(buf + i, 0, n); continue; }
+        for (size_t j = 0; j < n; j += 8) {
+            uint64_t v = rng_next(rng);
+            memcpy(buf + i + j, &v, n - j < 8 ? n - j : 8);
+        }
+    }
+}
+
+// Small files are 1..64 KiB, large ones 8..64 MiB, never more than left.
+static uint64_t next_file_size(const fixture_opts* f, uint64_t* rng, uint64_t left) {
+    uint64_t sz = f->small ? 1024 + rng_next(rng) % (63 * 1024)
+                           : MB(8) + rng_next(rng) % MB(56);
+    return sz < left ? sz : left;
+}
+
+static void put16(unsigned char* p, uint16_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static void put32(unsigned char* p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+
+static int pwrite_all(int fd, const void* buf, size_t len, uint64_t off) {
+    const unsigned char* p = buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Write one file's data of sz bytes at off in 1 MiB pieces through buf.
+static int write_file_data(int fd, uint64_t off, uint64_t sz, const fixture_opts* f,
+                           uint64_t* rng, unsigned char* buf) {
+    for (uint64_t done = 0; done < sz; ) {
+        size_t n = sz - done < MB(1) ? (size_t)(sz - done) : (size_t)MB(1);
+        fill_data(buf, n, f->data, rng);
+        // Zero data stays a hole, as free space does.
+        if (f->data != DATA_ZERO && pwrite_all(fd, buf, n, off + done) != 0) return -1;
+        done += n;
+    }
+    return 0;
+}
+
+// FAT32 laid out directly: reserved sectors with boot sector, FSInfo and
+// their backups, two FATs, then the root directory and every file in one
+// contiguous cluster run each. Names are F0000001.BIN and up.
+static int fat32_write(int fd, uint64_t part_off, uint64_t part_bytes, uint32_t hidden,
+                       const fixture_opts* f, uint64_t* rng, unsigned char* buf) {
+    const uint32_t bps = 512, rsvd = 32;
+    uint32_t total = (uint32_t)(part_bytes / bps);
+    uint32_t spc = part_bytes >= MB(512) ? 8 : 1;
+    uint32_t div = (256 * spc + 2) / 2;
+    uint32_t fatsz = (total - rsvd + div - 1) / div;
+    uint32_t clusters = (total - rsvd - 2 * fatsz) / spc;
+    uint64_t cb = (uint64_t)spc * bps;
+    if (clusters < 65525) {
+        sdc_loge("[BENCH] %llu MB is too small for FAT32", (unsigned long long)(part_bytes / MB(1)));
+        return -1;
+    }
+
+    // Plan the files: sizes until the fill target or the volume is reached.
+    uint64_t target = (uint64_t)clusters * cb * f->fill_pct / 100;
+    uint64_t* sizes = NULL;
+    uint32_t n = 0, cap = 0;
+    uint64_t used = 0, data = 0;
+    while (data < target) {
+        uint64_t sz = next_file_size(f, rng, target - data);
+        uint64_t need = (sz + cb - 1) / cb;
+        uint64_t dir = ((uint64_t)(n + 2) * 32 + cb - 1) / cb;
+        if (used + need + dir > clusters) break;
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            uint64_t* s = realloc(sizes, cap * sizeof(uint64_t));
+            if (!s) { free(sizes); return -1; }
+            sizes = s;
+        }
+        sizes[n++] = sz;
+        used += need;
+        data += sz;
+    }
+    uint32_t dir_clusters = (uint32_t)(((uint64_t)(n + 1) * 32 + cb - 1) / cb);
+
+    size_t fat_bytes = (size_t)fatsz * bps;
+    uint32_t* fat = calloc(fat_bytes / 4, sizeof(uint32_t));
+    unsigned char* dir = calloc(dir_clusters, cb);
+    if (!fat || !dir) { free(fat); free(dir); free(sizes); return -1; }
+    fat[0] = 0x0FFFFFF8;
+    fat[1] = 0x0FFFFFFF;
+    uint64_t data_off = part_off + (uint64_t)(rsvd + 2 * fatsz) * bps;
+    uint32_t next = 2;
+    for (uint32_t c = 0; c < dir_clusters; c++, next++)
+        fat[next] = c + 1 < dir_clusters ? next + 1 : 0x0FFFFFFF;
+
+    const uint16_t date = (uint16_t)(((2020 - 1980) << 9) | (1 << 5) | 1);
+    unsigned char* e = dir;
+    memcpy(e, "SDCBENCH   ", 11);
+    e[11] = 0x08;   // volume label
+    put16(e + 22, 0); put16(e + 24, date);
+    int rc = 0;
+    for (uint32_t i = 0; i < n && rc == 0; i++) {
+        uint32_t first = next;
+        uint32_t nc = (uint32_t)((sizes[i] + cb - 1) / cb);
+        for (uint32_t c = 0; c < nc; c++, next++) fat[next] = c + 1 < nc ? next + 1 : 0x0FFFFFFF;
+        e = dir + (size_t)(i + 1) * 32;
+        char name[16];
+        snprintf(name, sizeof(name), "F%07uBIN", i + 1);
+        memcpy(e, name, 11);
+        e[11] = 0x20;   // archive
+        put16(e + 14, 0); put16(e + 16, date); put16(e + 18, date);
+        put16(e + 20, (uint16_t)(first >> 16));
+        put16(e + 22, 0); put16(e + 24, date);
+        put16(e + 26, (uint16_t)first);
+        put32(e + 28, (uint32_t)sizes[i]);
+        rc = write_file_data(fd, data_off + (uint64_t)(first - 2) * cb, sizes[i], f, rng, buf);
+    }
+    if (rc == 0) rc = pwrite_all(fd, dir, (size_t)(dir_clusters * cb), data_off);
+
+    // The FAT is little-endian on disk; convert in place.
+    unsigned char* fb = (unsigned char*)fat;
+    for (size_t i = 0; i < fat_bytes / 4; i++) put32(fb + i * 4, fat[i]);
+    for (int k = 0; k < 2 && rc == 0; k++)
+        rc = pwrite_all(fd, fb, fat_bytes, part_off + (uint64_t)(rsvd + (uint32_t)k * fatsz) * bps);
+
+    unsigned char bs[512], fsi[512];
+    memset(bs, 0, sizeof(bs));
+    bs[0] = 0xEB; bs[1] = 0x58; bs[2] = 0x90;
+    memcpy(bs + 3, "SDCBENCH", 8);
+    put16(bs + 11, (uint16_t)bps);
+    bs[13] = (unsigned char)spc;
+    put16(bs + 14, (uint16_t)rsvd);
+    bs[16] = 2;            // FATs
+    bs[21] = 0xF8;         // fixed disk
+    put16(bs + 24, 63); put16(bs + 26, 255);
+    put32(bs + 28, hidden);
+    put32(bs + 32, total);
+    put32(bs + 36, fatsz);
+    put32(bs + 44, 2);     // root cluster
+    put16(bs + 48, 1);     // FSInfo sector
+    put16(bs + 50, 6);     // backup boot sector
+    bs[64] = 0x80; bs[66] = 0x29;
+    put32(bs + 67, (uint32_t)f->seed ^ 0x5DC0B3C4u);
+    memcpy(bs + 71, "SDCBENCH   FAT32   ", 19);
+    bs[510] = 0x55; bs[511] = 0xAA;
+    memset(fsi, 0, sizeof(fsi));
+    put32(fsi, 0x41615252);
+    put32(fsi + 484, 0x61417272);
+    put32(fsi + 488, clusters - (next - 2));
+    put32(fsi + 492, next);
+    put32(fsi + 508, 0xAA550000);
+    for (uint32_t s = 0; s <= 6 && rc == 0; s += 6) {
+        rc = pwrite_all(fd, bs, sizeof(bs), part_off + (uint64_t)s * bps);
+        if (rc == 0) rc = pwrite_all(fd, fsi, sizeof(fsi), part_off + (uint64_t)(s + 1) * bps);
+    }
+    if (rc == 0)
+        sdc_logi("[BENCH] FAT32: %u files, %.1f MB", n, (double)data / (double)MB(1));
+    free(fat); free(dir); free(sizes);
+    return rc;
+}
+
+static void remove_tree(const char* path) {
+    DIR* d = opendir(path);
+    if (d) {
+        struct dirent* de;
+        while ((de = readdir(d))) {
+            if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..")) continue;
+            char sub[PATH_MAX];
+            snprintf(sub, sizeof(sub), "%s/%s", path, de->d_name);
+            if (de->d_type == DT_DIR) remove_tree(sub); else unlink(sub);
+        }
+        closedir(d);
+    }
+    rmdir(path);
+}
+
+// mkfs.ext4 -d copies each staged file's ctime, which cannot be set from
+// user space; pin it afterwards with debugfs for the n files and their
+// directories.
+static int ext4_pin_ctimes(const char* img, uint64_t part_off, unsigned n) {
+    char script[PATH_MAX + 8];
+    snprintf(script, sizeof(script), "%s.sif", img);
+    FILE* fp = fopen(script, "w");
+    if (!fp) return -1;
+    fprintf(fp, "sif / ctime @%d\n", FIXTURE_EPOCH);
+    for (unsigned i = 0; i < n; i++) {
+        if (i % 256 == 0) fprintf(fp, "sif /d%04u ctime @%d\n", i / 256, FIXTURE_EPOCH);
+        fprintf(fp, "sif /d%04u/f%07u.bin ctime @%d\n", i / 256, i + 1, FIXTURE_EPOCH);
+    }
+    int rc = fclose(fp) == 0 ? 0 : -1;
+    char cmd[3 * PATH_MAX];
+    snprintf(cmd, sizeof(cmd), "E2FSPROGS_FAKE_TIME=%d debugfs -w -f '%s' '%s?offset=%llu' >/dev/null 2>&1",
+             FIXTURE_EPOCH, script, img, (unsigned long long)part_off);
+    if (rc == 0 && sdc_run_cmd(cmd) != 0) rc = -1;
+    unlink(script);
+    return rc;
+}
+
+// ext4 via mkfs.ext4 -d from a staging directory beside the image, with the
+// UUID, hash seed and timestamps pinned so the result repeats. ext4 needs
+// room for its own metadata, so data stops at 85% of the partition.
+static int ext4_write(const char* img, uint64_t part_off, uint64_t part_bytes,
+                      const fixture_opts* f, uint64_t* rng, unsigned char* buf) {
+    char stage[PATH_MAX];
+    snprintf(stage, sizeof(stage), "%s.stage.XXXXXX", img);
+    if (!mkdtemp(stage)) { sdc_loge("[BENCH] mkdtemp(%s): %s", stage, strerror(errno)); return -1; }
+    unsigned pct = f->fill_pct < 85 ? f->fill_pct : 85;
+    uint64_t target = part_bytes * pct / 100, data = 0;
+    unsigned n = 0;
+    int rc = 0;
+    struct timespec ts[2] = { { FIXTURE_EPOCH, 0 }, { FIXTURE_EPOCH, 0 } };
+    while (rc == 0 && data < target) {
+        char path[PATH_MAX + 32];
+        if (n % 256 == 0) {
+            snprintf(path, sizeof(path), "%s/d%04u", stage, n / 256);
+            if (mkdir(path, 0755) != 0) { rc = -1; break; }
+        }
+        snprintf(path, sizeof(path), "%s/d%04u/f%07u.bin", stage, n / 256, n + 1);
+        uint64_t sz = next_file_size(f, rng, target - data);
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) { rc = -1; break; }
+        if (ftruncate(fd, (off_t)sz) != 0 || write_file_data(fd, 0, sz, f, rng, buf) != 0) rc = -1;
+        futimens(fd, ts);
+        close(fd);
+        data += sz;
+        n++;
+    }
+    for (unsigned d = 0; rc == 0 && d * 256 < n; d++) {
+        char path[PATH_MAX + 32];
+        snprintf(path, sizeof(path), "%s/d%04u", stage, d);
+        utimensat(AT_FDCWD, path, ts, 0);
+    }
+    utimensat(AT_FDCWD, stage, ts, 0);
+    if (rc != 0) sdc_loge("[BENCH] staging ext4 files in %s: %s", stage, strerror(errno));
+
+    const char* uuid = "5dc0b3c4-0000-4000-8000-000000000001";
+    char cmd[3 * PATH_MAX];
+    if (rc == 0) {
+        snprintf(cmd, sizeof(cmd),
+                 "E2FSPROGS_FAKE_TIME=%d mkfs.ext4 -q -F -L SDCBENCH -U %s "
+                 "-E offset=%llu,hash_seed=%s,root_owner=0:0 -d '%s' '%s' %lluk",
+                 FIXTURE_EPOCH, uuid, (unsigned long long)part_off, uuid, stage, img,
+                 (unsigned long long)(part_bytes / 1024));
+        if (sdc_run_cmd(cmd) != 0) { sdc_loge("[BENCH] mkfs.ext4 failed"); rc = -1; }
+        else if (ext4_pin_ctimes(img, part_off, n) != 0) { sdc_loge("[BENCH] debugfs failed"); rc = -1; }
+    }
+    remove_tree(stage);
+    if (rc == 0)
+        sdc_logi("[BENCH] ext4: %u files, %.1f MB", n, (double)data / (double)MB(1));
+    return rc;
+}
+
+// MBR image: FAT32 first (a quarter of the disk, at least 64 MiB, when both
+// are asked for), ext4 after it, each aligned to 1 MiB.
+static int make_fixture(const char* out, const fixture_opts* f) {
+    const uint64_t align = MB(1);
+    uint64_t disk = f->size / align * align;
+    uint64_t avail = disk - align;
+    uint64_t fat_bytes = 0;
+    if (f->fat) fat_bytes = f->ext ? (avail / 4 > MB(64) ? avail / 4 : MB(64)) / align * align : avail;
+    uint64_t ext_bytes = f->ext ? avail - fat_bytes : 0;
+    if (disk < MB(48) || (f->ext && ext_bytes < MB(16)) || (f->fat && fat_bytes < MB(40))) {
+        sdc_loge("[BENCH] %llu MB is too small for this layout", (unsigned long long)(f->size / MB(1)));
+        return -1;
+    }
+    int fd = open(out, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) { sdc_loge("open(%s): %s", out, strerror(errno)); return -1; }
+    if (ftruncate(fd, (off_t)disk) != 0) {
+        sdc_loge("ftruncate(%s): %s", out, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    sdc_ptable pt;
+    memset(&pt, 0, sizeof(pt));
+    pt.kind = SDC_PT_MBR;
+    pt.sector_size = 512;
+    pt.disk_sig = (uint32_t)(f->seed * 2654435761u) | 1;
+    uint64_t off = align;
+    if (f->fat) {
+        sdc_part* p = &pt.part[pt.n++];
+        p->index = pt.n; p->start = off / 512; p->size = fat_bytes / 512;
+        p->mbr_type = 0x0C; p->bootable = true;
+        off += fat_bytes;
+    }
+    if (f->ext) {
+        sdc_part* p = &pt.part[pt.n++];
+        p->index = pt.n; p->start = off / 512; p->size = ext_bytes / 512;
+        p->mbr_type = 0x83;
+    }
+    uint64_t rng = f->seed;
+    unsigned char* buf = malloc(MB(1));
+    int rc = buf && sdc_ptable_write(out, &pt, disk) == 0 ? 0 : -1;
+    if (rc == 0 && f->fat) rc = fat32_write(fd, align, fat_bytes, (uint32_t)(align / 512), f, &rng, buf);
+    if (close(fd) != 0) rc = -1;
+    if (rc == 0 && f->ext) rc = ext4_write(out, align + fat_bytes, ext_bytes, f, &rng, buf);
+    free(buf);
+    if (rc != 0) unlink(out);
+    return rc;
+}
+
+// ---------------- Stages ------------------------------
+typedef struct {
+    const char*     src;           // image file or block device under test
+    bool            is_dev;
+    uint64_t        size;
+    char            archive[PATH_MAX];   // compress output, input of decompress / write
+    char            dest[PATH_MAX];      // write / verify target
+    bool            dest_scratch;        // dest is our own file, recreated per run
+    char            shrunk[PATH_MAX];
+    sdc_aio_backend io;
+    unsigned        io_depth;
+} bench_ctx;
+
+// Sent from the stage child to the parent.
+typedef struct {
+    int      status;     // 0 ok, 1 skipped, -1 failed
+    uint64_t bytes;      // input bytes processed
+    uint64_t out_bytes;  // output size where there is one
+    double   wall_s, user_s, sys_s;
+} stage_result;
+
+typedef struct {
+    struct timespec t;
+    struct rusage   ru;
+} stage_clock;
+
+static void clock_start(stage_clock* c) {
+    clock_gettime(CLOCK_MONOTONIC, &c->t);
+    getrusage(RUSAGE_SELF, &c->ru);
+}
+
+static double tv_s(struct timeval tv) { return (double)tv.tv_sec + (double)tv.tv_usec / 1e6; }
+
+static void clock_stop(const stage_clock* c, stage_result* r) {
+    struct timespec t; struct rusage ru;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    getrusage(RUSAGE_SELF, &ru);
+    r->wall_s = (double)(t.tv_sec - c->t.tv_sec) + (double)(t.tv_nsec - c->t.tv_nsec) / 1e9;
+    r->user_s = tv_s(ru.ru_utime) - tv_s(c->ru.ru_utime);
+    r->sys_s  = tv_s(ru.ru_stime) - tv_s(c->ru.ru_stime);
+}
+
+static uint64_t file_size(const char* path) {
+    struct stat st;
+    return stat(path, &st) == 0 ? (uint64_t)st.st_size : 0;
+}
+
+static void stream_opts(const bench_ctx* b, sdc_stream_opts* o) {
+    sdc_stream_opts_default(o);
+    o->io_backend = b->io;
+    o->io_depth = b->io_depth;
+}
+
+// Partition table plus allocation metadata of each partition (devices only;
+// an image file has no partition nodes).
+static void stage_probe(bench_ctx* b, stage_result* r) {
+    stage_clock c; clock_start(&c);
+    sdc_ptable pt;
+    r->status = sdc_ptable_read(b->src, &pt) == 0 ? 0 : -1;
+    for (int i = 0; r->status == 0 && b->is_dev && i < pt.n; i++) {
+        char dev[PATH_MAX];
+        sdc_part_devnode(b->src, pt.part[i].index, dev, sizeof(dev));
+        uint64_t used = 0;
+        if (sdc_fs_used_bytes(dev, &used) == 0) r->out_bytes += used;
+        sdc_extent_list l; memset(&l, 0, sizeof(l));
+        if (sdc_fsmap_partition(dev, pt.part[i].start * pt.sector_size, &l) < 0) r->status = -1;
+        sdc_extents_free(&l);
+    }
+    clock_stop(&c, r);
+}
+
+static void stage_read(bench_ctx* b, stage_result* r) {
+    sdc_stream_opts o; stream_opts(b, &o);
+    o.gzip_level = -1;
+    o.sparse = false;
+    stage_clock c; clock_start(&c);
+    r->status = sdc_stream_image(b->src, "/dev/null", &o) == 0 ? 0 : -1;
+    clock_stop(&c, r);
+    r->bytes = b->size;
+}
+
+static void stage_compress(bench_ctx* b, stage_result* r) {
+    sdc_stream_opts o; stream_opts(b, &o);
+    stage_clock c; clock_start(&c);
+    r->status = sdc_stream_image(b->src, b->archive, &o) == 0 ? 0 : -1;
+    clock_stop(&c, r);
+    r->bytes = b->size;
+    r->out_bytes = file_size(b->archive);
+}
+
+static void stage_decompress(bench_ctx* b, stage_result* r) {
+    sdc_stream_opts o; stream_opts(b, &o);
+    o.image_source = true;
+    o.direct_io = false;
+    o.gzip_level = -1;
+    o.sparse = false;
+    stage_clock c; clock_start(&c);
+    r->status = sdc_stream_image(b->archive, "/dev/null", &o) == 0 ? 0 : -1;
+    clock_stop(&c, r);
+    r->bytes = b->size;
+}
+
+// A scratch destination is a fresh sparse file each run, so every run
+// writes into unallocated space alike.
+static void stage_write(bench_ctx* b, stage_result* r) {
+    if (b->dest_scratch) {
+        int fd = open(b->dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)b->size) != 0) { r->status = -1; if (fd >= 0) close(fd); return; }
+        close(fd);
+    }
+    sdc_stream_opts o; stream_opts(b, &o);
+    stage_clock c; clock_start(&c);
+    r->status = sdc_burn_image(b->archive, b->dest, &o) == 0 ? 0 : -1;
+    clock_stop(&c, r);
+    r->bytes = b->size;
+}
+
+// Full O_DIRECT read-back of dest against the source's block CRCs, which
+// are taken before the clock starts.
+static void stage_verify(bench_ctx* b, stage_result* r) {
+    const size_t bs = MB(4);
+    uint64_t nblocks = (b->size + bs - 1) / bs;
+    uint32_t* crcs = calloc(nblocks ? nblocks : 1, sizeof(uint32_t));
+    unsigned char* buf = malloc(bs);
+    int fd = open(b->src, O_RDONLY | O_CLOEXEC);
+    r->status = crcs && buf && fd >= 0 ? 0 : -1;
+    for (uint64_t i = 0; r->status == 0 && i < nblocks; i++) {
+        size_t want = b->size - i * bs < bs ? (size_t)(b->size - i * bs) : bs;
+        size_t got = 0;
+        while (got < want) {
+            ssize_t n = pread(fd, buf + got, want - got, (off_t)(i * bs + got));
+            if (n <= 0) { if (n < 0 && errno == EINTR) continue; r->status = -1; break; }
+            got += (size_t)n;
+        }
+        crcs[i] = sdc_crc32c(0, buf, want);
+    }
+    if (fd >= 0) close(fd);
+    free(buf);
+    uint64_t nplan = 0;
+    uint64_t* plan = r->status == 0 ? sdc_verify_plan(nblocks, SDC_VERIFY_FULL, 0, &nplan) : NULL;
+    if (r->status == 0 && !plan) r->status = -1;
+    stage_clock c; clock_start(&c);
+    if (r->status == 0) r->status = sdc_verify_dest(b->dest, crcs, bs, b->size, plan, nplan, NULL, NULL) == 0 ? 0 : -1;
+    clock_stop(&c, r);
+    r->bytes = b->size;
+    free(plan);
+    free(crcs);
+}
+
+// FS-aware shrink needs partition nodes: a block or loop device.
+static void stage_shrink(bench_ctx* b, stage_result* r) {
+    if (!b->is_dev) { r->status = 1; return; }
+    stage_clock c; clock_start(&c);
+    r->status = sdc_shrink_image(b->src, b->size, b->shrunk) == 0 ? 0 : -1;
+    clock_stop(&c, r);
+    r->bytes = b->size;
+    r->out_bytes = file_size(b->shrunk);
+    unlink(b->shrunk);
+}
+
+static const struct {
+    const char* name;
+    void (*fn)(bench_ctx*, stage_result*);
+    bool needs_archive;
+} stages[] = {
+    { "probe",      stage_probe,      false },
+    { "read",       stage_read,       false },
+    { "compress",   stage_compress,   false },
+    { "decompress", stage_decompress, true  },
+    { "write",      stage_write,      true  },
+    { "verify",     stage_verify,     false },
+    { "shrink",     stage_shrink,     false },
+};
+#define NSTAGES (sizeof(stages) / sizeof(stages[0]))
+
+static unsigned stage_index(const char* name) {
+    unsigned i = 0;
+    while (i < NSTAGES && strcmp(stages[i].name, name) != 0) i++;
+    return i;
+}
+
+// Run stage i in a child; its CPU time and peak RSS come back through
+// wait4().
+static int run_stage(bench_ctx* b, unsigned i, stage_result* r, long* rss_kb) {
+    int pfd[2];
+    memset(r, 0, sizeof(*r));
+    r->status = -1;
+    if (pipe(pfd) != 0) return -1;
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0) { close(pfd[0]); close(pfd[1]); return -1; }
+    if (pid == 0) {
+        close(pfd[0]);
+        stage_result res; memset(&res, 0, sizeof(res));
+        stages[i].fn(b, &res);
+        fflush(NULL);
+        ssize_t w = write(pfd[1], &res, sizeof(res));
+        _exit(w == (ssize_t)sizeof(res) ? 0 : 1);
+    }
+    close(pfd[1]);
+    ssize_t got;
+    do got = read(pfd[0], r, sizeof(*r)); while (got < 0 && errno == EINTR);
+    close(pfd[0]);
+    int st = 0;
+    struct rusage ru;
+    memset(&ru, 0, sizeof(ru));
+    while (wait4(pid, &st, 0, &ru) < 0 && errno == EINTR) {}
+    *rss_kb = ru.ru_maxrss;
+    if (got != (ssize_t)sizeof(*r) || !WIFEXITED(st) || WEXITSTATUS(st) != 0) r->status = -1;
+    return 0;
+}
+
+static void drop_caches(void) {
+    sync();
+    int fd = open("/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    if (write(fd, "3", 1) != 1) sdc_loge("[BENCH] drop_caches: %s", strerror(errno));
+    close(fd);
+}
+
+static void json_str(FILE* out, const char* s) {
+    fputc('"', out);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(out, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+        else fputc(*s, out);
+    }
+    fputc('"', out);
+}
+
+static void json_header(FILE* out, const bench_ctx* b, const char* kind) {
+    struct utsname u;
+    if (uname(&u) != 0) memset(&u, 0, sizeof(u));
+    fprintf(out, "{\"bench\":\"sdcloner\",\"version\":");
+    json_str(out, SDC_VERSION);
+    fprintf(out, ",\"time\":%lld,\"kernel\":", (long long)time(NULL));
+    json_str(out, u.release);
+    fprintf(out, ",\"machine\":");
+    json_str(out, u.machine);
+    fprintf(out, ",\"cpus\":%ld,\"source\":", sysconf(_SC_NPROCESSORS_ONLN));
+    json_str(out, b->src);
+    fprintf(out, ",\"source_kind\":\"%s\",\"bytes\":%llu,\"io\":\"%s\",\"io_depth\":%u}\n", kind,
+            (unsigned long long)b->size, sdc_aio_name(b->io), b->io_depth);
+    fflush(out);
+}
+
+static void json_stage(FILE* out, const char* name, unsigned run, const stage_result* r, long rss_kb) {
+    const char* status = r->status == 0 ? "ok" : r->status > 0 ? "skipped" : "failed";
+    double mbps = r->status == 0 && r->wall_s > 0 ? (double)r->bytes / (double)MB(1) / r->wall_s : 0;
+    fprintf(out, "{\"stage\":\"%s\",\"run\":%u,\"status\":\"%s\",\"bytes\":%llu,\"out_bytes\":%llu,"
+                 "\"wall_s\":%.6f,\"cpu_user_s\":%.6f,\"cpu_sys_s\":%.6f,\"mb_s\":%.2f,"
+                 "\"peak_rss_kb\":%ld}\n",
+            name, run, status, (unsigned long long)r->bytes, (unsigned long long)r->out_bytes,
+            r->wall_s, r->user_s, r->sys_s, mbps, rss_kb);
+    fflush(out);
+}
+
+// ---------------- Command line ------------------------
+static int usage(const char* argv0) {
+    fprintf(stderr, "Usage:\n"
+            "  %s fixture OUT.img [--size MB] [--fs fat32|ext4|both] [--fill PCT]\n"
+            "          [--files small|large] [--data random|zero|mixed] [--seed N]\n"
+            "  %s run SRC [--stages LIST] [--repeat N] [--work DIR] [--dest PATH]\n"
+            "          [--loop] [--drop-caches] [--io auto|uring|threads|sync] [--io-depth N]\n"
+            "          [--json FILE]\n"
+            "Stages: probe,read,compress,decompress,write,verify,shrink (default: all).\n"
+            "--loop attaches an image file to a loop device first (root); --dest\n"
+            "overwrites PATH, the default is a scratch file in the work directory.\n",
+            argv0, argv0);
+    return 1;
+}
+
+static int cmd_fixture(int argc, char** argv) {
+    if (argc < 3) return usage(argv[0]);
+    fixture_opts f = { .size = MB(256), .fat = true, .ext = true, .fill_pct = 50,
+                       .small = true, .data = DATA_MIXED, .seed = 1 };
+    for (int i = 3; i < argc; i++) {
+        const char* a = argv[i];
+        const char* v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!v) return usage(argv[0]);
+        i++;
+        if (!strcmp(a, "--size")) f.size = MB(strtoull(v, NULL, 10));
+        else if (!strcmp(a, "--fill")) f.fill_pct = (unsigned)atoi(v);
+        else if (!strcmp(a, "--seed")) f.seed = strtoull(v, NULL, 10);
+        else if (!strcmp(a, "--fs") && !strcmp(v, "fat32")) { f.fat = true; f.ext = false; }
+        else if (!strcmp(a, "--fs") && !strcmp(v, "ext4")) { f.fat = false; f.ext = true; }
+        else if (!strcmp(a, "--fs") && !strcmp(v, "both")) { f.fat = f.ext = true; }
+        else if (!strcmp(a, "--files") && !strcmp(v, "small")) f.small = true;
+        else if (!strcmp(a, "--files") && !strcmp(v, "large")) f.small = false;
+        else if (!strcmp(a, "--data") && !strcmp(v, "random")) f.data = DATA_RANDOM;
+        else if (!strcmp(a, "--data") && !strcmp(v, "zero")) f.data = DATA_ZERO;
+        else if (!strcmp(a, "--data") && !strcmp(v, "mixed")) f.data = DATA_MIXED;
+        else return usage(argv[0]);
+    }
+    if (f.fill_pct > 100) return usage(argv[0]);
+    return make_fixture(argv[2], &f) == 0 ? 0 : 1;
+}
+
+static int cmd_run(int argc, char** argv) {
+    if (argc < 3) return usage(argv[0]);
+    bench_ctx b;
+    memset(&b, 0, sizeof(b));
+    b.src = argv[2];
+    b.io = SDC_AIO_AUTO;
+    b.io_depth = 4;
+    const char* work = ".";
+    const char* list = NULL;
+    const char* json = NULL;
+    const char* dest = NULL;
+    unsigned repeat = 1;
+    bool loop = false, drop = false;
+    for (int i = 3; i < argc; i++) {
+        const char* a = argv[i];
+        if (!strcmp(a, "--loop")) { loop = true; continue; }
+        if (!strcmp(a, "--drop-caches")) { drop = true; continue; }
+        const char* v = i + 1 < argc ? argv[++i] : NULL;
+        if (!v) return usage(argv[0]);
+        if (!strcmp(a, "--stages")) list = v;
+        else if (!strcmp(a, "--repeat")) repeat = (unsigned)atoi(v);
+        else if (!strcmp(a, "--work")) work = v;
+        else if (!strcmp(a, "--dest")) dest = v;
+        else if (!strcmp(a, "--json")) json = v;
+        else if (!strcmp(a, "--io-depth")) b.io_depth = (unsigned)atoi(v);
+        else if (!strcmp(a, "--io") && !strcmp(v, "auto")) b.io = SDC_AIO_AUTO;
+        else if (!strcmp(a, "--io") && !strcmp(v, "uring")) b.io = SDC_AIO_URING;
+        else if (!strcmp(a, "--io") && !strcmp(v, "threads")) b.io = SDC_AIO_THREADS;
+        else if (!strcmp(a, "--io") && !strcmp(v, "sync")) b.io = SDC_AIO_SYNC;
+        else return usage(argv[0]);
+    }
+    if (!repeat || !b.io_depth || b.io_depth > SDC_AIO_DEPTH_MAX) return usage(argv[0]);
+    bool want[NSTAGES];
+    for (unsigned i = 0; i < NSTAGES; i++) {
+        want[i] = !list;
+        if (list) {
+            size_t n = strlen(stages[i].name);
+            for (const char* p = list; (p = strstr(p, stages[i].name)); p += n)
+                if ((p == list || p[-1] == ',') && (p[n] == ',' || p[n] == '\0')) want[i] = true;
+        }
+    }
+
+    // Results keep the real stdout; engine logs (sdc_logi) move to stderr.
+    int json_fd = json ? -1 : dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    FILE* out = json ? fopen(json, "w") : fdopen(json_fd, "w");
+    if (!out) { sdc_loge("open(%s): %s", json ? json : "stdout", strerror(errno)); return 1; }
+
+    char loopdev[64] = "";
+    if (loop) {
+        char cmd[PATH_MAX + 64];
+        snprintf(cmd, sizeof(cmd), "losetup -fP --show '%s'", b.src);
+        char* dev = sdc_run_cmd_capture(cmd);
+        if (dev) {
+            snprintf(loopdev, sizeof(loopdev), "%s", dev);
+            loopdev[strcspn(loopdev, "\n")] = '\0';
+            free(dev);
+        }
+        if (strncmp(loopdev, "/dev/loop", 9) != 0) {
+            sdc_loge("[BENCH] losetup failed for %s", b.src);
+            fclose(out);
+            return 1;
+        }
+        b.src = loopdev;
+    }
+    struct stat st;
+    int rc = 0;
+    int fd = open(b.src, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        sdc_loge("open(%s): %s", b.src, strerror(errno));
+        rc = 1;
+    } else if (S_ISBLK(st.st_mode)) {
+        b.is_dev = true;
+        if (ioctl(fd, BLKGETSIZE64, &b.size) != 0) b.size = 0;
+    } else {
+        b.size = (uint64_t)st.st_size;
+    }
+    if (fd >= 0) close(fd);
+    snprintf(b.archive, sizeof(b.archive), "%s/bench.img.gz", work);
+    snprintf(b.shrunk, sizeof(b.shrunk), "%s/bench-shrink.img", work);
+    if (dest) snprintf(b.dest, sizeof(b.dest), "%s", dest);
+    else snprintf(b.dest, sizeof(b.dest), "%s/bench-dest.img", work);
+    b.dest_scratch = !dest;
+
+    if (rc == 0) json_header(out, &b, loop ? "loop" : b.is_dev ? "device" : "file");
+    for (unsigned i = 0; rc == 0 && i < NSTAGES; i++) {
+        if (!want[i]) continue;
+        // decompress / write alone still need an archive; make it untimed.
+        if (stages[i].needs_archive && access(b.archive, R_OK) != 0) {
+            stage_result r; long rss;
+            if (run_stage(&b, stage_index("compress"), &r, &rss) != 0 || r.status != 0) {
+                sdc_loge("[BENCH] cannot prepare %s", b.archive);
+                rc = 1;
+                break;
+            }
+        }
+        for (unsigned k = 1; k <= repeat; k++) {
+            if (drop) drop_caches();
+            stage_result r; long rss = 0;
+            if (run_stage(&b, i, &r, &rss) != 0) { rc = 1; break; }
+            json_stage(out, stages[i].name, k, &r, rss);
+            if (r.status < 0) rc = 1;
+        }
+    }
+    fclose(out);
+    unlink(b.archive);
+    if (b.dest_scratch) unlink(b.dest);
+    if (loop && loopdev[0]) {
+        char cmd[96];
+        snprintf(cmd, sizeof(cmd), "losetup -d %s", loopdev);
+        sdc_run_cmd(cmd);
+    }
+    return rc;
+}
+
+int main(int argc, char** argv) {
+    if (argc >= 2 && !strcmp(argv[1], "fixture")) return cmd_fixture(argc, argv);
+    if (argc >= 2 && !strcmp(argv[1], "run")) return cmd_run(argc, argv);
+    return usage(argv[0]);
+}
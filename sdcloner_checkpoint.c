@@ -0,0 +1,205 @@
+// sdcloner_checkpoint.c
+// Checkpoints for resuming interrupted image jobs.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_verify.h"
+#include "sdcloner_checkpoint.h"
+
+#define CKPT_HDR_LEN 160
+#define CKPT_ENT_LEN 24
+#define CKPT_VERSION 2
+
+static const unsigned char CKPT_MAGIC[8] = { 'S','D','C','K','P','T', 0, 1 };
+
+static void put_le32(unsigned char* d, uint32_t v) {
+    d[0] = (unsigned char)v; d[1] = (unsigned char)(v >> 8);
+    d[2] = (unsigned char)(v >> 16); d[3] = (unsigned char)(v >> 24);
+}
+static void put_le64(unsigned char* d, uint64_t v) {
+    put_le32(d, (uint32_t)v); put_le32(d + 4, (uint32_t)(v >> 32));
+}
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static uint64_t le64(const unsigned char* p) { return le32(p) | (uint64_t)le32(p + 4) << 32; }
+
+void sdc_checkpoint_free(sdc_checkpoint* c) {
+    free(c->idx);
+    memset(c, 0, sizeof(*c));
+}
+
+void sdc_checkpoint_sample(sdc_checkpoint* c, uint64_t block, uint64_t h64) {
+    if (!c->sample_stride) c->sample_stride = 1;
+    if (c->nsamples == SDC_CKPT_SAMPLES && block == (uint64_t)c->nsamples * c->sample_stride) {
+        for (uint32_t i = 0; i < SDC_CKPT_SAMPLES / 2; i++) c->sample_h64[i] = c->sample_h64[2 * i];
+        c->nsamples = SDC_CKPT_SAMPLES / 2;
+        c->sample_stride *= 2;
+    }
+    if (block != (uint64_t)c->nsamples * c->sample_stride) return;
+    c->sample_h64[c->nsamples++] = h64;
+}
+
+// Samples covering the committed blocks; later ones may already be taken.
+static uint32_t committed_samples(const sdc_checkpoint* c) {
+    uint64_t blocks = c->in_off / c->block_size;
+    return (uint32_t)((blocks + c->sample_stride - 1) / c->sample_stride);
+}
+
+int sdc_checkpoint_load(const char* path, sdc_checkpoint* c) {
+    memset(c, 0, sizeof(*c));
+    FILE* fp = fopen(path, "rbe");
+    if (!fp) return errno == ENOENT ? 1 : -1;
+    unsigned char h[CKPT_HDR_LEN], e[CKPT_ENT_LEN], t[4];
+    int rc = -1;
+    if (fread(h, 1, sizeof(h), fp) != sizeof(h) || memcmp(h, CKPT_MAGIC, 8) != 0 ||
+        le32(h + 8) != CKPT_VERSION || le32(h + 156) != sdc_crc32c(0, h, 156))
+        goto out;
+    c->block_size = le32(h + 12);
+    c->src_size = le64(h + 16);
+    c->gzip_level = (int32_t)le32(h + 24);
+    c->format = le32(h + 28);
+    c->flags = le32(h + 32);
+    c->base_crc = le32(h + 36);
+    c->in_off = le64(h + 40);
+    c->out_len = le64(h + 48);
+    c->head_h64 = le64(h + 56);
+    c->tail_h64 = le64(h + 64);
+    c->nchunks = le64(h + 72);
+    c->crc32c = le32(h + 80);
+    memcpy(c->source_id, h + 88, SDC_CKPT_ID_LEN);
+    c->source_id[SDC_CKPT_ID_LEN - 1] = '\0';
+    c->sample_stride = le32(h + 152);
+    if (!c->block_size || c->block_size % SDC_IO_ALIGN || !c->in_off ||
+        c->in_off % c->block_size || c->in_off > c->src_size ||
+        c->nchunks > c->in_off / c->block_size || !c->sample_stride ||
+        committed_samples(c) > SDC_CKPT_SAMPLES)
+        goto out;
+    c->nsamples = committed_samples(c);
+    c->idx = malloc((c->nchunks ? c->nchunks : 1) * sizeof(sdc_chunk));
+    if (!c->idx) goto out;
+    uint32_t crc = 0;
+    for (uint64_t i = 0; i < c->nchunks; i++) {
+        if (fread(e, 1, sizeof(e), fp) != sizeof(e)) goto out;
+        crc = sdc_crc32c(crc, e, sizeof(e));
+        c->idx[i].offset = le64(e);
+        c->idx[i].clen = le32(e + 8);
+        c->idx[i].flags = le32(e + 12);
+        c->idx[i].crc = le32(e + 16);
+        c->idx[i].crc32c = le32(e + 20);
+    }
+    for (uint32_t i = 0; i < c->nsamples; i++) {
+        if (fread(e, 1, 8, fp) != 8) goto out;
+        crc = sdc_crc32c(crc, e, 8);
+        c->sample_h64[i] = le64(e);
+    }
+    if (fread(t, 1, 4, fp) != 4 || le32(t) != crc) goto out;
+    rc = 0;
+out:
+    fclose(fp);
+    if (rc != 0) {
+        sdc_loge("[RESUME] checkpoint %s is damaged, ignored", path);
+        sdc_checkpoint_free(c);
+    }
+    return rc;
+}
+
+int sdc_checkpoint_save(const char* path, const sdc_checkpoint* c) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wbe");
+    if (!fp) { sdc_loge("[RESUME] cannot write %s: %s", tmp, strerror(errno)); return -1; }
+    unsigned char h[CKPT_HDR_LEN], e[CKPT_ENT_LEN], t[4];
+    memset(h, 0, sizeof(h));
+    memcpy(h, CKPT_MAGIC, 8);
+    put_le32(h + 8, CKPT_VERSION);
+    put_le32(h + 12, c->block_size);
+    put_le64(h + 16, c->src_size);
+    put_le32(h + 24, (uint32_t)c->gzip_level);
+    put_le32(h + 28, c->format);
+    put_le32(h + 32, c->flags);
+    put_le32(h + 36, c->base_crc);
+    put_le64(h + 40, c->in_off);
+    put_le64(h + 48, c->out_len);
+    put_le64(h + 56, c->head_h64);
+    put_le64(h + 64, c->tail_h64);
+    put_le64(h + 72, c->nchunks);
+    put_le32(h + 80, c->crc32c);
+    memcpy(h + 88, c->source_id, strnlen(c->source_id, SDC_CKPT_ID_LEN - 1));
+    put_le32(h + 152, c->sample_stride);
+    put_le32(h + 156, sdc_crc32c(0, h, 156));
+    bool ok = fwrite(h, 1, sizeof(h), fp) == sizeof(h);
+    uint32_t crc = 0;
+    for (uint64_t i = 0; ok && i < c->nchunks; i++) {
+        put_le64(e, c->idx[i].offset);
+        put_le32(e + 8, c->idx[i].clen);
+        put_le32(e + 12, c->idx[i].flags);
+        put_le32(e + 16, c->idx[i].crc);
+        put_le32(e + 20, c->idx[i].crc32c);
+        crc = sdc_crc32c(crc, e, sizeof(e));
+        ok = fwrite(e, 1, sizeof(e), fp) == sizeof(e);
+    }
+    uint32_t ns = committed_samples(c);
+    for (uint32_t i = 0; ok && i < ns; i++) {
+        put_le64(e, c->sample_h64[i]);
+        crc = sdc_crc32c(crc, e, 8);
+        ok = fwrite(e, 1, 8, fp) == 8;
+    }
+    put_le32(t, crc);
+    ok = ok && fwrite(t, 1, 4, fp) == 4 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(tmp, path) != 0) {
+        sdc_loge("[RESUME] cannot write %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static bool block_hashes(int fd, uint64_t off, size_t len, uint64_t want, unsigned char* buf,
+                         const sdc_extent_list* m) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, buf + got, len - got, (off_t)(off + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    for (size_t i = 0; m && i < m->n; i++) {
+        uint64_t s = m->ext[i].off > off ? m->ext[i].off : off;
+        uint64_t e = m->ext[i].off + m->ext[i].len < off + len ? m->ext[i].off + m->ext[i].len : off + len;
+        if (s < e) memset(buf + (s - off), 0, (size_t)(e - s));
+    }
+    return got == len && sdc_hash64(buf, len) == want;
+}
+
+bool sdc_checkpoint_matches(const sdc_checkpoint* c, const char* src_path, uint64_t src_size,
+                            const char* source_id, const sdc_extent_list* unallocated) {
+    if (c->src_size != src_size || strcmp(c->source_id, source_id ? source_id : "") != 0)
+        return false;
+    int fd = open(src_path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (fd < 0) fd = open(src_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    unsigned char* buf = NULL;
+    if (posix_memalign((void**)&buf, SDC_IO_ALIGN, c->block_size) != 0) { close(fd); return false; }
+    bool ok = block_hashes(fd, 0, c->block_size, c->head_h64, buf, unallocated) &&
+              block_hashes(fd, c->in_off - c->block_size, c->block_size, c->tail_h64, buf, unallocated);
+    for (uint32_t i = 1; ok && i < c->nsamples; i++)
+        ok = block_hashes(fd, (uint64_t)i * c->sample_stride * c->block_size, c->block_size,
+                          c->sample_h64[i], buf, unallocated);
+    free(buf);
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,72 @@
+// sdcloner_checkpoint.h
+// Checkpoints of a running image job, so an interrupted one (a USB reader
+// that resets, a pulled cable) can continue where the last checkpoint left
+// off instead of starting over.
+//
+// A checkpoint records how much of the source is safely in the image (a
+// whole number of blocks), how long the output file was at that point (it
+// ends on a gzip member or chunk boundary, fdatasync'd before the checkpoint
+// is written), the .sdimg index built so far, a running CRC32C of the source
+// and the XXH64 of its first and last committed blocks and of up to
+// SDC_CKPT_SAMPLES blocks spread evenly over the committed range, which are
+// read again to make sure a resumed job is looking at the same contents. A
+// USB reader has no card id, so cards flashed from one image would otherwise
+// pass on their first and last block alone.
+//
+// File layout (little-endian), beside the image as <image>.ckpt: 160-byte
+// header "SDCKPT\0\1", version, the fields below, CRC32C of the header; then
+// 24 bytes per index entry, 8 per sampled block hash and a CRC32C of both.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sdcloner_fsmap.h"
+#include "sdcloner_image.h"
+
+#define SDC_CKPT_EXT "ckpt"
+#define SDC_CKPT_ID_LEN 64
+#define SDC_CKPT_SAMPLES 32
+
+enum {
+    SDC_CKPT_SPARSE = 1,   // sdc_stream_opts.sparse was set
+};
+
+typedef struct {
+    char       source_id[SDC_CKPT_ID_LEN];   // card identity, "" if it has none
+    uint64_t   src_size;
+    uint32_t   block_size;
+    int32_t    gzip_level;
+    uint32_t   format;       // sdc_out_format
+    uint32_t   flags;        // SDC_CKPT_*
+    uint32_t   base_crc;     // .sdimg delta: the base's index CRC, else 0
+    uint64_t   in_off;       // source bytes committed, a multiple of block_size
+    uint64_t   out_len;      // output bytes holding them
+    uint32_t   crc32c;       // CRC32C of source [0, in_off)
+    uint64_t   head_h64;     // XXH64 of the first block
+    uint64_t   tail_h64;     // XXH64 of the block ending at in_off
+    uint64_t   nchunks;      // .sdimg index entries so far
+    sdc_chunk* idx;
+    uint32_t   sample_stride;   // blocks between sampled ones
+    uint32_t   nsamples;
+    uint64_t   sample_h64[SDC_CKPT_SAMPLES];   // XXH64 of blocks 0, stride, 2 * stride, ...
+} sdc_checkpoint;
+
+// Load path into c. Returns 0, 1 if there is no checkpoint, -1 if it is
+// damaged (logged).
+int  sdc_checkpoint_load(const char* path, sdc_checkpoint* c);
+// Write c to path atomically (temp file, fsync, rename). Returns 0 / -1.
+int  sdc_checkpoint_save(const char* path, const sdc_checkpoint* c);
+void sdc_checkpoint_free(sdc_checkpoint* c);
+
+// Offer the hash of full block number `block`; blocks come in order. Keeps
+// the samples evenly spread by doubling the stride when they run out.
+void sdc_checkpoint_sample(sdc_checkpoint* c, uint64_t block, uint64_t h64);
+
+// Whether src_path (src_size bytes, identified as source_id) still holds
+// what c committed: same size and identity, and the first, last and sampled
+// committed blocks hash as recorded. Reads those blocks with O_DIRECT; ranges in
+// unallocated (may be NULL) count as zeros, as the pipeline stored them.
+bool sdc_checkpoint_matches(const sdc_checkpoint* c, const char* src_path, uint64_t src_size,
+                            const char* source_id, const sdc_extent_list* unallocated);
@@ -0,0 +1,914 @@
+// sdcloner_decode.c
+// Magic-byte codec detection and the sequential image reader.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+#ifdef SDC_WITH_LZMA
+#include <lzma.h>
+#endif
+#ifdef SDC_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef SDC_WITH_LZ4
+#include <lz4frame.h>
+#endif
+
+#include "sdcloner_internal.h"
+#include "sdcloner_image.h"
+#include "sdcloner_store.h"
+#include "sdcloner_decode.h"
+
+#define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
+
+// Largest decoded unit handed to a worker; bigger zstd frames stream instead.
+#define SDC_DEC_UNIT_MAX  MB(64)
+#define SDC_DEC_IBUF      (1u << 20)
+#define SDC_DEC_THREADS_MAX 16
+
+#if defined(SDC_WITH_LZMA) || defined(SDC_WITH_ZSTD) || defined(SDC_WITH_LZ4)
+#define SDC_DEC_NATIVE 1    // some codec streams through a library
+#endif
+#if !defined(SDC_WITH_LZMA) || !defined(SDC_WITH_ZSTD) || !defined(SDC_WITH_LZ4)
+#define SDC_DEC_TOOLS 1     // some codec falls back to an external tool
+#endif
+
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static unsigned online_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+// Short reads only at EOF. Returns bytes read, -1 on error.
+static ssize_t pread_full(int fd, void* buf, size_t len, uint64_t off) {
+    unsigned char* p = buf;
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, p + got, len - got, (off_t)(off + got));
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+// ---------------- Codec detection ---------------------
+static sdc_codec codec_of(const unsigned char* m, size_t n) {
+    static const unsigned char SDIMG[8] = { 'S','D','C','I','M','G', 0, 1 };
+    static const unsigned char SDREF[8] = { 'S','D','C','R','E','F', 0, 1 };
+    static const unsigned char XZ[6]    = { 0xfd, '7', 'z', 'X', 'Z', 0 };
+    if (n >= 8 && !memcmp(m, SDIMG, 8)) return SDC_CODEC_SDIMG;
+    if (n >= 8 && !memcmp(m, SDREF, 8)) return SDC_CODEC_SDREF;
+    if (n >= 6 && !memcmp(m, XZ, 6)) return SDC_CODEC_XZ;
+    if (n >= 4 && le32(m) == 0xFD2FB528u) return SDC_CODEC_ZSTD;
+    if (n >= 4 && le32(m) == 0x184D2204u) return SDC_CODEC_LZ4;
+    if (n >= 3 && m[0] == 0x1f && m[1] == 0x8b && m[2] == 8) return SDC_CODEC_GZIP;
+    return SDC_CODEC_RAW;
+}
+
+int sdc_codec_detect(const char* path, sdc_codec* out) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    unsigned char m[8];
+    ssize_t n = pread_full(fd, m, sizeof(m), 0);
+    close(fd);
+    if (n < 0) return -1;
+    *out = codec_of(m, (size_t)n);
+    return 0;
+}
+
+const char* sdc_codec_name(sdc_codec c) {
+    switch (c) {
+    case SDC_CODEC_RAW:   return "raw";
+    case SDC_CODEC_GZIP:  return "gzip";
+    case SDC_CODEC_SDIMG: return "sdimg";
+    case SDC_CODEC_SDREF: return "sdref";
+    case SDC_CODEC_XZ:    return "xz";
+    case SDC_CODEC_ZSTD:  return "zstd";
+    case SDC_CODEC_LZ4:   return "lz4";
+    }
+    return "?";
+}
+
+// ---------------- Reader state ------------------------
+typedef enum {
+    MODE_RAW,       // plain read()
+    MODE_GZ,        // zlib gzread, any gzip
+    MODE_PIPE,      // external decompressor on a pipe
+    MODE_XZ,
+    MODE_ZSTD,
+    MODE_LZ4,
+    MODE_UNITS,     // parallel unit decoder below
+} read_mode;
+
+enum { SLOT_FREE, SLOT_FILLED, SLOT_BUSY, SLOT_READY, SLOT_ERR };
+
+typedef struct {
+    int            state;
+    uint64_t       seq;
+    uint64_t       at;          // file offset of the unit, for messages
+    unsigned char* in;  size_t in_len,  in_cap;
+    unsigned char* out; size_t out_len, out_cap;
+    uint64_t       expect;      // decoded size if known, else 0
+    size_t         pos;         // consumed by the reader
+} dec_slot;
+
+typedef struct dec_worker {
+    struct sdc_reader* r;
+    z_stream       zs;
+    bool           zs_ok;
+#ifdef SDC_WITH_ZSTD
+    ZSTD_DCtx*     zd;
+#endif
+} dec_worker;
+
+struct sdc_reader {
+    sdc_codec      codec;
+    read_mode      mode;
+    int            fd;
+    uint64_t       in_size;
+    bool           eof;
+    uint64_t       out_done;
+    bool           holes;       // sparse raw image: holes are zero-filled, not read
+
+    // Streaming decoders.
+    gzFile         gz;
+    pid_t          child;
+    const char*    tool;
+    unsigned char* ibuf;
+    size_t         ipos, ilen;
+    bool           ieof;
+    uint64_t       in_read;
+#ifdef SDC_WITH_LZMA
+    lzma_stream    xz;
+    bool           xz_init;
+#endif
+#ifdef SDC_WITH_ZSTD
+    ZSTD_DStream*  zds;
+    size_t         zst_hint;
+#endif
+#ifdef SDC_WITH_LZ4
+    LZ4F_dctx*     lz;
+    size_t         lz_hint;
+#endif
+
+    // Unit decoder: producer thread splits the input, workers decode, the
+    // caller of sdc_reader_read() consumes slots in sequence order.
+    sdc_image      img;
+    bool           has_img;
+    sdc_ref        ref;
+    bool           has_ref;
+    pthread_mutex_t mu;
+    pthread_cond_t  cv;
+    bool           sync_init;
+    dec_slot*      slots;
+    unsigned       nslots;
+    uint64_t       produced, next_decode, consumed;
+    bool           prod_eof, failed, stop;
+    uint64_t       unit_off;                 // producer's file position
+    bool           tail;                     // units end at unit_off; a stream decoder takes the rest
+    uint64_t       unit_in, unit_out;        // bytes split so far, for estimates
+    pthread_t      producer;
+    bool           producer_started;
+    dec_worker*    workers;
+    pthread_t*     tw;
+    unsigned       nworkers, nstarted;
+};
+
+// ---------------- Unit splitting ----------------------
+static int slot_reserve(unsigned char** p, size_t* cap, size_t need) {
+    if (*cap >= need) return 0;
+    unsigned char* n = realloc(*p, need);
+    if (!n) return -1;
+    *p = n; *cap = need;
+    return 0;
+}
+
+// Our own gzip members carry their total length in an "SC" extra subfield,
+// so the next member is found without inflating this one. Returns 1 with its
+// length in *len, 0 at the end of the gzip data, -1 on error, -2 if the
+// member has no SC field.
+static int gz_member_len(int fd, uint64_t off, uint32_t* len, bool first) {
+    unsigned char h[12];
+    ssize_t n = pread_full(fd, h, sizeof(h), off);
+    if (n < 0) return -1;
+    // Like gzread(), anything after the last member that is not gzip ends it.
+    if (n < (ssize_t)sizeof(h) || h[0] != 0x1f || h[1] != 0x8b || h[2] != 8)
+        return first ? -1 : 0;
+    if (!(h[3] & 4)) return -2;
+    unsigned xlen = (unsigned)h[10] | (unsigned)h[11] << 8;
+    unsigned char x[256];
+    if (xlen > sizeof(x)) return -2;
+    if (pread_full(fd, x, xlen, off + 12) != (ssize_t)xlen) return -1;
+    for (unsigned i = 0; i + 4 <= xlen; ) {
+        unsigned sl = (unsigned)x[i + 2] | (unsigned)x[i + 3] << 8;
+        if (x[i] == 'S' && x[i + 1] == 'C' && sl == 4 && i + 8 <= xlen) {
+            *len = le32(x + i + 4);
+            return *len >= 12 + xlen + 8 && *len <= SDC_DEC_UNIT_MAX + 4096 ? 1 : -2;
+        }
+        i += 4 + sl;
+    }
+    return -2;
+}
+
+#ifdef SDC_WITH_ZSTD
+// zstd frame at off: total length and an upper bound for its decoded size,
+// from the frame header and block headers alone. Skippable frames report a
+// bound of 0. Returns 1, 0 at end of data, -1 on error, -2 if the frame is
+// too large (or unbounded) to decode as one unit.
+static int zstd_frame_len(int fd, uint64_t off, uint64_t* len, uint64_t* bound, uint64_t* csize) {
+    unsigned char h[18];
+    ssize_t n = pread_full(fd, h, sizeof(h), off);
+    if (n < 0) return -1;
+    if (n == 0) return 0;
+    if (n < 8) return -1;
+    uint32_t magic = le32(h);
+    if ((magic & 0xFFFFFFF0u) == 0x184D2A50u) {
+        *len = 8 + (uint64_t)le32(h + 4);
+        *bound = 0; *csize = 0;
+        return 1;
+    }
+    if (magic != 0xFD2FB528u) return -1;
+    unsigned fhd = h[4];
+    bool single = (fhd >> 5) & 1;
+    static const unsigned did_len[4] = { 0, 1, 2, 4 };
+    unsigned fcs_len = (fhd >> 6) == 0 ? (single ? 1 : 0) : 1u << (fhd >> 6);
+    unsigned hl = 5 + (single ? 0 : 1) + did_len[fhd & 3] + fcs_len;
+    if ((size_t)n < hl) return -1;
+    *csize = 0;
+    if (fcs_len) {
+        const unsigned char* f = h + hl - fcs_len;
+        for (unsigned i = 0; i < fcs_len; i++) *csize |= (uint64_t)f[i] << (8 * i);
+        if (fcs_len == 2) *csize += 256;
+    }
+    uint64_t pos = off + hl, b = 0;
+    for (;;) {
+        unsigned char bh[3];
+        if (pread_full(fd, bh, 3, pos) != 3) return -1;
+        uint32_t v = (uint32_t)bh[0] | (uint32_t)bh[1] << 8 | (uint32_t)bh[2] << 16;
+        unsigned type = (v >> 1) & 3;
+        uint32_t sz = v >> 3;
+        if (type == 3) return -1;
+        pos += 3 + (type == 1 ? 1 : sz);
+        b += type == 2 ? 128 * 1024 : sz;
+        if (b > SDC_DEC_UNIT_MAX || (fcs_len && *csize > SDC_DEC_UNIT_MAX)) return -2;
+        if (v & 1) break;
+    }
+    if ((fhd >> 2) & 1) pos += 4;   // content checksum
+    *len = pos - off;
+    *bound = fcs_len ? *csize : b;
+    return 1;
+}
+#endif
+
+// Fill s with unit number s->seq. Returns 1, 0 at end, -1 on error (logged).
+static int next_unit(sdc_reader* r, dec_slot* s) {
+    s->at = r->unit_off;
+    s->pos = 0;
+    if (r->codec == SDC_CODEC_SDIMG) {
+        if (s->seq >= r->img.nchunks) return 0;
+        s->expect = sdc_image_chunk_len(&r->img, s->seq);
+        return 0 == slot_reserve(&s->in, &s->in_cap, r->img.max_clen ? r->img.max_clen : 1) &&
+               0 == slot_reserve(&s->out, &s->out_cap, r->img.chunk_size) ? 1 : -1;
+    }
+    if (r->codec == SDC_CODEC_SDREF) {
+        if (s->seq >= r->ref.n) return 0;
+        s->expect = r->ref.e[s->seq].len;
+        return 0 == slot_reserve(&s->in, &s->in_cap, sdc_ref_scratch(&r->ref)) &&
+               0 == slot_reserve(&s->out, &s->out_cap, r->ref.max_len) ? 1 : -1;
+    }
+    uint64_t len = 0, bound = 0;
+    if (r->codec == SDC_CODEC_GZIP) {
+        uint32_t ml = 0;
+        int rc = gz_member_len(r->fd, r->unit_off, &ml, s->seq == 0);
+        if (rc == 0) return 0;
+        if (rc == -2) {
+            // A member appended by another tool: units end here and
+            // units_read() inflates the rest serially.
+            sdc_logi("[DECODE] gzip member at %llu has no SC length field; inflating the rest serially",
+                     (unsigned long long)r->unit_off);
+            r->tail = true;
+            return 0;
+        }
+        if (rc < 0) goto io_err;
+        len = ml;
+    } else {
+#ifdef SDC_WITH_ZSTD
+        for (;;) {
+            uint64_t cs = 0;
+            int rc = zstd_frame_len(r->fd, r->unit_off, &len, &bound, &cs);
+            if (rc == 0) return 0;
+            if (rc == -2) {
+                // e.g. a plain `zstd` file appended to a pzstd one
+                sdc_logi("[DECODE] zstd frame at %llu is larger than %llu MiB; decoding the rest as a stream",
+                         (unsigned long long)r->unit_off,
+                         (unsigned long long)(SDC_DEC_UNIT_MAX / MB(1)));
+                r->tail = true;
+                return 0;
+            }
+            if (rc < 0) goto io_err;
+            if (bound) break;
+            r->unit_off += len;   // skippable frame
+            s->at = r->unit_off;
+        }
+#endif
+    }
+    if (slot_reserve(&s->in, &s->in_cap, (size_t)len) != 0) return -1;
+    if (pread_full(r->fd, s->in, (size_t)len, r->unit_off) != (ssize_t)len) goto io_err;
+    s->in_len = (size_t)len;
+    if (r->codec == SDC_CODEC_GZIP) bound = le32(s->in + len - 4);
+    if (bound > SDC_DEC_UNIT_MAX) {
+        sdc_loge("[DECODE] unit at %llu decodes to more than %llu MiB",
+                 (unsigned long long)r->unit_off, (unsigned long long)(SDC_DEC_UNIT_MAX / MB(1)));
+        return -1;
+    }
+    s->expect = r->codec == SDC_CODEC_GZIP ? bound : 0;
+    if (slot_reserve(&s->out, &s->out_cap, bound ? (size_t)bound : 1) != 0) return -1;
+    r->unit_off += len;
+    __atomic_store_n(&r->unit_in, r->unit_off, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&r->unit_out, bound, __ATOMIC_RELAXED);
+    return 1;
+io_err:
+    sdc_loge("[DECODE] truncated or unreadable input at %llu", (unsigned long long)r->unit_off);
+    return -1;
+}
+
+static void* producer_main(void* arg) {
+    sdc_reader* r = arg;
+    for (uint64_t seq = 0; ; seq++) {
+        dec_slot* s = &r->slots[seq % r->nslots];
+        pthread_mutex_lock(&r->mu);
+        while (s->state != SLOT_FREE && !r->stop && !r->failed) pthread_cond_wait(&r->cv, &r->mu);
+        bool quit = r->stop || r->failed;
+        pthread_mutex_unlock(&r->mu);
+        if (quit) break;
+
+        s->seq = seq;
+        int rc = next_unit(r, s);
+
+        pthread_mutex_lock(&r->mu);
+        if (rc > 0) { s->state = SLOT_FILLED; r->produced = seq + 1; }
+        else if (rc < 0) r->failed = true;
+        if (rc <= 0) r->prod_eof = true;
+        pthread_cond_broadcast(&r->cv);
+        pthread_mutex_unlock(&r->mu);
+        if (rc <= 0) break;
+    }
+    return NULL;
+}
+
+static int decode_unit(dec_worker* w, dec_slot* s) {
+    sdc_reader* r = w->r;
+    if (r->codec == SDC_CODEC_SDIMG) {
+        if (sdc_image_read_chunk(&r->img, s->seq, s->out, s->in) != 0) {
+            sdc_loge("[SDIMG] chunk %llu unreadable: %s", (unsigned long long)s->seq, strerror(errno));
+            return -1;
+        }
+        s->out_len = (size_t)s->expect;
+        return 0;
+    }
+    if (r->codec == SDC_CODEC_SDREF) {
+        if (sdc_ref_read_chunk(&r->ref, s->seq, s->out, s->in) != 0) return -1;
+        s->out_len = (size_t)s->expect;
+        return 0;
+    }
+    if (r->codec == SDC_CODEC_GZIP) {
+        // Header: 10 fixed bytes, FEXTRA, optional FNAME / FCOMMENT / FHCRC.
+        const unsigned char* p = s->in;
+        size_t hl = 12 + ((size_t)p[10] | (size_t)p[11] << 8);
+        if (p[3] & 8)  while (hl < s->in_len && p[hl++]) {}
+        if (p[3] & 16) while (hl < s->in_len && p[hl++]) {}
+        if (p[3] & 2)  hl += 2;
+        if (hl + 8 > s->in_len) goto gz_bad;
+        if (!w->zs_ok) {
+            if (inflateInit2(&w->zs, -15) != Z_OK) return -1;
+            w->zs_ok = true;
+        } else if (inflateReset(&w->zs) != Z_OK) return -1;
+        w->zs.next_in = (unsigned char*)p + hl;
+        w->zs.avail_in = (uInt)(s->in_len - hl - 8);
+        w->zs.next_out = s->out;
+        w->zs.avail_out = (uInt)s->expect;
+        int zrc = inflate(&w->zs, Z_FINISH);
+        s->out_len = (size_t)s->expect - w->zs.avail_out;
+        if (zrc != Z_STREAM_END || s->out_len != s->expect ||
+            (uint32_t)crc32(0L, s->out, (uInt)s->out_len) != le32(p + s->in_len - 8))
+            goto gz_bad;
+        return 0;
+gz_bad:
+        sdc_loge("[DECODE] gzip member at %llu is corrupt", (unsigned long long)s->at);
+        return -1;
+    }
+#ifdef SDC_WITH_ZSTD
+    if (!w->zd && !(w->zd = ZSTD_createDCtx())) return -1;
+    size_t n = ZSTD_decompressDCtx(w->zd, s->out, s->out_cap, s->in, s->in_len);
+    if (ZSTD_isError(n)) {
+        sdc_loge("[DECODE] zstd frame at %llu: %s", (unsigned long long)s->at, ZSTD_getErrorName(n));
+        return -1;
+    }
+    s->out_len = n;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+static void* worker_main(void* arg) {
+    dec_worker* w = arg;
+    sdc_reader* r = w->r;
+    pthread_mutex_lock(&r->mu);
+    for (;;) {
+        while (!r->stop && !r->failed && r->next_decode >= r->produced && !r->prod_eof)
+            pthread_cond_wait(&r->cv, &r->mu);
+        if (r->stop || r->failed || r->next_decode >= r->produced) break;
+        dec_slot* s = &r->slots[r->next_decode++ % r->nslots];
+        s->state = SLOT_BUSY;
+        pthread_mutex_unlock(&r->mu);
+
+        int rc = decode_unit(w, s);
+
+        pthread_mutex_lock(&r->mu);
+        s->state = rc == 0 ? SLOT_READY : SLOT_ERR;
+        if (rc != 0) r->failed = true;
+        pthread_cond_broadcast(&r->cv);
+    }
+    pthread_mutex_unlock(&r->mu);
+    return NULL;
+}
+
+static int units_start(sdc_reader* r) {
+    unsigned n = online_cpus();
+    if (n > SDC_DEC_THREADS_MAX) n = SDC_DEC_THREADS_MAX;
+    r->nslots = n + 4;
+    r->slots = calloc(r->nslots, sizeof(dec_slot));
+    r->workers = calloc(n, sizeof(dec_worker));
+    r->tw = calloc(n, sizeof(pthread_t));
+    if (!r->slots || !r->workers || !r->tw) return -1;
+    pthread_mutex_init(&r->mu, NULL);
+    pthread_cond_init(&r->cv, NULL);
+    r->sync_init = true;
+    r->producer_started = sdc_thread_create(&r->producer, producer_main, r) == 0;
+    if (!r->producer_started) return -1;
+    r->nworkers = n;
+    for (unsigned i = 0; i < n; i++) {
+        r->workers[i].r = r;
+        if (sdc_thread_create(&r->tw[i], worker_main, &r->workers[i]) != 0) break;
+        r->nstarted++;
+    }
+    return r->nstarted ? 0 : -1;
+}
+
+static void units_stop(sdc_reader* r) {
+    if (!r->sync_init) return;
+    pthread_mutex_lock(&r->mu);
+    r->stop = true;
+    pthread_cond_broadcast(&r->cv);
+    pthread_mutex_unlock(&r->mu);
+    if (r->producer_started) pthread_join(r->producer, NULL);
+    for (unsigned i = 0; i < r->nstarted; i++) pthread_join(r->tw[i], NULL);
+    for (unsigned i = 0; i < r->nworkers; i++) {
+        if (r->workers[i].zs_ok) inflateEnd(&r->workers[i].zs);
+#ifdef SDC_WITH_ZSTD
+        ZSTD_freeDCtx(r->workers[i].zd);
+#endif
+    }
+    for (unsigned i = 0; r->slots && i < r->nslots; i++) { free(r->slots[i].in); free(r->slots[i].out); }
+    pthread_cond_destroy(&r->cv);
+    pthread_mutex_destroy(&r->mu);
+}
+
+static ssize_t stream_read(sdc_reader* r, unsigned char* out, size_t len);
+static int open_stream_codec(sdc_reader* r, const char* path);
+
+// All units are consumed and what follows cannot be split (a foreign gzip
+// member, an oversized zstd frame): stop the unit decoder and stream from
+// there on, as when the first member or frame is like that.
+static int units_to_stream(sdc_reader* r) {
+    units_stop(r);
+    r->mode = MODE_RAW;   // nothing for units_stop() to do again
+    int rc = lseek(r->fd, (off_t)r->unit_off, SEEK_SET) < 0 ? -1 : 0;
+    if (rc == 0 && r->codec == SDC_CODEC_GZIP) {
+        r->gz = gzdopen(dup(r->fd), "rb");
+        if (r->gz) { gzbuffer(r->gz, SDC_DEC_IBUF); r->mode = MODE_GZ; }
+        else rc = -1;
+    } else if (rc == 0) {
+        r->in_read = r->unit_off;   // estimates count from the file start
+        r->ibuf = malloc(SDC_DEC_IBUF);
+        rc = r->ibuf ? open_stream_codec(r, NULL) : -1;
+    }
+    if (rc != 0)
+        sdc_loge("[DECODE] cannot decode %s from %llu: %s", sdc_codec_name(r->codec),
+                 (unsigned long long)r->unit_off, strerror(errno));
+    return rc;
+}
+
+static ssize_t units_read(sdc_reader* r, unsigned char* out, size_t len) {
+    size_t got = 0;
+    while (got < len) {
+        dec_slot* s = &r->slots[r->consumed % r->nslots];
+        pthread_mutex_lock(&r->mu);
+        while (!(s->state == SLOT_READY && s->seq == r->consumed) && !r->failed &&
+               !(r->prod_eof && r->consumed >= r->produced))
+            pthread_cond_wait(&r->cv, &r->mu);
+        bool ready = s->state == SLOT_READY && s->seq == r->consumed;
+        bool failed = r->failed;
+        pthread_mutex_unlock(&r->mu);
+        if (failed) return -1;
+        if (!ready && r->tail) {
+            if (units_to_stream(r) != 0) return -1;
+            ssize_t n = stream_read(r, out + got, len - got);
+            if (n < 0) return -1;
+            got += (size_t)n;
+            break;
+        }
+        if (!ready) { r->eof = true; break; }
+
+        size_t n = s->out_len - s->pos < len - got ? s->out_len - s->pos : len - got;
+        memcpy(out + got, s->out + s->pos, n);
+        s->pos += n; got += n;
+        if (s->pos == s->out_len) {
+            pthread_mutex_lock(&r->mu);
+            s->state = SLOT_FREE;
+            r->consumed++;
+            pthread_cond_broadcast(&r->cv);
+            pthread_mutex_unlock(&r->mu);
+        }
+    }
+    return (ssize_t)got;
+}
+
+// ---------------- Streaming decoders ------------------
+#ifdef SDC_DEC_NATIVE
+static int refill(sdc_reader* r) {
+    if (r->ipos < r->ilen || r->ieof) return 0;
+    ssize_t n;
+    do n = read(r->fd, r->ibuf, SDC_DEC_IBUF); while (n < 0 && errno == EINTR);
+    if (n < 0) { sdc_loge("[DECODE] read: %s", strerror(errno)); return -1; }
+    r->ipos = 0;
+    r->ilen = (size_t)n;
+    r->in_read += (uint64_t)n;
+    if (n == 0) r->ieof = true;
+    return 0;
+}
+#endif
+
+#ifdef SDC_DEC_TOOLS
+
+// Decoder process writing to a pipe; r->fd becomes its stdout.
+static int spawn_tool(sdc_reader* r, const char* path, const char* tool, const char* threads_arg) {
+    int pfd[2];
+    if (pipe2(pfd, O_CLOEXEC) != 0) return -1;
+    pid_t pid = fork();
+    if (pid < 0) { close(pfd[0]); close(pfd[1]); return -1; }
+    if (pid == 0) {
+        dup2(pfd[1], STDOUT_FILENO);
+        if (threads_arg) execlp(tool, tool, "-dc", threads_arg, "--", path, (char*)NULL);
+        else execlp(tool, tool, "-dc", "--", path, (char*)NULL);
+        _exit(127);
+    }
+    close(pfd[1]);
+    close(r->fd);
+    r->fd = pfd[0];
+    r->child = pid;
+    r->tool = tool;
+    sdc_logi("[DECODE] %s image decoded by external '%s'", sdc_codec_name(r->codec), tool);
+    return 0;
+}
+#endif
+
+static int reap_tool(sdc_reader* r, bool kill_it) {
+    if (r->child <= 0) return 0;
+    if (kill_it) kill(r->child, SIGTERM);
+    int st = 0;
+    while (waitpid(r->child, &st, 0) < 0 && errno == EINTR) {}
+    r->child = 0;
+    if (kill_it) return 0;
+    if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) {
+        sdc_loge("[DECODE] '%s' failed (status %d)%s", r->tool,
+                 WIFEXITED(st) ? WEXITSTATUS(st) : -1,
+                 WIFEXITED(st) && WEXITSTATUS(st) == 127 ? ": not installed?" : "");
+        return -1;
+    }
+    return 0;
+}
+
+// Raw image with holes: SEEK_DATA / SEEK_HOLE find them, and they are
+// produced as zeros without going through the page cache.
+static ssize_t raw_read_sparse(sdc_reader* r, unsigned char* out, size_t len) {
+    size_t got = 0;
+    while (got < len && r->out_done + got < r->in_size) {
+        uint64_t at = r->out_done + got;
+        size_t want = len - got;
+        if (want > r->in_size - at) want = (size_t)(r->in_size - at);
+        off_t data = lseek(r->fd, (off_t)at, SEEK_DATA);
+        if (data < 0 && errno != ENXIO) { sdc_loge("[READ] %s", strerror(errno)); return -1; }
+        if (data < 0 || (uint64_t)data > at) {      // ENXIO: only a hole remains
+            size_t z = data < 0 || (uint64_t)data - at > want ? want : (size_t)((uint64_t)data - at);
+            memset(out + got, 0, z);
+            got += z;
+            continue;
+        }
+        off_t hole = lseek(r->fd, (off_t)at, SEEK_HOLE);
+        if (hole > data && (uint64_t)hole - at < want) want = (size_t)((uint64_t)hole - at);
+        ssize_t n = pread_full(r->fd, out + got, want, at);
+        if (n < 0) { sdc_loge("[READ] %s", strerror(errno)); return -1; }
+        got += (size_t)n;
+        if ((size_t)n < want) break;
+    }
+    if (got < len) r->eof = true;
+    return (ssize_t)got;
+}
+
+static ssize_t stream_read(sdc_reader* r, unsigned char* out, size_t len) {
+    size_t got = 0;
+    switch (r->mode) {
+    case MODE_RAW:
+        if (r->holes) return raw_read_sparse(r, out, len);
+        /* fall through */
+    case MODE_PIPE:
+        while (got < len) {
+            ssize_t n = read(r->fd, out + got, len - got);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                sdc_loge("[READ] %s", strerror(errno));
+                return -1;
+            }
+            if (n == 0) {
+                r->eof = true;
+                if (r->mode == MODE_PIPE && reap_tool(r, false) != 0) return -1;
+                break;
+            }
+            got += (size_t)n;
+        }
+        break;
+    case MODE_GZ:
+        while (got < len) {
+            int n = gzread(r->gz, out + got, (unsigned)(len - got > (1u << 30) ? (1u << 30) : len - got));
+            if (n <= 0) {
+                int zerr = Z_OK;
+                const char* msg = gzerror(r->gz, &zerr);   // truncated input shows up here
+                if (n < 0 || zerr != Z_OK) { sdc_loge("[READ] %s", msg); return -1; }
+                r->eof = true;
+                break;
+            }
+            got += (size_t)n;
+        }
+        break;
+#ifdef SDC_WITH_LZMA
+    case MODE_XZ:
+        while (got < len) {
+            if (refill(r) != 0) return -1;
+            r->xz.next_in = r->ibuf + r->ipos;
+            r->xz.avail_in = r->ilen - r->ipos;
+            r->xz.next_out = out + got;
+            r->xz.avail_out = len - got;
+            lzma_ret ret = lzma_code(&r->xz, r->ieof ? LZMA_FINISH : LZMA_RUN);
+            r->ipos = r->ilen - r->xz.avail_in;
+            got = len - r->xz.avail_out;
+            if (ret == LZMA_STREAM_END) { r->eof = true; break; }
+            if (ret != LZMA_OK) { sdc_loge("[DECODE] xz: corrupt or truncated (liblzma %d)", (int)ret); return -1; }
+        }
+        break;
+#endif
+#ifdef SDC_WITH_ZSTD
+    case MODE_ZSTD:
+        while (got < len) {
+            if (refill(r) != 0) return -1;
+            ZSTD_inBuffer  ib = { r->ibuf, r->ilen, r->ipos };
+            ZSTD_outBuffer ob = { out + got, len - got, 0 };
+            size_t ret = ZSTD_decompressStream(r->zds, &ob, &ib);
+            if (ZSTD_isError(ret)) { sdc_loge("[DECODE] zstd: %s", ZSTD_getErrorName(ret)); return -1; }
+            // Only a call that made progress says whether a frame is open.
+            if (ib.pos != r->ipos || ob.pos) r->zst_hint = ret;
+            r->ipos = ib.pos;
+            got += ob.pos;
+            if (r->ieof && ob.pos == 0) {
+                if (r->zst_hint != 0) { sdc_loge("[DECODE] zstd: truncated input"); return -1; }
+                r->eof = true;
+                break;
+            }
+        }
+        break;
+#endif
+#ifdef SDC_WITH_LZ4
+    case MODE_LZ4:
+        while (got < len) {
+            if (refill(r) != 0) return -1;
+            size_t dst = len - got, src = r->ilen - r->ipos;
+            size_t ret = LZ4F_decompress(r->lz, out + got, &dst, r->ibuf + r->ipos, &src, NULL);
+            if (LZ4F_isError(ret)) { sdc_loge("[DECODE] lz4: %s", LZ4F_getErrorName(ret)); return -1; }
+            if (src || dst) r->lz_hint = ret;
+            r->ipos += src;
+            got += dst;
+            if (r->ieof && dst == 0) {
+                if (r->lz_hint != 0) { sdc_loge("[DECODE] lz4: truncated input"); return -1; }
+                r->eof = true;
+                break;
+            }
+        }
+        break;
+#endif
+    default:
+        return -1;
+    }
+    return (ssize_t)got;
+}
+
+// ---------------- Public reader -----------------------
+static int open_stream_codec(sdc_reader* r, const char* path) {
+    (void)path;
+    switch (r->codec) {
+    case SDC_CODEC_XZ:
+#ifdef SDC_WITH_LZMA
+    {
+        lzma_stream init = LZMA_STREAM_INIT;
+        r->xz = init;
+        lzma_ret ret;
+#if LZMA_VERSION >= 50040002
+        lzma_mt mt; memset(&mt, 0, sizeof(mt));
+        mt.flags = LZMA_CONCATENATED;
+        mt.threads = online_cpus();
+        mt.memlimit_threading = lzma_physmem() / 4;
+        mt.memlimit_stop = UINT64_MAX;
+        ret = lzma_stream_decoder_mt(&r->xz, &mt);
+#else
+        ret = lzma_stream_decoder(&r->xz, UINT64_MAX, LZMA_CONCATENATED);
+#endif
+        if (ret != LZMA_OK) { sdc_loge("[DECODE] liblzma init failed (%d)", (int)ret); return -1; }
+        r->xz_init = true;
+        r->mode = MODE_XZ;
+        return 0;
+    }
+#else
+        r->mode = MODE_PIPE;
+        return spawn_tool(r, path, "xz", "-T0");
+#endif
+    case SDC_CODEC_ZSTD:
+#ifdef SDC_WITH_ZSTD
+        if (!(r->zds = ZSTD_createDStream()) || ZSTD_isError(ZSTD_initDStream(r->zds))) return -1;
+        r->mode = MODE_ZSTD;
+        return 0;
+#else
+        r->mode = MODE_PIPE;
+        return spawn_tool(r, path, "zstd", NULL);
+#endif
+    case SDC_CODEC_LZ4:
+#ifdef SDC_WITH_LZ4
+        if (LZ4F_isError(LZ4F_createDecompressionContext(&r->lz, LZ4F_VERSION))) return -1;
+        r->mode = MODE_LZ4;
+        return 0;
+#else
+        r->mode = MODE_PIPE;
+        return spawn_tool(r, path, "lz4", NULL);
+#endif
+    default:
+        return -1;
+    }
+}
+
+sdc_reader* sdc_reader_open(const char* path) {
+    sdc_reader* r = calloc(1, sizeof(*r));
+    if (!r) return NULL;
+    r->img.fd = -1;
+    r->fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (r->fd < 0 || fstat(r->fd, &st) != 0) {
+        sdc_loge("open(%s): %s", path, strerror(errno));
+        sdc_reader_close(r);
+        return NULL;
+    }
+    r->in_size = (uint64_t)st.st_size;
+    unsigned char m[8];
+    ssize_t n = pread_full(r->fd, m, sizeof(m), 0);
+    if (n < 0) { sdc_loge("read(%s): %s", path, strerror(errno)); sdc_reader_close(r); return NULL; }
+    r->codec = codec_of(m, (size_t)n);
+    (void)posix_fadvise(r->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    int rc = 0;
+    uint32_t ml;
+    uint64_t zl, zb, zc;
+    switch (r->codec) {
+    case SDC_CODEC_RAW:
+        r->mode = MODE_RAW;
+        r->holes = S_ISREG(st.st_mode) && (uint64_t)st.st_blocks * 512 < r->in_size;
+        break;
+    case SDC_CODEC_SDIMG:
+        if (sdc_image_open(path, &r->img) != 0) { sdc_reader_close(r); return NULL; }
+        r->has_img = true;
+        r->mode = MODE_UNITS;
+        break;
+    case SDC_CODEC_SDREF:
+        if (sdc_ref_open(path, &r->ref) != 0) { sdc_reader_close(r); return NULL; }
+        r->has_ref = true;
+        r->mode = MODE_UNITS;
+        break;
+    case SDC_CODEC_GZIP:
+        if (gz_member_len(r->fd, 0, &ml, true) == 1) { r->mode = MODE_UNITS; break; }
+        // Foreign gzip (one deflate stream) cannot be split: inflate serially.
+        r->gz = gzdopen(dup(r->fd), "rb");
+        if (!r->gz) { sdc_loge("open(%s): %s", path, strerror(errno)); sdc_reader_close(r); return NULL; }
+        gzbuffer(r->gz, SDC_DEC_IBUF);
+        r->mode = MODE_GZ;
+        break;
+    case SDC_CODEC_ZSTD:
+#ifdef SDC_WITH_ZSTD
+        // Frames that fit a unit (pzstd, seekable zstd) decode in parallel;
+        // one big frame from plain `zstd` streams instead.
+        if (zstd_frame_len(r->fd, 0, &zl, &zb, &zc) == 1 && zb && zl < r->in_size) {
+            r->mode = MODE_UNITS;
+            break;
+        }
+#else
+        (void)zl; (void)zb; (void)zc;
+#endif
+        /* fall through */
+    default:
+        r->ibuf = malloc(SDC_DEC_IBUF);
+        rc = r->ibuf ? open_stream_codec(r, path) : -1;
+        break;
+    }
+    if (rc == 0 && r->mode == MODE_UNITS) rc = units_start(r);
+    if (rc != 0) {
+        sdc_loge("[DECODE] cannot decode %s (%s)", path, sdc_codec_name(r->codec));
+        sdc_reader_close(r);
+        return NULL;
+    }
+    if (r->mode == MODE_UNITS)
+        sdc_logi("[DECODE] %s: %s, %u decoder threads", path, sdc_codec_name(r->codec), r->nstarted);
+    return r;
+}
+
+sdc_codec sdc_reader_codec(const sdc_reader* r) { return r->codec; }
+
+ssize_t sdc_reader_read(sdc_reader* r, void* buf, size_t len) {
+    if (r->eof) return 0;
+    ssize_t n = r->mode == MODE_UNITS ? units_read(r, buf, len) : stream_read(r, buf, len);
+    if (n > 0) r->out_done += (uint64_t)n;
+    return n;
+}
+
+uint64_t sdc_reader_total(sdc_reader* r, uint64_t pos) {
+    if (r->eof) return r->out_done;
+    if (r->has_img) return r->img.image_size;
+    if (r->has_ref) return r->ref.image_size;
+    uint64_t in = 0, out = 0;
+    switch (r->mode) {
+    case MODE_RAW:  return r->in_size;
+    case MODE_PIPE: return 0;
+    case MODE_GZ:
+        if (gzdirect(r->gz)) return r->in_size;
+        in = gzoffset(r->gz) > 0 ? (uint64_t)gzoffset(r->gz) : 0;
+        out = pos;
+        break;
+    case MODE_UNITS:
+        in = __atomic_load_n(&r->unit_in, __ATOMIC_RELAXED);
+        out = __atomic_load_n(&r->unit_out, __ATOMIC_RELAXED);
+        break;
+    default:
+        in = r->in_read - (r->ilen - r->ipos);
+        out = pos;
+        break;
+    }
+    if (!in || !out) return 0;
+    uint64_t total = (uint64_t)((double)out * (double)r->in_size / (double)in);
+    return total < pos ? pos : total;
+}
+
+void sdc_reader_close(sdc_reader* r) {
+    if (!r) return;
+    if (r->mode == MODE_UNITS) units_stop(r);
+    free(r->slots);
+    free(r->workers);
+    free(r->tw);
+    if (r->gz) gzclose(r->gz);
+    if (r->fd >= 0) close(r->fd);
+    reap_tool(r, true);
+#ifdef SDC_WITH_LZMA
+    if (r->xz_init) lzma_end(&r->xz);
+#endif
+#ifdef SDC_WITH_ZSTD
+    ZSTD_freeDStream(r->zds);
+#endif
+#ifdef SDC_WITH_LZ4
+    if (r->lz) LZ4F_freeDecompressionContext(r->lz);
+#endif
+    if (r->has_img) sdc_image_close(&r->img);
+    if (r->has_ref) sdc_ref_close(&r->ref);
+    free(r->ibuf);
+    free(r);
+}
@@ -0,0 +1,45 @@
+// sdcloner_decode.h
+// Sequential image reader for burning and conversion. The format is chosen
+// from the file's magic bytes, never its name: raw .img, gzip, .sdimg,
+// .sdref, xz, zstd and lz4.
+//
+// Independent units are decoded on a worker pool and handed back in order:
+// SC-tagged gzip members (our own .img.gz), .sdimg chunks, .sdref store
+// chunks and zstd frames of known bounded size (pzstd / seekable zstd). xz
+// goes through liblzma's threaded decoder. Anything else streams on one thread. zstd, lz4 and xz
+// use their libraries when built with SDC_WITH_ZSTD / SDC_WITH_LZ4 /
+// SDC_WITH_LZMA, otherwise the matching command-line tool.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef enum {
+    SDC_CODEC_RAW = 0,
+    SDC_CODEC_GZIP,
+    SDC_CODEC_SDIMG,
+    SDC_CODEC_XZ,
+    SDC_CODEC_ZSTD,
+    SDC_CODEC_LZ4,
+    SDC_CODEC_SDREF,    // recipe in a chunk store, see sdcloner_store.h
+} sdc_codec;
+
+// Codec of path from its leading bytes. Returns 0, or -1 if unreadable.
+int sdc_codec_detect(const char* path, sdc_codec* out);
+const char* sdc_codec_name(sdc_codec c);
+
+typedef struct sdc_reader sdc_reader;
+
+// Open path for sequential decoding; decoder threads follow the online CPUs.
+sdc_reader* sdc_reader_open(const char* path);
+sdc_codec   sdc_reader_codec(const sdc_reader* r);
+// Read up to len bytes; fewer only at the end. Returns bytes, 0 at EOF, -1 on error.
+// Holes of a sparse raw image are returned as zeros without reading them.
+ssize_t sdc_reader_read(sdc_reader* r, void* buf, size_t len);
+// Logical size once pos bytes have been produced: exact for .img/.sdimg and
+// at EOF, otherwise extrapolated from the compressed bytes consumed so far
+// (0 if unknown, e.g. when an external tool decodes).
+uint64_t sdc_reader_total(sdc_reader* r, uint64_t pos);
+void sdc_reader_close(sdc_reader* r);
@@ -19,38 +19,108 @@
 #include <linux/fs.h>     // BLKGETSIZE64
 #include <dirent.h>
 #include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+
+#include "sdcloner_engine.h"
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_fsmap.h"
+#include "sdcloner_shrink.h"
+#include "sdcloner_probe.h"
+#include "sdcloner_image.h"
+#include "sdcloner_store.h"
+#include "sdcloner_checkpoint.h"
+#include "sdcloner_rescue.h"
 
 #define KB(x) ((uint64_t)(x) * 1024ULL)
 #define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
 #define GB(x) ((uint64_t)(x) * 1024ULL * 1024ULL * 1024ULL)
 
-#define SAFETY_MARGIN_BYTES MB(512) // extra room for metadata/slack
 
-static void die(const char* fmt, ...) {
+// ---------- Errors ----------
+// Where the job a thread works for collects its error: set by the
+// sdcloner_ctx_* calls, inherited by threads started with sdc_thread_create().
+typedef struct {
+    pthread_mutex_t mu;
+    sdcloner_error  e;
+    bool            classified;   // e.code set by sdc_fail()
+} job_err;
+
+static _Thread_local job_err* err_self;
+
+static void err_record(int code, const char* fmt, va_list ap) {
+    job_err* je = err_self;
+    if (!je) return;
+    pthread_mutex_lock(&je->mu);
+    if (!je->classified && (code || !je->e.message[0])) {
+        vsnprintf(je->e.message, sizeof(je->e.message), fmt, ap);
+        if (code) { je->e.code = (sdcloner_errcode)code; je->classified = true; }
+    }
+    pthread_mutex_unlock(&je->mu);
+}
+
+typedef struct {
+    void*    (*fn)(void*);
+    void*    arg;
+    job_err* err;
+} thread_start;
+
+static void* thread_main(void* p) {
+    thread_start ts = *(thread_start*)p;
+    free(p);
+    err_self = ts.err;
+    return ts.fn(ts.arg);
+}
+
+int sdc_thread_create(pthread_t* th, void* (*fn)(void*), void* arg) {
+    thread_start* ts = malloc(sizeof(*ts));
+    if (!ts) return ENOMEM;
+    ts->fn = fn;
+    ts->arg = arg;
+    ts->err = err_self;
+    int rc = pthread_create(th, NULL, thread_main, ts);
+    if (rc != 0) free(ts);
+    return rc;
+}
+
+void sdc_logi(const char* fmt, ...) {
+    va_list ap; va_start(ap, fmt);
+    vfprintf(stdout, fmt, ap);
+    va_end(ap);
+    fprintf(stdout, "\n");
+    fflush(stdout);
+}
+
+void sdc_loge(const char* fmt, ...) {
     va_list ap; va_start(ap, fmt);
     vfprintf(stderr, fmt, ap);
     va_end(ap);
     fprintf(stderr, "\n");
-    exit(EXIT_FAILURE);
+    va_start(ap, fmt);
+    err_record(0, fmt, ap);
+    va_end(ap);
 }
 
-static void logi(const char* fmt, ...) {
+void sdc_fail(int code, const char* fmt, ...) {
     va_list ap; va_start(ap, fmt);
-    vfprintf(stdout, fmt, ap);
+    vfprintf(stderr, fmt, ap);
+    va_end(ap);
+    fprintf(stderr, "\n");
+    va_start(ap, fmt);
+    err_record(code, fmt, ap);
     va_end(ap);
-    fprintf(stdout, "\n");
-    fflush(stdout);
 }
 
-static int run_cmd(const char* cmd) {
-    logi("[CMD] %s", cmd);
+int sdc_run_cmd(const char* cmd) {
+    sdc_logi("[CMD] %s", cmd);
     int rc = system(cmd);
     if (rc == -1) return -1;
     return WIFEXITED(rc) ? WEXITSTATUS(rc) : -1;
 }
 
-static char* run_cmd_capture(const char* cmd) {
-    logi("[CMD] %s", cmd);
+char* sdc_run_cmd_capture(const char* cmd) {
+    sdc_logi("[CMD] %s", cmd);
     FILE* fp = popen(cmd, "r");
     if (!fp) return NULL;
     char* buf = NULL; size_t cap = 0; size_t len = 0;
@@ -71,13 +141,14 @@ static char* run_cmd_capture(const char* cmd) {
     return buf;
 }
 
-static uint64_t get_blockdev_size_bytes(const char* devnode) {
+// Size of a block device, 0 if it cannot be read (logged as code).
+static uint64_t get_blockdev_size_bytes(const char* devnode, sdcloner_errcode code) {
     uint64_t bytes = 0;
     int fd = open(devnode, O_RDONLY | O_CLOEXEC);
-    if (fd < 0) die("open(%s): %s", devnode, strerror(errno));
+    if (fd < 0) { sdc_fail(code, "open(%s): %s", devnode, strerror(errno)); return 0; }
     if (ioctl(fd, BLKGETSIZE64, &bytes) < 0) {
-        close(fd);
-        die("ioctl(BLKGETSIZE64 %s): %s", devnode, strerror(errno));
+        sdc_fail(code, "ioctl(BLKGETSIZE64 %s): %s", devnode, strerror(errno));
+        bytes = 0;
     }
     close(fd);
     return bytes;
@@ -86,227 +157,623 @@ static uint64_t get_blockdev_size_bytes(const char* devnode) {
 // List partitions for a disk (e.g. /dev/sdd -> /dev/sdd1, /dev/sdd2).
 // Returns a malloc'd array of strings; caller frees each and the array.
 static char** list_partitions(const char* disk, int* out_count) {
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd),
-        "lsblk -rno PATH,TYPE '%s' | awk '$2==\"part\"{print $1}'", disk);
-    char* out = run_cmd_capture(cmd);
-    if (!out) { *out_count = 0; return NULL; }
-    int cap = 8, n = 0;
-    char** arr = malloc(sizeof(char*) * cap);
-    char* save = NULL;
-    for (char* line = strtok_r(out, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
-        if (!*line) continue;
-        if (n == cap) { cap *= 2; arr = realloc(arr, sizeof(char*) * cap); }
-        arr[n++] = strdup(line);
-    }
-    free(out);
-    *out_count = n;
+    sdcloner_partition* pl = NULL;
+    int n = 0;
+    *out_count = 0;
+    if (sdcloner_list_partitions(disk, &pl, &n) != 0 || n == 0) { free(pl); return NULL; }
+    char** arr = malloc(sizeof(char*) * (size_t)n);
+    if (arr)
+        for (int i = 0; i < n; i++) arr[i] = strdup(pl[i].path);
+    free(pl);
+    if (arr) *out_count = n;
     return arr;
 }
 
-// Try to get fstype for a partition
-static char* get_fstype(const char* part) {
-    char cmd[512];
-    snprintf(cmd, sizeof(cmd), "blkid -o value -s TYPE '%s' 2>/dev/null", part);
-    char* out = run_cmd_capture(cmd);
-    if (!out) return strdup("unknown");
-    char* nl = strchr(out, '\n'); if (nl) *nl = '\0';
-    if (!*out) { free(out); return strdup("unknown"); }
-    return out;
-}
-
-// Compute used bytes by mounting RO (if not mounted) and running df.
-// Returns sum of used (bytes) for supported filesystems.
+// Sum of used bytes across the disk's partitions, read from filesystem
+// metadata (no mounting). Unrecognised filesystems count at full size since
+// they will be copied verbatim.
 static uint64_t compute_used_bytes_sum(const char* disk) {
+    sdcloner_partition* pl = NULL;
     int n = 0;
-    char** parts = list_partitions(disk, &n);
-    if (!parts || n==0) return 0;
+    if (sdcloner_list_partitions(disk, &pl, &n) != 0) return 0;
     uint64_t sum = 0;
-
-    for (int i=0;i<n;i++) {
-        char* fs = get_fstype(parts[i]);
-        bool supported = (!strcmp(fs,"ext2") || !strcmp(fs,"ext3") || !strcmp(fs,"ext4") ||
-                          !strcmp(fs,"vfat") || !strcmp(fs,"fat") || !strcmp(fs,"fat32") ||
-                          !strcmp(fs,"exfat"));
-        free(fs);
-
-        // Current mountpoint (if any)
-        char cmd_mp[512];
-        snprintf(cmd_mp,sizeof(cmd_mp),
-                 "lsblk -rno MOUNTPOINT '%s' | head -n1", parts[i]);
-        char* mp = run_cmd_capture(cmd_mp);
-        if (mp) { char* nl = strchr(mp, '\n'); if (nl) *nl = '\0'; }
-        bool temp_mount=false;
-        char mnt[128]={0};
-
-        if (supported) {
-            if (!mp || strlen(mp)==0) {
-                // mount read-only to temp
-                snprintf(mnt,sizeof(mnt),"/mnt/sdcloner_src_%d", i);
-                char mk[256]; snprintf(mk,sizeof(mk),"sudo mkdir -p '%s'", mnt);
-                run_cmd(mk);
-                char mcmd[512]; snprintf(mcmd,sizeof(mcmd),
-                    "sudo mount -o ro '%s' '%s' 2>/dev/null", parts[i], mnt);
-                if (run_cmd(mcmd)==0) { temp_mount=true; }
-            } else {
-                strncpy(mnt, mp, sizeof(mnt)-1);
-            }
-
-            if (mnt[0]) {
-                char cmd_df[512];
-                snprintf(cmd_df,sizeof(cmd_df),
-                    "df --output=used -B1 '%s' | tail -n1", mnt);
-                char* used = run_cmd_capture(cmd_df);
-                if (used) {
-                    uint64_t u = strtoull(used, NULL, 10);
-                    sum += u;
-                    free(used);
-                }
-            }
-
-            if (temp_mount) {
-                char um[256]; snprintf(um,sizeof(um),"sudo umount '%s'", mnt);
-                run_cmd(um);
-                char rm[256]; snprintf(rm,sizeof(rm),"sudo rmdir '%s'", mnt);
-                run_cmd(rm);
-            }
+    for (int i = 0; i < n; i++) {
+        uint64_t used = 0;
+        if (sdc_fs_used_bytes(pl[i].path, &used) == 0) {
+            sdc_logi("[USED] %s (%s): %.2f MB", pl[i].path, pl[i].fstype,
+                     (double)used / (double)MB(1));
+        } else {
+            used = pl[i].size_bytes;
+            sdc_logi("[USED] %s (%s): unknown, counting full %.2f MB", pl[i].path,
+                     pl[i].fstype[0] ? pl[i].fstype : "?", (double)used / (double)MB(1));
         }
-        if (mp) free(mp);
-        free(parts[i]);
+        sum += used;
     }
-    free(parts);
+    free(pl);
     return sum;
 }
 
+// Create ~/SDCloner/<sub>
+static void ensure_data_dir(const char* sub, char* out_dir, size_t cap) {
+    const char* home = getenv("HOME"); if (!home) home = "/tmp";
+    snprintf(out_dir, cap, "%s/SDCloner", home);
+    if (mkdir(out_dir, 0755) != 0 && errno != EEXIST) sdc_loge("mkdir(%s): %s", out_dir, strerror(errno));
+    snprintf(out_dir, cap, "%s/SDCloner/%s", home, sub);
+    if (mkdir(out_dir, 0755) != 0 && errno != EEXIST) sdc_loge("mkdir(%s): %s", out_dir, strerror(errno));
+}
+
 // Create image directory
 static void ensure_image_dir(char* out_dir, size_t cap) {
-    const char* home = getenv("HOME"); if (!home) home = "/tmp";
-    snprintf(out_dir, cap, "%s/SDCloner/images", home);
-    char mk[512]; snprintf(mk,sizeof(mk),"mkdir -p '%s'", out_dir);
-    run_cmd(mk);
+    ensure_data_dir("images", out_dir, cap);
 }
 
-// Create a timestamped path
-static void timestamp_path(char* out, size_t cap, const char* dir, const char* ext) {
+// Create a timestamped path. The file is created empty so that jobs started
+// in the same second get distinct names (-2, -3, ... appended).
+static void timestamp_path(char* out, size_t cap, const char* dir, const char* prefix, const char* ext) {
     time_t t = time(NULL);
     struct tm tmv;
     localtime_r(&t, &tmv);
-    snprintf(out, cap, "%s/clone-%04d%02d%02d-%02d%02d%02d.%s",
-             dir,
-             1900 + tmv.tm_year, 1 + tmv.tm_mon, tmv.tm_mday,
-             tmv.tm_hour, tmv.tm_min, tmv.tm_sec,
-             ext);
+    char stamp[32];
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tmv);
+    for (int n = 1; n < 1000; n++) {
+        if (n == 1) snprintf(out, cap, "%s/%s-%s.%s", dir, prefix, stamp, ext);
+        else snprintf(out, cap, "%s/%s-%s-%d.%s", dir, prefix, stamp, n, ext);
+        int fd = open(out, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (fd >= 0) { close(fd); return; }
+        if (errno != EEXIST) return;   // the job reports the error when it opens out
+    }
+}
+
+// A job that failed on a path timestamp_path() reserved removes it again,
+// unless <path>.<keep_ext> (checkpoint, bad-range map) lets a new run
+// continue it. Otherwise the library would fill with empty or cut-off files.
+static void drop_reserved(const char* path, const char* keep_ext) {
+    char side[600];
+    if (keep_ext) {
+        snprintf(side, sizeof(side), "%s.%s", path, keep_ext);
+        if (access(side, F_OK) == 0) return;
+    }
+    if (unlink(path) == 0) sdc_logi("[JOB] removed unfinished %s", path);
+}
+
+void sdcloner_options_init(sdcloner_options* opt) {
+    memset(opt, 0, sizeof(*opt));
+    opt->keep_archive = 1;
+    opt->verify = SDCLONER_VERIFY_SAMPLED;
+    opt->verify_sample_pct = 5;
+    opt->io_depth = 4;
+    opt->checkpoint_mb = 1024;
+    opt->zero_discard = 1;
+}
+
+// ---------- Progress ----------
+#define PROGRESS_EMIT_SEC 0.2    // callback throttle
+#define PROGRESS_RATE_SEC 1.0    // window for the "recent" rate
+
+typedef struct {
+    sdcloner_progress_fn fn;
+    void*                user;
+    sdcloner_progress    cur;
+    double               t_phase;     // phase start
+    double               t_emit;      // last callback
+    double               t_win;       // start of current rate window
+    uint64_t             win_bytes;   // bytes_done at t_win
+    sdc_trace*           trace;       // NULL unless opt->trace
+    const char*          trace_job;
+    bool                 traced;      // a phase is open in trace
+    uint64_t             trace_t0;    // its start and the CPU used by then
+    double               trace_cpu0;
+} progress_ctx;
+
+const char* sdcloner_phase_name(sdcloner_phase phase) {
+    switch (phase) {
+    case SDCLONER_PHASE_PREPARE: return "Preparing";
+    case SDCLONER_PHASE_IMAGE:   return "Imaging";
+    case SDCLONER_PHASE_CLONE:   return "Cloning";
+    case SDCLONER_PHASE_SHRINK:  return "Shrinking";
+    case SDCLONER_PHASE_BURN:    return "Burning";
+    case SDCLONER_PHASE_VERIFY:  return "Verifying";
+    case SDCLONER_PHASE_DONE:    return "Done";
+    }
+    return "?";
+}
+
+static double mono_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// CPU seconds of this process and its reaped children (mkfs, rsync, ...).
+static double cpu_now(void) {
+    struct rusage self, kids;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &kids);
+    return (double)(self.ru_utime.tv_sec + self.ru_stime.tv_sec + kids.ru_utime.tv_sec + kids.ru_stime.tv_sec)
+         + (double)(self.ru_utime.tv_usec + self.ru_stime.tv_usec + kids.ru_utime.tv_usec + kids.ru_stime.tv_usec) / 1e6;
+}
+
+// job names the trace report; ignored unless opt asks for one.
+static void progress_init(progress_ctx* pc, const sdcloner_options* opt, const char* job) {
+    memset(pc, 0, sizeof(*pc));
+    if (opt) { pc->fn = opt->progress; pc->user = opt->progress_user; }
+    pc->cur.eta_s = -1;
+    if (opt && opt->trace != SDCLONER_TRACE_OFF && job) {
+        pc->trace = sdc_trace_new(job, opt->trace == SDCLONER_TRACE_TIMELINE);
+        pc->trace_job = job;
+    }
+}
+
+// Close the traced phase, if any, with the bytes it reported.
+static void trace_phase_end(progress_ctx* pc) {
+    if (!pc->traced) return;
+    sdc_trace_phase(pc->trace, sdcloner_phase_name(pc->cur.phase), pc->trace_t0, sdc_trace_now(),
+                    cpu_now() - pc->trace_cpu0, pc->cur.bytes_done);
+    pc->traced = false;
+}
+
+static void progress_phase(progress_ctx* pc, sdcloner_phase phase, uint64_t total) {
+    trace_phase_end(pc);
+    if (pc->trace && phase != SDCLONER_PHASE_DONE) {
+        pc->traced = true;
+        pc->trace_t0 = sdc_trace_now();
+        pc->trace_cpu0 = cpu_now();
+    }
+    double now = mono_now();
+    memset(&pc->cur, 0, sizeof(pc->cur));
+    pc->cur.phase = phase;
+    pc->cur.bytes_total = total;
+    pc->cur.eta_s = -1;
+    pc->t_phase = pc->t_emit = pc->t_win = now;
+    pc->win_bytes = 0;
+    if (pc->fn) pc->fn(&pc->cur, pc->user);
+}
+
+// sdc_progress_fn: called by the pipeline per block.
+static void progress_update(uint64_t done, uint64_t total, void* user) {
+    progress_ctx* pc = user;
+    double now = mono_now();
+    sdcloner_progress* c = &pc->cur;
+    c->bytes_done = done;
+    if (total) c->bytes_total = total;
+    c->elapsed_s = now - pc->t_phase;
+    if (now - pc->t_win >= PROGRESS_RATE_SEC) {
+        c->rate_mbps = (double)(done - pc->win_bytes) / (double)MB(1) / (now - pc->t_win);
+        pc->t_win = now;
+        pc->win_bytes = done;
+    }
+    if (c->elapsed_s > 0) c->avg_mbps = (double)done / (double)MB(1) / c->elapsed_s;
+    if (!c->rate_mbps) c->rate_mbps = c->avg_mbps;
+    c->eta_s = (c->bytes_total && c->avg_mbps > 0 && done <= c->bytes_total)
+             ? (double)(c->bytes_total - done) / (double)MB(1) / c->avg_mbps : -1;
+    bool last = c->bytes_total && done >= c->bytes_total;
+    if (pc->fn && (last || now - pc->t_emit >= PROGRESS_EMIT_SEC)) {
+        pc->t_emit = now;
+        pc->fn(c, pc->user);
+    }
+}
+
+// Read-back progress: switches the phase on its first report.
+static void progress_verify(uint64_t done, uint64_t total, void* user) {
+    progress_ctx* pc = user;
+    if (pc->cur.phase != SDCLONER_PHASE_VERIFY) progress_phase(pc, SDCLONER_PHASE_VERIFY, total);
+    progress_update(done, total, user);
+}
+
+// End of a public job: write its trace report, if one was asked for, to
+// ~/SDCloner/traces/<job>-<time>.json (+ .trace.json). Returns rc.
+static int job_done(progress_ctx* pc, int rc) {
+    if (!pc->trace) return rc;
+    trace_phase_end(pc);
+    char dir[256]; ensure_data_dir("traces", dir, sizeof(dir));
+    char summary[512], timeline[520];
+    timestamp_path(summary, sizeof(summary), dir, pc->trace_job, "json");
+    snprintf(timeline, sizeof(timeline), "%.*s.trace.json", (int)(strlen(summary) - 5), summary);
+    sdc_trace_write(pc->trace, rc, summary, timeline);
+    sdc_trace_free(pc->trace);
+    pc->trace = NULL;
+    return rc;
+}
+
+static void io_opts_for(const sdcloner_options* opt, sdc_stream_opts* o) {
+    if (!opt) return;
+    o->io_backend = opt->io == SDCLONER_IO_URING   ? SDC_AIO_URING
+                  : opt->io == SDCLONER_IO_THREADS ? SDC_AIO_THREADS
+                  : opt->io == SDCLONER_IO_SYNC    ? SDC_AIO_SYNC : SDC_AIO_AUTO;
+    if (opt->io_depth) o->io_depth = opt->io_depth;
+}
+
+// Pipeline settings for reading src_disk. With alloc_aware, free space found
+// in FAT tables / ext bitmaps goes into *map and is never read from the source.
+static void stream_opts_for(const char* src_disk, const sdcloner_options* opt, progress_ctx* pc,
+                            sdc_stream_opts* o, sdc_extent_list* map) {
+    sdc_stream_opts_default(o);
+    memset(map, 0, sizeof(*map));
+    if (pc && (pc->fn || pc->trace)) { o->progress = progress_update; o->progress_user = pc; }
+    if (pc) o->trace = pc->trace;
+    o->ctl = sdc_ctl_self();
+    io_opts_for(opt, o);
+    if (opt && opt->format == SDCLONER_FMT_SDIMG) o->format = SDC_FMT_SDIMG;
+    if (opt && opt->format == SDCLONER_FMT_STORE) o->format = SDC_FMT_STORE;
+    if (opt && opt->base_image) {
+        o->format = SDC_FMT_SDIMG;
+        o->base_image = opt->base_image;
+    }
+    if (!opt || !opt->alloc_aware) return;
+    int n = 0;
+    char** parts = list_partitions(src_disk, &n);
+    if (sdc_fsmap_build(parts, n, map) > 0 && map->n) {
+        o->unallocated = map;
+        sdc_logi("[FSMAP] %.2f GB of free space will be stored as zeros",
+                 (double)map->total / (double)GB(1));
+    }
+    for (int i = 0; i < n; i++) free(parts[i]);
+    free(parts);
+}
+
+static const char* archive_ext(const sdcloner_options* opt) {
+    if (opt && (opt->format == SDCLONER_FMT_SDIMG || opt->base_image)) return SDC_IMG_EXT;
+    if (opt && opt->format == SDCLONER_FMT_STORE) return SDC_REF_EXT;
+    return "img.gz";
+}
+
+// An interrupted image of this card left <image>.ckpt in dir; take the
+// newest whose checkpoint still matches the card. Returns true with the
+// image's path in out_path.
+static bool find_resumable(const char* dir, const char* ext, const char* src_disk, const char* id,
+                           const sdc_extent_list* map, char* out_path, size_t out_cap) {
+    DIR* d = opendir(dir);
+    if (!d) return false;
+    uint64_t src_size = get_blockdev_size_bytes(src_disk, SDCLONER_ERR_SOURCE);
+    char suffix[64], best[256] = "";
+    snprintf(suffix, sizeof(suffix), ".%s.%s", ext, SDC_CKPT_EXT);
+    struct dirent* e;
+    while ((e = readdir(d))) {
+        size_t n = strlen(e->d_name), m = strlen(suffix);
+        if (n <= m || strcmp(e->d_name + n - m, suffix) != 0 || strcmp(e->d_name, best) <= 0) continue;
+        char path[512]; snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+        sdc_checkpoint c;
+        if (sdc_checkpoint_load(path, &c) != 0) continue;
+        if (sdc_checkpoint_matches(&c, src_disk, src_size, id, map))
+            snprintf(best, sizeof(best), "%s", e->d_name);
+        sdc_checkpoint_free(&c);
+    }
+    closedir(d);
+    if (!*best) return false;
+    snprintf(out_path, out_cap, "%s/%.*s", dir, (int)(strlen(best) - strlen(SDC_CKPT_EXT) - 1), best);
+    return true;
 }
 
 // RAW image (bit-for-bit) → gzip
-static int make_raw_image_gz(const char* src_disk, char* out_path, size_t out_cap) {
+// Streams in-process: reader → compressor pool → writer over bounded queues.
+// Output is multi-member gzip (one member per block), readable by gzip -dc,
+// or an .sdimg with format = SDCLONER_FMT_SDIMG.
+static int make_raw_image_gz(const char* src_disk, const sdcloner_options* opt, progress_ctx* pc,
+                             char* out_path, size_t out_cap) {
     char dir[256]; ensure_image_dir(dir, sizeof(dir));
-    timestamp_path(out_path, out_cap, dir, "img.gz");
-    char cmd[1024];
-    snprintf(cmd,sizeof(cmd),
-       "sudo dd if='%s' bs=4M status=progress | gzip > '%s'", src_disk, out_path);
-    int rc = run_cmd(cmd);
+    sdc_stream_opts o; sdc_extent_list map;
+    stream_opts_for(src_disk, opt, pc, &o, &map);
+    // Checkpoints let an image cut short by a reader reset continue later.
+    char id[SDC_CKPT_ID_LEN] = "", ckpt[600];
+    bool checkpoints = opt && opt->checkpoint_mb && o.format != SDC_FMT_STORE;
+    if (checkpoints && sdc_probe_card_id(src_disk, id, sizeof(id)) != 0) *id = '\0';
+    if (!checkpoints || !find_resumable(dir, archive_ext(opt), src_disk, id, o.unallocated, out_path, out_cap))
+        timestamp_path(out_path, out_cap, dir, "clone", archive_ext(opt));
+    if (checkpoints) {
+        snprintf(ckpt, sizeof(ckpt), "%s.%s", out_path, SDC_CKPT_EXT);
+        o.checkpoint = ckpt;
+        o.checkpoint_every = MB(opt->checkpoint_mb);
+        o.resume = true;
+        o.source_id = id;
+    }
+    progress_phase(pc, SDCLONER_PHASE_IMAGE, 0);
+    sdc_logi("[STREAM] %s -> %s (bs=%zuK, depth=%u, direct=%d, io=%s/%u)",
+             src_disk, out_path, o.block_size / 1024, o.queue_depth, (int)o.direct_io,
+             sdc_aio_name(o.io_backend), o.io_depth);
+    int rc = sdc_stream_image(src_disk, out_path, &o) == 0 ? 0 : 1;
+    sdc_extents_free(&map);
+    if (rc != 0) drop_reserved(out_path, checkpoints ? SDC_CKPT_EXT : NULL);
     return rc;
 }
 
 // Filesystem-aware image that fits within target_bytes.
-// Minimal implementation: single-partition FAT32 and rsync of first partition.
-// Extend to mirror multiple partitions as needed for your device layout.
-static int make_fsaware_image_fit(const char* src_disk, uint64_t target_bytes,
+// Mirrors every source partition (same table, types and filesystems) into a
+// tightly sized sparse .img; see sdcloner_shrink.c.
+static int make_fsaware_image_fit(const char* src_disk, uint64_t target_bytes, progress_ctx* pc,
                                   char* out_path, size_t out_cap) {
-    int n=0; char** parts = list_partitions(src_disk,&n);
-    if (n==0) { if (parts) free(parts); die("No partitions found on %s", src_disk); }
+    progress_phase(pc, SDCLONER_PHASE_SHRINK, 0);
+    char dir[256]; ensure_image_dir(dir, sizeof(dir));
+    timestamp_path(out_path, out_cap, dir, "clone", "img"); // uncompressed file
+    sdc_logi("[SHRINK] %s -> %s (limit %.2f GB)", src_disk, out_path,
+             (double)target_bytes / (double)GB(1));
+    if (sdc_shrink_image(src_disk, target_bytes, out_path) != 0) {
+        drop_reserved(out_path, NULL);
+        return 1;
+    }
 
-    uint64_t used = compute_used_bytes_sum(src_disk);
-    uint64_t need = used + SAFETY_MARGIN_BYTES;
-    if (need > target_bytes) {
-        for (int i=0;i<n;i++) { free(parts[i]); }
-        free(parts);
-        die("Destination capacity too small: need ~%lu MB, have ~%lu MB",
-            (unsigned long)(need/1024/1024), (unsigned long)(target_bytes/1024/1024));
+    uint64_t punched = 0;
+    if (sdc_punch_zero_holes(out_path, &punched) == 0 && punched)
+        sdc_logi("Sparse image: released %.2f MB of zero blocks",
+                 (double)punched / (double)MB(1));
+    return 0;
+}
+
+// Unmount any mounted partitions of a destination disk
+static void unmount_disk_partitions(const char* disk) {
+    int n = 0;
+    char** parts = list_partitions(disk, &n);
+    for (int i = 0; i < n; i++) {
+        char* mps[16];
+        int m = sdc_probe_mountpoints(parts[i], mps, 16);
+        // Unmount in reverse so nested mounts go before their parents.
+        while (m-- > 0) {
+            char um[512]; snprintf(um,sizeof(um),"sudo umount '%s' 2>/dev/null", mps[m]);
+            sdc_run_cmd(um);
+            free(mps[m]);
+        }
+        free(parts[i]);
     }
+    free(parts);
+}
 
-    char dir[256]; ensure_image_dir(dir, sizeof(dir));
-    timestamp_path(out_path, out_cap, dir, "img"); // uncompressed file
-    char falloc[512]; snprintf(falloc,sizeof(falloc),
-        "truncate -s %lu '%s'", (unsigned long)target_bytes, out_path);
-    if (run_cmd(falloc)!=0) die("Failed to create image file");
-
-    // Create loop device for image
-    char* loop = run_cmd_capture("sudo losetup -f");
-    if (!loop) die("losetup -f failed");
-    char* nl = strchr(loop,'\n'); if (nl) *nl = '\0';
-    char set[512]; snprintf(set,sizeof(set), "sudo losetup -P '%s' '%s'", loop, out_path);
-    if (run_cmd(set)!=0) { free(loop); die("losetup -P failed"); }
-
-    // Create msdos label and a single FAT32 partition filling the image.
-    char mklabel[512]; snprintf(mklabel,sizeof(mklabel),
-        "sudo parted -s '%s' mklabel msdos", loop);
-    if (run_cmd(mklabel)!=0) { free(loop); die("parted mklabel failed"); }
-
-    char mkpart[512]; snprintf(mkpart,sizeof(mkpart),
-        "sudo parted -s '%s' mkpart primary fat32 1MiB 100%%", loop);
-    if (run_cmd(mkpart)!=0) { free(loop); die("parted mkpart failed"); }
-
-    // Get loop p1 node
-    char *loop_p1 = NULL;
-    {
-        char q[512]; snprintf(q,sizeof(q),"ls '%sp1' 2>/dev/null", loop);
-        loop_p1 = run_cmd_capture(q);
-        if (loop_p1) { nl = strchr(loop_p1,'\n'); if (nl) *nl = '\0'; }
-        if (!loop_p1 || !*loop_p1) { free(loop); die("Could not find loop partition node"); }
-    }
-
-    // Format target partition FAT32
-    char mkfs[512]; snprintf(mkfs,sizeof(mkfs),"sudo mkfs.vfat -F32 -n CLONE '%s'", loop_p1);
-    if (run_cmd(mkfs)!=0) { free(loop_p1); free(loop); die("mkfs target failed"); }
-
-    // Mount RO source (first partition) and RW image, then rsync
-    char msrc[64], mtgt[64];
-    snprintf(msrc,sizeof(msrc),"/mnt/sdcloner_src");
-    snprintf(mtgt,sizeof(mtgt),"/mnt/sdcloner_img");
-    run_cmd("sudo mkdir -p /mnt/sdcloner_src /mnt/sdcloner_img");
-
-    int srcn=0; char** sp = list_partitions(src_disk, &srcn);
-    if (srcn==0) { free(loop_p1); free(loop); die("No source partitions"); }
-    char m1[512]; snprintf(m1,sizeof(m1),"sudo mount -o ro '%s' '%s'", sp[0], msrc);
-    if (run_cmd(m1)!=0) { free(loop_p1); free(loop); die("mount source failed"); }
-
-    char m2[512]; snprintf(m2,sizeof(m2),"sudo mount '%s' '%s'", loop_p1, mtgt);
-    if (run_cmd(m2)!=0) {
-        run_cmd("sudo umount /mnt/sdcloner_src");
-        free(loop_p1); free(loop); die("mount target failed");
-    }
-
-    int rc = run_cmd("sudo rsync -aHAX --numeric-ids /mnt/sdcloner_src/ /mnt/sdcloner_img/");
-    run_cmd("sync");
-    run_cmd("sudo umount /mnt/sdcloner_img");
-    run_cmd("sudo umount /mnt/sdcloner_src");
-
-    for (int i=0;i<srcn;i++) { free(sp[i]); }
-    free(sp);
-
-    // Detach loop
-    char dt[512]; snprintf(dt,sizeof(dt),"sudo losetup -d '%s'", loop);
-    run_cmd(dt);
-    free(loop_p1);
-    free(loop);
+static bool same_device(const char* a, const char* b) {
+    struct stat sa, sb;
+    if (stat(a, &sa) != 0 || stat(b, &sb) != 0) return false;
+    if (S_ISBLK(sa.st_mode) && S_ISBLK(sb.st_mode)) return sa.st_rdev == sb.st_rdev;
+    return sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+}
+
+// Direct device → device raw clone in one pass.
+// If keep_archive, a compressed copy is written to ~/SDCloner/images as well.
+static int clone_direct(const char* src_disk, const char* dest_disk, int keep_archive,
+                        const sdcloner_options* opt, progress_ctx* pc) {
+    if (same_device(src_disk, dest_disk)) {
+        sdc_fail(SDCLONER_ERR_INVALID, "Source and destination are the same device (%s)", src_disk);
+        return 1;
+    }
+    unmount_disk_partitions(dest_disk);
+
+    char outpath[512];
+    const char* archive = NULL;
+    if (keep_archive) {
+        char dir[256]; ensure_image_dir(dir, sizeof(dir));
+        timestamp_path(outpath, sizeof(outpath), dir, "clone", archive_ext(opt));
+        archive = outpath;
+    }
+    sdc_stream_opts o; sdc_extent_list map;
+    stream_opts_for(src_disk, opt, pc, &o, &map);
+    progress_phase(pc, SDCLONER_PHASE_CLONE, 0);
+    sdc_logi("[CLONE] %s -> %s%s%s", src_disk, dest_disk,
+             archive ? " + archive " : "", archive ? archive : "");
+    int rc = sdc_clone_stream(src_disk, dest_disk, archive, &o) == 0 ? 0 : 1;
+    sdc_extents_free(&map);
+    if (rc != 0 && archive) drop_reserved(archive, NULL);
+    if (rc == 0 && archive) sdc_logi("Archive copy: %s", archive);
     return rc;
 }
 
-// Burn raw .img.gz or .img to destination
+int sdcloner_clone_direct(const char* src_disk, const char* dest_disk, int keep_archive) {
+    progress_ctx pc; progress_init(&pc, NULL, NULL);
+    return clone_direct(src_disk, dest_disk, keep_archive, NULL, &pc);
+}
+
+// Burn an image to destination; the format is detected from its magic bytes
+// and decoded in-process (sdcloner_decode.c).
+static void burn_opts_for(const sdcloner_options* opt, progress_ctx* pc, sdc_stream_opts* o) {
+    sdcloner_options def;
+    if (!opt) { sdcloner_options_init(&def); opt = &def; }
+    sdc_stream_opts_default(o);
+    if (pc->fn || pc->trace) {
+        o->progress = progress_update;
+        o->verify_progress = progress_verify;
+        o->progress_user = pc;
+    }
+    o->trace = pc->trace;
+    o->ctl = sdc_ctl_self();
+    o->verify = opt->verify == SDCLONER_VERIFY_FULL    ? SDC_VERIFY_FULL
+              : opt->verify == SDCLONER_VERIFY_SAMPLED ? SDC_VERIFY_SAMPLED : SDC_VERIFY_SKIP;
+    if (opt->verify_sample_pct) o->verify_sample_pct = opt->verify_sample_pct;
+    o->diff = opt->diff_burn != 0;
+    o->zero_offload = opt->zero_discard != 0;
+    io_opts_for(opt, o);
+}
+
+// Differential burns: ~/SDCloner/manifests/<card id>.sdman per destination,
+// NULL where the card has no stable identity (read-compare only). Returns
+// NULL unless opt asks for a differential burn.
+static char** manifest_paths(const sdcloner_options* opt, const char* const* devs, int n) {
+    if (!opt || !opt->diff_burn) return NULL;
+    char** paths = calloc((size_t)n, sizeof(char*));
+    if (!paths) return NULL;
+    char dir[256]; ensure_data_dir("manifests", dir, sizeof(dir));
+    for (int i = 0; i < n; i++) {
+        char id[128];
+        if (sdc_probe_card_id(devs[i], id, sizeof(id)) != 0) {
+            sdc_logi("[DIFF] %s: no card ID, blocks are compared by reading", devs[i]);
+            continue;
+        }
+        size_t cap = strlen(dir) + strlen(id) + 8;
+        paths[i] = malloc(cap);
+        if (paths[i]) snprintf(paths[i], cap, "%s/%s.sdman", dir, id);
+    }
+    return paths;
+}
+
+static void free_paths(char** paths, int n) {
+    for (int i = 0; paths && i < n; i++) free(paths[i]);
+    free(paths);
+}
+
+// Bad-range map left by a rescue beside image_path, if any (empty otherwise).
+static void load_badmap(const char* image_path, sdc_extent_list* bad) {
+    char path[600]; snprintf(path, sizeof(path), "%s.%s", image_path, SDC_BADMAP_EXT);
+    uint64_t size;
+    if (sdc_badmap_load(path, bad, &size) != 0) return;
+    sdc_logi("[RESCUE] %s: %.1f KB in %zu range(s) could not be read from the original card;"
+             " they are written as zeros and always verified", image_path,
+             (double)bad->total / 1024.0, bad->n);
+}
+
+static int burn_image(const char* image_path, const char* dest_disk, const sdcloner_options* opt,
+                      progress_ctx* pc) {
+    if (same_device(image_path, dest_disk)) {
+        sdc_fail(SDCLONER_ERR_INVALID, "Image and destination are the same file (%s)", image_path);
+        return 1;
+    }
+    unmount_disk_partitions(dest_disk);
+    sdc_stream_opts o;
+    burn_opts_for(opt, pc, &o);
+    char** manifests = manifest_paths(opt, &dest_disk, 1);
+    o.manifests = (const char* const*)manifests;
+    sdc_extent_list bad; load_badmap(image_path, &bad);
+    o.bad = &bad;
+    progress_phase(pc, SDCLONER_PHASE_BURN, 0);
+    sdc_logi("[BURN] %s -> %s", image_path, dest_disk);
+    int result = -1;
+    sdc_burn_fanout(image_path, &dest_disk, 1, &o, &result);
+    free_paths(manifests, 1);
+    sdc_extents_free(&bad);
+    return result == 0 ? 0 : result == -2 ? 2 : result == -3 ? 3 : 1;
+}
+
 int burn_image_to_disk(const char* image_path, const char* dest_disk) {
-    // Unmount any partitions
-    char um[512]; snprintf(um,sizeof(um),
-        "lsblk -rno MOUNTPOINT '%s' | tail -n+2 | xargs -r -n1 sudo umount 2>/dev/null", dest_disk);
-    run_cmd(um);
+    return burn_image_to_disk_ex(image_path, dest_disk, NULL);
+}
+
+int burn_image_to_disk_ex(const char* image_path, const char* dest_disk,
+                          const sdcloner_options* opt) {
+    progress_ctx pc; progress_init(&pc, opt, "burn");
+    int rc = burn_image(image_path, dest_disk, opt, &pc);
+    if (rc == 0) progress_phase(&pc, SDCLONER_PHASE_DONE, 0);
+    return job_done(&pc, rc);
+}
+
+int sdcloner_burn_multi(const char* image_path, const char* const* dest_disks, int ndest,
+                        const sdcloner_options* opt, int* results) {
+    if (ndest <= 0) return 1;
+    const char** ok_devs = calloc((size_t)ndest, sizeof(char*));
+    int* ok_idx = calloc((size_t)ndest, sizeof(int));
+    int* ok_rc = calloc((size_t)ndest, sizeof(int));
+    if (!ok_devs || !ok_idx || !ok_rc) {
+        free(ok_devs); free(ok_idx); free(ok_rc);
+        return 1;
+    }
+    int n = 0;
+    for (int i = 0; i < ndest; i++) {
+        results[i] = 1;
+        if (same_device(image_path, dest_disks[i])) {
+            sdc_fail(SDCLONER_ERR_INVALID, "Image and destination are the same file (%s)", image_path);
+            continue;
+        }
+        bool dup = false;
+        for (int j = 0; j < n && !dup; j++) dup = same_device(ok_devs[j], dest_disks[i]);
+        if (dup) { sdc_loge("%s listed twice, skipped", dest_disks[i]); continue; }
+        unmount_disk_partitions(dest_disks[i]);
+        ok_idx[n] = i;
+        ok_devs[n++] = dest_disks[i];
+    }
+
+    progress_ctx pc; progress_init(&pc, opt, "burn");
+    sdc_stream_opts o;
+    burn_opts_for(opt, &pc, &o);
+    char** manifests = manifest_paths(opt, ok_devs, n);
+    o.manifests = (const char* const*)manifests;
+    sdc_extent_list bad; load_badmap(image_path, &bad);
+    o.bad = &bad;
+    progress_phase(&pc, SDCLONER_PHASE_BURN, 0);
+    sdc_logi("[BURN] %s -> %d destination(s)", image_path, n);
+    if (n) sdc_burn_fanout(image_path, ok_devs, n, &o, ok_rc);
+    free_paths(manifests, n);
+    sdc_extents_free(&bad);
+
+    int failed = ndest - n;
+    for (int k = 0; k < n; k++) {
+        results[ok_idx[k]] = ok_rc[k] == 0 ? 0 : ok_rc[k] == -2 ? 2 : ok_rc[k] == -3 ? 3 : 1;
+        if (ok_rc[k] != 0) failed++;
+    }
+    for (int i = 0; i < ndest; i++)
+        sdc_logi("[BURN] %s: %s", dest_disks[i],
+                 results[i] == 0 ? "OK" : results[i] == 2 ? "VERIFY FAILED" :
+                 results[i] == 3 ? "CANCELLED" : "FAILED");
+    free(ok_devs); free(ok_idx); free(ok_rc);
+    if (failed == 0) progress_phase(&pc, SDCLONER_PHASE_DONE, 0);
+    return job_done(&pc, failed ? 1 : 0);
+}
 
-    const char* gz = strstr(image_path,".gz") ? "gzip -dc" : "cat";
-    char cmd[1024];
-    snprintf(cmd,sizeof(cmd),
-        "%s '%s' | sudo dd of='%s' bs=4M status=progress conv=fsync",
-        gz, image_path, dest_disk);
-    return run_cmd(cmd);
+static bool has_suffix(const char* s, const char* suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+int sdcloner_convert_image(const char* in_path, const char* out_path, const sdcloner_options* opt) {
+    if (same_device(in_path, out_path)) {
+        sdc_fail(SDCLONER_ERR_INVALID, "Input and output are the same file (%s)", in_path);
+        return 1;
+    }
+    progress_ctx pc; progress_init(&pc, opt, "convert");
+    sdc_stream_opts o;
+    sdc_stream_opts_default(&o);
+    o.image_source = true;
+    o.direct_io = false;
+    if (pc.fn || pc.trace) { o.progress = progress_update; o.progress_user = &pc; }
+    o.trace = pc.trace;
+    o.ctl = sdc_ctl_self();
+    if (has_suffix(out_path, "." SDC_IMG_EXT)) o.format = SDC_FMT_SDIMG;
+    else if (has_suffix(out_path, "." SDC_REF_EXT)) o.format = SDC_FMT_STORE;
+    else if (!has_suffix(out_path, ".gz")) o.gzip_level = -1;   // raw, sparse .img
+    progress_phase(&pc, SDCLONER_PHASE_IMAGE, 0);
+    sdc_logi("[CONVERT] %s -> %s", in_path, out_path);
+    if (sdc_stream_image(in_path, out_path, &o) != 0) {
+        unlink(out_path);
+        return job_done(&pc, 1);
+    }
+    // A rescued image's bad-range map describes the converted one as well.
+    char map_in[600], map_out[600];
+    snprintf(map_in, sizeof(map_in), "%s.%s", in_path, SDC_BADMAP_EXT);
+    snprintf(map_out, sizeof(map_out), "%s.%s", out_path, SDC_BADMAP_EXT);
+    sdc_extent_list bad; uint64_t bad_size;
+    if (sdc_badmap_load(map_in, &bad, &bad_size) == 0) {
+        sdc_badmap_save(map_out, &bad, bad_size);
+        sdc_extents_free(&bad);
+    }
+    progress_phase(&pc, SDCLONER_PHASE_DONE, 0);
+    return job_done(&pc, 0);
+}
+
+int sdcloner_rescue(const char* src_disk, const char* image_path, const sdcloner_options* opt) {
+    progress_ctx pc; progress_init(&pc, opt, "rescue");
+    char out[512], map[600];
+    if (image_path) {
+        snprintf(out, sizeof(out), "%s", image_path);
+    } else {
+        char dir[256]; ensure_image_dir(dir, sizeof(dir));
+        timestamp_path(out, sizeof(out), dir, "rescue", "img");
+    }
+    snprintf(map, sizeof(map), "%s.%s", out, SDC_BADMAP_EXT);
+    sdc_rescue_opts o; sdc_rescue_opts_default(&o);
+    if (pc.fn || pc.trace) { o.progress = progress_update; o.progress_user = &pc; }
+    o.trace = pc.trace;
+    o.ctl = sdc_ctl_self();
+    progress_phase(&pc, SDCLONER_PHASE_IMAGE, 0);
+    sdc_logi("[RESCUE] %s -> %s", src_disk, out);
+    sdc_rescue_stats st;
+    if (sdc_rescue_image(src_disk, out, map, &o, &st) != 0) {
+        if (!image_path) drop_reserved(out, SDC_BADMAP_EXT);
+        if (access(map, F_OK) == 0) sdc_logi("[RESCUE] incomplete; run again with %s to continue", out);
+        return job_done(&pc, 1);
+    }
+    if (st.ranges)
+        sdc_logi("[RESCUE] %s: %.1f KB unreadable in %zu range(s), listed in %s", out,
+                 (double)st.bad / 1024.0, st.ranges, map);
+    else
+        sdc_logi("[RESCUE] %s: every sector was read", out);
+    progress_phase(&pc, SDCLONER_PHASE_DONE, 0);
+    return job_done(&pc, st.ranges ? 2 : 0);
+}
+
+int sdcloner_store_gc(uint64_t* freed) {
+    char dir[256]; ensure_image_dir(dir, sizeof(dir));
+    return sdc_store_gc(dir, freed) == 0 ? 0 : 1;
 }
 
 // High-level: decide and act
@@ -314,51 +781,163 @@ int burn_image_to_disk(const char* image_path, const char* dest_disk) {
 // If dest_disk provided → choose raw vs fs-aware based on capacity vs used.
 int sdcloner_clone(const char* src_disk, const char* dest_disk,
                    uint64_t dest_capacity_hint /* 0 if unknown */) {
-    if (!src_disk || access(src_disk, R_OK)!=0) die("Source %s not readable", src_disk);
+    return sdcloner_clone_ex(src_disk, dest_disk, dest_capacity_hint, NULL);
+}
 
-    uint64_t src_bytes = get_blockdev_size_bytes(src_disk);
-    logi("Source size: %.2f GB", (double)src_bytes/ (double)GB(1));
+int sdcloner_clone_ex(const char* src_disk, const char* dest_disk,
+                      uint64_t dest_capacity_hint, const sdcloner_options* opt) {
+    if (!src_disk || access(src_disk, R_OK)!=0) {
+        sdc_fail(SDCLONER_ERR_SOURCE, "Source %s not readable", src_disk ? src_disk : "(none)");
+        return 1;
+    }
+    uint64_t src_bytes = get_blockdev_size_bytes(src_disk, SDCLONER_ERR_SOURCE);
+    if (!src_bytes) return 1;
+    progress_ctx pc; progress_init(&pc, opt, "clone");
+    progress_phase(&pc, SDCLONER_PHASE_PREPARE, 0);
+
+    sdc_logi("Source size: %.2f GB", (double)src_bytes/ (double)GB(1));
     uint64_t used = compute_used_bytes_sum(src_disk);
-    logi("Estimated used data: %.2f GB", (double)used/(double)GB(1));
+    sdc_logi("Estimated used data: %.2f GB", (double)used/(double)GB(1));
 
     char outpath[512];
 
     if (!dest_disk || !*dest_disk) {
         // Save image locally
-        logi("No destination present → creating local image");
+        sdc_logi("No destination present → creating local image");
         if (dest_capacity_hint && dest_capacity_hint < src_bytes) {
-            if (used + SAFETY_MARGIN_BYTES <= dest_capacity_hint) {
-                logi("Making FS-aware image to fit within %.2f GB", (double)dest_capacity_hint/(double)GB(1));
-                return make_fsaware_image_fit(src_disk, dest_capacity_hint, outpath, sizeof(outpath));
+            // Quick reject only; the shrink computes the exact layout size.
+            if (used <= dest_capacity_hint) {
+                sdc_logi("Making FS-aware image to fit within %.2f GB", (double)dest_capacity_hint/(double)GB(1));
+                int rc = make_fsaware_image_fit(src_disk, dest_capacity_hint, &pc, outpath, sizeof(outpath));
+                if (rc == 0) progress_phase(&pc, SDCLONER_PHASE_DONE, 0);
+                return job_done(&pc, rc);
             } else {
-                die("Future destination too small (need ~%.2f GB incl. margin)",
-                    (double)(used+SAFETY_MARGIN_BYTES)/(double)GB(1));
+                sdc_fail(SDCLONER_ERR_SPACE, "Future destination too small (need > %.2f GB)",
+                         (double)used/(double)GB(1));
+                return job_done(&pc, 1);
             }
         }
-        int rc = make_raw_image_gz(src_disk, outpath, sizeof(outpath));
-        if (rc==0) logi("Image ready: %s", outpath);
-        return rc;
+        int rc = make_raw_image_gz(src_disk, opt, &pc, outpath, sizeof(outpath));
+        if (rc==0) { sdc_logi("Image ready: %s", outpath); progress_phase(&pc, SDCLONER_PHASE_DONE, 0); }
+        return job_done(&pc, rc);
     } else {
         // Destination provided: check size
-        uint64_t dst_bytes = get_blockdev_size_bytes(dest_disk);
-        logi("Destination size: %.2f GB", (double)dst_bytes/(double)GB(1));
+        uint64_t dst_bytes = get_blockdev_size_bytes(dest_disk, SDCLONER_ERR_DEST);
+        if (!dst_bytes) return job_done(&pc, 1);
+        sdc_logi("Destination size: %.2f GB", (double)dst_bytes/(double)GB(1));
 
         if (dst_bytes >= src_bytes) {
-            logi("Destination >= source → raw clone (image+burn)");
-            int rc1 = make_raw_image_gz(src_disk, outpath, sizeof(outpath));
-            if (rc1!=0) return rc1;
-            logi("Raw image created: %s", outpath);
-            return burn_image_to_disk(outpath, dest_disk);
+            sdc_logi("Destination >= source → direct raw clone (archive tee)");
+            int rc = clone_direct(src_disk, dest_disk, opt ? opt->keep_archive : 1, opt, &pc);
+            if (rc == 0) progress_phase(&pc, SDCLONER_PHASE_DONE, 0);
+            return job_done(&pc, rc);
         } else {
-            if (used + SAFETY_MARGIN_BYTES > dst_bytes) {
-                die("Destination smaller than used data + margin (need ~%.2f GB)",
-                    (double)(used+SAFETY_MARGIN_BYTES)/(double)GB(1));
+            if (used > dst_bytes) {
+                sdc_fail(SDCLONER_ERR_SPACE, "Destination smaller than used data (need > %.2f GB)",
+                         (double)used/(double)GB(1));
+                return job_done(&pc, 1);
             }
-            logi("Destination smaller, but used fits → FS-aware image");
-            int rc2 = make_fsaware_image_fit(src_disk, dst_bytes, outpath, sizeof(outpath));
-            if (rc2!=0) return rc2;
-            logi("FS-aware image created: %s", outpath);
-            return burn_image_to_disk(outpath, dest_disk);
+            sdc_logi("Destination smaller, but used fits → FS-aware image");
+            int rc2 = make_fsaware_image_fit(src_disk, dst_bytes, &pc, outpath, sizeof(outpath));
+            if (rc2!=0) return job_done(&pc, rc2);
+            sdc_logi("FS-aware image created: %s", outpath);
+            rc2 = burn_image(outpath, dest_disk, opt, &pc);
+            if (rc2 == 0) progress_phase(&pc, SDCLONER_PHASE_DONE, 0);
+            return job_done(&pc, rc2);
         }
     }
 }
+
+// ---------- Job contexts ----------
+struct sdcloner_ctx {
+    sdcloner_options opt;
+    job_err          err;
+};
+
+sdcloner_ctx* sdcloner_ctx_new(const sdcloner_options* opt) {
+    sdcloner_ctx* c = calloc(1, sizeof(*c));
+    if (!c) return NULL;
+    if (opt) c->opt = *opt; else sdcloner_options_init(&c->opt);
+    pthread_mutex_init(&c->err.mu, NULL);
+    return c;
+}
+
+void sdcloner_ctx_free(sdcloner_ctx* c) {
+    if (!c) return;
+    pthread_mutex_destroy(&c->err.mu);
+    free(c);
+}
+
+const sdcloner_error* sdcloner_ctx_error(const sdcloner_ctx* c) {
+    return &c->err.e;
+}
+
+const char* sdcloner_errcode_name(sdcloner_errcode code) {
+    switch (code) {
+    case SDCLONER_ERR_NONE:      return "no error";
+    case SDCLONER_ERR_INVALID:   return "invalid request";
+    case SDCLONER_ERR_SOURCE:    return "source unavailable";
+    case SDCLONER_ERR_DEST:      return "destination unavailable";
+    case SDCLONER_ERR_SPACE:     return "destination too small";
+    case SDCLONER_ERR_VERIFY:    return "verification failed";
+    case SDCLONER_ERR_PARTIAL:   return "partially recovered";
+    case SDCLONER_ERR_CANCELLED: return "cancelled";
+    case SDCLONER_ERR_FAILED:    return "failed";
+    }
+    return "?";
+}
+
+// Errors logged on this thread (and threads it starts) go to c until
+// ctx_end(), which classifies rc: 2 means code2 (verify / partial).
+static job_err* ctx_begin(sdcloner_ctx* c) {
+    memset(&c->err.e, 0, sizeof(c->err.e));
+    c->err.classified = false;
+    job_err* prev = err_self;
+    err_self = &c->err;
+    return prev;
+}
+
+static int ctx_end(sdcloner_ctx* c, job_err* prev, int rc, sdcloner_errcode code2) {
+    err_self = prev;
+    sdcloner_error* e = &c->err.e;
+    if (rc == 0) {
+        memset(e, 0, sizeof(*e));
+    } else if (sdc_ctl_cancelled(sdc_ctl_self())) {
+        e->code = SDCLONER_ERR_CANCELLED;
+    } else if (!c->err.classified) {
+        e->code = rc == 2 ? code2 : SDCLONER_ERR_FAILED;
+    }
+    if (rc != 0 && !e->message[0])
+        snprintf(e->message, sizeof(e->message), "%s", sdcloner_errcode_name(e->code));
+    return rc;
+}
+
+int sdcloner_ctx_clone(sdcloner_ctx* c, const char* src_disk, const char* dest_disk,
+                       uint64_t dest_capacity_hint) {
+    job_err* prev = ctx_begin(c);
+    int rc = sdcloner_clone_ex(src_disk, dest_disk, dest_capacity_hint, &c->opt);
+    return ctx_end(c, prev, rc, SDCLONER_ERR_VERIFY);
+}
+
+int sdcloner_ctx_burn(sdcloner_ctx* c, const char* image_path, const char* const* dest_disks,
+                      int ndest, int* results) {
+    job_err* prev = ctx_begin(c);
+    int rc = sdcloner_burn_multi(image_path, dest_disks, ndest, &c->opt, results);
+    // Only bad read-backs: report as a verify failure.
+    bool verify = rc != 0 && ndest > 0;
+    for (int i = 0; verify && i < ndest; i++) verify = results[i] == 0 || results[i] == 2;
+    ctx_end(c, prev, verify ? 2 : rc, SDCLONER_ERR_VERIFY);
+    return rc;
+}
+
+int sdcloner_ctx_convert(sdcloner_ctx* c, const char* in_path, const char* out_path) {
+    job_err* prev = ctx_begin(c);
+    int rc = sdcloner_convert_image(in_path, out_path, &c->opt);
+    return ctx_end(c, prev, rc, SDCLONER_ERR_FAILED);
+}
+
+int sdcloner_ctx_rescue(sdcloner_ctx* c, const char* src_disk, const char* image_path) {
+    job_err* prev = ctx_begin(c);
+    int rc = sdcloner_rescue(src_disk, image_path, &c->opt);
+    return ctx_end(c, prev, rc, SDCLONER_ERR_PARTIAL);
+}
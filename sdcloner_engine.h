@@ -4,11 +4,135 @@
 
 #pragma once
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Whole-disk block device as seen in sysfs.
+typedef struct {
+    char     path[64];        // e.g. "/dev/sdd"
+    uint64_t size_bytes;
+    char     model[64];       // vendor + model, may be empty
+    int      removable;       // sysfs "removable"
+    int      readonly;        // sysfs "ro"
+} sdcloner_device;
+
+// Partition of a disk (or of a partitioned image file).
+typedef struct {
+    char     path[64];        // e.g. "/dev/sdd2"
+    int      index;           // partition number
+    uint64_t start_bytes;
+    uint64_t size_bytes;
+    char     fstype[16];      // "ext4", "vfat", "exfat", ... or "" if unknown
+    char     mountpoint[256]; // first mountpoint, "" if not mounted
+} sdcloner_partition;
+
+// Enumerate whole disks (no loop/ram/dm/md/optical). *out is malloc'd;
+// caller frees it. Returns 0 on success, -1 on failure.
+int sdcloner_list_devices(sdcloner_device** out, int* count);
+
+// Hotplug watch: fn receives the device list (as sdcloner_list_devices())
+// once right away and again whenever it changes, e.g. a card inserted into
+// a reader or a reader unplugged. It runs on a watcher thread, driven by
+// kernel uevents over netlink, or inotify on /dev where those are not
+// available; bursts of events are coalesced into one rescan. devs is only
+// valid during the call. Returns NULL if neither source can be set up.
+typedef void (*sdcloner_devices_fn)(const sdcloner_device* devs, int count, void* user);
+typedef struct sdcloner_device_watch sdcloner_device_watch;
+sdcloner_device_watch* sdcloner_watch_devices(sdcloner_devices_fn fn, void* user);
+// Stop the watcher; fn is not called again once this returns.
+void sdcloner_unwatch_devices(sdcloner_device_watch* w);
+
+// Enumerate partitions of disk from sysfs, or from its MBR/GPT when disk is
+// an image file. *out is malloc'd; caller frees it. Returns 0 / -1.
+int sdcloner_list_partitions(const char* disk, sdcloner_partition** out, int* count);
+
+// Stage of a running operation, as reported to the progress callback.
+typedef enum {
+    SDCLONER_PHASE_PREPARE = 0,  // sizing, used-space scan
+    SDCLONER_PHASE_IMAGE,        // source → image file
+    SDCLONER_PHASE_CLONE,        // source → destination (direct raw clone)
+    SDCLONER_PHASE_SHRINK,       // building an FS-aware image (no byte count)
+    SDCLONER_PHASE_BURN,         // image → destination
+    SDCLONER_PHASE_VERIFY,       // destination read-back compared with the image
+    SDCLONER_PHASE_DONE
+} sdcloner_phase;
+
+typedef struct {
+    sdcloner_phase phase;
+    uint64_t bytes_done;     // within the current phase
+    uint64_t bytes_total;    // 0 if unknown; estimated while burning a compressed image
+    double   rate_mbps;      // recent throughput (MiB/s, ~1 s window)
+    double   avg_mbps;       // average since the phase started
+    double   elapsed_s;      // since the phase started
+    double   eta_s;          // seconds left, -1 if unknown
+} sdcloner_progress;
+
+// Called from an engine thread, at most every ~200 ms plus on each phase
+// change. Must not block; copy what it needs and return.
+typedef void (*sdcloner_progress_fn)(const sdcloner_progress* p, void* user);
+
+const char* sdcloner_phase_name(sdcloner_phase phase);
+
+// Container for images written to ~/SDCloner/images.
+typedef enum {
+    SDCLONER_FMT_GZ = 0,   // .img.gz, multi-member gzip (readable by gzip -dc)
+    SDCLONER_FMT_SDIMG,    // .sdimg, seekable chunks + trailing index (random access)
+    SDCLONER_FMT_STORE,    // .sdref recipe; data deduplicated into ~/SDCloner/images/.chunks
+} sdcloner_format;
+
+// Read-back check after burning.
+typedef enum {
+    SDCLONER_VERIFY_SKIP = 0,
+    SDCLONER_VERIFY_SAMPLED,   // first and last block plus a random share of the rest
+    SDCLONER_VERIFY_FULL,      // every block
+} sdcloner_verify;
+
+// How device reads (imaging, cloning) and card writes (burning) are issued.
+typedef enum {
+    SDCLONER_IO_AUTO = 0,   // io_uring if the kernel allows it, else I/O threads
+    SDCLONER_IO_URING,      // io_uring only; fail if unavailable
+    SDCLONER_IO_THREADS,    // pread/pwrite on a small thread pool
+    SDCLONER_IO_SYNC,       // one request at a time
+} sdcloner_io;
+
+// Instrumentation written when a job ends: <job>-<time>.json holds wall / CPU
+// time and throughput per phase and pipeline stage, a device I/O latency
+// histogram and queue stall counts; TIMELINE adds <job>-<time>.trace.json,
+// a Chrome trace of every block (chrome://tracing, ui.perfetto.dev).
+typedef enum {
+    SDCLONER_TRACE_OFF = 0,
+    SDCLONER_TRACE_SUMMARY,
+    SDCLONER_TRACE_TIMELINE,
+} sdcloner_trace;
+
+// Tunables for clone/image operations. Initialise with sdcloner_options_init().
+typedef struct {
+    int alloc_aware;   // raw imaging: read only blocks allocated in FAT/ext
+                       // filesystems and store zeros for free space (default 0)
+    int keep_archive;  // direct raw clone: tee a .img.gz into ~/SDCloner/images (default 1)
+    sdcloner_progress_fn progress;   // optional progress callback
+    void* progress_user;
+    sdcloner_format format;          // raw images and clone archives (default .img.gz)
+    sdcloner_verify verify;          // burns: read the card back (default sampled)
+    unsigned verify_sample_pct;      // blocks checked by SDCLONER_VERIFY_SAMPLED (default 5)
+    int diff_burn;     // burns: write only blocks the card does not already hold,
+                       // using ~/SDCloner/manifests/<card id>.sdman when valid (default 0)
+    const char* base_image;   // raw imaging: incremental backup as an .sdimg delta that
+                              // stores only blocks changed since this .sdimg (default NULL)
+    sdcloner_io io;                  // device I/O backend (default auto)
+    unsigned io_depth;               // requests in flight per device, 1..64 (default 4)
+    sdcloner_trace trace;            // per-job report in ~/SDCloner/traces (default off)
+    unsigned checkpoint_mb;          // raw imaging: checkpoint every N MB so an interrupted
+                                     // image of the same card resumes, 0 = off (default 1024)
+    int zero_discard;  // burns: clear all-zero blocks with zero-out instead of writing
+                       // them, where the device guarantees they read back as zeros (default 1)
+} sdcloner_options;
+
+void sdcloner_options_init(sdcloner_options* opt);
+
 // High-level clone entry point.
 // If dest_disk == NULL or empty, a local image is created in ~/SDCloner/images/.
 // If dest_disk is provided, the engine decides raw vs FS-aware and burns it.
@@ -16,10 +140,175 @@ extern "C" {
 // Returns 0 on success, non-zero on failure.
 int sdcloner_clone(const char* src_disk, const char* dest_disk, uint64_t dest_capacity_hint);
 
-// Burn an existing image (.img or .img.gz) to a destination block device.
+// As sdcloner_clone(), with explicit options (NULL = defaults).
+int sdcloner_clone_ex(const char* src_disk, const char* dest_disk, uint64_t dest_capacity_hint,
+                      const sdcloner_options* opt);
+
+// Raw clone straight from src_disk to dest_disk in a single pass (dest must be
+// at least as large as the source). If keep_archive is non-zero, a compressed
+// copy is teed into ~/SDCloner/images/ at the same time.
 // Returns 0 on success, non-zero on failure.
+int sdcloner_clone_direct(const char* src_disk, const char* dest_disk, int keep_archive);
+
+// Burn an existing image (.img, .img.gz, .sdimg, .img.xz, .img.zst or .img.lz4,
+// recognised by content) to a destination block device. Blocks are hashed
+// (CRC32C) while writing and the card is read back with O_DIRECT afterwards
+// according to sdcloner_options.verify; mismatching ranges are logged.
+// Returns 0 on success, 2 if the card was written but does not read back
+// correctly, 3 if the job was cancelled (sdcloner_job_cancel()), other
+// non-zero values on failure. With diff_burn, blocks equal to
+// what the card holds (by its stored manifest, else by reading) are skipped.
 int burn_image_to_disk(const char* image_path, const char* dest_disk);
 
+// As burn_image_to_disk(), with explicit options (NULL = defaults).
+int burn_image_to_disk_ex(const char* image_path, const char* dest_disk,
+                          const sdcloner_options* opt);
+
+// Burn one image to ndest destinations at once. The image is read and
+// decompressed once; each destination has its own writer, so a slow card
+// delays the others by at most a bounded buffer and a failing card does not
+// stop them. results[i] (required) gets 0, 2 (verification failed), 3
+// (cancelled) or another non-zero value for dest_disks[i]; progress follows the slowest card, then
+// the read-back of all cards together. Returns 0 only if every burn succeeded.
+int sdcloner_burn_multi(const char* image_path, const char* const* dest_disks, int ndest,
+                        const sdcloner_options* opt, int* results);
+
+// Convert an image between formats: the input (any format burning reads) is
+// detected by content, the output format by out_path's suffix (".sdimg",
+// ".sdref", ".gz", anything else = raw .img). Returns 0 on success, non-zero
+// on failure.
+int sdcloner_convert_image(const char* in_path, const char* out_path, const sdcloner_options* opt);
+
+// Rescue a failing card into a raw sparse .img: readable areas first in
+// large reads, skipping ahead on errors, then the skipped areas in smaller
+// pieces and single sectors with bounded retries. Unreadable ranges stay
+// zero and are listed in <image>.bad, which burns of the image (or of images
+// converted from it) report and always verify. image_path NULL creates
+// ~/SDCloner/images/rescue-<time>.img; an existing image with its .bad map
+// retries only the listed ranges. Returns 0 if everything was read, 2 if the
+// image is complete except for the mapped ranges, other values on failure.
+int sdcloner_rescue(const char* src_disk, const char* image_path, const sdcloner_options* opt);
+
+// ---------- Job contexts ----------
+// Reentrant form of the calls above: create a context, run one or more jobs
+// with it, read why the last one failed, free it. No engine call exits the
+// process; every job uses its own output names, temp files and mount points,
+// so any number of contexts can run at once on different threads (one job
+// per context at a time).
+typedef enum {
+    SDCLONER_ERR_NONE = 0,
+    SDCLONER_ERR_INVALID,     // bad arguments (e.g. source and destination are the same)
+    SDCLONER_ERR_SOURCE,      // source missing, unreadable or not a block device
+    SDCLONER_ERR_DEST,        // destination cannot be opened or sized
+    SDCLONER_ERR_SPACE,       // destination too small for the data
+    SDCLONER_ERR_VERIFY,      // written, but does not read back correctly
+    SDCLONER_ERR_PARTIAL,     // rescue: image complete except for the mapped ranges
+    SDCLONER_ERR_CANCELLED,   // cancelled through the scheduler
+    SDCLONER_ERR_FAILED,      // anything else; see message
+} sdcloner_errcode;
+
+typedef struct {
+    sdcloner_errcode code;
+    char message[256];        // first error the job reported, "" if none
+} sdcloner_error;
+
+typedef struct sdcloner_ctx sdcloner_ctx;
+
+// opt NULL = defaults; it is copied (pointers in it must stay valid while
+// jobs run). Returns NULL if out of memory.
+sdcloner_ctx* sdcloner_ctx_new(const sdcloner_options* opt);
+// The jobs, with the return values of their sdcloner_* counterparts.
+int sdcloner_ctx_clone(sdcloner_ctx* c, const char* src_disk, const char* dest_disk,
+                       uint64_t dest_capacity_hint);
+int sdcloner_ctx_burn(sdcloner_ctx* c, const char* image_path, const char* const* dest_disks,
+                      int ndest, int* results);
+int sdcloner_ctx_convert(sdcloner_ctx* c, const char* in_path, const char* out_path);
+int sdcloner_ctx_rescue(sdcloner_ctx* c, const char* src_disk, const char* image_path);
+// Outcome of the last job run with c (code NONE if it succeeded).
+const sdcloner_error* sdcloner_ctx_error(const sdcloner_ctx* c);
+void sdcloner_ctx_free(sdcloner_ctx* c);
+const char* sdcloner_errcode_name(sdcloner_errcode code);
+
+// ---------- Job scheduler ----------
+// Runs clone, burn, convert and rescue jobs side by side, e.g. one per
+// reader of a duplication station. Devices are grouped by the host
+// controller they hang off (USB xHCI/EHCI, MMC host); at most jobs_per_bus
+// jobs run on one controller at a time and, with bus_mbps, they share that
+// much bandwidth. Each job can have its own cap (max_mbps) and can be
+// paused, resumed and cancelled. Pause and cancel take effect at the next
+// block of data; a cancelled imaging job keeps its checkpoint, so running
+// it again resumes. Burns are verified inside their job. Each job runs in a
+// context of its own (sdcloner_ctx), so a failing job only ends itself.
+typedef enum {
+    SDCLONER_JOB_CLONE = 0,   // sdcloner_clone_ex(source, dests[0] or NULL)
+    SDCLONER_JOB_BURN,        // image source to every dest (sdcloner_burn_multi)
+    SDCLONER_JOB_CONVERT,     // sdcloner_convert_image(source, dests[0])
+    SDCLONER_JOB_RESCUE,      // sdcloner_rescue(source, dests[0] or NULL)
+} sdcloner_job_kind;
+
+typedef enum {
+    SDCLONER_JOB_QUEUED = 0,  // waiting for a free slot on its controllers
+    SDCLONER_JOB_RUNNING,
+    SDCLONER_JOB_PAUSED,
+    SDCLONER_JOB_DONE,
+    SDCLONER_JOB_FAILED,
+    SDCLONER_JOB_CANCELLED,
+} sdcloner_job_state;
+
+typedef struct {
+    sdcloner_job_kind kind;
+    const char* source;          // disk (clone, rescue) or image (burn, convert)
+    const char* const* dests;    // destinations / output path, see the kinds
+    int         ndest;
+    uint64_t    dest_capacity_hint;   // clone only
+    const sdcloner_options* options;  // NULL = defaults; pointers in it must
+                                      // stay valid until the job ends
+    double      max_mbps;        // bandwidth cap of this job (MiB/s), 0 = none
+} sdcloner_job_spec;
+
+typedef struct {
+    unsigned max_jobs;           // running at once (default 8)
+    unsigned jobs_per_bus;       // running on one host controller (default 2)
+    double   bus_mbps;           // bandwidth shared per controller (MiB/s), 0 = none
+} sdcloner_sched_opts;
+
+// State changes of job id, from a scheduler or caller thread. rc is the
+// job's return value once it has ended, else 0. Must not block.
+typedef void (*sdcloner_job_fn)(int id, sdcloner_job_state state, int rc, void* user);
+
+typedef struct sdcloner_sched sdcloner_sched;
+
+void sdcloner_sched_opts_init(sdcloner_sched_opts* o);
+// opts NULL = defaults; fn optional.
+sdcloner_sched* sdcloner_sched_new(const sdcloner_sched_opts* opts, sdcloner_job_fn fn, void* user);
+// Queue a job; spec's strings are copied. Returns its id (> 0) or -1.
+int  sdcloner_sched_submit(sdcloner_sched* s, const sdcloner_job_spec* spec);
+int  sdcloner_job_pause(sdcloner_sched* s, int id);
+int  sdcloner_job_resume(sdcloner_sched* s, int id);
+int  sdcloner_job_cancel(sdcloner_sched* s, int id);
+// State of job id; *rc (optional) gets its return value once ended and
+// results (optional, ndest entries) a burn's per-destination results.
+sdcloner_job_state sdcloner_job_get(sdcloner_sched* s, int id, int* rc, int* results);
+// Why job id failed, once it has ended. Returns 0, or -1 if it is unknown or
+// still queued or running.
+int  sdcloner_job_error(sdcloner_sched* s, int id, sdcloner_error* err);
+// Block until every submitted job has ended.
+void sdcloner_sched_wait(sdcloner_sched* s);
+// Cancel whatever is still queued or running, wait for it, free s.
+void sdcloner_sched_free(sdcloner_sched* s);
+
+// Host controller dev hangs off ("0000:00:14.0" for a USB reader, "mmc0"
+// for an SD slot; the disk itself if it is on a bus of its own), written
+// to out. Returns 0, or -1 if dev is not a block device.
+int sdcloner_device_bus(const char* dev, char* out, size_t cap);
+
+// Reclaim chunk-store space after .sdref images were deleted from
+// ~/SDCloner/images: chunks no remaining recipe uses are removed. Do not run
+// while an image is being written. *freed (optional) gets the bytes released.
+// Returns 0 on success, non-zero on failure (nothing is deleted when a
+// recipe cannot be read).
+int sdcloner_store_gc(uint64_t* freed);
+
 #ifdef __cplusplus
 }
 #endif
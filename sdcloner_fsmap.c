@@ -0,0 +1,505 @@
+// sdcloner_fsmap.c
+// Free-space maps from FAT allocation tables and ext2/3/4 block bitmaps,
+// plus metadata-only used-space estimates (ext, FAT, exFAT).
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/statvfs.h>
+
+#include "sdcloner_internal.h"
+#include "sdcloner_fsmap.h"
+#include "sdcloner_probe.h"
+
+// ---------------- Extent lists ------------------------
+void sdc_extents_free(sdc_extent_list* l) {
+    free(l->ext);
+    memset(l, 0, sizeof(*l));
+}
+
+int sdc_extents_add(sdc_extent_list* l, uint64_t off, uint64_t len) {
+    if (!len) return 0;
+    // Cheap coalesce for the common in-order case.
+    if (l->n && l->ext[l->n - 1].off + l->ext[l->n - 1].len == off) {
+        l->ext[l->n - 1].len += len;
+        l->total += len;
+        return 0;
+    }
+    if (l->n == l->cap) {
+        size_t ncap = l->cap ? l->cap * 2 : 256;
+        sdc_extent* ne = realloc(l->ext, ncap * sizeof(sdc_extent));
+        if (!ne) return -1;
+        l->ext = ne; l->cap = ncap;
+    }
+    l->ext[l->n].off = off;
+    l->ext[l->n].len = len;
+    l->n++;
+    l->total += len;
+    return 0;
+}
+
+static int ext_cmp(const void* a, const void* b) {
+    const sdc_extent* x = a; const sdc_extent* y = b;
+    return x->off < y->off ? -1 : x->off > y->off;
+}
+
+void sdc_extents_normalize(sdc_extent_list* l) {
+    if (l->n < 2) return;
+    qsort(l->ext, l->n, sizeof(sdc_extent), ext_cmp);
+    size_t w = 0;
+    l->total = l->ext[0].len;
+    for (size_t i = 1; i < l->n; i++) {
+        sdc_extent* cur = &l->ext[w];
+        uint64_t end = cur->off + cur->len;
+        if (l->ext[i].off <= end) {
+            uint64_t nend = l->ext[i].off + l->ext[i].len;
+            if (nend > end) { l->total += nend - end; cur->len = nend - cur->off; }
+        } else {
+            l->ext[++w] = l->ext[i];
+            l->total += l->ext[i].len;
+        }
+    }
+    l->n = w + 1;
+}
+
+// ---------------- Helpers -----------------------------
+static uint16_t le16(const unsigned char* p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static int pread_exact(int fd, void* buf, size_t len, uint64_t off) {
+    unsigned char* p = buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, (off_t)off);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        if (n == 0) { errno = EIO; return -1; }
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+// Mounted read-write means the on-disk bitmaps may lag behind the kernel.
+static bool mounted_rw(const char* dev) {
+    char want[PATH_MAX];
+    if (!realpath(dev, want)) return false;
+    FILE* fp = fopen("/proc/self/mounts", "r");
+    if (!fp) return true;   // cannot tell → be conservative
+    char line[4096];
+    bool rw = false;
+    while (!rw && fgets(line, sizeof(line), fp)) {
+        char src[PATH_MAX], mnt[PATH_MAX], type[64], opts[1024];
+        if (sscanf(line, "%4095s %4095s %63s %1023s", src, mnt, type, opts) != 4) continue;
+        char real[PATH_MAX];
+        if (!realpath(src, real) || strcmp(real, want) != 0) continue;
+        rw = strncmp(opts, "rw", 2) == 0 && (opts[2] == ',' || opts[2] == '\0');
+    }
+    fclose(fp);
+    return rw;
+}
+
+// Byte offset of a partition on its disk from /sys/class/block/<name>/start.
+static int part_start_bytes(const char* part_dev, uint64_t* out) {
+    const char* name = strrchr(part_dev, '/');
+    name = name ? name + 1 : part_dev;
+    char path[512];
+    snprintf(path, sizeof(path), "/sys/class/block/%s/start", name);
+    FILE* fp = fopen(path, "r");
+    if (!fp) return -1;
+    unsigned long long sectors = 0;
+    int ok = fscanf(fp, "%llu", &sectors) == 1;
+    fclose(fp);
+    if (!ok) return -1;
+    *out = (uint64_t)sectors * 512ULL;
+    return 0;
+}
+
+// ---------------- FAT12/16/32 -------------------------
+static int map_fat(int fd, const unsigned char* bs, uint64_t base, sdc_extent_list* l) {
+    uint32_t bps  = le16(bs + 11);
+    uint32_t spc  = bs[13];
+    uint32_t rsvd = le16(bs + 14);
+    uint32_t nfat = bs[16];
+    uint32_t root_ents = le16(bs + 17);
+    uint32_t tot  = le16(bs + 19) ? le16(bs + 19) : le32(bs + 32);
+    uint32_t fatsz = le16(bs + 22) ? le16(bs + 22) : le32(bs + 36);
+    if (!bps || (bps & (bps - 1)) || bps < 512 || !spc || !nfat || !fatsz || !tot) return 1;
+
+    uint32_t root_secs = (root_ents * 32 + bps - 1) / bps;
+    uint32_t data_sec = rsvd + nfat * fatsz + root_secs;
+    if (data_sec >= tot) return 1;
+    uint32_t clusters = (tot - data_sec) / spc;
+    int bits = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+
+    size_t fat_bytes = (size_t)fatsz * bps;
+    unsigned char* fat = malloc(fat_bytes);
+    if (!fat) return -1;
+    if (pread_exact(fd, fat, fat_bytes, (uint64_t)rsvd * bps) != 0) { free(fat); return -1; }
+
+    // FAT[1] carries the clean-shutdown flag on FAT16/32.
+    bool clean = bits == 12 ||
+                 (bits == 16 && (le16(fat + 2) & 0x8000)) ||
+                 (bits == 32 && (le32(fat + 4) & 0x08000000));
+    if (!clean) { free(fat); sdc_logi("[FSMAP] FAT volume marked dirty, not mapped"); return 1; }
+
+    uint64_t clus_bytes = (uint64_t)spc * bps;
+    uint64_t data_off = base + (uint64_t)data_sec * bps;
+    for (uint32_t c = 2; c < clusters + 2; c++) {
+        uint32_t v;
+        if (bits == 12) {
+            size_t i = c + c / 2;
+            if (i + 1 >= fat_bytes) break;
+            v = le16(fat + i);
+            v = (c & 1) ? v >> 4 : v & 0xFFF;
+        } else if (bits == 16) {
+            if ((size_t)c * 2 + 2 > fat_bytes) break;
+            v = le16(fat + c * 2);
+        } else {
+            if ((size_t)c * 4 + 4 > fat_bytes) break;
+            v = le32(fat + (size_t)c * 4) & 0x0FFFFFFF;
+        }
+        if (v == 0 && sdc_extents_add(l, data_off + (uint64_t)(c - 2) * clus_bytes, clus_bytes) != 0) {
+            free(fat);
+            return -1;
+        }
+    }
+    free(fat);
+    return 0;
+}
+
+// ---------------- ext2/3/4 ----------------------------
+#define EXT_INCOMPAT_RECOVER 0x0004
+#define EXT_INCOMPAT_META_BG 0x0010
+#define EXT_INCOMPAT_64BIT   0x0080
+#define EXT_RO_SPARSE_SUPER  0x0001
+#define EXT_RO_BIGALLOC      0x0200
+#define EXT_BG_BLOCK_UNINIT  0x0002
+
+static bool is_power_of(uint32_t n, uint32_t b) {
+    while (n > 1 && n % b == 0) n /= b;
+    return n == 1;
+}
+
+static bool group_has_super(uint32_t g, bool sparse) {
+    if (!sparse || g <= 1) return true;
+    return is_power_of(g, 3) || is_power_of(g, 5) || is_power_of(g, 7);
+}
+
+// Set bits for blocks [blk, blk+cnt) that fall inside the group starting at first.
+static void mark_used(unsigned char* bm, uint64_t first, uint64_t blk, uint64_t cnt, uint32_t bpg) {
+    uint64_t lo = blk > first ? blk : first;
+    uint64_t hi = blk + cnt < first + bpg ? blk + cnt : first + bpg;
+    for (uint64_t b = lo; b < hi; b++) {
+        uint64_t i = b - first;
+        bm[i / 8] |= (unsigned char)(1u << (i % 8));
+    }
+}
+
+static int map_ext(int fd, const unsigned char* sb, uint64_t base, sdc_extent_list* l) {
+    uint32_t incompat = le32(sb + 96), ro_compat = le32(sb + 100);
+    uint16_t state = le16(sb + 58);
+    if (!(state & 1) || (incompat & EXT_INCOMPAT_RECOVER)) {
+        sdc_logi("[FSMAP] ext filesystem not clean, not mapped");
+        return 1;
+    }
+    if (incompat & EXT_INCOMPAT_META_BG) return 1;   // scattered GDT layout
+    if (ro_compat & EXT_RO_BIGALLOC) {                // bitmaps count clusters, not blocks
+        sdc_logi("[FSMAP] ext bigalloc filesystem, not mapped");
+        return 1;
+    }
+
+    uint64_t bs = 1024ULL << le32(sb + 24);
+    uint64_t blocks = le32(sb + 4);
+    if (incompat & EXT_INCOMPAT_64BIT) blocks |= (uint64_t)le32(sb + 336) << 32;
+    uint32_t first = le32(sb + 20);
+    uint32_t bpg = le32(sb + 32);
+    uint32_t ipg = le32(sb + 40);
+    uint32_t isz = le16(sb + 88) ? le16(sb + 88) : 128;
+    uint32_t dsz = (incompat & EXT_INCOMPAT_64BIT) ? le16(sb + 254) : 32;
+    uint32_t rsvd_gdt = le16(sb + 206);
+    if (bs > 65536 || !bpg || bpg > bs * 8 || dsz < 32 || blocks <= first) return 1;
+
+    uint32_t groups = (uint32_t)((blocks - first + bpg - 1) / bpg);
+    uint64_t gdt_bytes = (uint64_t)groups * dsz;
+    uint64_t gdt_blocks = (gdt_bytes + bs - 1) / bs;
+    unsigned char* gdt = malloc(gdt_bytes);
+    unsigned char* bm = malloc(bs);
+    if (!gdt || !bm) { free(gdt); free(bm); return -1; }
+    if (pread_exact(fd, gdt, gdt_bytes, (uint64_t)(first + 1) * bs) != 0) {
+        free(gdt); free(bm); return -1;
+    }
+
+    uint64_t itable_blocks = ((uint64_t)ipg * isz + bs - 1) / bs;
+    int rc = 0;
+    for (uint32_t g = 0; g < groups && rc == 0; g++) {
+        const unsigned char* d = gdt + (uint64_t)g * dsz;
+        uint64_t gfirst = first + (uint64_t)g * bpg;
+        uint32_t gblocks = (uint32_t)(blocks - gfirst < bpg ? blocks - gfirst : bpg);
+        uint64_t bb = le32(d + 0);
+        if (dsz >= 64) bb |= (uint64_t)le32(d + 0x20) << 32;
+
+        if (le16(d + 18) & EXT_BG_BLOCK_UNINIT) {
+            // Bitmap was never written: rebuild what the kernel would compute,
+            // i.e. superblock/GDT backups plus any group's metadata placed here.
+            memset(bm, 0, bs);
+            if (group_has_super(g, ro_compat & EXT_RO_SPARSE_SUPER))
+                mark_used(bm, gfirst, gfirst, 1 + gdt_blocks + rsvd_gdt, bpg);
+            for (uint32_t h = 0; h < groups; h++) {
+                const unsigned char* e = gdt + (uint64_t)h * dsz;
+                uint64_t hb = le32(e + 0), ib = le32(e + 4), it = le32(e + 8);
+                if (dsz >= 64) {
+                    hb |= (uint64_t)le32(e + 0x20) << 32;
+                    ib |= (uint64_t)le32(e + 0x24) << 32;
+                    it |= (uint64_t)le32(e + 0x28) << 32;
+                }
+                mark_used(bm, gfirst, hb, 1, bpg);
+                mark_used(bm, gfirst, ib, 1, bpg);
+                mark_used(bm, gfirst, it, itable_blocks, bpg);
+            }
+        } else if (!bb || bb >= blocks || pread_exact(fd, bm, bs, bb * bs) != 0) {
+            rc = bb && bb < blocks ? -1 : 1;
+            break;
+        }
+
+        for (uint32_t i = 0; i < gblocks; ) {
+            if (bm[i / 8] & (1u << (i % 8))) { i++; continue; }
+            uint32_t j = i;
+            while (j < gblocks && !(bm[j / 8] & (1u << (j % 8)))) j++;
+            if (sdc_extents_add(l, base + (gfirst + i) * bs, (uint64_t)(j - i) * bs) != 0) rc = -1;
+            i = j;
+        }
+    }
+    free(gdt);
+    free(bm);
+    return rc;
+}
+
+// ---------------- Used-space estimates ----------------
+// ext: total minus the sum of per-group free counts (one GDT read). The
+// superblock's own counter is only refreshed on unmount, the descriptors are not.
+static int used_ext(int fd, const unsigned char* sb, uint64_t* used) {
+    uint32_t incompat = le32(sb + 96);
+    if (le32(sb + 100) & EXT_RO_BIGALLOC) return 1;   // free counts are in clusters
+    bool is64 = incompat & EXT_INCOMPAT_64BIT;
+    uint64_t bs = 1024ULL << le32(sb + 24);
+    uint64_t blocks = le32(sb + 4), free_sb = le32(sb + 12);
+    if (is64) {
+        blocks  |= (uint64_t)le32(sb + 336) << 32;
+        free_sb |= (uint64_t)le32(sb + 344) << 32;
+    }
+    uint32_t first = le32(sb + 20), bpg = le32(sb + 32);
+    uint32_t dsz = is64 ? le16(sb + 254) : 32;
+    if (bs > 65536 || !bpg || dsz < 32 || blocks <= first) return 1;
+
+    uint64_t free_blocks = free_sb;
+    if (!(incompat & EXT_INCOMPAT_META_BG)) {
+        uint32_t groups = (uint32_t)((blocks - first + bpg - 1) / bpg);
+        size_t gdt_bytes = (size_t)groups * dsz;
+        unsigned char* gdt = malloc(gdt_bytes);
+        if (!gdt) return -1;
+        if (pread_exact(fd, gdt, gdt_bytes, (uint64_t)(first + 1) * bs) != 0) { free(gdt); return -1; }
+        uint64_t sum = 0;
+        for (uint32_t g = 0; g < groups; g++) {
+            const unsigned char* d = gdt + (size_t)g * dsz;
+            sum += le16(d + 12);
+            if (dsz >= 64) sum += (uint64_t)le16(d + 0x2C) << 16;
+        }
+        free(gdt);
+        if (sum <= blocks) free_blocks = sum;
+    }
+    if (free_blocks > blocks) return 1;
+    *used = (blocks - free_blocks) * bs;
+    return 0;
+}
+
+// FAT: FSInfo free count on FAT32 when set and plausible, else count zero entries.
+static int used_fat(int fd, const unsigned char* bs, uint64_t* used) {
+    uint32_t bps  = le16(bs + 11);
+    uint32_t spc  = bs[13];
+    uint32_t rsvd = le16(bs + 14);
+    uint32_t nfat = bs[16];
+    uint32_t root_ents = le16(bs + 17);
+    uint32_t tot  = le16(bs + 19) ? le16(bs + 19) : le32(bs + 32);
+    uint32_t fatsz = le16(bs + 22) ? le16(bs + 22) : le32(bs + 36);
+    if (!bps || (bps & (bps - 1)) || bps < 512 || !spc || !nfat || !fatsz || !tot) return 1;
+
+    uint32_t root_secs = (root_ents * 32 + bps - 1) / bps;
+    uint32_t data_sec = rsvd + nfat * fatsz + root_secs;
+    if (data_sec >= tot) return 1;
+    uint32_t clusters = (tot - data_sec) / spc;
+    int bits = clusters < 4085 ? 12 : clusters < 65525 ? 16 : 32;
+    uint64_t clus_bytes = (uint64_t)spc * bps;
+
+    if (bits == 32 && le16(bs + 48) && le16(bs + 48) < rsvd) {
+        unsigned char fsi[512];
+        if (pread_exact(fd, fsi, sizeof(fsi), (uint64_t)le16(bs + 48) * bps) != 0) return -1;
+        uint32_t fr = le32(fsi + 488);
+        if (le32(fsi) == 0x41615252 && le32(fsi + 484) == 0x61417272 && fr <= clusters) {
+            *used = (uint64_t)(clusters - fr) * clus_bytes;
+            return 0;
+        }
+    }
+
+    size_t fat_bytes = (size_t)fatsz * bps;
+    unsigned char* fat = malloc(fat_bytes);
+    if (!fat) return -1;
+    if (pread_exact(fd, fat, fat_bytes, (uint64_t)rsvd * bps) != 0) { free(fat); return -1; }
+    uint64_t in_use = 0;
+    for (uint32_t c = 2; c < clusters + 2; c++) {
+        uint32_t v;
+        if (bits == 12) {
+            size_t i = c + c / 2;
+            if (i + 1 >= fat_bytes) break;
+            v = le16(fat + i);
+            v = (c & 1) ? v >> 4 : v & 0xFFF;
+        } else if (bits == 16) {
+            if ((size_t)c * 2 + 2 > fat_bytes) break;
+            v = le16(fat + c * 2);
+        } else {
+            if ((size_t)c * 4 + 4 > fat_bytes) break;
+            v = le32(fat + (size_t)c * 4) & 0x0FFFFFFF;
+        }
+        if (v) in_use++;
+    }
+    free(fat);
+    *used = in_use * clus_bytes;
+    return 0;
+}
+
+// exFAT: popcount of the allocation bitmap named in the root directory.
+// Falls back to the boot sector's PercentInUse if the bitmap cannot be found.
+static int used_exfat(int fd, const unsigned char* bs, uint64_t* used) {
+    uint32_t ss_shift = bs[108], sc_shift = bs[109];
+    if (ss_shift < 9 || ss_shift > 12 || ss_shift + sc_shift > 25) return 1;
+    uint64_t ss = 1ULL << ss_shift, clus_bytes = ss << sc_shift;
+    uint64_t heap = (uint64_t)le32(bs + 88) * ss;
+    uint32_t clusters = le32(bs + 92), root = le32(bs + 96);
+    if (!clusters || root < 2 || root - 2 >= clusters) return 1;
+
+    unsigned char* dir = malloc(clus_bytes);
+    if (!dir) return -1;
+    if (pread_exact(fd, dir, clus_bytes, heap + (uint64_t)(root - 2) * clus_bytes) != 0) {
+        free(dir); return -1;
+    }
+    uint32_t bm_clus = 0;
+    uint64_t bm_len = 0;
+    for (uint64_t o = 0; o + 32 <= clus_bytes && dir[o]; o += 32) {
+        if (dir[o] == 0x81 && !(dir[o + 1] & 1)) {   // first (or only) bitmap
+            bm_clus = le32(dir + o + 20);
+            bm_len = (uint64_t)le32(dir + o + 24) | (uint64_t)le32(dir + o + 28) << 32;
+            break;
+        }
+    }
+    free(dir);
+
+    if (bm_clus >= 2 && bm_clus - 2 < clusters && bm_len && bm_len <= (clusters + 7) / 8) {
+        unsigned char* bm = malloc(bm_len);
+        if (!bm) return -1;
+        // mkfs.exfat and the kernel keep the bitmap contiguous.
+        if (pread_exact(fd, bm, bm_len, heap + (uint64_t)(bm_clus - 2) * clus_bytes) != 0) {
+            free(bm); return -1;
+        }
+        uint64_t in_use = 0;
+        for (uint64_t i = 0; i < bm_len; i++) in_use += (uint64_t)__builtin_popcount(bm[i]);
+        free(bm);
+        *used = in_use * clus_bytes;
+        return 0;
+    }
+    if (bs[112] <= 100) {
+        *used = (uint64_t)clusters * clus_bytes * bs[112] / 100;
+        return 0;
+    }
+    return 1;
+}
+
+// ---------------- Entry points ------------------------
+static sdc_fs_kind probe_kind(int fd, unsigned char* bs, unsigned char* sb) {
+    if (pread_exact(fd, sb, 1024, 1024) == 0 && le16(sb + 56) == 0xEF53) return SDC_FS_EXT;
+    if (pread_exact(fd, bs, 512, 0) == 0 && bs[510] == 0x55 && bs[511] == 0xAA &&
+        (!memcmp(bs + 54, "FAT", 3) || !memcmp(bs + 82, "FAT32", 5))) return SDC_FS_FAT;
+    return SDC_FS_UNKNOWN;
+}
+
+sdc_fs_kind sdc_fs_kind_of(const char* part_dev) {
+    int fd = open(part_dev, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return SDC_FS_UNKNOWN;
+    unsigned char bs[512], sb[1024];
+    sdc_fs_kind k = probe_kind(fd, bs, sb);
+    close(fd);
+    return k;
+}
+
+int sdc_fsmap_partition(const char* part_dev, uint64_t part_start, sdc_extent_list* l) {
+    if (mounted_rw(part_dev)) {
+        sdc_logi("[FSMAP] %s is mounted read-write, not mapped", part_dev);
+        return 1;
+    }
+    int fd = open(part_dev, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { sdc_loge("open(%s): %s", part_dev, strerror(errno)); return -1; }
+
+    unsigned char bs[512], sb[1024];
+    int rc = 1;
+    switch (probe_kind(fd, bs, sb)) {
+    case SDC_FS_EXT: rc = map_ext(fd, sb, part_start, l); break;
+    case SDC_FS_FAT: rc = map_fat(fd, bs, part_start, l); break;
+    default: break;
+    }
+    if (rc < 0) sdc_loge("[FSMAP] %s: %s", part_dev, strerror(errno));
+    close(fd);
+    return rc;
+}
+
+int sdc_fs_used_bytes(const char* part_dev, uint64_t* used) {
+    char mp[256];
+    struct statvfs vs;
+    if (sdc_probe_mountpoint(part_dev, mp, sizeof(mp)) == 0 && statvfs(mp, &vs) == 0) {
+        *used = (uint64_t)(vs.f_blocks - vs.f_bfree) * vs.f_frsize;
+        return 0;
+    }
+    int fd = open(part_dev, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { sdc_loge("open(%s): %s", part_dev, strerror(errno)); return -1; }
+
+    unsigned char bs[512], sb[1024];
+    int rc = 1;
+    switch (probe_kind(fd, bs, sb)) {
+    case SDC_FS_EXT: rc = used_ext(fd, sb, used); break;
+    case SDC_FS_FAT: rc = used_fat(fd, bs, used); break;
+    default:
+        if (pread_exact(fd, bs, 512, 0) == 0 && !memcmp(bs + 3, "EXFAT   ", 8))
+            rc = used_exfat(fd, bs, used);
+        break;
+    }
+    if (rc < 0) sdc_loge("[FSMAP] %s: %s", part_dev, strerror(errno));
+    close(fd);
+    return rc;
+}
+
+int sdc_fsmap_build(char* const* parts, int n, sdc_extent_list* out) {
+    int mapped = 0;
+    for (int i = 0; i < n; i++) {
+        uint64_t start;
+        if (part_start_bytes(parts[i], &start) != 0) {
+            sdc_logi("[FSMAP] %s: partition offset unknown, not mapped", parts[i]);
+            continue;
+        }
+        uint64_t before = out->total;
+        int rc = sdc_fsmap_partition(parts[i], start, out);
+        if (rc < 0) return -1;
+        if (rc == 0) {
+            mapped++;
+            sdc_logi("[FSMAP] %s: %.2f MB unallocated", parts[i],
+                     (double)(out->total - before) / (1024.0 * 1024.0));
+        }
+    }
+    sdc_extents_normalize(out);
+    return mapped;
+}
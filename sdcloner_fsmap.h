@@ -0,0 +1,47 @@
+// sdcloner_fsmap.h
+// Free-space maps built from on-disk filesystem allocation metadata
+// (FAT tables, ext2/3/4 block bitmaps). Used by raw imaging to skip reading
+// unallocated space and emit zeros for it instead. Never writes to the source.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct {
+    uint64_t off;   // byte offset from the start of the disk
+    uint64_t len;
+} sdc_extent;
+
+typedef struct {
+    sdc_extent* ext;        // sorted, non-overlapping, coalesced
+    size_t      n, cap;
+    uint64_t    total;      // sum of all extent lengths
+} sdc_extent_list;
+
+typedef enum { SDC_FS_UNKNOWN = 0, SDC_FS_FAT, SDC_FS_EXT } sdc_fs_kind;
+
+void sdc_extents_free(sdc_extent_list* l);
+int  sdc_extents_add(sdc_extent_list* l, uint64_t off, uint64_t len);
+void sdc_extents_normalize(sdc_extent_list* l);   // sort + coalesce
+
+// Filesystem family on part_dev, from its superblock magic.
+sdc_fs_kind sdc_fs_kind_of(const char* part_dev);
+
+// Append the free (unallocated) extents of the filesystem on part_dev to l.
+// part_start is the partition's byte offset on the whole disk. Filesystems
+// that are unknown, dirty or mounted read-write add nothing (treated as fully
+// allocated). Returns 0 if part_dev was mapped, 1 if skipped, -1 on I/O error.
+int sdc_fsmap_partition(const char* part_dev, uint64_t part_start, sdc_extent_list* l);
+
+// Used bytes of the filesystem on part_dev from its allocation metadata:
+// ext group descriptor free counts, FAT32 FSInfo (or a FAT scan on FAT12/16
+// and when FSInfo is unset), the exFAT allocation bitmap. Mounted filesystems
+// are asked via statvfs() instead, since on-disk counters lag behind.
+// Returns 0 on success, 1 if the filesystem is not recognised, -1 on I/O error.
+int sdc_fs_used_bytes(const char* part_dev, uint64_t* used);
+
+// Map every partition in parts[0..n) (e.g. from list_partitions()); each
+// partition's disk offset comes from /sys/class/block/<name>/start.
+// Returns the number of partitions mapped, or -1 on I/O error.
+int sdc_fsmap_build(char* const* parts, int n, sdc_extent_list* out);
@@ -4,7 +4,6 @@
 
 #define _POSIX_C_SOURCE 200809L
 #include <gtk/gtk.h>
-#include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
@@ -19,57 +18,141 @@ typedef struct {
     GtkWidget *label_status;
     GtkWidget *progress;
     gchar     *source_dev;     // e.g., "/dev/sdd"
-    gchar     *dest_dev;       // e.g., "/dev/sdb"
+    gchar    **dest_devs;      // NULL-terminated; several = fan-out burn
+    gint       n_dest;
     gchar     *image_path;     // selected via File->Open Image...
-    gboolean   busy;
-    pthread_t  worker;
+    gboolean   busy;           // some job has not ended yet
+    sdcloner_sched *sched;     // runs reads and burns, several at once
+    GHashTable *jobs;          // job id -> JobCtx of jobs not yet ended
+    GMutex     prog_mu;        // guards every JobCtx's prog/prog_valid (written by engine threads)
+    GtkListStore *job_store;   // one row per job not yet ended
+    GtkWidget  *job_view;
+    GtkListStore *devices;     // live disk list shown by every picker
+    sdcloner_device_watch *watch;   // keeps devices current; NULL = rescan per picker
 } App;
 
+enum { JOB_COL_ID, JOB_COL_WHAT, JOB_COL_STATUS, JOB_NCOLS };
+
+typedef struct {
+    App  *app;
+    int   id;
+    sdcloner_job_state state;
+    gchar *what;       // "Read /dev/sdd", shown in the job list
+    sdcloner_options opt;   // submitted with the job (the scheduler copies it)
+    gchar **dests;     // copy: the selection may change while the job runs
+    int  *results;     // fan-out burn: per-destination result, else NULL
+    int   n_results;
+    sdcloner_progress prog;   // latest engine report, under app->prog_mu
+    gboolean prog_valid;
+} JobCtx;
+
 static void set_status(App *app, const char *msg) {
     gtk_label_set_text(GTK_LABEL(app->label_status), msg);
 }
 
 static void set_progress_busy(App *app, gboolean busy) {
     app->busy = busy;
-    if (busy) {
-        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app->progress), 0.0);
-        gtk_progress_bar_set_text(GTK_PROGRESS_BAR(app->progress), "Working...");
-    } else {
-        gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app->progress), 0.0);
-        gtk_progress_bar_set_text(GTK_PROGRESS_BAR(app->progress), "Idle");
+    gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(app->progress), 0.0);
+    gtk_progress_bar_set_text(GTK_PROGRESS_BAR(app->progress), busy ? "Working..." : "Idle");
+}
+
+// Engine progress callback (job thread): just keep the job's latest snapshot.
+static void on_engine_progress(const sdcloner_progress *p, void *user) {
+    JobCtx *jc = (JobCtx*)user;
+    g_mutex_lock(&jc->app->prog_mu);
+    jc->prog = *p;
+    jc->prog_valid = TRUE;
+    g_mutex_unlock(&jc->app->prog_mu);
+}
+
+// "Burning 42% \u2014 18.3 MB/s (avg 17.9) \u2014 ETA 1:05"; *frac gets the fraction
+// done, or -1 while the phase has no byte count.
+static gchar* progress_text(const sdcloner_progress *p, double *frac) {
+    double mb = (double)p->bytes_done / (1024.0 * 1024.0);
+    *frac = -1;
+    if (p->bytes_total) {
+        double f = (double)p->bytes_done / (double)p->bytes_total;
+        *frac = f > 1.0 ? 1.0 : f;
+        if (p->eta_s >= 0)
+            return g_strdup_printf("%s %.0f%% \u2014 %.1f MB/s (avg %.1f) \u2014 ETA %d:%02d",
+                                   sdcloner_phase_name(p->phase), f * 100.0, p->rate_mbps,
+                                   p->avg_mbps, (int)p->eta_s / 60, (int)p->eta_s % 60);
+        return g_strdup_printf("%s %.0f%% \u2014 %.1f MB/s", sdcloner_phase_name(p->phase),
+                               f * 100.0, p->rate_mbps);
     }
+    return mb > 0 ? g_strdup_printf("%s \u2014 %.0f MB, %.1f MB/s",
+                                    sdcloner_phase_name(p->phase), mb, p->rate_mbps)
+                  : g_strdup_printf("%s...", sdcloner_phase_name(p->phase));
 }
 
+// Refresh every job row; the bar shows the one running job, or the
+// byte-weighted total of all running jobs.
 static gboolean pulse_cb(gpointer data) {
     App *app = (App*)data;
-    if (app->busy) {
-        gtk_progress_bar_pulse(GTK_PROGRESS_BAR(app->progress));
+    if (!app->busy) return TRUE;
+    GtkTreeModel *model = GTK_TREE_MODEL(app->job_store);
+    GtkTreeIter it;
+    uint64_t done = 0, total = 0;
+    double rate = 0;
+    int running = 0;
+    gboolean sized = TRUE;
+    sdcloner_progress one = {0};
+    gboolean one_valid = FALSE;
+    for (gboolean more = gtk_tree_model_get_iter_first(model, &it); more;
+         more = gtk_tree_model_iter_next(model, &it)) {
+        gint id;
+        gtk_tree_model_get(model, &it, JOB_COL_ID, &id, -1);
+        JobCtx *jc = (JobCtx*)g_hash_table_lookup(app->jobs, GINT_TO_POINTER(id));
+        if (!jc) continue;
+        g_mutex_lock(&app->prog_mu);
+        sdcloner_progress p = jc->prog;
+        gboolean valid = jc->prog_valid;
+        g_mutex_unlock(&app->prog_mu);
+
+        double row_frac;
+        gchar *txt = jc->state == SDCLONER_JOB_QUEUED ? g_strdup("Queued")
+                   : jc->state == SDCLONER_JOB_PAUSED ? g_strdup("Paused")
+                   : valid ? progress_text(&p, &row_frac) : g_strdup("Starting...");
+        gtk_list_store_set(app->job_store, &it, JOB_COL_STATUS, txt, -1);
+        g_free(txt);
+        if (jc->state != SDCLONER_JOB_RUNNING) continue;
+        running++;
+        one = p;
+        one_valid = valid;
+        if (!valid || !p.bytes_total) { sized = FALSE; continue; }
+        done += p.bytes_done < p.bytes_total ? p.bytes_done : p.bytes_total;
+        total += p.bytes_total;
+        rate += p.rate_mbps;
+    }
+
+    GtkProgressBar *bar = GTK_PROGRESS_BAR(app->progress);
+    gchar *txt;
+    double frac = -1;
+    if (running == 0) {
+        txt = g_strdup("Queued / paused");
+    } else if (running == 1) {
+        txt = one_valid ? progress_text(&one, &frac) : g_strdup("Working...");
+    } else {
+        if (sized && total) frac = (double)done / (double)total;
+        txt = frac >= 0 ? g_strdup_printf("%d jobs %.0f%% \u2014 %.1f MB/s", running, frac * 100.0, rate)
+                        : g_strdup_printf("%d jobs running", running);
     }
+    if (frac >= 0) gtk_progress_bar_set_fraction(bar, frac);
+    else gtk_progress_bar_pulse(bar);
+    gtk_progress_bar_set_text(bar, txt);
+    g_free(txt);
     return TRUE; // keep timer
 }
 
 // ---------- Helpers: block-device listing & validation ----------
-static char* lsblk_list(void) {
-    const char *cmd =
-        "lsblk -pnro NAME,SIZE,MODEL,TYPE,RM | awk '$4==\"disk\"{print $1\"|\"$2\"|\"$3\"|\"$4\"|\"$5}'";
-    FILE *fp = popen(cmd, "r");
-    if (!fp) return NULL;
-    char *buf = NULL; size_t cap = 0, len = 0;
-    char line[4096];
-    while (fgets(line, sizeof(line), fp)) {
-        size_t add = strlen(line);
-        if (len + add + 1 > cap) {
-            size_t ncap = cap ? cap*2 : 8192;
-            while (ncap < len + add + 1) ncap *= 2;
-            buf = (char*)realloc(buf, ncap);
-            cap = ncap;
-        }
-        memcpy(buf + len, line, add);
-        len += add;
-        buf[len] = '\0';
-    }
-    pclose(fp);
-    return buf; // caller free()
+// lsblk-style size: 119.1G, 512M, ...
+static void human_size(uint64_t bytes, char *out, size_t cap) {
+    static const char units[] = "BKMGTP";
+    double v = (double)bytes;
+    int u = 0;
+    while (v >= 1024.0 && u < 5) { v /= 1024.0; u++; }
+    if (u == 0) snprintf(out, cap, "%lluB", (unsigned long long)bytes);
+    else        snprintf(out, cap, v < 10.0 ? "%.1f%c" : "%.0f%c", v, units[u]);
 }
 
 static gboolean is_block_device(const char *path) {
@@ -78,10 +161,84 @@ static gboolean is_block_device(const char *path) {
     return S_ISBLK(st.st_mode);
 }
 
-// Returns g_strdup() of selected block device path (or NULL)
-static char* pick_block_device(GtkWindow *parent, const char *title) {
+// ---------- Device model: kept current by hotplug events ----------
+enum { DEV_COL_PATH, DEV_COL_SIZE, DEV_COL_MODEL, DEV_COL_TYPE, DEV_COL_RM, DEV_NCOLS };
+
+static void set_device_row(GtkListStore *store, GtkTreeIter *it, const sdcloner_device *d) {
+    char size[32];
+    human_size(d->size_bytes, size, sizeof(size));
+    gtk_list_store_set(store, it,
+                       DEV_COL_PATH, d->path,
+                       DEV_COL_SIZE, size,
+                       DEV_COL_MODEL, d->model,
+                       DEV_COL_TYPE, "disk",
+                       DEV_COL_RM, d->removable ? "1" : "0", -1);
+}
+
+// Bring the store in line with devs in place (rows updated, removed,
+// appended), so a picker that is open keeps its selection.
+static void sync_device_store(GtkListStore *store, const sdcloner_device *devs, int n) {
+    gboolean *seen = g_new0(gboolean, n ? n : 1);
+    GtkTreeIter it;
+    gboolean valid = gtk_tree_model_get_iter_first(GTK_TREE_MODEL(store), &it);
+    while (valid) {
+        gchar *path = NULL;
+        gtk_tree_model_get(GTK_TREE_MODEL(store), &it, DEV_COL_PATH, &path, -1);
+        int k = 0;
+        while (k < n && (seen[k] || g_strcmp0(devs[k].path, path) != 0)) k++;
+        g_free(path);
+        if (k == n) { valid = gtk_list_store_remove(store, &it); continue; }
+        seen[k] = TRUE;
+        set_device_row(store, &it, &devs[k]);
+        valid = gtk_tree_model_iter_next(GTK_TREE_MODEL(store), &it);
+    }
+    for (int k = 0; k < n; k++) {
+        if (seen[k]) continue;
+        gtk_list_store_append(store, &it);
+        set_device_row(store, &it, &devs[k]);
+    }
+    g_free(seen);
+}
+
+typedef struct {
+    App             *app;
+    sdcloner_device *devs;
+    int              n;
+} DevicesUpdate;
+
+static gboolean ui_devices_update(gpointer data) {
+    DevicesUpdate *u = data;
+    sync_device_store(u->app->devices, u->devs, u->n);
+    g_free(u->devs);
+    g_free(u);
+    return FALSE;
+}
+
+// Device watcher thread: sysfs has already been read there; hand the list
+// to the main loop.
+static void on_devices_changed(const sdcloner_device *devs, int n, void *user) {
+    DevicesUpdate *u = g_new0(DevicesUpdate, 1);
+    u->app = (App*)user;
+    u->devs = g_new(sdcloner_device, n ? n : 1);
+    memcpy(u->devs, devs, sizeof(*devs) * (size_t)n);
+    u->n = n;
+    g_idle_add(ui_devices_update, u);
+}
+
+// Without a watcher the list is read when a picker opens, as a snapshot.
+static void refresh_devices_now(App *app) {
+    sdcloner_device *devs = NULL;
+    int ndev = 0;
+    if (sdcloner_list_devices(&devs, &ndev) == 0) sync_device_store(app->devices, devs, ndev);
+    free(devs);
+}
+
+// Returns a g_strfreev()-able NULL-terminated list of selected block device
+// paths (or NULL). multi allows Ctrl/Shift-selecting several rows. Cards
+// inserted or removed while the dialog is open show up in it.
+static gchar** pick_block_devices(App *app, const char *title, gboolean multi) {
     GtkWidget *dlg = gtk_dialog_new_with_buttons(
-        title, parent, GTK_DIALOG_MODAL,
+        title, GTK_WINDOW(app->win), GTK_DIALOG_MODAL,
         "_Cancel", GTK_RESPONSE_CANCEL,
         "_Select", GTK_RESPONSE_ACCEPT, NULL);
 
@@ -90,54 +247,51 @@ static char* pick_block_device(GtkWindow *parent, const char *title) {
     gtk_widget_set_size_request(scroll, 640, 300);
     gtk_container_add(GTK_CONTAINER(content), scroll);
 
-    GtkListStore *store = gtk_list_store_new(5, G_TYPE_STRING, G_TYPE_STRING,
-                                                G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
-    char *txt = lsblk_list();
-    if (txt && *txt) {
-        char *save=NULL;
-        for (char *line=strtok_r(txt, "\n", &save); line; line=strtok_r(NULL, "\n", &save)) {
-            char *name=strtok(line, "|");
-            char *size=strtok(NULL, "|");
-            char *model=strtok(NULL, "|");
-            char *type=strtok(NULL, "|");
-            char *rm  =strtok(NULL, "|");
-            if (!name||!size||!type) continue;
-            GtkTreeIter it;
-            gtk_list_store_append(store, &it);
-            gtk_list_store_set(store, &it,
-                               0, name,
-                               1, size,
-                               2, model ? model : "",
-                               3, type,
-                               4, rm ? rm : "0", -1);
-        }
-    }
-    free(txt);
-
-    GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(store));
-    g_object_unref(store);
+    if (!app->watch) refresh_devices_now(app);
+    GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(app->devices));
 
     GtkCellRenderer *r = gtk_cell_renderer_text_new();
-    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Device", r, "text", 0, NULL);
-    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Size",   r, "text", 1, NULL);
-    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Model",  r, "text", 2, NULL);
-    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Type",   r, "text", 3, NULL);
-    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "RM",     r, "text", 4, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Device", r, "text", DEV_COL_PATH, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Size",   r, "text", DEV_COL_SIZE, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Model",  r, "text", DEV_COL_MODEL, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "Type",   r, "text", DEV_COL_TYPE, NULL);
+    gtk_tree_view_insert_column_with_attributes(GTK_TREE_VIEW(view), -1, "RM",     r, "text", DEV_COL_RM, NULL);
 
     gtk_container_add(GTK_CONTAINER(scroll), view);
     gtk_widget_show_all(dlg);
 
-    char *result = NULL;
+    GtkTreeSelection *sel = gtk_tree_view_get_selection(GTK_TREE_VIEW(view));
+    gtk_tree_selection_set_mode(sel, multi ? GTK_SELECTION_MULTIPLE : GTK_SELECTION_SINGLE);
+
+    gchar **result = NULL;
     if (gtk_dialog_run(GTK_DIALOG(dlg)) == GTK_RESPONSE_ACCEPT) {
-        GtkTreeSelection *sel = gtk_tree_view_get_selection(GTK_TREE_VIEW(view));
-        GtkTreeModel *model; GtkTreeIter iter;
-        if (gtk_tree_selection_get_selected(sel, &model, &iter)) {
-            gchar *dev=NULL; gtk_tree_model_get(model, &iter, 0, &dev, -1);
-            if (dev && is_block_device(dev)) result = g_strdup(dev);
-            g_free(dev);
+        GtkTreeModel *model;
+        GList *rows = gtk_tree_selection_get_selected_rows(sel, &model);
+        GPtrArray *arr = g_ptr_array_new();
+        for (GList *l = rows; l; l = l->next) {
+            GtkTreeIter iter;
+            if (!gtk_tree_model_get_iter(model, &iter, (GtkTreePath*)l->data)) continue;
+            gchar *dev=NULL; gtk_tree_model_get(model, &iter, DEV_COL_PATH, &dev, -1);
+            if (dev && is_block_device(dev)) g_ptr_array_add(arr, dev);
+            else g_free(dev);
+        }
+        g_list_free_full(rows, (GDestroyNotify)gtk_tree_path_free);
+        if (arr->len) {
+            g_ptr_array_add(arr, NULL);
+            result = (gchar**)g_ptr_array_free(arr, FALSE);
+        } else {
+            g_ptr_array_free(arr, TRUE);
         }
     }
     gtk_widget_destroy(dlg);
+    return result; // g_strfreev() by caller
+}
+
+// Returns g_strdup() of selected block device path (or NULL)
+static char* pick_block_device(App *app, const char *title) {
+    gchar **v = pick_block_devices(app, title, FALSE);
+    char *result = v ? g_strdup(v[0]) : NULL;
+    g_strfreev(v);
     return result; // g_free() by caller
 }
 
@@ -145,7 +299,7 @@ static char* pick_block_device(GtkWindow *parent, const char *title) {
 static void on_open_image(GtkWidget *w, gpointer user) {
     App *app = (App*)user;
     GtkWidget *dlg = gtk_file_chooser_dialog_new(
-        "Open Image (.img or .img.gz)",
+        "Open Image (.img, .img.gz, .sdimg, .sdref, .xz, .zst, .lz4)",
         GTK_WINDOW(app->win),
         GTK_FILE_CHOOSER_ACTION_OPEN,
         "_Cancel", GTK_RESPONSE_CANCEL,
@@ -156,6 +310,11 @@ static void on_open_image(GtkWidget *w, gpointer user) {
     gtk_file_filter_set_name(flt, "Disk Images");
     gtk_file_filter_add_pattern(flt, "*.img");
     gtk_file_filter_add_pattern(flt, "*.img.gz");
+    gtk_file_filter_add_pattern(flt, "*.sdimg");
+    gtk_file_filter_add_pattern(flt, "*.sdref");
+    gtk_file_filter_add_pattern(flt, "*.img.xz");
+    gtk_file_filter_add_pattern(flt, "*.img.zst");
+    gtk_file_filter_add_pattern(flt, "*.img.lz4");
     gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dlg), flt);
 
     if (gtk_dialog_run(GTK_DIALOG(dlg)) == GTK_RESPONSE_ACCEPT) {
@@ -173,7 +332,7 @@ static void on_open_image(GtkWidget *w, gpointer user) {
 // --------------- Tools → Select Source ----------------
 static void on_select_source(GtkWidget *w, gpointer user) {
     App *app = (App*)user;
-    char *choice = pick_block_device(GTK_WINDOW(app->win), "Select Source Block Device");
+    char *choice = pick_block_device(app, "Select Source Block Device");
     if (!choice) { set_status(app, "Source selection canceled."); return; }
     if (!is_block_device(choice)) { set_status(app, "Not a block device."); g_free(choice); return; }
     g_free(app->source_dev);
@@ -188,85 +347,233 @@ static void on_select_source(GtkWidget *w, gpointer user) {
 // --------------- Tools → Select Destination -----------
 static void on_select_dest(GtkWidget *w, gpointer user) {
     App *app = (App*)user;
-    char *choice = pick_block_device(GTK_WINDOW(app->win), "Select Destination Block Device");
+    gchar **choice = pick_block_devices(app, "Select Destination Block Device(s)", TRUE);
     if (!choice) { set_status(app, "Destination selection canceled."); return; }
-    if (!is_block_device(choice)) { set_status(app, "Not a block device."); g_free(choice); return; }
-    g_free(app->dest_dev);
-    app->dest_dev = g_strdup(choice);
-    gtk_label_set_text(GTK_LABEL(app->label_dest), app->dest_dev);
-    gchar *msg = g_strdup_printf("Destination set to %s", app->dest_dev);
+    g_strfreev(app->dest_devs);
+    app->dest_devs = choice;
+    app->n_dest = (gint)g_strv_length(choice);
+    gchar *joined = g_strjoinv(", ", choice);
+    gtk_label_set_text(GTK_LABEL(app->label_dest), joined);
+    gchar *msg = app->n_dest > 1
+        ? g_strdup_printf("%d destinations set: %s", app->n_dest, joined)
+        : g_strdup_printf("Destination set to %s", joined);
     set_status(app, msg);
     g_free(msg);
-    g_free(choice);
+    g_free(joined);
 }
 
 // ---------------- Background job helpers --------------
-typedef struct { App *app; } JobCtx;
+// Fan-out burns report per card: "3 of 4 cards OK; failed: /dev/sdc".
+static void show_results(JobCtx *jc) {
+    GString *failed = g_string_new(NULL);
+    int ok = 0;
+    for (int i = 0; i < jc->n_results; i++) {
+        if (jc->results[i] == 0) { ok++; continue; }
+        g_string_append_printf(failed, "%s%s%s", failed->len ? ", " : "", jc->dests[i],
+                               jc->results[i] == 2 ? " (verify)" : jc->results[i] == 3 ? " (cancelled)" : "");
+    }
+    gchar *msg = failed->len
+        ? g_strdup_printf("%s: %d of %d cards OK; failed: %s", jc->what, ok, jc->n_results, failed->str)
+        : g_strdup_printf("%s: all %d cards written successfully.", jc->what, jc->n_results);
+    set_status(jc->app, msg);
+    g_free(msg);
+    g_string_free(failed, TRUE);
+}
 
-static gboolean ui_done_ok(gpointer data) {
+static void job_free(gpointer data) {
     JobCtx *jc = (JobCtx*)data;
-    set_status(jc->app, "Operation completed successfully.");
-    set_progress_busy(jc->app, FALSE);
+    g_free(jc->what);
+    g_strfreev(jc->dests);
+    free(jc->results);
     free(jc);
+}
+
+static gboolean find_job_row(App *app, int id, GtkTreeIter *it) {
+    GtkTreeModel *model = GTK_TREE_MODEL(app->job_store);
+    for (gboolean more = gtk_tree_model_get_iter_first(model, it); more;
+         more = gtk_tree_model_iter_next(model, it)) {
+        gint row_id;
+        gtk_tree_model_get(model, it, JOB_COL_ID, &row_id, -1);
+        if (row_id == id) return TRUE;
+    }
     return FALSE;
 }
-static gboolean ui_done_fail(gpointer data) {
-    JobCtx *jc = (JobCtx*)data;
-    set_status(jc->app, "Operation failed (see terminal logs).");
-    set_progress_busy(jc->app, FALSE);
-    free(jc);
+
+typedef struct {
+    App *app;
+    int  id;
+    sdcloner_job_state state;
+} JobEvent;
+
+static void job_ended(App *app, JobCtx *jc, sdcloner_job_state state) {
+    gchar *msg = NULL;
+    sdcloner_job_get(app->sched, jc->id, NULL, jc->results);
+    if (jc->results && state != SDCLONER_JOB_CANCELLED) {
+        show_results(jc);
+    } else if (state == SDCLONER_JOB_DONE) {
+        msg = g_strdup_printf("%s: completed successfully.", jc->what);
+    } else if (state == SDCLONER_JOB_CANCELLED) {
+        msg = g_strdup_printf("%s: cancelled.", jc->what);
+    } else {
+        sdcloner_error err;
+        msg = sdcloner_job_error(app->sched, jc->id, &err) == 0 && err.message[0]
+            ? g_strdup_printf("%s failed: %s", jc->what, err.message)
+            : g_strdup_printf("%s failed (see terminal logs).", jc->what);
+    }
+    if (msg) { set_status(app, msg); g_free(msg); }
+    GtkTreeIter it;
+    if (find_job_row(app, jc->id, &it)) gtk_list_store_remove(app->job_store, &it);
+    g_hash_table_remove(app->jobs, GINT_TO_POINTER(jc->id));
+}
+
+static gboolean ui_job_event(gpointer data) {
+    JobEvent *e = (JobEvent*)data;
+    App *app = e->app;
+    JobCtx *jc = (JobCtx*)g_hash_table_lookup(app->jobs, GINT_TO_POINTER(e->id));
+    if (jc && e->state >= SDCLONER_JOB_DONE) job_ended(app, jc, e->state);
+    else if (jc) jc->state = e->state;
+    if (app->busy && g_hash_table_size(app->jobs) == 0) set_progress_busy(app, FALSE);
+    g_free(e);
     return FALSE;
 }
 
-// ---------------- Tools → Read Source -----------------
-static void* worker_read(void *arg) {
-    JobCtx *jc = (JobCtx*)arg;
-    App *app = jc->app;
-    int rc = sdcloner_clone(app->source_dev, NULL, 0);
-    g_idle_add(rc==0 ? ui_done_ok : ui_done_fail, jc);
-    return NULL;
+// Scheduler callback (scheduler or job thread): hand state changes to the UI.
+static void on_job_state(int id, sdcloner_job_state state, int rc, void *user) {
+    (void)rc;
+    JobEvent *e = g_new0(JobEvent, 1);
+    e->app = (App*)user;
+    e->id = id;
+    e->state = state;
+    g_idle_add(ui_job_event, e);
 }
 
-static void on_read_source(GtkWidget *w, gpointer user) {
-    App *app = (App*)user;
-    if (app->busy) return;
-    if (!app->source_dev) { set_status(app, "Please select a source device first."); return; }
-    set_status(app, "Reading source to local image...");
-    set_progress_busy(app, TRUE);
-    JobCtx *jc = (JobCtx*)calloc(1,sizeof(JobCtx));
+static JobCtx* job_new(App *app) {
+    JobCtx *jc = (JobCtx*)calloc(1, sizeof(JobCtx));
     jc->app = app;
-    pthread_create(&app->worker, NULL, worker_read, jc);
-    pthread_detach(app->worker);
+    sdcloner_options_init(&jc->opt);
+    jc->opt.progress = on_engine_progress;
+    jc->opt.progress_user = jc;
+    return jc;
 }
 
-// --------------- Tools → Burn to Destination ----------
-static void* worker_burn(void *arg) {
-    JobCtx *jc = (JobCtx*)arg;
-    App *app = jc->app;
-    int rc = -1;
-    if (app->image_path && app->dest_dev) {
-        rc = burn_image_to_disk(app->image_path, app->dest_dev);
-    } else if (app->source_dev && app->dest_dev) {
-        rc = sdcloner_clone(app->source_dev, app->dest_dev, 0);
+// Queue jc; on success the UI owns it until job_ended().
+static gboolean job_submit(App *app, JobCtx *jc, sdcloner_job_kind kind, const char *source,
+                           gchar *what) {
+    jc->what = what;
+    sdcloner_job_spec spec = {0};
+    spec.kind = kind;
+    spec.source = source;
+    spec.dests = (const char* const*)jc->dests;
+    spec.ndest = jc->dests ? (int)g_strv_length(jc->dests) : 0;
+    spec.options = &jc->opt;
+    int id = sdcloner_sched_submit(app->sched, &spec);
+    if (id < 0) {
+        set_status(app, "Could not start the job (see terminal logs).");
+        job_free(jc);
+        return FALSE;
     }
-    g_idle_add(rc==0 ? ui_done_ok : ui_done_fail, jc);
-    return NULL;
+    jc->id = id;
+    g_hash_table_insert(app->jobs, GINT_TO_POINTER(id), jc);
+    gtk_list_store_insert_with_values(app->job_store, NULL, -1, JOB_COL_ID, id,
+                                      JOB_COL_WHAT, jc->what, JOB_COL_STATUS, "Queued", -1);
+    if (!app->busy) set_progress_busy(app, TRUE);
+    return TRUE;
 }
 
+// ---------------- Tools → Read Source -----------------
+static void on_read_source(GtkWidget *w, gpointer user) {
+    App *app = (App*)user;
+    if (!app->source_dev) { set_status(app, "Please select a source device first."); return; }
+    if (job_submit(app, job_new(app), SDCLONER_JOB_CLONE, app->source_dev,
+                   g_strdup_printf("Read %s", app->source_dev)))
+        set_status(app, "Reading source to local image...");
+}
+
+// --------------- Tools → Burn to Destination ----------
 static void on_burn_dest(GtkWidget *w, gpointer user) {
     App *app = (App*)user;
-    if (app->busy) return;
-    if (!app->dest_dev) { set_status(app, "Please select a destination device."); return; }
+    if (!app->dest_devs) { set_status(app, "Please select a destination device."); return; }
     if (!app->image_path && !app->source_dev) {
         set_status(app, "Load an image or select a source.");
         return;
     }
-    set_status(app, "Burning to destination...");
-    set_progress_busy(app, TRUE);
-    JobCtx *jc = (JobCtx*)calloc(1,sizeof(JobCtx));
-    jc->app = app;
-    pthread_create(&app->worker, NULL, worker_burn, jc);
-    pthread_detach(app->worker);
+    if (app->n_dest > 1 && !app->image_path) {
+        set_status(app, "Load an image to burn several cards at once.");
+        return;
+    }
+    JobCtx *jc = job_new(app);
+    if (app->image_path) {
+        jc->dests = g_strdupv(app->dest_devs);
+        if (app->n_dest > 1) {
+            jc->n_results = app->n_dest;
+            jc->results = (int*)calloc((size_t)app->n_dest, sizeof(int));
+        }
+        gchar *base = g_path_get_basename(app->image_path);
+        gchar *what = app->n_dest > 1 ? g_strdup_printf("Burn %s to %d cards", base, app->n_dest)
+                                      : g_strdup_printf("Burn %s to %s", base, app->dest_devs[0]);
+        g_free(base);
+        if (job_submit(app, jc, SDCLONER_JOB_BURN, app->image_path, what))
+            set_status(app, app->n_dest > 1 ? "Burning to all destinations..." : "Burning to destination...");
+    } else {
+        gchar *one[] = { app->dest_devs[0], NULL };
+        jc->dests = g_strdupv(one);
+        if (job_submit(app, jc, SDCLONER_JOB_CLONE, app->source_dev,
+                       g_strdup_printf("Clone %s to %s", app->source_dev, app->dest_devs[0])))
+            set_status(app, "Burning to destination...");
+    }
+}
+
+// --------------- Jobs → Pause / Resume / Cancel -------
+// Act on the job selected in the list, else the most recently started one.
+static gint target_job(App *app) {
+    GtkTreeSelection *sel = gtk_tree_view_get_selection(GTK_TREE_VIEW(app->job_view));
+    GtkTreeModel *model;
+    GtkTreeIter it;
+    gint id = 0;
+    if (gtk_tree_selection_get_selected(sel, &model, &it))
+        gtk_tree_model_get(model, &it, JOB_COL_ID, &id, -1);
+    if (id && g_hash_table_contains(app->jobs, GINT_TO_POINTER(id))) return id;
+    GHashTableIter hi;
+    gpointer key;
+    id = 0;
+    g_hash_table_iter_init(&hi, app->jobs);
+    while (g_hash_table_iter_next(&hi, &key, NULL))
+        if (GPOINTER_TO_INT(key) > id) id = GPOINTER_TO_INT(key);
+    if (id) return id;
+    set_status(app, "No job is running.");
+    return 0;
+}
+
+static void on_job_pause(GtkWidget *w, gpointer user) {
+    App *app = (App*)user;
+    gint id = target_job(app);
+    if (id && sdcloner_job_pause(app->sched, id) == 0) set_status(app, "Job paused.");
+}
+
+static void on_job_resume(GtkWidget *w, gpointer user) {
+    App *app = (App*)user;
+    gint id = target_job(app);
+    if (id && sdcloner_job_resume(app->sched, id) == 0) set_status(app, "Job resumed.");
+}
+
+static void on_job_cancel(GtkWidget *w, gpointer user) {
+    App *app = (App*)user;
+    gint id = target_job(app);
+    if (id && sdcloner_job_cancel(app->sched, id) == 0) set_status(app, "Cancelling job...");
+}
+
+static void on_job_cancel_all(GtkWidget *w, gpointer user) {
+    App *app = (App*)user;
+    GHashTableIter hi;
+    gpointer key;
+    int n = 0;
+    g_hash_table_iter_init(&hi, app->jobs);
+    while (g_hash_table_iter_next(&hi, &key, NULL))
+        if (sdcloner_job_cancel(app->sched, GPOINTER_TO_INT(key)) == 0) n++;
+    if (!n) { set_status(app, "No job is running."); return; }
+    gchar *msg = g_strdup_printf("Cancelling %d job(s)...", n);
+    set_status(app, msg);
+    g_free(msg);
 }
 
 // ---------------- Help → About ------------------------
@@ -296,7 +603,9 @@ static void on_about(GtkWidget *w, gpointer user) {
         "Technologies Used:\n"
         "- C (C17)\n"
         "- GTK 3 (GLib)\n"
-        "- dd, gzip, parted, rsync, losetup, lsblk, blkid\n"
+        "- zlib, liblzma (xz), optional zstd / lz4\n"
+        "- dd, gzip, parted, rsync, losetup\n"
+        "- Linux sysfs / mountinfo device probing\n"
         "- Pop!_OS / Ubuntu 22.04\n",
         -1);
 
@@ -347,6 +656,24 @@ static GtkWidget* build_menubar(App *app) {
     g_signal_connect(i_read,    "activate", G_CALLBACK(on_read_source),  app);
     g_signal_connect(i_burn,    "activate", G_CALLBACK(on_burn_dest),    app);
 
+    // Jobs
+    GtkWidget *m_jobs = gtk_menu_new();
+    GtkWidget *i_jobs   = gtk_menu_item_new_with_mnemonic("_Jobs");
+    GtkWidget *i_pause  = gtk_menu_item_new_with_mnemonic("_Pause");
+    GtkWidget *i_resume = gtk_menu_item_new_with_mnemonic("_Resume");
+    GtkWidget *i_cancel = gtk_menu_item_new_with_mnemonic("_Cancel");
+    GtkWidget *i_cancel_all = gtk_menu_item_new_with_mnemonic("Cancel _All");
+    gtk_menu_shell_append(GTK_MENU_SHELL(m_jobs), i_pause);
+    gtk_menu_shell_append(GTK_MENU_SHELL(m_jobs), i_resume);
+    gtk_menu_shell_append(GTK_MENU_SHELL(m_jobs), i_cancel);
+    gtk_menu_shell_append(GTK_MENU_SHELL(m_jobs), i_cancel_all);
+    gtk_menu_item_set_submenu(GTK_MENU_ITEM(i_jobs), m_jobs);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menubar), i_jobs);
+    g_signal_connect(i_pause,  "activate", G_CALLBACK(on_job_pause),  app);
+    g_signal_connect(i_resume, "activate", G_CALLBACK(on_job_resume), app);
+    g_signal_connect(i_cancel, "activate", G_CALLBACK(on_job_cancel), app);
+    g_signal_connect(i_cancel_all, "activate", G_CALLBACK(on_job_cancel_all), app);
+
     // Help
     GtkWidget *m_help = gtk_menu_new();
     GtkWidget *i_help = gtk_menu_item_new_with_mnemonic("_Help");
@@ -364,6 +691,12 @@ int main(int argc, char **argv) {
     gtk_init(&argc, &argv);
 
     App app = {0};
+    g_mutex_init(&app.prog_mu);
+    app.jobs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, job_free);
+    app.sched = sdcloner_sched_new(NULL, on_job_state, &app);
+    app.job_store = gtk_list_store_new(JOB_NCOLS, G_TYPE_INT, G_TYPE_STRING, G_TYPE_STRING);
+    app.devices = gtk_list_store_new(DEV_NCOLS, G_TYPE_STRING, G_TYPE_STRING,
+                                     G_TYPE_STRING, G_TYPE_STRING, G_TYPE_STRING);
     app.win = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     gtk_window_set_title(GTK_WINDOW(app.win), "SD Card Cloner (GUI)");
     gtk_window_set_default_size(GTK_WINDOW(app.win), 760, 460);
@@ -385,16 +718,38 @@ int main(int argc, char **argv) {
     gtk_box_pack_start(GTK_BOX(vbox), app.label_status, FALSE, FALSE, 0);
     gtk_box_pack_start(GTK_BOX(vbox), app.progress,     FALSE, FALSE, 6);
 
+    // job list: select a row for Jobs -> Pause / Resume / Cancel
+    app.job_view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(app.job_store));
+    const char *job_titles[] = { "Job", "Task", "Status" };
+    for (int c = 0; c < JOB_NCOLS; c++) {
+        GtkTreeViewColumn *col = gtk_tree_view_column_new_with_attributes(
+            job_titles[c], gtk_cell_renderer_text_new(), "text", c, NULL);
+        gtk_tree_view_column_set_resizable(col, TRUE);
+        gtk_tree_view_append_column(GTK_TREE_VIEW(app.job_view), col);
+    }
+    GtkWidget *job_scroll = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(job_scroll), GTK_POLICY_AUTOMATIC, GTK_POLICY_AUTOMATIC);
+    gtk_container_add(GTK_CONTAINER(job_scroll), app.job_view);
+    gtk_box_pack_start(GTK_BOX(vbox), job_scroll, TRUE, TRUE, 0);
+
     gtk_container_add(GTK_CONTAINER(app.win), vbox);
     gtk_widget_show_all(app.win);
 
     // progress pulser
     g_timeout_add(200, pulse_cb, &app);
+    // device list: first scan and hotplug updates off the main thread
+    app.watch = sdcloner_watch_devices(on_devices_changed, &app);
 
     gtk_main();
 
+    sdcloner_unwatch_devices(app.watch);
+    sdcloner_sched_free(app.sched);   // cancels what is still running
+    g_hash_table_destroy(app.jobs);
+    g_object_unref(app.job_store);
+    g_object_unref(app.devices);
+
     g_free(app.source_dev);
-    g_free(app.dest_dev);
+    g_strfreev(app.dest_devs);
     g_free(app.image_path);
     return 0;
 }
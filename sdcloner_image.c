@@ -0,0 +1,292 @@
+// sdcloner_image.c
+// Seekable .sdimg container.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "sdcloner_internal.h"
+#include "sdcloner_image.h"
+
+static const unsigned char HDR_MAGIC[8]    = { 'S','D','C','I','M','G', 0, 1 };
+static const unsigned char FOOTER_MAGIC[8] = { 'S','D','C','I','D','X', 0, 1 };
+
+static void put_le32(unsigned char* d, uint32_t v) {
+    d[0] = (unsigned char)v; d[1] = (unsigned char)(v >> 8);
+    d[2] = (unsigned char)(v >> 16); d[3] = (unsigned char)(v >> 24);
+}
+static void put_le64(unsigned char* d, uint64_t v) {
+    put_le32(d, (uint32_t)v); put_le32(d + 4, (uint32_t)(v >> 32));
+}
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static uint64_t le64(const unsigned char* p) { return le32(p) | (uint64_t)le32(p + 4) << 32; }
+
+static int pread_exact(int fd, void* buf, size_t len, uint64_t off) {
+    unsigned char* p = buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, (off_t)off);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        if (n == 0) { errno = EIO; return -1; }
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int pwrite_exact(int fd, const void* buf, size_t len, uint64_t off) {
+    const unsigned char* p = buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+// ---------------- Container ---------------------------
+void sdc_image_encode_header(unsigned char h[SDC_IMG_HDR_LEN], uint32_t chunk_size,
+                             uint64_t image_size, uint64_t nchunks, uint64_t idx_off,
+                             const sdc_image_link* base) {
+    memset(h, 0, SDC_IMG_HDR_LEN);
+    memcpy(h, HDR_MAGIC, 8);
+    put_le32(h + 8, 1);                       // version
+    put_le32(h + 12, chunk_size);
+    put_le64(h + 16, image_size);
+    put_le64(h + 24, nchunks);
+    put_le64(h + 32, idx_off);
+    put_le32(h + 40, SDC_IMG_CODEC_DEFLATE);
+    if (base) {
+        put_le32(h + 44, SDC_IMG_FLAG_DELTA);
+        put_le32(h + 48, (uint32_t)strlen(base->name));
+        put_le32(h + 52, base->idx_crc);
+    }
+    put_le32(h + 60, (uint32_t)crc32(0L, h, 60));
+}
+
+int sdc_image_begin(int fd, uint32_t chunk_size, const sdc_image_link* base, uint64_t* data_off) {
+    unsigned char h[SDC_IMG_HDR_LEN];
+    sdc_image_encode_header(h, chunk_size, 0, 0, 0, base);
+    *data_off = SDC_IMG_HDR_LEN;
+    if (pwrite_exact(fd, h, sizeof(h), 0) != 0) return -1;
+    if (!base) return 0;
+    size_t n = strlen(base->name);
+    *data_off += n;
+    return pwrite_exact(fd, base->name, n, SDC_IMG_HDR_LEN);
+}
+
+int sdc_image_finish(int fd, uint32_t chunk_size, uint64_t image_size,
+                     const sdc_chunk* idx, uint64_t nchunks, uint64_t idx_off,
+                     const sdc_image_link* base) {
+    size_t ilen = (size_t)nchunks * SDC_IMG_IDX_ENTRY;
+    unsigned char* buf = calloc(1, ilen + SDC_IMG_FOOTER_LEN);
+    if (!buf) return -1;
+    for (uint64_t i = 0; i < nchunks; i++) {
+        unsigned char* e = buf + i * SDC_IMG_IDX_ENTRY;
+        put_le64(e, idx[i].offset);
+        put_le32(e + 8, idx[i].clen);
+        put_le32(e + 12, idx[i].flags);
+        put_le32(e + 16, idx[i].crc);
+        put_le32(e + 20, idx[i].crc32c);
+    }
+    unsigned char* f = buf + ilen;
+    memcpy(f, FOOTER_MAGIC, 8);
+    put_le64(f + 8, idx_off);
+    put_le64(f + 16, nchunks);
+    put_le32(f + 24, (uint32_t)crc32(0L, buf, (uInt)ilen));
+    put_le32(f + 28, (uint32_t)crc32(0L, f, 28));
+    int rc = pwrite_exact(fd, buf, ilen + SDC_IMG_FOOTER_LEN, idx_off);
+    free(buf);
+    if (rc != 0) return -1;
+    // The index is durable before the header points at it.
+    if (fdatasync(fd) != 0) return -1;
+    unsigned char h[SDC_IMG_HDR_LEN];
+    sdc_image_encode_header(h, chunk_size, image_size, nchunks, idx_off, base);
+    if (pwrite_exact(fd, h, sizeof(h), 0) != 0) return -1;
+    return ftruncate(fd, (off_t)(idx_off + ilen + SDC_IMG_FOOTER_LEN));
+}
+
+bool sdc_image_is(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    unsigned char m[8];
+    bool is = pread(fd, m, 8, 0) == 8 && !memcmp(m, HDR_MAGIC, 8);
+    close(fd);
+    return is;
+}
+
+static int image_open(const char* path, sdc_image* img, int depth);
+
+// Open the base named in a delta header; relative names resolve beside the delta.
+static int open_base(const char* path, sdc_image* img, const unsigned char* h, int depth) {
+    uint32_t nlen = le32(h + 48);
+    if (!nlen || nlen >= 4096 || depth >= SDC_IMG_CHAIN_MAX) {
+        sdc_loge("%s: bad base reference", path);
+        return -1;
+    }
+    char name[4096], bpath[8192];
+    if (pread_exact(img->fd, name, nlen, SDC_IMG_HDR_LEN) != 0) {
+        sdc_loge("%s: base reference unreadable", path);
+        return -1;
+    }
+    name[nlen] = '\0';
+    const char* slash = strrchr(path, '/');
+    if (name[0] == '/' || !slash) snprintf(bpath, sizeof(bpath), "%s", name);
+    else snprintf(bpath, sizeof(bpath), "%.*s/%s", (int)(slash - path), path, name);
+    img->base = calloc(1, sizeof(sdc_image));
+    if (!img->base) return -1;
+    if (image_open(bpath, img->base, depth + 1) != 0) {
+        free(img->base);
+        img->base = NULL;
+        sdc_loge("%s: base image %s is missing or unreadable", path, bpath);
+        return -1;
+    }
+    if (img->base->idx_crc != le32(h + 52) || img->base->chunk_size != img->chunk_size) {
+        sdc_loge("%s: base image %s is not the one this delta was made from", path, bpath);
+        return -1;
+    }
+    if (img->base->max_clen > img->max_clen) img->max_clen = img->base->max_clen;
+    return 0;
+}
+
+int sdc_image_open(const char* path, sdc_image* img) {
+    return image_open(path, img, 0);
+}
+
+static int image_open(const char* path, sdc_image* img, int depth) {
+    memset(img, 0, sizeof(*img));
+    img->fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (img->fd < 0) { sdc_loge("open(%s): %s", path, strerror(errno)); return -1; }
+    unsigned char h[SDC_IMG_HDR_LEN];
+    if (pread_exact(img->fd, h, sizeof(h), 0) != 0 || memcmp(h, HDR_MAGIC, 8) != 0 ||
+        le32(h + 60) != (uint32_t)crc32(0L, h, 60)) {
+        sdc_loge("%s: not an .sdimg image or header damaged", path);
+        goto fail;
+    }
+    img->chunk_size = le32(h + 12);
+    img->image_size = le64(h + 16);
+    img->nchunks = le64(h + 24);
+    uint64_t idx_off = le64(h + 32);
+    if (le32(h + 8) != 1 || le32(h + 40) != SDC_IMG_CODEC_DEFLATE) {
+        sdc_loge("%s: unsupported .sdimg version/codec", path);
+        goto fail;
+    }
+    if (!idx_off) { sdc_loge("%s: incomplete image (no index)", path); goto fail; }
+    if (!img->chunk_size || img->chunk_size % 512 ||
+        img->nchunks != (img->image_size + img->chunk_size - 1) / img->chunk_size) {
+        sdc_loge("%s: inconsistent .sdimg header", path);
+        goto fail;
+    }
+
+    size_t ilen = (size_t)img->nchunks * SDC_IMG_IDX_ENTRY;
+    unsigned char* buf = malloc(ilen + SDC_IMG_FOOTER_LEN);
+    img->idx = calloc(img->nchunks ? img->nchunks : 1, sizeof(sdc_chunk));
+    if (!buf || !img->idx) { free(buf); sdc_loge("out of memory loading index"); goto fail; }
+    if (pread_exact(img->fd, buf, ilen + SDC_IMG_FOOTER_LEN, idx_off) != 0) {
+        free(buf); sdc_loge("%s: index unreadable: %s", path, strerror(errno)); goto fail;
+    }
+    const unsigned char* f = buf + ilen;
+    img->idx_crc = (uint32_t)crc32(0L, buf, (uInt)ilen);
+    if (memcmp(f, FOOTER_MAGIC, 8) != 0 || le64(f + 8) != idx_off || le64(f + 16) != img->nchunks ||
+        le32(f + 24) != img->idx_crc) {
+        free(buf); sdc_loge("%s: index damaged", path); goto fail;
+    }
+    for (uint64_t i = 0; i < img->nchunks; i++) {
+        const unsigned char* e = buf + i * SDC_IMG_IDX_ENTRY;
+        sdc_chunk* c = &img->idx[i];
+        c->offset = le64(e);
+        c->clen = le32(e + 8);
+        c->flags = le32(e + 12);
+        c->crc = le32(e + 16);
+        c->crc32c = le32(e + 20);
+        if (c->clen > img->max_clen) img->max_clen = c->clen;
+        if (c->offset + c->clen > idx_off) { free(buf); sdc_loge("%s: index damaged", path); goto fail; }
+    }
+    free(buf);
+    if ((le32(h + 44) & SDC_IMG_FLAG_DELTA) && open_base(path, img, h, depth) != 0) goto fail;
+    return 0;
+fail:
+    sdc_image_close(img);
+    return -1;
+}
+
+void sdc_image_close(sdc_image* img) {
+    if (img->fd >= 0) close(img->fd);
+    if (img->base) { sdc_image_close(img->base); free(img->base); }
+    free(img->idx);
+    memset(img, 0, sizeof(*img));
+    img->fd = -1;
+}
+
+size_t sdc_image_chunk_len(const sdc_image* img, uint64_t i) {
+    uint64_t start = i * img->chunk_size;
+    uint64_t left = img->image_size - start;
+    return left < img->chunk_size ? (size_t)left : img->chunk_size;
+}
+
+int sdc_image_read_chunk(const sdc_image* img, uint64_t i, unsigned char* out,
+                         unsigned char* scratch) {
+    const sdc_chunk* c = &img->idx[i];
+    size_t len = sdc_image_chunk_len(img, i);
+    if (c->flags & SDC_CHUNK_ZERO) { memset(out, 0, len); return 0; }
+    if (c->flags & SDC_CHUNK_BASE) {
+        if (!img->base || i >= img->base->nchunks || sdc_image_chunk_len(img->base, i) != len ||
+            img->base->idx[i].crc != c->crc) { errno = EIO; return -1; }
+        return sdc_image_read_chunk(img->base, i, out, scratch);
+    }
+    if (c->flags & SDC_CHUNK_STORED) {
+        if (c->clen != len || pread_exact(img->fd, out, len, c->offset) != 0) return -1;
+    } else {
+        if (pread_exact(img->fd, scratch, c->clen, c->offset) != 0) return -1;
+        z_stream zs; memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, -15) != Z_OK) return -1;
+        zs.next_in = scratch; zs.avail_in = c->clen;
+        zs.next_out = out;    zs.avail_out = (uInt)len;
+        int zrc = inflate(&zs, Z_FINISH);
+        size_t got = len - zs.avail_out;
+        inflateEnd(&zs);
+        if (zrc != Z_STREAM_END || got != len) { errno = EIO; return -1; }
+    }
+    if ((uint32_t)crc32(0L, out, (uInt)len) != c->crc) {
+        sdc_loge("[SDIMG] chunk %llu: checksum mismatch", (unsigned long long)i);
+        errno = EIO;
+        return -1;
+    }
+    return 0;
+}
+
+ssize_t sdc_image_pread(const sdc_image* img, void* buf, size_t len, uint64_t off) {
+    if (off >= img->image_size) return 0;
+    if (len > img->image_size - off) len = (size_t)(img->image_size - off);
+    unsigned char* chunk = malloc(img->chunk_size);
+    unsigned char* scratch = malloc(img->max_clen ? img->max_clen : 1);
+    if (!chunk || !scratch) { free(chunk); free(scratch); return -1; }
+    size_t done = 0;
+    while (done < len) {
+        uint64_t pos = off + done;
+        uint64_t i = pos / img->chunk_size;
+        size_t in = (size_t)(pos % img->chunk_size);
+        size_t n = sdc_image_chunk_len(img, i) - in;
+        if (n > len - done) n = len - done;
+        if (img->idx[i].flags & SDC_CHUNK_ZERO) {
+            memset((unsigned char*)buf + done, 0, n);
+        } else {
+            if (sdc_image_read_chunk(img, i, chunk, scratch) != 0) { done = (size_t)-1; break; }
+            memcpy((unsigned char*)buf + done, chunk + in, n);
+        }
+        done += n;
+    }
+    free(chunk);
+    free(scratch);
+    return done == (size_t)-1 ? -1 : (ssize_t)done;
+}
@@ -0,0 +1,99 @@
+// sdcloner_image.h
+// Native seekable image container (.sdimg).
+//
+// Layout (all integers little-endian):
+//   header  64 bytes  "SDCIMG\0\1", version, chunk size, image size, chunk
+//                     count, index offset, codec, flags, base name length,
+//                     base index CRC32, CRC32 of the header
+//   base              delta images only: the base image's name
+//   chunks            each chunk_size bytes of the disk (last may be short),
+//                     raw deflate, stored as-is if that is smaller, or
+//                     absent for all-zero chunks and chunks of the base
+//   index   24 bytes per chunk: offset, stored length, flags, CRC32 and
+//                     CRC32C (0 if not recorded) of the uncompressed chunk
+//   footer  32 bytes  "SDCIDX\0\1", index offset, chunk count, index CRC32
+// The header's index offset stays 0 until the index is complete, so a
+// truncated write is never mistaken for a valid image.
+//
+// A delta image (incremental backup) names a base .sdimg with the same chunk
+// size; chunks flagged SDC_CHUNK_BASE are read from the base's chunk at the
+// same index, recursively for chains of deltas. The base's index CRC32 is
+// recorded so a replaced base is refused rather than silently mixed in.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define SDC_IMG_EXT         "sdimg"
+#define SDC_IMG_HDR_LEN     64
+#define SDC_IMG_IDX_ENTRY   24
+#define SDC_IMG_FOOTER_LEN  32
+#define SDC_IMG_CODEC_DEFLATE 1
+#define SDC_IMG_FLAG_DELTA    1
+#define SDC_IMG_CHAIN_MAX     64    // deltas on top of a full image
+
+enum {
+    SDC_CHUNK_ZERO   = 1,   // all zero bytes, nothing stored
+    SDC_CHUNK_STORED = 2,   // stored uncompressed
+    SDC_CHUNK_BASE   = 4,   // unchanged, read from the base image
+};
+
+typedef struct {
+    uint64_t offset;    // file offset of the stored bytes
+    uint32_t clen;      // stored length
+    uint32_t flags;     // SDC_CHUNK_*
+    uint32_t crc;       // CRC32 of the uncompressed chunk
+    uint32_t crc32c;    // CRC32C of the uncompressed chunk, 0 = not recorded
+} sdc_chunk;
+
+typedef struct sdc_image {
+    int        fd;
+    uint32_t   chunk_size;
+    uint64_t   image_size;   // logical (uncompressed) size
+    uint64_t   nchunks;
+    sdc_chunk* idx;
+    uint32_t   max_clen;     // largest stored chunk of the whole chain, for scratch buffers
+    uint32_t   idx_crc;      // CRC32 of the index, identifies the image as a base
+    struct sdc_image* base;  // delta images: the opened base
+} sdc_image;
+
+// Base of a delta image being written.
+typedef struct {
+    const char* name;        // stored as given: relative names resolve beside the delta
+    uint32_t    idx_crc;     // the base's sdc_image.idx_crc
+} sdc_image_link;
+
+// True if path starts with the .sdimg magic.
+bool sdc_image_is(const char* path);
+
+// Open an .sdimg and load its index, and for a delta image its bases.
+// Returns 0 / -1 (logged).
+int  sdc_image_open(const char* path, sdc_image* img);
+void sdc_image_close(sdc_image* img);
+
+// Uncompressed length of chunk i.
+size_t sdc_image_chunk_len(const sdc_image* img, uint64_t i);
+
+// Decode chunk i into out (chunk_size bytes), checking its CRC. scratch must
+// hold max_clen bytes. Thread-safe for distinct buffers. Returns 0 / -1.
+int sdc_image_read_chunk(const sdc_image* img, uint64_t i, unsigned char* out,
+                         unsigned char* scratch);
+
+// Random access: read len bytes of the disk at off, decoding only the chunks
+// that cover the range. Returns bytes read (short at the end), -1 on error.
+ssize_t sdc_image_pread(const sdc_image* img, void* buf, size_t len, uint64_t off);
+
+// Writer side, used by the imaging pipeline: write a placeholder header (and
+// the base name for a delta, base may be NULL) and return the offset of the
+// first chunk in *data_off; then append index + footer at idx_off and
+// finalise the header. Returns 0 / -1.
+void sdc_image_encode_header(unsigned char h[SDC_IMG_HDR_LEN], uint32_t chunk_size,
+                             uint64_t image_size, uint64_t nchunks, uint64_t idx_off,
+                             const sdc_image_link* base);
+int  sdc_image_begin(int fd, uint32_t chunk_size, const sdc_image_link* base, uint64_t* data_off);
+int  sdc_image_finish(int fd, uint32_t chunk_size, uint64_t image_size,
+                      const sdc_chunk* idx, uint64_t nchunks, uint64_t idx_off,
+                      const sdc_image_link* base);
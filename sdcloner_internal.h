@@ -0,0 +1,23 @@
+// sdcloner_internal.h
+// Helpers shared between engine modules (not part of the public API).
+// License: GPLv3
+
+#pragma once
+#include <pthread.h>
+
+// Log to stdout / stderr with a trailing newline. The first error logged by
+// a job run through an sdcloner_ctx becomes its error message.
+void sdc_logi(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+void sdc_loge(const char* fmt, ...) __attribute__((format(printf, 1, 2)));
+// sdc_loge() that also classifies the job's failure (an sdcloner_errcode).
+void sdc_fail(int code, const char* fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// pthread_create() for threads working for a job: errors they log are
+// reported by the job's context.
+int sdc_thread_create(pthread_t* th, void* (*fn)(void*), void* arg);
+
+// Run a shell command (logged as [CMD]). Returns its exit status, -1 on error.
+int sdc_run_cmd(const char* cmd);
+
+// Run a shell command and capture stdout (malloc'd, caller frees; NULL on error).
+char* sdc_run_cmd_capture(const char* cmd);
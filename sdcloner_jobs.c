@@ -0,0 +1,470 @@
+// sdcloner_jobs.c
+// Concurrent job scheduler with per-controller limits, bandwidth budgets,
+// pause and cancel.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "sdcloner_engine.h"
+#include "sdcloner_internal.h"
+#include "sdcloner_trace.h"
+#include "sdcloner_jobs.h"
+
+#define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
+#define JOB_MAXBUS 16            // controllers one job can span
+#define RATE_BURST_NS 250000000ULL   // idle time a budget may catch up on
+
+// ---------------- Bandwidth budgets -------------------
+// Virtual clock: t_ns is when everything granted so far has been paid for
+// at bps. A grant is due at the clock before it, so a job under its budget
+// never waits, and idle time is only banked for RATE_BURST_NS.
+typedef struct {
+    pthread_mutex_t mu;
+    double          bps;      // bytes per second, 0 = unlimited
+    uint64_t        t_ns;
+} sdc_rate;
+
+static void rate_init(sdc_rate* r, double mbps) {
+    pthread_mutex_init(&r->mu, NULL);
+    r->bps = mbps > 0 ? mbps * (double)MB(1) : 0;
+    r->t_ns = 0;
+}
+
+// When bytes granted now on r may move.
+static uint64_t rate_take(sdc_rate* r, uint64_t bytes, uint64_t now) {
+    if (r->bps <= 0) return now;
+    pthread_mutex_lock(&r->mu);
+    uint64_t floor = now > RATE_BURST_NS ? now - RATE_BURST_NS : 0;
+    if (r->t_ns < floor) r->t_ns = floor;
+    uint64_t due = r->t_ns;
+    r->t_ns += (uint64_t)((double)bytes * 1e9 / r->bps);
+    pthread_mutex_unlock(&r->mu);
+    return due;
+}
+
+// ---------------- Job control -------------------------
+struct sdc_ctl {
+    pthread_mutex_t mu;
+    pthread_cond_t  cv;       // CLOCK_MONOTONIC; pause / resume / cancel
+    bool            paused;
+    bool            cancelled;
+    sdc_rate        rate;     // the job's own budget
+    sdc_rate*       bus[JOB_MAXBUS];   // one entry per device on that controller
+    int             nbus;
+};
+
+static _Thread_local sdc_ctl* ctl_self;
+
+sdc_ctl* sdc_ctl_self(void) { return ctl_self; }
+
+bool sdc_ctl_cancelled(sdc_ctl* c) {
+    if (!c) return false;
+    pthread_mutex_lock(&c->mu);
+    bool v = c->cancelled;
+    pthread_mutex_unlock(&c->mu);
+    return v;
+}
+
+bool sdc_ctl_gate(sdc_ctl* c, uint64_t bytes) {
+    if (!c) return true;
+    pthread_mutex_lock(&c->mu);
+    while (c->paused && !c->cancelled) pthread_cond_wait(&c->cv, &c->mu);
+    bool go = !c->cancelled;
+    pthread_mutex_unlock(&c->mu);
+    if (!go) return false;
+
+    uint64_t now = sdc_trace_now(), due = rate_take(&c->rate, bytes, now);
+    for (int i = 0; i < c->nbus; i++) {
+        uint64_t d = rate_take(c->bus[i], bytes, now);
+        if (d > due) due = d;
+    }
+    pthread_mutex_lock(&c->mu);
+    while (!c->cancelled && (c->paused || sdc_trace_now() < due)) {
+        if (c->paused) { pthread_cond_wait(&c->cv, &c->mu); continue; }
+        struct timespec ts = { .tv_sec = (time_t)(due / 1000000000ULL), .tv_nsec = (long)(due % 1000000000ULL) };
+        pthread_cond_timedwait(&c->cv, &c->mu, &ts);
+    }
+    go = !c->cancelled;
+    pthread_mutex_unlock(&c->mu);
+    return go;
+}
+
+static void ctl_init(sdc_ctl* c, double mbps) {
+    pthread_condattr_t ca;
+    pthread_condattr_init(&ca);
+    pthread_condattr_setclock(&ca, CLOCK_MONOTONIC);
+    pthread_mutex_init(&c->mu, NULL);
+    pthread_cond_init(&c->cv, &ca);
+    pthread_condattr_destroy(&ca);
+    rate_init(&c->rate, mbps);
+}
+
+static void ctl_set(sdc_ctl* c, bool* field, bool v) {
+    pthread_mutex_lock(&c->mu);
+    *field = v;
+    pthread_cond_broadcast(&c->cv);
+    pthread_mutex_unlock(&c->mu);
+}
+
+// ---------------- Scheduler ---------------------------
+typedef struct {
+    char     key[64];
+    unsigned running;         // jobs admitted that use this controller
+    sdc_rate rate;
+} sched_bus;
+
+typedef struct {
+    int                id;
+    sdcloner_sched*    s;
+    sdcloner_job_kind  kind;
+    char*              source;
+    char**             dests;
+    int                ndest;
+    uint64_t           hint;
+    sdcloner_options   opt;
+    bool               has_opt;
+    int*               results;
+    sdc_ctl            ctl;
+    sched_bus*         buses[JOB_MAXBUS];   // distinct, for admission
+    int                nbuses;
+    sdcloner_job_state state;
+    bool               started;
+    int                rc;
+    sdcloner_error     err;
+    pthread_t          th;
+    bool               joinable;
+} sched_job;
+
+struct sdcloner_sched {
+    sdcloner_sched_opts o;
+    sdcloner_job_fn     fn;
+    void*               user;
+    pthread_mutex_t     mu;
+    pthread_cond_t      cv;       // admissions and job ends
+    sched_job**         jobs;     // index = id - 1, in submission order
+    int                 njobs, cap;
+    sched_bus**         buses;
+    int                 nbuses, bcap;
+    unsigned            running;
+};
+
+void sdcloner_sched_opts_init(sdcloner_sched_opts* o) {
+    memset(o, 0, sizeof(*o));
+    o->max_jobs = 8;
+    o->jobs_per_bus = 2;
+}
+
+sdcloner_sched* sdcloner_sched_new(const sdcloner_sched_opts* opts, sdcloner_job_fn fn, void* user) {
+    sdcloner_sched* s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    if (opts) s->o = *opts; else sdcloner_sched_opts_init(&s->o);
+    if (!s->o.max_jobs) s->o.max_jobs = 1;
+    if (!s->o.jobs_per_bus) s->o.jobs_per_bus = 1;
+    s->fn = fn;
+    s->user = user;
+    pthread_mutex_init(&s->mu, NULL);
+    pthread_cond_init(&s->cv, NULL);
+    return s;
+}
+
+// With s->mu held.
+static sched_bus* bus_get(sdcloner_sched* s, const char* key) {
+    for (int i = 0; i < s->nbuses; i++)
+        if (strcmp(s->buses[i]->key, key) == 0) return s->buses[i];
+    if (s->nbuses == s->bcap) {
+        int cap = s->bcap ? s->bcap * 2 : 8;
+        sched_bus** nb = realloc(s->buses, sizeof(*nb) * (size_t)cap);
+        if (!nb) return NULL;
+        s->buses = nb;
+        s->bcap = cap;
+    }
+    sched_bus* b = calloc(1, sizeof(*b));
+    if (!b) return NULL;
+    snprintf(b->key, sizeof(b->key), "%s", key);
+    rate_init(&b->rate, s->o.bus_mbps);
+    s->buses[s->nbuses++] = b;
+    return b;
+}
+
+// With s->mu held: charge dev's controller to j (files have none).
+static void job_add_bus(sched_job* j, const char* dev) {
+    char key[64];
+    if (!dev || sdcloner_device_bus(dev, key, sizeof(key)) != 0 || j->ctl.nbus == JOB_MAXBUS) return;
+    sched_bus* b = bus_get(j->s, key);
+    if (!b) return;
+    j->ctl.bus[j->ctl.nbus++] = &b->rate;
+    for (int i = 0; i < j->nbuses; i++) if (j->buses[i] == b) return;
+    j->buses[j->nbuses++] = b;
+}
+
+static bool job_fits(const sdcloner_sched* s, const sched_job* j) {
+    if (j->state != SDCLONER_JOB_QUEUED || s->running >= s->o.max_jobs) return false;
+    for (int i = 0; i < j->nbuses; i++)
+        if (j->buses[i]->running >= s->o.jobs_per_bus) return false;
+    return true;
+}
+
+// With s->mu held: j may start if it fits and no job queued before it does.
+static bool job_admissible(const sdcloner_sched* s, const sched_job* j) {
+    if (!job_fits(s, j)) return false;
+    for (int i = 0; i < j->id - 1; i++)
+        if (job_fits(s, s->jobs[i])) return false;
+    return true;
+}
+
+static void notify(sched_job* j, sdcloner_job_state st, int rc) {
+    if (j->s->fn) j->s->fn(j->id, st, rc, j->s->user);
+}
+
+// Runs in a context of its own; its error lands in *err.
+static int job_run(sched_job* j, sdcloner_error* err) {
+    sdcloner_ctx* c = sdcloner_ctx_new(j->has_opt ? &j->opt : NULL);
+    if (!c) {
+        err->code = SDCLONER_ERR_FAILED;
+        snprintf(err->message, sizeof(err->message), "out of memory");
+        return 1;
+    }
+    const char* d0 = j->ndest ? j->dests[0] : NULL;
+    int rc = 1;
+    switch (j->kind) {
+    case SDCLONER_JOB_CLONE:   rc = sdcloner_ctx_clone(c, j->source, d0, j->hint); break;
+    case SDCLONER_JOB_BURN:
+        rc = sdcloner_ctx_burn(c, j->source, (const char* const*)j->dests, j->ndest, j->results);
+        break;
+    case SDCLONER_JOB_CONVERT: rc = sdcloner_ctx_convert(c, j->source, d0); break;
+    case SDCLONER_JOB_RESCUE:  rc = sdcloner_ctx_rescue(c, j->source, d0); break;
+    }
+    *err = *sdcloner_ctx_error(c);
+    sdcloner_ctx_free(c);
+    return rc;
+}
+
+static void* job_main(void* arg) {
+    sched_job* j = arg;
+    sdcloner_sched* s = j->s;
+    pthread_mutex_lock(&s->mu);
+    while (!sdc_ctl_cancelled(&j->ctl) && !job_admissible(s, j)) pthread_cond_wait(&s->cv, &s->mu);
+    if (sdc_ctl_cancelled(&j->ctl)) {
+        j->state = SDCLONER_JOB_CANCELLED;
+        j->err.code = SDCLONER_ERR_CANCELLED;
+        snprintf(j->err.message, sizeof(j->err.message), "cancelled before it started");
+        pthread_cond_broadcast(&s->cv);
+        pthread_mutex_unlock(&s->mu);
+        notify(j, SDCLONER_JOB_CANCELLED, 0);
+        return NULL;
+    }
+    s->running++;
+    for (int i = 0; i < j->nbuses; i++) j->buses[i]->running++;
+    j->state = SDCLONER_JOB_RUNNING;
+    j->started = true;
+    pthread_mutex_unlock(&s->mu);
+    sdc_logi("[JOB] %d started", j->id);
+    notify(j, SDCLONER_JOB_RUNNING, 0);
+
+    ctl_self = &j->ctl;
+    sdcloner_error err;
+    int rc = job_run(j, &err);
+    ctl_self = NULL;
+
+    bool cancelled = sdc_ctl_cancelled(&j->ctl);
+    sdcloner_job_state st = cancelled ? SDCLONER_JOB_CANCELLED : rc == 0 ? SDCLONER_JOB_DONE : SDCLONER_JOB_FAILED;
+    pthread_mutex_lock(&s->mu);
+    s->running--;
+    for (int i = 0; i < j->nbuses; i++) j->buses[i]->running--;
+    j->state = st;
+    j->rc = rc;
+    j->err = err;
+    pthread_cond_broadcast(&s->cv);
+    pthread_mutex_unlock(&s->mu);
+    sdc_logi("[JOB] %d %s (%d)", j->id, cancelled ? "cancelled" : rc == 0 ? "done" : "failed", rc);
+    notify(j, st, rc);
+    return NULL;
+}
+
+static void job_free(sched_job* j) {
+    free(j->source);
+    for (int i = 0; i < j->ndest; i++) free(j->dests[i]);
+    free(j->dests);
+    free(j->results);
+    free(j);
+}
+
+int sdcloner_sched_submit(sdcloner_sched* s, const sdcloner_job_spec* spec) {
+    if (!s || !spec || !spec->source || spec->ndest < 0 ||
+        (spec->kind == SDCLONER_JOB_BURN && spec->ndest < 1) ||
+        (spec->kind == SDCLONER_JOB_CONVERT && spec->ndest != 1) ||
+        (spec->kind != SDCLONER_JOB_BURN && spec->ndest > 1)) {
+        sdc_loge("[JOB] invalid job");
+        return -1;
+    }
+    sched_job* j = calloc(1, sizeof(*j));
+    if (!j) return -1;
+    j->s = s;
+    j->kind = spec->kind;
+    j->ndest = spec->ndest;
+    j->hint = spec->dest_capacity_hint;
+    j->has_opt = spec->options != NULL;
+    if (j->has_opt) j->opt = *spec->options;
+    j->source = strdup(spec->source);
+    j->dests = calloc((size_t)(j->ndest ? j->ndest : 1), sizeof(char*));
+    j->results = calloc((size_t)(j->ndest ? j->ndest : 1), sizeof(int));
+    bool ok = j->source && j->dests && j->results;
+    for (int i = 0; ok && i < j->ndest; i++) ok = (j->dests[i] = strdup(spec->dests[i])) != NULL;
+    if (!ok) { job_free(j); return -1; }
+    ctl_init(&j->ctl, spec->max_mbps);
+
+    pthread_mutex_lock(&s->mu);
+    if (s->njobs == s->cap) {
+        int cap = s->cap ? s->cap * 2 : 16;
+        sched_job** nj = realloc(s->jobs, sizeof(*nj) * (size_t)cap);
+        if (!nj) { pthread_mutex_unlock(&s->mu); job_free(j); return -1; }
+        s->jobs = nj;
+        s->cap = cap;
+    }
+    if (j->kind == SDCLONER_JOB_CLONE || j->kind == SDCLONER_JOB_RESCUE) job_add_bus(j, j->source);
+    if (j->kind == SDCLONER_JOB_CLONE || j->kind == SDCLONER_JOB_BURN)
+        for (int i = 0; i < j->ndest; i++) job_add_bus(j, j->dests[i]);
+    j->id = s->njobs + 1;
+    j->state = SDCLONER_JOB_QUEUED;
+    s->jobs[s->njobs++] = j;
+    pthread_mutex_unlock(&s->mu);
+    sdc_logi("[JOB] %d queued: %s %s", j->id, j->kind == SDCLONER_JOB_CLONE ? "clone" :
+             j->kind == SDCLONER_JOB_BURN ? "burn" : j->kind == SDCLONER_JOB_CONVERT ? "convert" : "rescue",
+             j->source);
+    notify(j, SDCLONER_JOB_QUEUED, 0);
+
+    j->joinable = pthread_create(&j->th, NULL, job_main, j) == 0;
+    if (!j->joinable) {
+        sdc_loge("[JOB] cannot start job %d", j->id);
+        pthread_mutex_lock(&s->mu);
+        j->state = SDCLONER_JOB_FAILED;
+        j->rc = 1;
+        j->err.code = SDCLONER_ERR_FAILED;
+        snprintf(j->err.message, sizeof(j->err.message), "cannot start job %d", j->id);
+        pthread_cond_broadcast(&s->cv);
+        pthread_mutex_unlock(&s->mu);
+        notify(j, SDCLONER_JOB_FAILED, 1);
+        return -1;
+    }
+    return j->id;
+}
+
+static sched_job* job_of(sdcloner_sched* s, int id) {
+    return s && id >= 1 && id <= s->njobs ? s->jobs[id - 1] : NULL;
+}
+
+static bool job_ended(const sched_job* j) {
+    return j->state == SDCLONER_JOB_DONE || j->state == SDCLONER_JOB_FAILED ||
+           j->state == SDCLONER_JOB_CANCELLED;
+}
+
+// A paused job that has not started is not admitted; a running one stops
+// at its next block.
+int sdcloner_job_pause(sdcloner_sched* s, int id) {
+    if (!s) return -1;
+    pthread_mutex_lock(&s->mu);
+    sched_job* j = job_of(s, id);
+    bool ok = j && !job_ended(j) && j->state != SDCLONER_JOB_PAUSED;
+    if (ok) {
+        ctl_set(&j->ctl, &j->ctl.paused, true);
+        j->state = SDCLONER_JOB_PAUSED;
+    }
+    pthread_mutex_unlock(&s->mu);
+    if (!ok) return -1;
+    notify(j, SDCLONER_JOB_PAUSED, 0);
+    return 0;
+}
+
+int sdcloner_job_resume(sdcloner_sched* s, int id) {
+    if (!s) return -1;
+    pthread_mutex_lock(&s->mu);
+    sched_job* j = job_of(s, id);
+    bool ok = j && j->state == SDCLONER_JOB_PAUSED;
+    sdcloner_job_state st = SDCLONER_JOB_QUEUED;
+    if (ok) {
+        st = j->started ? SDCLONER_JOB_RUNNING : SDCLONER_JOB_QUEUED;
+        j->state = st;
+        ctl_set(&j->ctl, &j->ctl.paused, false);
+        pthread_cond_broadcast(&s->cv);
+    }
+    pthread_mutex_unlock(&s->mu);
+    if (!ok) return -1;
+    notify(j, st, 0);
+    return 0;
+}
+
+int sdcloner_job_cancel(sdcloner_sched* s, int id) {
+    if (!s) return -1;
+    pthread_mutex_lock(&s->mu);
+    sched_job* j = job_of(s, id);
+    bool ok = j && !job_ended(j);
+    if (ok) {
+        ctl_set(&j->ctl, &j->ctl.cancelled, true);
+        pthread_cond_broadcast(&s->cv);
+    }
+    pthread_mutex_unlock(&s->mu);
+    return ok ? 0 : -1;
+}
+
+sdcloner_job_state sdcloner_job_get(sdcloner_sched* s, int id, int* rc, int* results) {
+    sdcloner_job_state st = SDCLONER_JOB_FAILED;
+    if (!s) return st;
+    pthread_mutex_lock(&s->mu);
+    sched_job* j = job_of(s, id);
+    if (j) {
+        st = j->state;
+        if (rc) *rc = job_ended(j) ? j->rc : 0;
+        if (results && j->kind == SDCLONER_JOB_BURN)
+            memcpy(results, j->results, sizeof(int) * (size_t)j->ndest);
+    }
+    pthread_mutex_unlock(&s->mu);
+    return st;
+}
+
+int sdcloner_job_error(sdcloner_sched* s, int id, sdcloner_error* err) {
+    int rc = -1;
+    if (!s || !err) return rc;
+    pthread_mutex_lock(&s->mu);
+    sched_job* j = job_of(s, id);
+    if (j && job_ended(j)) {
+        *err = j->err;
+        rc = 0;
+    }
+    pthread_mutex_unlock(&s->mu);
+    return rc;
+}
+
+void sdcloner_sched_wait(sdcloner_sched* s) {
+    if (!s) return;
+    pthread_mutex_lock(&s->mu);
+    for (int i = 0; i < s->njobs; i++)
+        while (!job_ended(s->jobs[i])) pthread_cond_wait(&s->cv, &s->mu);
+    pthread_mutex_unlock(&s->mu);
+}
+
+void sdcloner_sched_free(sdcloner_sched* s) {
+    if (!s) return;
+    for (int id = 1; id <= s->njobs; id++) sdcloner_job_cancel(s, id);
+    for (int i = 0; i < s->njobs; i++) {
+        sched_job* j = s->jobs[i];
+        if (j->joinable) pthread_join(j->th, NULL);
+        pthread_cond_destroy(&j->ctl.cv);
+        pthread_mutex_destroy(&j->ctl.mu);
+        job_free(j);
+    }
+    for (int i = 0; i < s->nbuses; i++) free(s->buses[i]);
+    free(s->jobs);
+    free(s->buses);
+    pthread_cond_destroy(&s->cv);
+    pthread_mutex_destroy(&s->mu);
+    free(s);
+}
@@ -0,0 +1,25 @@
+// sdcloner_jobs.h
+// Job control behind the scheduler (sdcloner_sched_* in sdcloner_engine.h):
+// pause, cancel and bandwidth budgets, applied where data moves. The
+// imaging pipeline, the fan-out burn, read-back verification and rescue call
+// sdc_ctl_gate() once per block with the bytes about to move; it sleeps
+// while the job is paused or ahead of its budget (its own and that of every
+// host controller it uses) and returns false once the job is cancelled.
+//
+// Engine entry points pick up the control of the job they run for with
+// sdc_ctl_self(). Outside the scheduler that is NULL and every gate is free.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct sdc_ctl sdc_ctl;
+
+// Wait until bytes may move for c's job. Returns false if it was cancelled
+// (NULL: always true, never waits).
+bool sdc_ctl_gate(sdc_ctl* c, uint64_t bytes);
+bool sdc_ctl_cancelled(sdc_ctl* c);
+
+// Control of the job the calling thread runs, or NULL.
+sdc_ctl* sdc_ctl_self(void);
@@ -0,0 +1,146 @@
+// sdcloner_manifest.c
+// Block-hash manifests for differential burns.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_ptable.h"
+#include "sdcloner_verify.h"
+#include "sdcloner_manifest.h"
+
+#define MAN_HDR_LEN 40
+
+static const unsigned char MAN_MAGIC[8] = { 'S','D','C','M','A','N', 0, 1 };
+
+static void put_le32(unsigned char* d, uint32_t v) {
+    d[0] = (unsigned char)v; d[1] = (unsigned char)(v >> 8);
+    d[2] = (unsigned char)(v >> 16); d[3] = (unsigned char)(v >> 24);
+}
+static void put_le64(unsigned char* d, uint64_t v) {
+    put_le32(d, (uint32_t)v); put_le32(d + 4, (uint32_t)(v >> 32));
+}
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static uint64_t le64(const unsigned char* p) { return le32(p) | (uint64_t)le32(p + 4) << 32; }
+
+void sdc_manifest_free(sdc_manifest* m) {
+    free(m->hash);
+    memset(m, 0, sizeof(*m));
+}
+
+int sdc_manifest_load(const char* path, sdc_manifest* m) {
+    memset(m, 0, sizeof(*m));
+    FILE* fp = fopen(path, "rbe");
+    if (!fp) return errno == ENOENT ? 1 : -1;
+    unsigned char h[MAN_HDR_LEN], t[4];
+    int rc = -1;
+    if (fread(h, 1, sizeof(h), fp) != sizeof(h) || memcmp(h, MAN_MAGIC, 8) != 0 ||
+        le32(h + 8) != 1 || le32(h + 36) != sdc_crc32c(0, h, 36))
+        goto out;
+    m->block_size = le32(h + 12);
+    m->dev_size = le64(h + 16);
+    m->n = le64(h + 24);
+    if (!m->block_size || m->block_size % SDC_IO_ALIGN ||
+        m->n > (m->dev_size + m->block_size - 1) / m->block_size)
+        goto out;
+    m->hash = malloc((m->n ? m->n : 1) * sizeof(uint64_t));
+    if (!m->hash) goto out;
+    unsigned char e[8];
+    uint32_t crc = 0;
+    for (uint64_t i = 0; i < m->n; i++) {
+        if (fread(e, 1, 8, fp) != 8) goto out;
+        crc = sdc_crc32c(crc, e, 8);
+        m->hash[i] = le64(e);
+    }
+    if (fread(t, 1, 4, fp) != 4 || le32(t) != crc) goto out;
+    rc = 0;
+out:
+    fclose(fp);
+    if (rc != 0) {
+        sdc_loge("[DIFF] manifest %s is damaged, ignored", path);
+        sdc_manifest_free(m);
+    }
+    return rc;
+}
+
+int sdc_manifest_save(const char* path, const sdc_manifest* m) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* fp = fopen(tmp, "wbe");
+    if (!fp) { sdc_loge("[DIFF] cannot write %s: %s", tmp, strerror(errno)); return -1; }
+    unsigned char h[MAN_HDR_LEN], e[8], t[4];
+    memset(h, 0, sizeof(h));
+    memcpy(h, MAN_MAGIC, 8);
+    put_le32(h + 8, 1);
+    put_le32(h + 12, m->block_size);
+    put_le64(h + 16, m->dev_size);
+    put_le64(h + 24, m->n);
+    put_le32(h + 36, sdc_crc32c(0, h, 36));
+    bool ok = fwrite(h, 1, sizeof(h), fp) == sizeof(h);
+    uint32_t crc = 0;
+    for (uint64_t i = 0; ok && i < m->n; i++) {
+        put_le64(e, m->hash[i]);
+        crc = sdc_crc32c(crc, e, 8);
+        ok = fwrite(e, 1, 8, fp) == 8;
+    }
+    put_le32(t, crc);
+    ok = ok && fwrite(t, 1, 4, fp) == 4 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(tmp, path) != 0) {
+        sdc_loge("[DIFF] cannot write %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static bool block_matches(int fd, const sdc_manifest* m, uint64_t blk, unsigned char* buf) {
+    if (blk >= m->n || !m->hash[blk]) return true;   // nothing recorded
+    uint64_t off = blk * m->block_size;
+    size_t len = m->dev_size - off < m->block_size ? (size_t)(m->dev_size - off) : m->block_size;
+    size_t rlen = (len + SDC_IO_ALIGN - 1) / SDC_IO_ALIGN * SDC_IO_ALIGN;
+    size_t got = 0;
+    while (got < rlen) {
+        ssize_t n = pread(fd, buf + got, rlen - got, (off_t)(off + got));
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    return got >= len && sdc_hash64(buf, len) == m->hash[blk];
+}
+
+bool sdc_manifest_matches(const sdc_manifest* m, const char* dev_path, uint64_t dev_size) {
+    if (!m->n || m->dev_size != dev_size) return false;
+    int fd = open(dev_path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (fd < 0) fd = open(dev_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    unsigned char* buf = NULL;
+    if (posix_memalign((void**)&buf, SDC_IO_ALIGN, m->block_size) != 0) { close(fd); return false; }
+
+    bool ok = block_matches(fd, m, 0, buf) && block_matches(fd, m, m->n - 1, buf);
+    sdc_ptable pt;
+    if (ok && sdc_ptable_read(dev_path, &pt) == 0) {
+        for (int i = 0; ok && i < pt.n; i++) {
+            uint64_t start = pt.part[i].start * pt.sector_size;
+            ok = block_matches(fd, m, start / m->block_size, buf);
+            // ext superblock sits 1 KiB in; may straddle into the next block.
+            if (ok && (start + 2048) / m->block_size != start / m->block_size)
+                ok = block_matches(fd, m, (start + 2048) / m->block_size, buf);
+        }
+    }
+    free(buf);
+    close(fd);
+    return ok;
+}
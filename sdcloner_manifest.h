@@ -0,0 +1,37 @@
+// sdcloner_manifest.h
+// Per-card block-hash manifest for differential burns: the XXH64 of every
+// block as it was last written to a card, so the next burn of a similar
+// image can skip unchanged blocks without reading the card.
+//
+// A hash of 0 means "unknown" (e.g. a block the last image only partly
+// covered) and never matches.
+//
+// File layout (little-endian): 40-byte header "SDCMAN\0\1", version, block
+// size, card size, block count, CRC32C of the header; then one 64-bit hash
+// per block and a CRC32C of the hash array.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint32_t  block_size;
+    uint64_t  dev_size;     // card capacity in bytes when written
+    uint64_t  n;            // blocks covered, from offset 0
+    uint64_t* hash;
+} sdc_manifest;
+
+// Load path into m. Returns 0, 1 if there is no manifest, -1 if it is
+// damaged (logged).
+int  sdc_manifest_load(const char* path, sdc_manifest* m);
+// Write m to path atomically (temp file, fsync, rename). Returns 0 / -1.
+int  sdc_manifest_save(const char* path, const sdc_manifest* m);
+void sdc_manifest_free(sdc_manifest* m);
+
+// Whether m still describes the card in dev_path: same block size and
+// capacity, and the blocks holding the partition table, every partition's
+// first block (superblocks, FAT boot sector / FSInfo, which change when the
+// card is mounted and written elsewhere) and the last recorded block still
+// hash as recorded. Reads those few blocks with O_DIRECT.
+bool sdc_manifest_matches(const sdc_manifest* m, const char* dev_path, uint64_t dev_size);
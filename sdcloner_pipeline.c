@@ -0,0 +1,1911 @@
+// sdcloner_pipeline.c
+// In-process streaming pipeline: reader → compressor pool → writer.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/sysmacros.h>
+#include <linux/fs.h>     // BLKGETSIZE64, BLKZEROOUT
+#include <zlib.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_image.h"
+#include "sdcloner_decode.h"
+#include "sdcloner_manifest.h"
+#include "sdcloner_store.h"
+#include "sdcloner_checkpoint.h"
+
+#define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
+#define GB(x) ((uint64_t)(x) * 1024ULL * 1024ULL * 1024ULL)
+
+void sdc_stream_opts_default(sdc_stream_opts* o) {
+    memset(o, 0, sizeof(*o));
+    o->block_size  = MB(4);
+    o->queue_depth = 8;
+    o->direct_io   = true;
+    o->drop_cache  = true;
+    o->gzip_level  = 6;
+    o->threads     = 0;
+    o->sparse      = true;
+    o->verify_sample_pct = 5;
+    o->io_backend  = SDC_AIO_AUTO;
+    o->io_depth    = 4;
+    o->checkpoint_every = GB(1);
+    o->zero_offload = true;
+}
+
+static unsigned online_cpus(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (unsigned)n : 1;
+}
+
+// ---------------- Zero detection ----------------------
+// OR-fold the buffer and test once per 256 bytes, so mostly-data blocks bail
+// out after the first non-zero stretch and zero blocks run at memory speed.
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static bool is_zero_avx2(const unsigned char* p, size_t len) {
+    while (len >= 256) {
+        __m256i acc = _mm256_loadu_si256((const __m256i*)p);
+        for (int i = 1; i < 8; i++)
+            acc = _mm256_or_si256(acc, _mm256_loadu_si256((const __m256i*)(p + 32 * i)));
+        if (!_mm256_testz_si256(acc, acc)) return false;
+        p += 256; len -= 256;
+    }
+    while (len) { if (*p++) return false; len--; }
+    return true;
+}
+
+__attribute__((target("sse2")))
+static bool is_zero_sse2(const unsigned char* p, size_t len) {
+    const __m128i z = _mm_setzero_si128();
+    while (len >= 256) {
+        __m128i acc = _mm_loadu_si128((const __m128i*)p);
+        for (int i = 1; i < 16; i++)
+            acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i*)(p + 16 * i)));
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(acc, z)) != 0xFFFF) return false;
+        p += 256; len -= 256;
+    }
+    while (len) { if (*p++) return false; len--; }
+    return true;
+}
+#endif
+
+static bool is_zero_scalar(const unsigned char* p, size_t len) {
+    while (len >= 8 * sizeof(uint64_t)) {
+        uint64_t w[8], acc = 0;
+        memcpy(w, p, sizeof(w));
+        for (int i = 0; i < 8; i++) acc |= w[i];
+        if (acc) return false;
+        p += sizeof(w); len -= sizeof(w);
+    }
+    while (len) { if (*p++) return false; len--; }
+    return true;
+}
+
+bool sdc_is_zero(const void* buf, size_t len) {
+    const unsigned char* p = buf;
+#if defined(__x86_64__) || defined(__i386__)
+    static int level = -1;   // benign race: every thread computes the same value
+    if (level < 0) {
+        __builtin_cpu_init();
+        level = __builtin_cpu_supports("avx2") ? 2 : __builtin_cpu_supports("sse2") ? 1 : 0;
+    }
+    if (level == 2) return is_zero_avx2(p, len);
+    if (level == 1) return is_zero_sse2(p, len);
+#endif
+    return is_zero_scalar(p, len);
+}
+
+// ---------------- Bounded queue -----------------------
+typedef struct {
+    void**          slot;
+    unsigned        cap, head, count;
+    bool            closed;
+    uint64_t        push_waits, push_wait_ns;   // stalls on a full queue
+    uint64_t        pop_waits, pop_wait_ns;     // stalls on an empty one
+    pthread_mutex_t mu;
+    pthread_cond_t  not_empty, not_full;
+} sdc_queue;
+
+static int q_init(sdc_queue* q, unsigned cap) {
+    memset(q, 0, sizeof(*q));
+    q->slot = calloc(cap, sizeof(void*));
+    if (!q->slot) return -1;
+    q->cap = cap;
+    pthread_mutex_init(&q->mu, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    return 0;
+}
+
+static void q_destroy(sdc_queue* q) {
+    if (!q->slot) return;
+    pthread_mutex_destroy(&q->mu);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_cond_destroy(&q->not_full);
+    free(q->slot);
+    q->slot = NULL;
+}
+
+// Blocks while full. Returns false if the queue was closed.
+static bool q_push(sdc_queue* q, void* item) {
+    pthread_mutex_lock(&q->mu);
+    if (q->count == q->cap && !q->closed) {
+        uint64_t t0 = sdc_trace_now();
+        while (q->count == q->cap && !q->closed)
+            pthread_cond_wait(&q->not_full, &q->mu);
+        q->push_waits++;
+        q->push_wait_ns += sdc_trace_now() - t0;
+    }
+    if (q->closed) { pthread_mutex_unlock(&q->mu); return false; }
+    q->slot[(q->head + q->count) % q->cap] = item;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->mu);
+    return true;
+}
+
+static void* q_take(sdc_queue* q, bool wait) {
+    pthread_mutex_lock(&q->mu);
+    if (wait && q->count == 0 && !q->closed) {
+        uint64_t t0 = sdc_trace_now();
+        while (q->count == 0 && !q->closed)
+            pthread_cond_wait(&q->not_empty, &q->mu);
+        q->pop_waits++;
+        q->pop_wait_ns += sdc_trace_now() - t0;
+    }
+    void* item = NULL;
+    if (q->count) {
+        item = q->slot[q->head];
+        q->head = (q->head + 1) % q->cap;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->mu);
+    return item;
+}
+
+// Blocks while empty. Returns NULL once closed and drained.
+static void* q_pop(sdc_queue* q) { return q_take(q, true); }
+// Returns NULL if nothing is queued right now.
+static void* q_try_pop(sdc_queue* q) { return q_take(q, false); }
+
+static void q_close(sdc_queue* q) {
+    pthread_mutex_lock(&q->mu);
+    q->closed = true;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->mu);
+}
+
+// ---------------- Pipeline state ----------------------
+typedef struct {
+    uint64_t       seq;
+    uint64_t       offset;
+    size_t         len;
+    unsigned char* data;      // SDC_IO_ALIGN-aligned, block_size bytes
+    unsigned char* out;       // stage output handed to the writer
+    size_t         out_len;
+    unsigned char* zbuf;      // gzip member (header + deflate + trailer)
+    size_t         zcap;
+    uint32_t       crc;       // .sdimg: CRC32 of data
+    uint32_t       crc32c;    // .sdimg: CRC32C of data
+    uint32_t       flags;     // .sdimg: SDC_CHUNK_*
+    sdc_ref_entry* refs;      // store: chunks of this block
+    size_t         nrefs;
+} sdc_block;
+
+// Compressed form of an all-zero full block, built once per run and shared
+// read-only by every worker.
+typedef struct {
+    unsigned char* data;
+    size_t         len;
+} sdc_zero_member;
+
+typedef struct {
+    sdc_stream_opts o;
+    const char*     src_path;
+    const char*     out_path; // archive / image file, NULL when not writing one
+    const char*     dev_path; // destination device for direct clones, or NULL
+    int             src_fd;
+    sdc_reader*     src_img;  // o.image_source: decoded image instead of src_fd
+    int             out_fd;
+    int             dev_fd;
+    uint64_t        src_size;
+    size_t          map_pos;  // cursor into o.unallocated (reader only)
+    bool            direct;   // O_DIRECT currently active on src_fd
+    bool            dev_direct;
+    sdc_aio*        aio;      // asynchronous source reads, NULL = synchronous
+    sdc_queue       free_q;   // empty blocks → reader
+    sdc_queue       read_q;   // filled blocks → compressor pool
+    sdc_queue       done_q;   // compressed blocks → writer (any order)
+    sdc_block*      blocks;
+    unsigned        nblocks;
+    sdc_zero_member zero;
+    uint64_t        out_size;      // logical output size (raw sparse mode)
+    sdc_chunk*      idx;           // .sdimg index, built by the writer
+    uint64_t        idx_n, idx_cap;
+    sdc_store*      store;         // store: chunk directory
+    sdc_ref_entry*  ref;           // store: recipe, built by the writer
+    uint64_t        ref_n, ref_cap;
+    uint64_t        out_pos;       // .sdimg append position
+    sdc_image       base;          // .sdimg delta: the base image
+    bool            has_base;
+    sdc_image_link  link;
+    char            link_name[PATH_MAX];
+    uint64_t        base_chunks;   // chunks taken from the base
+    uint64_t        zero_blocks;   // full blocks recognised as zero
+    bool            ckpt;          // writing checkpoints
+    sdc_checkpoint  ck;            // the next one (writer only); idx is lent from p->idx
+    uint64_t        ck_next;       // source offset due for the next checkpoint
+    uint64_t        start;         // resumed: first source offset read
+    bool            resumed;
+    unsigned        workers_live;  // compressor threads still running
+    pthread_mutex_t err_mu;
+    int             failed;
+} sdc_pipe;
+
+static void pipe_fail(sdc_pipe* p, const char* fmt, ...) {
+    pthread_mutex_lock(&p->err_mu);
+    bool first = !p->failed;
+    p->failed = 1;
+    pthread_mutex_unlock(&p->err_mu);
+    if (first) {
+        char msg[512];
+        va_list ap; va_start(ap, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, ap);
+        va_end(ap);
+        sdc_loge("%s", msg);
+    }
+    q_close(&p->free_q);
+    q_close(&p->read_q);
+    q_close(&p->done_q);
+}
+
+static ssize_t read_full(sdc_pipe* p, unsigned char* buf, size_t len) {
+    if (p->src_img) return sdc_reader_read(p->src_img, buf, len);
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = read(p->src_fd, buf + got, len - got);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && p->direct) {
+                // O_DIRECT refused (filesystem or unaligned tail) → buffered I/O
+                int fl = fcntl(p->src_fd, F_GETFL);
+                if (fl >= 0 && fcntl(p->src_fd, F_SETFL, fl & ~O_DIRECT) == 0) {
+                    p->direct = false;
+                    continue;
+                }
+            }
+            return -1;
+        }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+static int pwrite_full(int fd, const unsigned char* buf, size_t len, uint64_t off) {
+    while (len) {
+        ssize_t n = pwrite(fd, buf, len, (off_t)off);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+// *direct tracks whether O_DIRECT is still active on fd; it is dropped on the
+// first EINVAL (unaligned range or filesystem without O_DIRECT support).
+static ssize_t pread_full(int fd, bool* direct, unsigned char* buf, size_t len, uint64_t off) {
+    size_t got = 0;
+    while (got < len) {
+        ssize_t n = pread(fd, buf + got, len - got, (off_t)(off + got));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EINVAL && *direct) {
+                int fl = fcntl(fd, F_GETFL);
+                if (fl >= 0 && fcntl(fd, F_SETFL, fl & ~O_DIRECT) == 0) {
+                    *direct = false;
+                    continue;
+                }
+            }
+            return -1;
+        }
+        if (n == 0) break;
+        got += (size_t)n;
+    }
+    return (ssize_t)got;
+}
+
+// Fill [off, off+len) reading only the ranges not listed in m; listed ranges
+// are zero-filled without touching the source. *cursor must only move forward.
+static ssize_t read_mapped(int fd, bool* direct, const sdc_extent_list* m, size_t* cursor,
+                           unsigned char* buf, size_t len, uint64_t off) {
+    uint64_t end = off + len, pos = off;
+    while (*cursor < m->n && m->ext[*cursor].off + m->ext[*cursor].len <= off)
+        (*cursor)++;
+    for (size_t i = *cursor; pos < end; i++) {
+        uint64_t hs = i < m->n ? m->ext[i].off : end;
+        uint64_t he = i < m->n ? m->ext[i].off + m->ext[i].len : end;
+        if (hs > end) hs = end;
+        if (hs > pos) {
+            size_t want = (size_t)(hs - pos);
+            ssize_t n = pread_full(fd, direct, buf + (pos - off), want, pos);
+            if (n < 0) return -1;
+            if ((size_t)n < want) return (ssize_t)(pos - off) + n;
+            pos = hs;
+        }
+        if (pos < end && he > pos) {
+            uint64_t ze = he < end ? he : end;
+            memset(buf + (pos - off), 0, (size_t)(ze - pos));
+            pos = ze;
+        }
+    }
+    return (ssize_t)len;
+}
+
+static int write_full(int fd, const unsigned char* buf, size_t len) {
+    while (len) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        buf += n; len -= (size_t)n;
+    }
+    return 0;
+}
+
+// Positional device write; shared by all workers, so ordering is free.
+static int dev_write(sdc_pipe* p, const sdc_block* b) {
+    for (;;) {
+        uint64_t t0 = sdc_trace_now();
+        if (pwrite_full(p->dev_fd, b->data, b->len, b->offset) == 0) {
+            uint64_t t1 = sdc_trace_now();
+            sdc_trace_io(p->o.trace, SDC_TRACE_WRITE, t0, t1, b->len);
+            sdc_trace_span(p->o.trace, "device write", 0, t0, t1);
+            return 0;
+        }
+        if (errno != EINVAL || !p->dev_direct) return -1;
+        // Unaligned tail (image file source) → drop O_DIRECT and retry.
+        int fl = fcntl(p->dev_fd, F_GETFL);
+        if (fl < 0 || fcntl(p->dev_fd, F_SETFL, fl & ~O_DIRECT) != 0) return -1;
+        p->dev_direct = false;
+    }
+}
+
+// ---------------- Stages ------------------------------
+// Device reader with up to io_depth reads in flight. Blocks are submitted at
+// consecutive offsets and handed on strictly in submission order, so the
+// stages behind it see the same stream as from reader_main. A read refused
+// under O_DIRECT is redone buffered, as read_full would.
+static uint64_t reader_aio(sdc_pipe* p) {
+    unsigned depth = p->o.io_depth;
+    sdc_block* fifo[SDC_AIO_DEPTH_MAX];
+    ssize_t res[SDC_AIO_DEPTH_MAX];
+    uint64_t sub_ns[SDC_AIO_DEPTH_MAX];
+    bool done[SDC_AIO_DEPTH_MAX];
+    unsigned head = 0, count = 0;
+    uint64_t sub_off = p->start, off = p->start, seq = 0;
+    bool eof = false, was_direct = p->direct;
+    for (;;) {
+        while (!eof && count < depth && sub_off < p->src_size) {
+            sdc_block* b = count ? q_try_pop(&p->free_q) : q_pop(&p->free_q);
+            if (!b) { if (!count) eof = true; break; }
+            if (!sdc_ctl_gate(p->o.ctl, p->o.block_size)) {
+                q_push(&p->free_q, b);
+                pipe_fail(p, "[JOB] %s: cancelled", p->src_path);
+                eof = true;
+                break;
+            }
+            unsigned slot = (head + count) % depth;
+            b->offset = sub_off;
+            fifo[slot] = b;
+            done[slot] = false;
+            sub_ns[slot] = sdc_trace_now();
+            if (sdc_aio_read(p->aio, p->src_fd, b->data, p->o.block_size, sub_off, slot) != 0) {
+                // Queue full: reap and submit again. Refused with nothing in
+                // flight, it never will be; that must not pass for EOF.
+                q_push(&p->free_q, b);
+                if (!count) {
+                    pipe_fail(p, "read(%s) at %llu: cannot queue request", p->src_path,
+                              (unsigned long long)sub_off);
+                    eof = true;
+                }
+                break;
+            }
+            count++;
+            sub_off += p->o.block_size;
+        }
+        if (!count) break;
+        uint64_t tag; ssize_t r;
+        if (sdc_aio_wait(p->aio, &tag, &r) != 0) {
+            pipe_fail(p, "read(%s): %s", p->src_path, strerror(errno));
+            break;
+        }
+        sdc_block* b = fifo[tag];
+        // Timed to the reap: includes any time the reader spent blocked on a queue.
+        uint64_t now = sdc_trace_now();
+        sdc_trace_io(p->o.trace, SDC_TRACE_READ, sub_ns[tag], now, r > 0 ? (uint64_t)r : 0);
+        sdc_trace_span(p->o.trace, "read", 2 + (unsigned)tag, sub_ns[tag], now);
+        if (r == -EINVAL && was_direct) {
+            if (p->direct) {
+                int fl = fcntl(p->src_fd, F_GETFL);
+                if (fl >= 0 && fcntl(p->src_fd, F_SETFL, fl & ~O_DIRECT) == 0) p->direct = false;
+            }
+            r = p->direct ? -EINVAL : pread_full(p->src_fd, &p->direct, b->data, p->o.block_size, b->offset);
+            if (r < 0) r = -errno;
+        }
+        res[tag] = r;
+        done[tag] = true;
+        // Hand on every completed block at the head of the queue.
+        while (count && done[head]) {
+            b = fifo[head];
+            ssize_t n = res[head];
+            head = (head + 1) % depth;
+            count--;
+            if (eof || n <= 0) {
+                if (n < 0 && !eof)
+                    pipe_fail(p, "read(%s) at %llu: %s", p->src_path,
+                              (unsigned long long)b->offset, strerror((int)-n));
+                eof = true;
+                q_push(&p->free_q, b);
+                continue;
+            }
+            b->len = (size_t)n; b->seq = seq++;
+            if (p->o.drop_cache && !p->direct)
+                posix_fadvise(p->src_fd, (off_t)off, (off_t)n, POSIX_FADV_DONTNEED);
+            off += (uint64_t)n;
+            if ((size_t)n < p->o.block_size) eof = true;
+            if (!q_push(&p->read_q, b)) eof = true;
+        }
+    }
+    return off;
+}
+
+static void* reader_main(void* arg) {
+    sdc_pipe* p = arg;
+    uint64_t off = p->start, seq = 0;
+    const char* stage = p->src_img ? "decode" : "read";
+    sdc_trace_clock clk; sdc_trace_stage_begin(&clk);
+    posix_fadvise(p->src_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (p->aio) {
+        off = reader_aio(p);
+        q_close(&p->read_q);
+        sdc_trace_stage_end(p->o.trace, &clk, stage, off);
+        return NULL;
+    }
+    for (;;) {
+        sdc_block* b = q_pop(&p->free_q);
+        if (!b) break;
+        if (!sdc_ctl_gate(p->o.ctl, p->o.block_size)) {
+            q_push(&p->free_q, b);
+            pipe_fail(p, "[JOB] %s: cancelled", p->src_path);
+            break;
+        }
+        uint64_t t0 = sdc_trace_now();
+        ssize_t n;
+        if (p->o.unallocated && p->o.unallocated->n && p->src_size) {
+            size_t want = p->src_size - off < p->o.block_size ? (size_t)(p->src_size - off)
+                                                              : p->o.block_size;
+            n = want ? read_mapped(p->src_fd, &p->direct, p->o.unallocated, &p->map_pos,
+                                   b->data, want, off) : 0;
+        } else {
+            n = read_full(p, b->data, p->o.block_size);
+        }
+        if (n < 0) { pipe_fail(p, "read(%s) at %llu: %s", p->src_path,
+                               (unsigned long long)off, strerror(errno)); break; }
+        if (n == 0) { q_push(&p->free_q, b); break; }
+        uint64_t t1 = sdc_trace_now();
+        if (!p->src_img) sdc_trace_io(p->o.trace, SDC_TRACE_READ, t0, t1, (uint64_t)n);
+        sdc_trace_span(p->o.trace, stage, 0, t0, t1);
+        b->len = (size_t)n; b->offset = off; b->seq = seq++;
+        if (p->o.drop_cache && !p->direct)
+            posix_fadvise(p->src_fd, (off_t)off, (off_t)n, POSIX_FADV_DONTNEED);
+        off += (uint64_t)n;
+        if (!q_push(&p->read_q, b)) break;
+        if ((size_t)n < p->o.block_size) break;
+    }
+    q_close(&p->read_q);
+    sdc_trace_stage_end(p->o.trace, &clk, stage, off);
+    return NULL;
+}
+
+// Each block becomes an independent gzip member, so blocks can be compressed
+// in any order and the concatenation is still a valid multi-member .gz
+// stream. The header carries an "SC" extra subfield with the total member
+// length (as BGZF does) so readers can split members without inflating.
+static void put_le32(unsigned char* d, uint32_t v) {
+    d[0] = (unsigned char)v; d[1] = (unsigned char)(v >> 8);
+    d[2] = (unsigned char)(v >> 16); d[3] = (unsigned char)(v >> 24);
+}
+
+static int deflate_block(z_stream* zs, sdc_block* b) {
+    if (deflateReset(zs) != Z_OK) return -1;
+    unsigned char* h = b->zbuf;
+    memset(h, 0, SDC_GZ_HDR_LEN);
+    h[0] = 0x1f; h[1] = 0x8b; h[2] = 8; h[3] = 4;   // deflate, FEXTRA
+    h[9] = 3;                                        // OS = Unix
+    h[10] = 8; h[11] = 0;                            // XLEN
+    h[12] = 'S'; h[13] = 'C'; h[14] = 4; h[15] = 0;  // subfield, LEN=4
+    zs->next_in = b->data;
+    zs->avail_in = (uInt)b->len;
+    zs->next_out = b->zbuf + SDC_GZ_HDR_LEN;
+    zs->avail_out = (uInt)(b->zcap - SDC_GZ_HDR_LEN - 8);
+    if (deflate(zs, Z_FINISH) != Z_STREAM_END) return -1;
+    size_t n = SDC_GZ_HDR_LEN + (b->zcap - SDC_GZ_HDR_LEN - 8 - zs->avail_out);
+    put_le32(b->zbuf + n, (uint32_t)crc32(0L, b->data, (uInt)b->len));
+    put_le32(b->zbuf + n + 4, (uint32_t)b->len);
+    n += 8;
+    put_le32(h + 16, (uint32_t)n);
+    b->out = b->zbuf;
+    b->out_len = n;
+    return 0;
+}
+
+// .sdimg chunk: raw deflate, kept uncompressed if that is not smaller,
+// nothing at all for zero chunks or, in a delta, chunks the base holds
+// (both CRC32 and CRC32C equal).
+static int sdimg_chunk(sdc_pipe* p, z_stream* zs, sdc_block* b) {
+    b->crc = (uint32_t)crc32(0L, b->data, (uInt)b->len);
+    b->crc32c = sdc_crc32c(0, b->data, b->len);
+    b->flags = 0;
+    if (p->o.sparse && sdc_is_zero(b->data, b->len)) {
+        b->flags = SDC_CHUNK_ZERO;
+        b->out = NULL; b->out_len = 0;
+        __atomic_add_fetch(&p->zero_blocks, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    if (p->has_base && b->seq < p->base.nchunks) {
+        const sdc_chunk* c = &p->base.idx[b->seq];
+        if (sdc_image_chunk_len(&p->base, b->seq) == b->len && c->crc32c &&
+            c->crc == b->crc && c->crc32c == b->crc32c) {
+            b->flags = SDC_CHUNK_BASE;
+            b->out = NULL; b->out_len = 0;
+            __atomic_add_fetch(&p->base_chunks, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+    }
+    if (p->o.gzip_level >= 0) {
+        if (deflateReset(zs) != Z_OK) return -1;
+        zs->next_in = b->data;
+        zs->avail_in = (uInt)b->len;
+        zs->next_out = b->zbuf;
+        zs->avail_out = (uInt)b->zcap;
+        if (deflate(zs, Z_FINISH) != Z_STREAM_END) return -1;
+        size_t n = b->zcap - zs->avail_out;
+        if (n < b->len) { b->out = b->zbuf; b->out_len = n; return 0; }
+    }
+    b->flags = SDC_CHUNK_STORED;
+    b->out = b->data; b->out_len = b->len;
+    return 0;
+}
+
+static void* compressor_main(void* arg) {
+    sdc_pipe* p = arg;
+    bool raw = p->o.gzip_level < 0;
+    z_stream zs; memset(&zs, 0, sizeof(zs));
+    if (!raw && deflateInit2(&zs, p->o.gzip_level, Z_DEFLATED, -15, 8,
+                             Z_DEFAULT_STRATEGY) != Z_OK) {
+        pipe_fail(p, "deflateInit2 failed");
+        raw = true;
+    }
+    sdc_trace_clock clk; sdc_trace_stage_begin(&clk);
+    uint64_t bytes = 0;
+    for (;;) {
+        sdc_block* b = q_pop(&p->read_q);
+        if (!b) break;
+        bytes += b->len;
+        if (p->dev_fd >= 0 && dev_write(p, b) != 0) {
+            pipe_fail(p, "write(%s) at %llu: %s", p->dev_path,
+                      (unsigned long long)b->offset, strerror(errno));
+            break;
+        }
+        uint64_t t0 = sdc_trace_now();
+        if (p->o.format == SDC_FMT_STORE) {
+            if (sdc_store_put(p->store, raw ? NULL : &zs, b->data, b->len, b->refs, &b->nrefs,
+                              b->zbuf, b->zcap) != 0) {
+                pipe_fail(p, "storing chunks at offset %llu failed", (unsigned long long)b->offset);
+                break;
+            }
+            sdc_trace_span(p->o.trace, "store", 0, t0, sdc_trace_now());
+            if (!q_push(&p->done_q, b)) break;
+            continue;
+        }
+        if (p->o.format == SDC_FMT_SDIMG) {
+            if (sdimg_chunk(p, &zs, b) != 0) {
+                pipe_fail(p, "deflate failed at offset %llu", (unsigned long long)b->offset);
+                break;
+            }
+            sdc_trace_span(p->o.trace, "compress", 0, t0, sdc_trace_now());
+            if (!q_push(&p->done_q, b)) break;
+            continue;
+        }
+        bool zero = p->o.sparse && !raw && p->zero.data &&
+                    b->len == p->o.block_size && sdc_is_zero(b->data, b->len);
+        if (raw) {
+            b->out = b->data; b->out_len = b->len;
+        } else if (zero) {
+            b->out = p->zero.data; b->out_len = p->zero.len;
+            __atomic_add_fetch(&p->zero_blocks, 1, __ATOMIC_RELAXED);
+        } else if (deflate_block(&zs, b) != 0) {
+            pipe_fail(p, "deflate failed at offset %llu", (unsigned long long)b->offset);
+            break;
+        }
+        if (!raw) sdc_trace_span(p->o.trace, "compress", 0, t0, sdc_trace_now());
+        if (!q_push(&p->done_q, b)) break;
+    }
+    sdc_trace_stage_end(p->o.trace, &clk, !raw ? "compress" : p->dev_fd >= 0 ? "device write" : "copy", bytes);
+    if (p->o.gzip_level >= 0) deflateEnd(&zs);
+    // The last worker out closes the writer's queue.
+    pthread_mutex_lock(&p->err_mu);
+    bool last = (--p->workers_live == 0);
+    pthread_mutex_unlock(&p->err_mu);
+    if (last) q_close(&p->done_q);
+    return NULL;
+}
+
+// Raw sparse output: skip zero grains so the file gets holes; the final
+// ftruncate() restores the logical length after a trailing zero run.
+static int write_out(sdc_pipe* p, const sdc_block* b) {
+    if (p->o.format == SDC_FMT_STORE) {
+        if (p->ref_n + b->nrefs > p->ref_cap) {
+            uint64_t ncap = p->ref_cap ? p->ref_cap * 2 : 4096;
+            while (ncap < p->ref_n + b->nrefs) ncap *= 2;
+            sdc_ref_entry* nr = realloc(p->ref, ncap * sizeof(sdc_ref_entry));
+            if (!nr) return -1;
+            p->ref = nr; p->ref_cap = ncap;
+        }
+        memcpy(p->ref + p->ref_n, b->refs, b->nrefs * sizeof(sdc_ref_entry));
+        p->ref_n += b->nrefs;
+        p->out_size = b->offset + b->len;
+        return 0;
+    }
+    if (p->o.format == SDC_FMT_SDIMG) {
+        if (p->idx_n == p->idx_cap) {
+            uint64_t ncap = p->idx_cap ? p->idx_cap * 2 : 1024;
+            sdc_chunk* ni = realloc(p->idx, ncap * sizeof(sdc_chunk));
+            if (!ni) return -1;
+            p->idx = ni; p->idx_cap = ncap;
+        }
+        sdc_chunk* c = &p->idx[p->idx_n++];
+        c->offset = p->out_pos;
+        c->clen = (uint32_t)b->out_len;
+        c->flags = b->flags;
+        c->crc = b->crc;
+        c->crc32c = b->crc32c;
+        if (b->out_len && pwrite_full(p->out_fd, b->out, b->out_len, p->out_pos) != 0) return -1;
+        p->out_pos += b->out_len;
+        p->out_size = b->offset + b->len;
+        return 0;
+    }
+    bool raw = p->o.gzip_level < 0;
+    if (!raw || !p->o.sparse) return write_full(p->out_fd, b->out, b->out_len);
+    for (size_t i = 0; i < b->out_len; i += SDC_SPARSE_GRAIN) {
+        size_t n = b->out_len - i < SDC_SPARSE_GRAIN ? b->out_len - i : SDC_SPARSE_GRAIN;
+        if (sdc_is_zero(b->out + i, n)) continue;
+        if (pwrite_full(p->out_fd, b->out + i, n, b->offset + i) != 0) return -1;
+    }
+    p->out_size = b->offset + b->out_len;
+    return 0;
+}
+
+// Keep the running CRC32C and the hashes a resumed job checks, and every
+// checkpoint_every bytes make the output durable and write a checkpoint. A
+// checkpoint that cannot be written is logged and the image goes on.
+static void checkpoint_block(sdc_pipe* p, const sdc_block* b) {
+    sdc_checkpoint* c = &p->ck;
+    c->crc32c = sdc_crc32c(c->crc32c, b->data, b->len);
+    uint64_t end = b->offset + b->len;
+    if (b->len != p->o.block_size) return;
+    uint64_t h64 = sdc_hash64(b->data, b->len);
+    if (b->offset == 0) c->head_h64 = h64;
+    sdc_checkpoint_sample(c, b->offset / b->len, h64);
+    if (end < p->ck_next) return;
+    p->ck_next = end + p->o.checkpoint_every;
+    c->in_off = end;
+    c->tail_h64 = h64;
+    c->idx = p->idx;
+    c->nchunks = p->idx_n;
+    // Sparse raw output may end in a hole; give the file its full length.
+    bool holes = p->o.format == SDC_FMT_GZIP && p->o.gzip_level < 0 && p->o.sparse;
+    if (holes && ftruncate(p->out_fd, (off_t)p->out_size) != 0) c->in_off = 0;
+    c->out_len = p->o.format == SDC_FMT_SDIMG ? p->out_pos
+               : holes ? p->out_size : (uint64_t)lseek(p->out_fd, 0, SEEK_CUR);
+    if (c->in_off && fdatasync(p->out_fd) == 0) sdc_checkpoint_save(p->o.checkpoint, c);
+    else sdc_loge("[RESUME] no checkpoint at %llu: %s", (unsigned long long)end, strerror(errno));
+    c->idx = NULL;
+}
+
+// Workers finish out of order; write blocks strictly by sequence number.
+// At most nblocks are in flight, so seq % nblocks never collides.
+static void* writer_main(void* arg) {
+    sdc_pipe* p = arg;
+    sdc_block** pending = calloc(p->nblocks, sizeof(sdc_block*));
+    if (!pending) { pipe_fail(p, "out of memory in writer"); return NULL; }
+    uint64_t next = 0, done = p->start;
+    sdc_trace_clock clk; sdc_trace_stage_begin(&clk);
+    for (;;) {
+        sdc_block* b = q_pop(&p->done_q);
+        if (!b) break;
+        pending[b->seq % p->nblocks] = b;
+        while ((b = pending[next % p->nblocks]) && b->seq == next) {
+            pending[next % p->nblocks] = NULL;
+            uint64_t t0 = sdc_trace_now();
+            if (p->out_fd >= 0 && write_out(p, b) != 0) {
+                pipe_fail(p, "write(%s): %s", p->out_path, strerror(errno));
+                free(pending);
+                return NULL;
+            }
+            // Store chunks are written by the workers; the recipe is built here.
+            if (p->out_fd >= 0 && p->o.format != SDC_FMT_STORE) {
+                uint64_t t1 = sdc_trace_now();
+                sdc_trace_io(p->o.trace, SDC_TRACE_WRITE, t0, t1, b->out_len);
+                sdc_trace_span(p->o.trace, "write", 0, t0, t1);
+            }
+            if (p->ckpt) checkpoint_block(p, b);
+            next++;
+            done = b->offset + b->len;
+            q_push(&p->free_q, b);
+            if (p->o.progress) p->o.progress(done, p->src_size, p->o.progress_user);
+        }
+    }
+    sdc_trace_stage_end(p->o.trace, &clk, "write", done);
+    free(pending);
+    return NULL;
+}
+
+// ---------------- Entry point -------------------------
+static int build_zero_member(sdc_pipe* p) {
+    sdc_block tmp; memset(&tmp, 0, sizeof(tmp));
+    tmp.len = p->o.block_size;
+    tmp.data = calloc(1, tmp.len);
+    tmp.zcap = compressBound((uLong)tmp.len) + 65536;
+    tmp.zbuf = malloc(tmp.zcap);
+    z_stream zs; memset(&zs, 0, sizeof(zs));
+    int rc = -1;
+    if (tmp.data && tmp.zbuf &&
+        deflateInit2(&zs, p->o.gzip_level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+        if (deflate_block(&zs, &tmp) == 0) {
+            p->zero.data = malloc(tmp.out_len);
+            if (p->zero.data) {
+                memcpy(p->zero.data, tmp.out, tmp.out_len);
+                p->zero.len = tmp.out_len;
+                rc = 0;
+            }
+        }
+        deflateEnd(&zs);
+    }
+    free(tmp.data);
+    free(tmp.zbuf);
+    return rc;
+}
+
+static void pipe_free(sdc_pipe* p) {
+    free(p->zero.data);
+    free(p->idx);
+    sdc_checkpoint_free(&p->ck);
+    free(p->ref);
+    sdc_store_close(p->store);
+    sdc_aio_close(p->aio);
+    if (p->has_base) sdc_image_close(&p->base);
+    sdc_reader_close(p->src_img);
+    for (unsigned i = 0; p->blocks && i < p->nblocks; i++) {
+        free(p->blocks[i].data);
+        free(p->blocks[i].zbuf);
+        free(p->blocks[i].refs);
+    }
+    free(p->blocks);
+    q_destroy(&p->free_q);
+    q_destroy(&p->read_q);
+    q_destroy(&p->done_q);
+    pthread_mutex_destroy(&p->err_mu);
+}
+
+static int open_source(sdc_pipe* p) {
+    int flags = O_RDONLY | O_CLOEXEC;
+    if (p->o.image_source) {
+        p->src_img = sdc_reader_open(p->src_path);
+        if (!p->src_img) return -1;
+        p->src_fd = open(p->src_path, flags);   // only for fadvise
+        if (p->src_fd < 0) { sdc_reader_close(p->src_img); p->src_img = NULL; return -1; }
+        p->src_size = sdc_reader_total(p->src_img, 0);
+        return 0;
+    }
+    p->src_fd = open(p->src_path, flags | (p->o.direct_io ? O_DIRECT : 0));
+    if (p->src_fd >= 0) p->direct = p->o.direct_io;
+    else if (p->o.direct_io && errno == EINVAL) p->src_fd = open(p->src_path, flags);
+    if (p->src_fd < 0) { sdc_loge("open(%s): %s", p->src_path, strerror(errno)); return -1; }
+    struct stat st;
+    if (fstat(p->src_fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+        if (ioctl(p->src_fd, BLKGETSIZE64, &p->src_size) != 0) p->src_size = 0;
+    } else if (fstat(p->src_fd, &st) == 0) {
+        p->src_size = (uint64_t)st.st_size;
+    }
+    return 0;
+}
+
+// Plain reads of a device or file of known size go through sdc_aio, with
+// the block buffers registered; decoded images and mapped reads stay
+// synchronous. Only an explicitly requested backend that cannot start fails.
+static int open_source_aio(sdc_pipe* p) {
+    if (p->o.io_backend == SDC_AIO_SYNC || p->src_img || !p->src_size ||
+        (p->o.unallocated && p->o.unallocated->n))
+        return 0;
+    if (!p->o.io_depth) p->o.io_depth = 1;
+    if (p->o.io_depth > p->nblocks / 2) p->o.io_depth = p->nblocks / 2;
+    if (p->o.io_depth > SDC_AIO_DEPTH_MAX) p->o.io_depth = SDC_AIO_DEPTH_MAX;
+    unsigned char** bufs = calloc(p->nblocks, sizeof(unsigned char*));
+    if (!bufs) return -1;
+    for (unsigned i = 0; i < p->nblocks; i++) bufs[i] = p->blocks[i].data;
+    p->aio = sdc_aio_open(p->o.io_backend, p->o.io_depth, bufs, p->nblocks, p->o.block_size);
+    free(bufs);
+    return p->aio || p->o.io_backend == SDC_AIO_AUTO ? 0 : -1;
+}
+
+// Delta output: chunk size follows the base, and the base is recorded by
+// file name when it sits beside the delta (the pair can move together),
+// otherwise by absolute path.
+static int open_delta_base(sdc_pipe* p) {
+    if (!sdc_image_is(p->o.base_image)) {
+        sdc_loge("[DELTA] base %s is not an .sdimg image", p->o.base_image);
+        return -1;
+    }
+    if (sdc_image_open(p->o.base_image, &p->base) != 0) return -1;
+    p->has_base = true;
+    p->o.block_size = p->base.chunk_size;
+    char base_real[PATH_MAX], out_dir[PATH_MAX], base_dir[PATH_MAX];
+    if (!realpath(p->o.base_image, base_real)) return -1;
+    snprintf(out_dir, sizeof(out_dir), "%s", p->out_path);
+    char* s = strrchr(out_dir, '/');
+    if (s) *s = '\0'; else snprintf(out_dir, sizeof(out_dir), ".");
+    snprintf(base_dir, sizeof(base_dir), "%s", base_real);
+    *strrchr(base_dir, '/') = '\0';
+    char out_real[PATH_MAX];
+    bool beside = realpath(out_dir, out_real) && strcmp(out_real, base_dir) == 0;
+    snprintf(p->link_name, sizeof(p->link_name), "%s",
+             beside ? base_real + strlen(base_dir) + 1 : base_real);
+    p->link.name = p->link_name;
+    p->link.idx_crc = p->base.idx_crc;
+    sdc_logi("[DELTA] base %s: %llu chunks of %u KiB", base_real,
+             (unsigned long long)p->base.nchunks, p->base.chunk_size / 1024);
+    return 0;
+}
+
+// O_EXCL on a block device fails with EBUSY while anything has it mounted.
+static int open_device(sdc_pipe* p) {
+    int flags = O_WRONLY | O_CLOEXEC | O_EXCL;
+    p->dev_fd = open(p->dev_path, flags | (p->o.direct_io ? O_DIRECT : 0));
+    if (p->dev_fd >= 0) p->dev_direct = p->o.direct_io;
+    else if (p->o.direct_io && errno == EINVAL) p->dev_fd = open(p->dev_path, flags);
+    if (p->dev_fd < 0) sdc_loge("open(%s): %s", p->dev_path, strerror(errno));
+    return p->dev_fd < 0 ? -1 : 0;
+}
+
+// Continue from o.checkpoint if it was written with the same settings and
+// the source still holds what it committed; otherwise the image starts over.
+// Called before the output is opened.
+static void resume_checkpoint(sdc_pipe* p) {
+    sdc_checkpoint* c = &p->ck;
+    if (sdc_checkpoint_load(p->o.checkpoint, c) != 0) return;
+    struct stat st;
+    const char* why = NULL;
+    if (c->block_size != p->o.block_size || c->gzip_level != p->o.gzip_level ||
+        c->format != (uint32_t)p->o.format || (c->flags & SDC_CKPT_SPARSE) != (p->o.sparse ? SDC_CKPT_SPARSE : 0u) ||
+        c->base_crc != (p->has_base ? p->link.idx_crc : 0))
+        why = "written with different settings";
+    else if (stat(p->out_path, &st) != 0 || (uint64_t)st.st_size < c->out_len)
+        why = "the image is shorter than recorded";
+    else if (!sdc_checkpoint_matches(c, p->src_path, p->src_size, p->o.source_id, p->o.unallocated))
+        why = "the source is not the same card or has changed";
+    if (why) {
+        sdc_logi("[RESUME] %s not used: %s; starting over", p->o.checkpoint, why);
+        sdc_checkpoint_free(c);
+        return;
+    }
+    p->idx = c->idx;
+    p->idx_n = p->idx_cap = c->nchunks;
+    c->idx = NULL;
+    p->out_pos = c->out_len;
+    p->out_size = c->in_off;
+    p->start = c->in_off;
+    p->resumed = true;
+    sdc_logi("[RESUME] continuing at %.2f of %.2f GB", (double)p->start / (double)GB(1),
+             (double)p->src_size / (double)GB(1));
+}
+
+static int run_pipeline(const char* src_path, const char* out_path, const char* dev_path,
+                        const sdc_stream_opts* opts) {
+    sdc_pipe p; memset(&p, 0, sizeof(p));
+    if (opts) p.o = *opts; else sdc_stream_opts_default(&p.o);
+    if (!p.o.block_size || p.o.block_size % SDC_IO_ALIGN) {
+        sdc_loge("block size must be a non-zero multiple of %d", SDC_IO_ALIGN);
+        return -1;
+    }
+    if (!out_path) { p.o.gzip_level = -1; p.o.sparse = false; }
+    if (!p.o.threads) p.o.threads = online_cpus();
+    // Raw output has nothing to parallelise except device writes.
+    if (p.o.gzip_level < 0 && p.o.format != SDC_FMT_STORE) p.o.threads = dev_path ? 2 : 1;
+    if (p.o.queue_depth < p.o.threads * 2) p.o.queue_depth = p.o.threads * 2;
+    p.src_path = src_path;
+    p.out_path = out_path;
+    p.dev_path = dev_path;
+    p.src_fd = p.out_fd = p.dev_fd = -1;
+    pthread_mutex_init(&p.err_mu, NULL);
+    if (out_path && p.o.format == SDC_FMT_SDIMG && p.o.base_image && open_delta_base(&p) != 0) {
+        pipe_free(&p);
+        return -1;
+    }
+
+    p.nblocks = p.o.queue_depth * 2 + 2;
+    p.blocks = calloc(p.nblocks, sizeof(sdc_block));
+    if (!p.blocks || q_init(&p.free_q, p.nblocks) || q_init(&p.read_q, p.o.queue_depth) ||
+        q_init(&p.done_q, p.o.queue_depth)) {
+        sdc_loge("out of memory setting up pipeline");
+        pipe_free(&p);
+        return -1;
+    }
+    bool store = p.o.format == SDC_FMT_STORE;
+    size_t zcap = compressBound((uLong)p.o.block_size) + 65536;
+    for (unsigned i = 0; i < p.nblocks; i++) {
+        sdc_block* b = &p.blocks[i];
+        b->zcap = zcap;
+        if (posix_memalign((void**)&b->data, SDC_IO_ALIGN, p.o.block_size) != 0) b->data = NULL;
+        b->zbuf = p.o.gzip_level < 0 && !store ? NULL : malloc(zcap);
+        b->refs = store ? calloc(p.o.block_size / SDC_CDC_MIN + 1, sizeof(sdc_ref_entry)) : NULL;
+        if (!b->data || ((p.o.gzip_level >= 0 || store) && !b->zbuf) || (store && !b->refs)) {
+            sdc_loge("out of memory allocating %u x %zu byte blocks", p.nblocks, p.o.block_size);
+            pipe_free(&p);
+            return -1;
+        }
+        q_push(&p.free_q, b);
+    }
+    if (p.o.sparse && p.o.gzip_level >= 0 && p.o.format == SDC_FMT_GZIP &&
+        build_zero_member(&p) != 0) {
+        sdc_loge("failed to prepare zero-block member");
+        pipe_free(&p);
+        return -1;
+    }
+
+    if (store) {
+        char cdir[4096];
+        sdc_ref_chunk_dir(out_path, cdir, sizeof(cdir));
+        if (!(p.store = sdc_store_open(cdir))) { pipe_free(&p); return -1; }
+    }
+
+    if (open_source(&p) != 0) { pipe_free(&p); return -1; }
+    if (open_source_aio(&p) != 0) { close(p.src_fd); pipe_free(&p); return -1; }
+    // Checkpoints need a seekable source of known size and an append-only output.
+    p.ckpt = p.o.checkpoint && out_path && !dev_path && !p.src_img && p.src_size &&
+             p.o.format != SDC_FMT_STORE && p.o.checkpoint_every;
+    if (p.ckpt && p.o.resume) resume_checkpoint(&p);
+    if (p.start && !p.aio && lseek(p.src_fd, (off_t)p.start, SEEK_SET) < 0) {
+        sdc_loge("lseek(%s): %s", src_path, strerror(errno));
+        close(p.src_fd); pipe_free(&p);
+        return -1;
+    }
+    if (p.ckpt && !p.resumed) {
+        sdc_checkpoint* c = &p.ck;
+        snprintf(c->source_id, sizeof(c->source_id), "%s", p.o.source_id ? p.o.source_id : "");
+        c->src_size = p.src_size;
+        c->block_size = (uint32_t)p.o.block_size;
+        c->gzip_level = p.o.gzip_level;
+        c->format = (uint32_t)p.o.format;
+        c->flags = p.o.sparse ? SDC_CKPT_SPARSE : 0;
+        c->base_crc = p.has_base ? p.link.idx_crc : 0;
+    }
+    p.ck_next = p.start + p.o.checkpoint_every;
+    if (dev_path && open_device(&p) != 0) {
+        close(p.src_fd); pipe_free(&p);
+        return -1;
+    }
+    if (out_path) {
+        p.out_fd = open(out_path, O_WRONLY | O_CREAT | O_CLOEXEC | (p.resumed ? 0 : O_TRUNC), 0644);
+        if (p.out_fd >= 0 && p.resumed &&
+            (ftruncate(p.out_fd, (off_t)p.ck.out_len) != 0 ||
+             lseek(p.out_fd, (off_t)p.ck.out_len, SEEK_SET) < 0)) {
+            close(p.out_fd);
+            p.out_fd = -1;
+        }
+        if (p.out_fd < 0) {
+            sdc_loge("open(%s): %s", out_path, strerror(errno));
+            close(p.src_fd); if (p.dev_fd >= 0) close(p.dev_fd);
+            pipe_free(&p);
+            return -1;
+        }
+        // .sdimg header without an index offset until the index is written.
+        if (p.o.format == SDC_FMT_SDIMG && !p.resumed &&
+            sdc_image_begin(p.out_fd, (uint32_t)p.o.block_size, p.has_base ? &p.link : NULL,
+                            &p.out_pos) != 0)
+            pipe_fail(&p, "write(%s): %s", out_path, strerror(errno));
+    }
+
+    pthread_t tr, tw;
+    pthread_t* tc = calloc(p.o.threads, sizeof(pthread_t));
+    if (!tc) {
+        sdc_loge("out of memory starting workers");
+        close(p.src_fd);
+        if (p.out_fd >= 0) close(p.out_fd);
+        if (p.dev_fd >= 0) close(p.dev_fd);
+        pipe_free(&p);
+        return -1;
+    }
+    p.workers_live = p.o.threads;
+    sdc_thread_create(&tr, reader_main, &p);
+    for (unsigned i = 0; i < p.o.threads; i++)
+        sdc_thread_create(&tc[i], compressor_main, &p);
+    sdc_thread_create(&tw, writer_main, &p);
+    pthread_join(tr, NULL);
+    for (unsigned i = 0; i < p.o.threads; i++) pthread_join(tc[i], NULL);
+    pthread_join(tw, NULL);
+    free(tc);
+    sdc_trace_stall(p.o.trace, "read: no free block", p.free_q.pop_waits, p.free_q.pop_wait_ns);
+    sdc_trace_stall(p.o.trace, "read: read queue full", p.read_q.push_waits, p.read_q.push_wait_ns);
+    sdc_trace_stall(p.o.trace, "compress: read queue empty", p.read_q.pop_waits, p.read_q.pop_wait_ns);
+    sdc_trace_stall(p.o.trace, "compress: write queue full", p.done_q.push_waits, p.done_q.push_wait_ns);
+    sdc_trace_stall(p.o.trace, "write: write queue empty", p.done_q.pop_waits, p.done_q.pop_wait_ns);
+
+    close(p.src_fd);
+    if (p.dev_fd >= 0) {
+        if (!p.failed && fdatasync(p.dev_fd) != 0)
+            pipe_fail(&p, "fdatasync(%s): %s", dev_path, strerror(errno));
+        close(p.dev_fd);
+    }
+    if (p.out_fd >= 0) {
+        if (!p.failed && p.o.format == SDC_FMT_SDIMG &&
+            sdc_image_finish(p.out_fd, (uint32_t)p.o.block_size, p.out_size,
+                             p.idx, p.idx_n, p.out_pos, p.has_base ? &p.link : NULL) != 0)
+            pipe_fail(&p, "writing index of %s: %s", out_path, strerror(errno));
+        // Chunks are durable before the recipe that needs them exists.
+        if (!p.failed && store &&
+            (sdc_store_sync(p.store) != 0 || sdc_ref_finish(p.out_fd, p.out_size, p.ref, p.ref_n) != 0))
+            pipe_fail(&p, "writing recipe %s: %s", out_path, strerror(errno));
+        if (!p.failed && p.o.format == SDC_FMT_GZIP && p.o.sparse && p.o.gzip_level < 0 &&
+            ftruncate(p.out_fd, (off_t)p.out_size) != 0)
+            pipe_fail(&p, "ftruncate(%s): %s", out_path, strerror(errno));
+        if (close(p.out_fd) != 0 && !p.failed)
+            pipe_fail(&p, "close(%s): %s", out_path, strerror(errno));
+        // A recipe without its header can never be read and would stop
+        // sdc_store_gc(); its chunks are unreferenced and go with the next GC.
+        if (p.failed && store && unlink(out_path) == 0)
+            sdc_logi("[STORE] removed incomplete recipe %s", out_path);
+    }
+    if (p.ckpt && !p.failed) {
+        unlink(p.o.checkpoint);
+        if (p.resumed)
+            sdc_logi("[RESUME] image complete; CRC32C of the source: %08x", p.ck.crc32c);
+    } else if (p.ckpt && p.ck.in_off) {
+        sdc_logi("[RESUME] %s kept: a new run resumes at %.2f GB", p.o.checkpoint,
+                 (double)p.ck.in_off / (double)GB(1));
+    }
+    if (!p.failed && p.has_base)
+        sdc_logi("[DELTA] %llu of %llu chunks unchanged from the base, %.2f MB stored",
+                 (unsigned long long)p.base_chunks, (unsigned long long)p.idx_n,
+                 (double)p.out_pos / (double)MB(1));
+    if (!p.failed && p.zero_blocks)
+        sdc_logi(p.o.format == SDC_FMT_SDIMG ? "[STREAM] %llu zero chunks stored as index flags"
+                                              : "[STREAM] %llu zero blocks stored as shared members",
+                 (unsigned long long)p.zero_blocks);
+    int rc = p.failed ? -1 : 0;
+    pipe_free(&p);
+    return rc;
+}
+
+int sdc_stream_image(const char* src_path, const char* out_path, const sdc_stream_opts* opts) {
+    return run_pipeline(src_path, out_path, NULL, opts);
+}
+
+int sdc_clone_stream(const char* src_path, const char* dev_path, const char* archive_path,
+                     const sdc_stream_opts* opts) {
+    return run_pipeline(src_path, archive_path, dev_path, opts);
+}
+
+// ---------------- Image burn (fan-out) ----------------
+// One reader decompresses the image into a ring of shared slots; each
+// destination has its own writer thread and cursor. A slot is reused only
+// after every live writer has written it, so the fastest card runs at most
+// nslots blocks ahead of the slowest. A failed destination drops out and
+// releases its references instead of stalling the others.
+typedef struct {
+    unsigned char* data;
+    size_t         len;
+    uint64_t       offset;
+    uint64_t       h64;       // sdc_hash64 of data (differential burns)
+    bool           zero;      // all zeros and whole pages (zero_offload)
+    int            refs;      // live writers that still have to write this slot
+} fan_slot;
+
+// How a destination clears zero blocks when they are not written. Discard
+// is never used: the kernel no longer reports whether discarded blocks read
+// back as zeros, and on SD cards that depends on the card and the region.
+enum {
+    FAN_ZERO_WRITE = 0,   // written like any other block
+    FAN_ZERO_OUT,         // BLKZEROOUT, offloaded by the device (write_zeroes_max_bytes)
+    FAN_ZERO_PUNCH,       // regular file: punch a hole
+};
+
+// Longest zero run cleared in one call, so progress does not stall on it.
+#define FAN_ZERO_RUN MB(256)
+
+typedef struct sdc_fan sdc_fan;
+
+typedef struct {
+    sdc_fan*       f;
+    const char*    path;
+    int            fd;
+    bool           direct;
+    uint64_t       next;      // next sequence number to write
+    uint64_t       written;
+    int            rc;
+    bool           live;
+    bool           started;   // writer thread created
+    // Differential burn: skip blocks the card already holds.
+    bool           diff;
+    int            rfd;       // buffered read side for read-compare, -1 if none
+    unsigned char* cmp;
+    sdc_manifest   man;       // previous hashes of this card, if trusted
+    bool           use_man;
+    uint64_t       dev_size;
+    uint64_t       skipped;   // bytes left as they were
+    uint64_t       waits, wait_ns;   // stalls on an empty ring
+    // Zero blocks: coalesced into runs and cleared without writing them.
+    int            zmode;     // FAN_ZERO_*
+    uint64_t       zoff, zlen;   // pending run
+    uint64_t       zeroed;    // bytes cleared instead of written
+} fan_dest;
+
+struct sdc_fan {
+    pthread_mutex_t mu;
+    pthread_cond_t  filled;   // reader → writers
+    pthread_cond_t  freed;    // writers → reader
+    fan_slot*       slots;
+    unsigned        nslots;
+    uint64_t        produced; // slots filled so far (sequence numbers < produced)
+    bool            eof;
+    int             live;
+    fan_dest*       dests;
+    int             ndests;
+    sdc_aio_backend io_backend;
+    unsigned        io_depth;
+    size_t          block_size;
+    sdc_trace*      trace;
+    unsigned char*  zeros;    // block_size zero bytes, for runs that must be written
+};
+
+// Drop a failed writer: give back its references on every filled slot it
+// has not written yet.
+static void fan_drop(sdc_fan* f, fan_dest* d) {
+    pthread_mutex_lock(&f->mu);
+    for (uint64_t q = d->next; q < f->produced; q++) f->slots[q % f->nslots].refs--;
+    d->live = false;
+    f->live--;
+    pthread_cond_broadcast(&f->freed);
+    pthread_mutex_unlock(&f->mu);
+}
+
+// Whether the card already holds block seq. With a trusted manifest the
+// hashes decide and nothing is read; otherwise the block is read and compared
+// while the kernel reads the following ones ahead.
+static bool fan_unchanged(fan_dest* d, const fan_slot* s, uint64_t seq) {
+    if (d->use_man) return seq < d->man.n && d->man.hash[seq] && d->man.hash[seq] == s->h64;
+    if (d->rfd < 0) return false;
+    (void)readahead(d->rfd, (off_t)(s->offset + s->len), s->len * 2);
+    bool direct = false;
+    uint64_t t0 = sdc_trace_now();
+    ssize_t got = pread_full(d->rfd, &direct, d->cmp, s->len, s->offset);
+    if (got > 0) sdc_trace_io(d->f->trace, SDC_TRACE_READ, t0, sdc_trace_now(), (uint64_t)got);
+    bool same = got == (ssize_t)s->len && memcmp(d->cmp, s->data, s->len) == 0;
+    (void)posix_fadvise(d->rfd, (off_t)s->offset, (off_t)s->len, POSIX_FADV_DONTNEED);
+    return same;
+}
+
+// O_DIRECT needs sector-sized writes; finish an odd tail buffered.
+static void fan_tail_buffered(fan_dest* d, const fan_slot* s) {
+    if (d->direct && s->len % SDC_IO_ALIGN) {
+        fcntl(d->fd, F_SETFL, fcntl(d->fd, F_GETFL) & ~O_DIRECT);
+        d->direct = false;
+    }
+}
+
+// Mark the block at d->next (in slot s) written and release the slot.
+static void fan_retire(fan_dest* d, fan_slot* s) {
+    sdc_fan* f = d->f;
+    pthread_mutex_lock(&f->mu);
+    d->written = s->offset + s->len;
+    d->next++;
+    if (--s->refs == 0) pthread_cond_broadcast(&f->freed);
+    pthread_mutex_unlock(&f->mu);
+}
+
+// With f->mu held and the writer idle, wait until block seq is filled or the
+// image ends; the wait is counted as a stall of this writer. A writer with
+// requests in flight reaps those instead of waiting.
+static void fan_wait_filled(fan_dest* d, uint64_t seq, bool idle) {
+    sdc_fan* f = d->f;
+    if (seq < f->produced || f->eof || !idle) return;
+    uint64_t t0 = sdc_trace_now();
+    while (seq >= f->produced && !f->eof) pthread_cond_wait(&f->filled, &f->mu);
+    d->waits++;
+    d->wait_ns += sdc_trace_now() - t0;
+}
+
+static const char* fan_zero_name(int zmode) {
+    switch (zmode) {
+    case FAN_ZERO_OUT:     return "zero-out";
+    case FAN_ZERO_PUNCH:   return "hole punching";
+    }
+    return "writing";
+}
+
+// Queue limit of the block device st (its disk's, for a partition); 0 if
+// unknown.
+static uint64_t queue_limit(const struct stat* st, const char* name) {
+    static const char* const up[] = { "", "/.." };
+    for (size_t i = 0; i < sizeof(up) / sizeof(up[0]); i++) {
+        char path[128];
+        snprintf(path, sizeof(path), "/sys/dev/block/%u:%u%s/queue/%s",
+                 major(st->st_rdev), minor(st->st_rdev), up[i], name);
+        FILE* fp = fopen(path, "re");
+        if (!fp) continue;
+        unsigned long long v = 0;
+        if (fscanf(fp, "%llu", &v) != 1) v = 0;
+        fclose(fp);
+        return v;
+    }
+    return 0;
+}
+
+// Pick how d clears zero blocks: zero-out only where the device offloads
+// it with a zeroing guarantee (write_zeroes_max_bytes); anything else is
+// written.
+static void fan_zero_setup(fan_dest* d) {
+    struct stat st;
+    if (fstat(d->fd, &st) != 0) return;
+    if (S_ISREG(st.st_mode)) d->zmode = FAN_ZERO_PUNCH;
+    else if (S_ISBLK(st.st_mode) && queue_limit(&st, "write_zeroes_max_bytes")) d->zmode = FAN_ZERO_OUT;
+    sdc_logi("[ZERO] %s: zero blocks cleared by %s", d->path, fan_zero_name(d->zmode));
+}
+
+static bool fan_write_zeros(fan_dest* d, uint64_t off, uint64_t len) {
+    while (len) {
+        size_t n = len < d->f->block_size ? (size_t)len : d->f->block_size;
+        if (pwrite_full(d->fd, d->f->zeros, n, off) != 0) {
+            sdc_loge("write(%s) at %llu: %s", d->path, (unsigned long long)off, strerror(errno));
+            return false;
+        }
+        off += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Clear d's pending zero run. A method the destination refuses is given up
+// for the rest of the burn and the run written instead.
+static bool fan_zero_flush(fan_dest* d) {
+    uint64_t off = d->zoff, end = d->zoff + d->zlen;
+    if (!d->zlen) return true;
+    d->zlen = 0;
+    uint64_t t0 = sdc_trace_now();
+    uint64_t a = off, b = end;
+    int rc = 0;
+    uint64_t range[2];
+    struct stat st;
+    switch (d->zmode) {
+    case FAN_ZERO_OUT:
+        range[0] = a; range[1] = b - a;
+        rc = ioctl(d->fd, BLKZEROOUT, range);
+        break;
+    case FAN_ZERO_PUNCH:
+        // Holes need the file to reach past them already.
+        rc = fstat(d->fd, &st);
+        if (rc == 0 && (uint64_t)st.st_size < end) {
+            rc = ftruncate(d->fd, (off_t)end);
+            b = (uint64_t)st.st_size > off ? (uint64_t)st.st_size : off;
+        }
+        if (rc == 0 && a < b) rc = fallocate(d->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)a, (off_t)(b - a));
+        a = off;
+        b = end;   // extended or punched, either way zeros now
+        break;
+    default:
+        a = b = off;
+    }
+    if (rc != 0) {
+        sdc_logi("[ZERO] %s: %s refused (%s), writing zeros", d->path, fan_zero_name(d->zmode), strerror(errno));
+        d->zmode = FAN_ZERO_WRITE;
+        a = b = off;
+    }
+    if (!fan_write_zeros(d, off, a - off) || !fan_write_zeros(d, b, end - b)) return false;
+    d->zeroed += b - a;
+    sdc_trace_span(d->f->trace, "zero", 0, t0, sdc_trace_now());
+    return true;
+}
+
+// Take block s into d's zero run instead of writing it. Returns 1 if taken,
+// 0 if it has to be written (any run ahead of it is cleared first), -1 on a
+// write error.
+static int fan_zero_block(fan_dest* d, const fan_slot* s) {
+    bool take = s->zero && d->zmode != FAN_ZERO_WRITE;
+    if (d->zlen && (!take || d->zoff + d->zlen != s->offset || d->zlen >= FAN_ZERO_RUN) &&
+        !fan_zero_flush(d))
+        return -1;
+    if (!take || d->zmode == FAN_ZERO_WRITE) return 0;
+    if (!d->zlen) d->zoff = s->offset;
+    d->zlen += s->len;
+    return 1;
+}
+
+static bool fan_write_sync(fan_dest* d) {
+    sdc_fan* f = d->f;
+    for (;;) {
+        pthread_mutex_lock(&f->mu);
+        fan_wait_filled(d, d->next, true);
+        if (d->next >= f->produced) { pthread_mutex_unlock(&f->mu); return fan_zero_flush(d); }
+        fan_slot* s = &f->slots[d->next % f->nslots];
+        pthread_mutex_unlock(&f->mu);
+
+        fan_tail_buffered(d, s);
+        uint64_t t0 = sdc_trace_now();
+        bool same = d->diff && fan_unchanged(d, s, d->next);
+        int z = same ? 1 : fan_zero_block(d, s);
+        if (same) {
+            d->skipped += s->len;
+        } else if (z < 0) {
+            return false;
+        } else if (z == 0 && pwrite_full(d->fd, s->data, s->len, s->offset) != 0) {
+            sdc_loge("write(%s) at %llu: %s", d->path, (unsigned long long)s->offset, strerror(errno));
+            return false;
+        } else if (z == 0) {
+            uint64_t t1 = sdc_trace_now();
+            sdc_trace_io(f->trace, SDC_TRACE_WRITE, t0, t1, s->len);
+            sdc_trace_span(f->trace, "write", 0, t0, t1);
+        }
+        fan_retire(d, s);
+    }
+}
+
+// Up to io_depth writes in flight ahead of d->next. Slots are still released
+// in order, so the reader's ring and the progress cursor work as before.
+static bool fan_write_aio(fan_dest* d, sdc_aio* a) {
+    sdc_fan* f = d->f;
+    unsigned depth = sdc_aio_depth(a);
+    bool done[SDC_AIO_DEPTH_MAX];
+    uint64_t sub_ns[SDC_AIO_DEPTH_MAX];
+    uint64_t sub = d->next;   // next sequence number to submit
+    for (;;) {
+        unsigned inflight = (unsigned)(sub - d->next);
+        pthread_mutex_lock(&f->mu);
+        fan_wait_filled(d, sub, !inflight);
+        fan_slot* s = sub < f->produced ? &f->slots[sub % f->nslots] : NULL;
+        pthread_mutex_unlock(&f->mu);
+        if (!s && !inflight) return fan_zero_flush(d);
+
+        // An unaligned tail waits until the aligned writes ahead of it are done.
+        if (s && inflight < depth && !(d->direct && s->len % SDC_IO_ALIGN && inflight)) {
+            fan_tail_buffered(d, s);
+            bool same = d->diff && fan_unchanged(d, s, sub);
+            int z = same ? 1 : fan_zero_block(d, s);
+            if (z < 0) return false;
+            done[sub % depth] = z == 1;
+            if (same) d->skipped += s->len;
+            else if (z == 0 && sdc_aio_write(a, d->fd, s->data, s->len, s->offset, sub) != 0) return false;
+            sub_ns[sub % depth] = sdc_trace_now();
+            sub++;
+        } else {
+            uint64_t tag; ssize_t r;
+            if (sdc_aio_wait(a, &tag, &r) != 0) return false;
+            const fan_slot* w = &f->slots[tag % f->nslots];
+            if (r < 0) {
+                sdc_loge("write(%s) at %llu: %s", d->path, (unsigned long long)w->offset, strerror((int)-r));
+                return false;
+            }
+            uint64_t now = sdc_trace_now();
+            sdc_trace_io(f->trace, SDC_TRACE_WRITE, sub_ns[tag % depth], now, (uint64_t)r);
+            sdc_trace_span(f->trace, "write", 2 + (unsigned)(tag % depth), sub_ns[tag % depth], now);
+            done[tag % depth] = true;
+        }
+        while (d->next < sub && done[d->next % depth])
+            fan_retire(d, &f->slots[d->next % f->nslots]);
+    }
+}
+
+static void* fan_writer_main(void* arg) {
+    fan_dest* d = arg;
+    sdc_fan* f = d->f;
+    sdc_aio* a = NULL;
+    bool ok = true;
+    sdc_trace_clock clk; sdc_trace_stage_begin(&clk);
+    if (f->io_backend != SDC_AIO_SYNC) {
+        unsigned char** bufs = calloc(f->nslots, sizeof(unsigned char*));
+        for (unsigned i = 0; bufs && i < f->nslots; i++) bufs[i] = f->slots[i].data;
+        if (bufs) a = sdc_aio_open(f->io_backend, f->io_depth, bufs, f->nslots, f->block_size);
+        free(bufs);
+        ok = a || f->io_backend == SDC_AIO_AUTO;
+    }
+    if (ok) ok = a ? fan_write_aio(d, a) : fan_write_sync(d);
+    sdc_aio_close(a);   // nothing may still write a slot once it is released
+    sdc_trace_stage_end(f->trace, &clk, "burn", d->written);
+    sdc_trace_stall(f->trace, "burn: ring empty", d->waits, d->wait_ns);
+    if (!ok) {
+        d->rc = -1;
+        fan_drop(f, d);
+        return NULL;
+    }
+    if (fdatasync(d->fd) != 0) {
+        sdc_loge("fdatasync(%s): %s", d->path, strerror(errno));
+        d->rc = -1;
+    }
+    return NULL;
+}
+
+static int fan_open_dest(fan_dest* d, bool direct_io) {
+    int flags = O_WRONLY | O_CLOEXEC | O_EXCL;
+    d->direct = direct_io;
+    d->fd = open(d->path, flags | (d->direct ? O_DIRECT : 0));
+    if (d->fd < 0 && d->direct && errno == EINVAL) { d->direct = false; d->fd = open(d->path, flags); }
+    if (d->fd < 0) { sdc_loge("open(%s): %s", d->path, strerror(errno)); return -1; }
+    struct stat st;
+    if (fstat(d->fd, &st) == 0) {
+        d->dev_size = (uint64_t)st.st_size;
+        if (S_ISBLK(st.st_mode) && ioctl(d->fd, BLKGETSIZE64, &d->dev_size) != 0) d->dev_size = 0;
+    }
+    return 0;
+}
+
+// Prepare a differential burn of d: trust the card's manifest if it still
+// matches, else fall back to read-compare. The manifest file is removed
+// until the burn has completed, so an interrupted burn cannot leave one
+// that lies about the card.
+static void fan_diff_setup(fan_dest* d, const char* manifest, size_t block_size) {
+    d->diff = true;
+    if (manifest && sdc_manifest_load(manifest, &d->man) == 0) {
+        d->use_man = d->man.block_size == block_size &&
+                     sdc_manifest_matches(&d->man, d->path, d->dev_size);
+        if (!d->use_man) {
+            sdc_logi("[DIFF] %s: manifest no longer matches the card, comparing by reading", d->path);
+            sdc_manifest_free(&d->man);
+        }
+        unlink(manifest);
+    }
+    if (!d->use_man) {
+        d->rfd = open(d->path, O_RDONLY | O_CLOEXEC);
+        if (d->rfd < 0 || posix_memalign((void**)&d->cmp, SDC_IO_ALIGN, block_size) != 0) {
+            d->cmp = NULL;
+            d->diff = false;
+            sdc_loge("[DIFF] %s: cannot read back, writing every block", d->path);
+        }
+    }
+    sdc_logi("[DIFF] %s: %s", d->path, !d->diff ? "full write" :
+             d->use_man ? "using block-hash manifest" : "read-compare");
+}
+
+// Record what d now holds: this image's block hashes, plus the previous
+// manifest's entries past the image end when that manifest was trusted.
+static void fan_save_manifest(const fan_dest* d, const char* path, const uint64_t* h64s,
+                              uint64_t nblocks, uint64_t image_size, size_t block_size) {
+    sdc_manifest m = { .block_size = (uint32_t)block_size, .dev_size = d->dev_size };
+    m.n = d->use_man && d->man.n > nblocks ? d->man.n : nblocks;
+    m.hash = calloc(m.n ? m.n : 1, sizeof(uint64_t));
+    if (!m.hash) return;
+    memcpy(m.hash, h64s, nblocks * sizeof(uint64_t));
+    if (m.n > nblocks) memcpy(m.hash + nblocks, d->man.hash + nblocks, (m.n - nblocks) * sizeof(uint64_t));
+    // A partial last block only covered part of what is on the card there.
+    if (image_size % block_size && image_size != d->dev_size) m.hash[nblocks - 1] = 0;
+    if (sdc_manifest_save(path, &m) == 0) sdc_logi("[DIFF] manifest saved: %s", path);
+    free(m.hash);
+}
+
+// ---------------- Read-back verification -------------
+// One verifier per successfully written destination, all in parallel (they
+// are separate cards). Progress is reported from the calling thread.
+typedef struct {
+    const char*      path;
+    const sdc_stream_opts* o;
+    const uint32_t*  crcs;
+    uint64_t         image_size;
+    const uint64_t*  plan;
+    uint64_t         nplan;
+    uint64_t         checked;
+    int              rc;
+    pthread_mutex_t* mu;
+    pthread_cond_t*  done;
+    int*             pending;
+} verify_job;
+
+static void* fan_verify_main(void* arg) {
+    verify_job* j = arg;
+    j->rc = sdc_verify_dest(j->path, j->crcs, j->o->block_size, j->image_size,
+                            j->plan, j->nplan, &j->checked, j->o->ctl);
+    pthread_mutex_lock(j->mu);
+    (*j->pending)--;
+    pthread_cond_signal(j->done);
+    pthread_mutex_unlock(j->mu);
+    return NULL;
+}
+
+// Returns the number of destinations that failed verification; their
+// results[] become -2 (-3 where the job was cancelled before a difference
+// showed up).
+static int fan_verify(const sdc_stream_opts* o, const char* const* dev_paths, int ndev,
+                      int* results, const uint32_t* crcs, uint64_t image_size,
+                      const uint64_t* plan, uint64_t nplan) {
+    uint64_t per_dest = 0;
+    for (uint64_t k = 0; k < nplan; k++)
+        per_dest += image_size - plan[k] * o->block_size < o->block_size
+                  ? image_size - plan[k] * o->block_size : o->block_size;
+    verify_job* jobs = calloc((size_t)ndev, sizeof(verify_job));
+    pthread_t* th = calloc((size_t)ndev, sizeof(pthread_t));
+    bool* started = calloc((size_t)ndev, sizeof(bool));
+    if (!jobs || !th || !started) { free(jobs); free(th); free(started); return 0; }
+    pthread_mutex_t mu = PTHREAD_MUTEX_INITIALIZER;
+    pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+    int pending = 0, nver = 0;
+
+    sdc_logi("[VERIFY] reading back %llu of %llu block(s) per destination",
+             (unsigned long long)nplan, (unsigned long long)((image_size + o->block_size - 1) / o->block_size));
+    for (int i = 0; i < ndev; i++) {
+        if (results[i] != 0) continue;
+        verify_job* j = &jobs[i];
+        j->path = dev_paths[i]; j->o = o; j->crcs = crcs; j->image_size = image_size;
+        j->plan = plan; j->nplan = nplan; j->rc = -1;
+        j->mu = &mu; j->done = &done; j->pending = &pending;
+        pthread_mutex_lock(&mu);
+        pending++;
+        pthread_mutex_unlock(&mu);
+        started[i] = sdc_thread_create(&th[i], fan_verify_main, j) == 0;
+        if (!started[i]) { pthread_mutex_lock(&mu); pending--; pthread_mutex_unlock(&mu); }
+        nver++;
+    }
+
+    uint64_t total = per_dest * (uint64_t)nver;
+    pthread_mutex_lock(&mu);
+    while (pending > 0) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += 200 * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) { ts.tv_sec++; ts.tv_nsec -= 1000000000L; }
+        pthread_cond_timedwait(&done, &mu, &ts);
+        if (o->verify_progress) {
+            uint64_t sum = 0;
+            for (int i = 0; i < ndev; i++) sum += __atomic_load_n(&jobs[i].checked, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&mu);
+            o->verify_progress(sum, total, o->progress_user);
+            pthread_mutex_lock(&mu);
+        }
+    }
+    pthread_mutex_unlock(&mu);
+
+    int bad = 0;
+    for (int i = 0; i < ndev; i++) {
+        if (results[i] != 0) continue;
+        if (started[i]) pthread_join(th[i], NULL);
+        if (jobs[i].rc != 0) { results[i] = jobs[i].rc == -2 ? -3 : -2; bad++; }
+    }
+    if (o->verify_progress && !bad) o->verify_progress(total, total, o->progress_user);
+    free(jobs); free(th); free(started);
+    return bad;
+}
+
+// A rescued image holds zeros where the card could not be read; those
+// blocks are read back even in a sampled verify. Returns the merged plan
+// (plan itself if out of memory).
+static uint64_t* plan_with_bad(uint64_t* plan, uint64_t* nplan, const sdc_extent_list* bad,
+                               size_t block_size, uint64_t nblocks) {
+    unsigned char* want = calloc(nblocks ? nblocks : 1, 1);
+    if (!want) return plan;
+    for (uint64_t k = 0; k < *nplan; k++) want[plan[k]] = 1;
+    uint64_t n = *nplan;
+    for (size_t i = 0; i < bad->n; i++)
+        for (uint64_t b = bad->ext[i].off / block_size;
+             b < nblocks && b * block_size < bad->ext[i].off + bad->ext[i].len; b++)
+            if (!want[b]) { want[b] = 1; n++; }
+    uint64_t* merged = malloc(n * sizeof(uint64_t));
+    if (merged) {
+        uint64_t k = 0;
+        for (uint64_t b = 0; b < nblocks; b++) if (want[b]) merged[k++] = b;
+        free(plan);
+        plan = merged;
+        *nplan = n;
+    }
+    free(want);
+    return plan;
+}
+
+// The image is read through sdc_reader, so any supported format works and
+// decoding runs ahead of the writers on its own threads.
+int sdc_burn_fanout(const char* image_path, const char* const* dev_paths, int ndev,
+                    const sdc_stream_opts* opts, int* results) {
+    sdc_stream_opts o;
+    if (opts) o = *opts; else sdc_stream_opts_default(&o);
+    for (int i = 0; i < ndev; i++) results[i] = -1;
+    if (ndev <= 0) return -1;
+    if (!o.block_size || o.block_size % SDC_IO_ALIGN) {
+        sdc_loge("block size must be a non-zero multiple of %d", SDC_IO_ALIGN);
+        return -1;
+    }
+    sdc_reader* rd = sdc_reader_open(image_path);
+    if (!rd) return -1;
+
+    sdc_fan f; memset(&f, 0, sizeof(f));
+    pthread_mutex_init(&f.mu, NULL);
+    pthread_cond_init(&f.filled, NULL);
+    pthread_cond_init(&f.freed, NULL);
+    f.nslots = o.queue_depth * 2 + 2;
+    f.io_backend = o.io_backend;
+    f.io_depth = o.io_depth < f.nslots / 2 ? o.io_depth : f.nslots / 2;
+    f.block_size = o.block_size;
+    f.trace = o.trace;
+    f.slots = calloc(f.nslots, sizeof(fan_slot));
+    f.dests = calloc((size_t)ndev, sizeof(fan_dest));
+    pthread_t* tw = calloc((size_t)ndev, sizeof(pthread_t));
+    bool ok = f.slots && f.dests && tw;
+    for (unsigned i = 0; ok && i < f.nslots; i++)
+        if (posix_memalign((void**)&f.slots[i].data, SDC_IO_ALIGN, o.block_size) != 0) {
+            f.slots[i].data = NULL;
+            ok = false;
+        }
+    if (ok && o.zero_offload) {
+        if (posix_memalign((void**)&f.zeros, SDC_IO_ALIGN, o.block_size) == 0) memset(f.zeros, 0, o.block_size);
+        else f.zeros = NULL;
+    }
+    if (!ok) sdc_loge("out of memory allocating %u x %zu byte burn buffers", f.nslots, o.block_size);
+
+    f.ndests = ndev;
+    for (int i = 0; ok && i < ndev; i++) {
+        fan_dest* d = &f.dests[i];
+        d->f = &f;
+        d->path = dev_paths[i];
+        d->fd = -1;
+        d->rfd = -1;
+        if (fan_open_dest(d, o.direct_io) != 0) continue;   // reported as failed, others go on
+        if (o.diff) fan_diff_setup(d, o.manifests ? o.manifests[i] : NULL, o.block_size);
+        if (f.zeros) fan_zero_setup(d);
+        d->live = true;
+        f.live++;
+    }
+    for (int i = 0; ok && i < ndev; i++)
+        if (f.dests[i].live) {
+            f.dests[i].started = sdc_thread_create(&tw[i], fan_writer_main, &f.dests[i]) == 0;
+            if (!f.dests[i].started) { f.dests[i].live = false; f.live--; }
+        }
+
+    int read_rc = ok ? 0 : -1;
+    uint64_t pos = 0, nblocks = 0, crc_cap = 0;
+    uint32_t* crcs = NULL;
+    uint64_t* h64s = NULL;
+    uint64_t ring_waits = 0, ring_wait_ns = 0;
+    sdc_trace_clock clk; sdc_trace_stage_begin(&clk);
+    for (uint64_t seq = 0; ok; seq++) {
+        fan_slot* s = &f.slots[seq % f.nslots];
+        pthread_mutex_lock(&f.mu);
+        if (s->refs > 0 && f.live > 0) {
+            uint64_t t0 = sdc_trace_now();
+            while (s->refs > 0 && f.live > 0) pthread_cond_wait(&f.freed, &f.mu);
+            ring_waits++;
+            ring_wait_ns += sdc_trace_now() - t0;
+        }
+        bool any = f.live > 0;
+        pthread_mutex_unlock(&f.mu);
+        if (!any) break;
+
+        if (!sdc_ctl_gate(o.ctl, o.block_size)) {
+            sdc_loge("[JOB] %s: cancelled", image_path);
+            read_rc = -1;
+            break;
+        }
+        uint64_t t0 = sdc_trace_now();
+        ssize_t got = sdc_reader_read(rd, s->data, o.block_size);
+        if (got <= 0) { if (got < 0) read_rc = -1; break; }
+        sdc_trace_span(o.trace, "decode", 0, t0, sdc_trace_now());
+        if (nblocks == crc_cap) {
+            crc_cap = crc_cap ? crc_cap * 2 : 1024;
+            uint32_t* c = realloc(crcs, crc_cap * sizeof(uint32_t));
+            uint64_t* h = c ? realloc(h64s, crc_cap * sizeof(uint64_t)) : NULL;
+            if (c) crcs = c;
+            if (h) h64s = h;
+            if (!c || !h) { sdc_loge("out of memory for block checksums"); read_rc = -1; break; }
+        }
+        if (o.verify != SDC_VERIFY_SKIP) crcs[nblocks] = sdc_crc32c(0, s->data, (size_t)got);
+        if (o.diff) s->h64 = h64s[nblocks] = sdc_hash64(s->data, (size_t)got);
+        s->zero = f.zeros && (size_t)got % SDC_IO_ALIGN == 0 && sdc_is_zero(s->data, (size_t)got);
+        nblocks++;
+
+        pthread_mutex_lock(&f.mu);
+        s->len = (size_t)got;
+        s->offset = pos;
+        s->refs = f.live;
+        f.produced = seq + 1;
+        pthread_cond_broadcast(&f.filled);
+        // Aggregate progress follows the slowest live destination.
+        uint64_t slowest = UINT64_MAX;
+        for (int i = 0; i < ndev; i++)
+            if (f.dests[i].live && f.dests[i].written < slowest) slowest = f.dests[i].written;
+        pthread_mutex_unlock(&f.mu);
+        pos += (uint64_t)got;
+
+        if (o.progress && slowest != UINT64_MAX)
+            o.progress(slowest, sdc_reader_total(rd, pos), o.progress_user);
+        if ((size_t)got < o.block_size) break;
+    }
+
+    pthread_mutex_lock(&f.mu);
+    f.eof = true;
+    pthread_cond_broadcast(&f.filled);
+    pthread_mutex_unlock(&f.mu);
+    sdc_trace_stage_end(o.trace, &clk, "decode", pos);
+    sdc_trace_stall(o.trace, "decode: ring full", ring_waits, ring_wait_ns);
+
+    int failed = 0;
+    for (int i = 0; i < ndev; i++) {
+        fan_dest* d = f.dests ? &f.dests[i] : NULL;
+        if (d && d->fd >= 0) {
+            if (d->started) pthread_join(tw[i], NULL);
+            if (close(d->fd) != 0 && d->rc == 0) {
+                sdc_loge("close(%s): %s", d->path, strerror(errno));
+                d->rc = -1;
+            }
+            // A read error must not leave a partial copy looking like success.
+            results[i] = (d->started && d->rc == 0 && read_rc == 0) ? 0 : -1;
+            if (results[i] != 0 && d->rc == 0 && sdc_ctl_cancelled(o.ctl)) results[i] = -3;
+            if (results[i] == 0 && d->diff)
+                sdc_logi("[DIFF] %s: %.2f of %.2f MB changed and written", d->path,
+                         (double)(d->written - d->skipped) / (double)MB(1), (double)d->written / (double)MB(1));
+            else if (results[i] == 0)
+                sdc_logi("[BURN] %.2f MB written to %s", (double)d->written / (double)MB(1), d->path);
+            if (results[i] == 0 && d->zeroed)
+                sdc_logi("[ZERO] %s: %.2f MB of zeros cleared without writing them", d->path,
+                         (double)d->zeroed / (double)MB(1));
+        }
+        if (results[i] != 0) failed++;
+    }
+    if (failed == 0 && o.progress) o.progress(pos, pos, o.progress_user);
+    sdc_reader_close(rd);
+
+    if (o.verify != SDC_VERIFY_SKIP && failed < ndev) {
+        uint64_t nplan = 0;
+        uint64_t* plan = sdc_verify_plan(nblocks, o.verify, o.verify_sample_pct, &nplan);
+        if (o.bad && o.bad->n) plan = plan_with_bad(plan, &nplan, o.bad, o.block_size, nblocks);
+        if (nplan) failed += fan_verify(&o, dev_paths, ndev, results, crcs, pos, plan, nplan);
+        free(plan);
+    }
+    for (int i = 0; f.dests && i < ndev; i++) {
+        fan_dest* d = &f.dests[i];
+        if (o.diff && results[i] == 0 && o.manifests && o.manifests[i])
+            fan_save_manifest(d, o.manifests[i], h64s, nblocks, pos, o.block_size);
+        if (d->rfd >= 0) close(d->rfd);
+        free(d->cmp);
+        sdc_manifest_free(&d->man);
+    }
+    free(crcs);
+    free(h64s);
+
+    for (unsigned i = 0; f.slots && i < f.nslots; i++) free(f.slots[i].data);
+    free(f.slots);
+    free(f.zeros);
+    free(f.dests);
+    free(tw);
+    pthread_cond_destroy(&f.filled);
+    pthread_cond_destroy(&f.freed);
+    pthread_mutex_destroy(&f.mu);
+    return failed ? -1 : 0;
+}
+
+int sdc_burn_image(const char* image_path, const char* dev_path, const sdc_stream_opts* opts) {
+    int result;
+    return sdc_burn_fanout(image_path, &dev_path, 1, opts, &result);
+}
+
+// ---------------- Range copy --------------------------
+int sdc_copy_range(const char* src_path, uint64_t len, const char* dst_path, uint64_t dst_off,
+                   const sdc_extent_list* unallocated) {
+    static const sdc_extent_list none = {0};
+    const sdc_extent_list* m = unallocated ? unallocated : &none;
+    int sfd = open(src_path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    bool direct = sfd >= 0;
+    if (sfd < 0) sfd = open(src_path, O_RDONLY | O_CLOEXEC);
+    if (sfd < 0) { sdc_loge("open(%s): %s", src_path, strerror(errno)); return -1; }
+    int dfd = open(dst_path, O_WRONLY | O_CLOEXEC);
+    if (dfd < 0) {
+        sdc_loge("open(%s): %s", dst_path, strerror(errno));
+        close(sfd);
+        return -1;
+    }
+    size_t bufsz = MB(4);
+    unsigned char* buf = NULL;
+    if (posix_memalign((void**)&buf, SDC_IO_ALIGN, bufsz) != 0) {
+        close(sfd); close(dfd);
+        return -1;
+    }
+
+    int rc = 0;
+    size_t cursor = 0;
+    for (uint64_t pos = 0; pos < len && rc == 0; ) {
+        size_t want = len - pos < bufsz ? (size_t)(len - pos) : bufsz;
+        ssize_t n = read_mapped(sfd, &direct, m, &cursor, buf, want, pos);
+        if (n < 0 || (size_t)n < want) {
+            sdc_loge("read(%s) at %llu: %s", src_path, (unsigned long long)pos,
+                     n < 0 ? strerror(errno) : "short read");
+            rc = -1;
+            break;
+        }
+        // Destination is a fresh sparse file: skip zero grains.
+        for (size_t i = 0; i < want; i += SDC_SPARSE_GRAIN) {
+            size_t g = want - i < SDC_SPARSE_GRAIN ? want - i : SDC_SPARSE_GRAIN;
+            if (sdc_is_zero(buf + i, g)) continue;
+            if (pwrite_full(dfd, buf + i, g, dst_off + pos + i) != 0) {
+                sdc_loge("write(%s): %s", dst_path, strerror(errno));
+                rc = -1;
+                break;
+            }
+        }
+        pos += want;
+    }
+    free(buf);
+    close(sfd);
+    if (close(dfd) != 0 && rc == 0) { sdc_loge("close(%s): %s", dst_path, strerror(errno)); rc = -1; }
+    return rc;
+}
+
+// ---------------- Hole punching -----------------------
+// Walk the allocated extents of path and deallocate every all-zero grain.
+int sdc_punch_zero_holes(const char* path, uint64_t* punched) {
+    if (punched) *punched = 0;
+    int fd = open(path, O_RDWR | O_CLOEXEC);
+    if (fd < 0) { sdc_loge("open(%s): %s", path, strerror(errno)); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) != 0) { close(fd); return -1; }
+    size_t bufsz = MB(1);
+    unsigned char* buf = NULL;
+    if (posix_memalign((void**)&buf, SDC_IO_ALIGN, bufsz) != 0) { close(fd); return -1; }
+
+    int rc = 0;
+    off_t off = 0;
+    while (off < st.st_size) {
+        off_t data = lseek(fd, off, SEEK_DATA);
+        if (data < 0) break;                        // ENXIO: only holes remain
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) hole = st.st_size;
+        data -= data % SDC_SPARSE_GRAIN;
+        for (off_t pos = data; pos < hole; ) {
+            size_t want = (size_t)(hole - pos) < bufsz ? (size_t)(hole - pos) : bufsz;
+            ssize_t n = pread(fd, buf, want, pos);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) { rc = -1; break; }
+            if (n == 0) break;
+            for (ssize_t i = 0; i < n; i += SDC_SPARSE_GRAIN) {
+                size_t g = (size_t)(n - i) < SDC_SPARSE_GRAIN ? (size_t)(n - i) : SDC_SPARSE_GRAIN;
+                if (g == SDC_SPARSE_GRAIN && sdc_is_zero(buf + i, g) &&
+                    fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, pos + i, (off_t)g) == 0 &&
+                    punched) *punched += g;
+            }
+            pos += n;
+        }
+        if (rc != 0) break;
+        off = hole;
+    }
+    if (rc != 0) sdc_loge("read(%s): %s", path, strerror(errno));
+    free(buf);
+    close(fd);
+    return rc;
+}
@@ -0,0 +1,127 @@
+// sdcloner_pipeline.h
+// In-process streaming pipeline: reader → compressor pool → writer.
+// Stages run on their own threads and hand aligned blocks to each other
+// through bounded queues, so a slow stage applies back-pressure instead of
+// growing memory.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sdcloner_fsmap.h"
+#include "sdcloner_verify.h"
+#include "sdcloner_aio.h"
+#include "sdcloner_trace.h"
+#include "sdcloner_jobs.h"
+
+#define SDC_IO_ALIGN 4096
+
+// Compressed output is one gzip member per block. Each member header has
+// FEXTRA with an "SC" subfield holding the member's total length (LE32),
+// so members can be located and inflated in parallel.
+#define SDC_GZ_HDR_LEN 20
+
+// Granularity at which zero runs become holes in uncompressed images.
+#define SDC_SPARSE_GRAIN 65536
+
+// Progress hook: done/total bytes of the operation (total 0 if unknown).
+// Called from a pipeline thread, once per completed block, in order.
+typedef void (*sdc_progress_fn)(uint64_t done, uint64_t total, void* user);
+
+typedef enum {
+    SDC_FMT_GZIP = 0,   // multi-member .img.gz (gzip_level >= 0) or raw .img
+    SDC_FMT_SDIMG,      // seekable chunked container, see sdcloner_image.h
+    SDC_FMT_STORE,      // .sdref recipe + deduplicated chunks, see sdcloner_store.h
+} sdc_out_format;
+
+typedef struct {
+    size_t   block_size;   // bytes per block, multiple of SDC_IO_ALIGN (default 4 MiB)
+    unsigned queue_depth;  // blocks in flight between stages (default 8)
+    bool     direct_io;    // try O_DIRECT on the source, fall back if refused
+    bool     drop_cache;   // posix_fadvise(DONTNEED) behind the reader
+    int      gzip_level;   // 0..9 = gzip output, -1 = raw output
+    unsigned threads;      // compressor workers, 0 = all online CPUs
+    bool     sparse;       // zero blocks: holes in raw output, shared member in gzip
+    const sdc_extent_list* unallocated;  // source ranges never read, emitted as zeros
+    sdc_progress_fn progress;            // optional
+    void*    progress_user;
+    sdc_out_format format;               // output container (default gzip)
+    const char* base_image;              // .sdimg output: write a delta against this
+                                         // .sdimg, storing only chunks that differ
+    bool     image_source;               // src_path is an image (.img/.img.gz/.sdimg),
+                                         // decoded while reading (conversion)
+    sdc_verify_mode verify;              // burn: read destinations back (default skip)
+    unsigned verify_sample_pct;          // share of blocks for SDC_VERIFY_SAMPLED (default 5)
+    sdc_progress_fn verify_progress;     // optional, bytes compared / to compare
+    bool     diff;                       // burn: write only blocks the destination lacks
+    const char* const* manifests;        // diff: per-destination manifest path (or NULL)
+    sdc_aio_backend io_backend;          // device reads / burn writes (default auto)
+    unsigned io_depth;                   // requests in flight per device (default 4)
+    sdc_trace* trace;                    // optional: stage times, I/O latency, stalls
+    const char* checkpoint;              // imaging: checkpoint file (see sdcloner_checkpoint.h),
+                                         // rewritten every checkpoint_every bytes and removed
+                                         // once the image is complete; NULL = none
+    uint64_t checkpoint_every;           // default 1 GiB
+    bool     resume;                     // continue from checkpoint when it still matches
+    const char* source_id;               // identity recorded in checkpoints (card CID), or NULL
+    const sdc_extent_list* bad;          // burn: image ranges a rescue could not read (see
+                                         // sdcloner_rescue.h); always verified, may be NULL
+    bool     zero_offload;               // burn: clear zero blocks with zero-out or
+                                         // hole punching instead of writing them (default on)
+    sdc_ctl* ctl;                        // optional: scheduler pause / cancel / bandwidth,
+                                         // gated per block read (see sdcloner_jobs.h)
+} sdc_stream_opts;
+
+void sdc_stream_opts_default(sdc_stream_opts* o);
+
+// Copy src_path (block device or file) into out_path, compressed according
+// to o->gzip_level and o->format. Returns 0 on success, -1 on failure (already logged).
+// With o->checkpoint (gzip, raw or .sdimg output of a device or file) the
+// image can be resumed: with o->resume and a checkpoint that matches the
+// settings and the source, out_path is cut back to the checkpoint and the
+// source is read from there on; otherwise it starts over.
+int sdc_stream_image(const char* src_path, const char* out_path, const sdc_stream_opts* o);
+
+// Single-pass raw clone: every source block is written to dev_path at the
+// same offset. If archive_path is non-NULL the same blocks are also compressed
+// into it (tee), so the clone costs as long as the slowest device.
+int sdc_clone_stream(const char* src_path, const char* dev_path, const char* archive_path,
+                     const sdc_stream_opts* o);
+
+// Write an image (.img, .img.gz or .sdimg, detected by content)
+// to dev_path, opened O_EXCL with O_DIRECT when o->direct_io allows, then
+// fdatasync. For compressed input, progress totals are estimated from the
+// compressed position and converge to the real size.
+int sdc_burn_image(const char* image_path, const char* dev_path, const sdc_stream_opts* o);
+
+// Fan-out burn: the image is read and decompressed once into a ring of
+// shared blocks (2 * queue_depth + 2) and written to ndev destinations by one
+// writer thread each. A slow destination holds the others back by at most the
+// ring size; a failing one drops out without stopping the rest. Each block's
+// CRC32C is taken as it is handed out; with o->verify the destinations are
+// then read back in parallel and compared. results[i] gets 0, -1 (write
+// failure), -2 (read-back mismatch) or -3 (cancelled through o->ctl) per
+// destination; progress follows the slowest live one. With o->diff each writer skips blocks the destination
+// already holds, judged by its manifest (o->manifests[i], see
+// sdcloner_manifest.h) or by reading it; successful destinations get a fresh
+// manifest. With o->zero_offload, runs of all-zero blocks are not written:
+// BLKZEROOUT where the device offloads it, a punched hole for a file, plain
+// writes otherwise.
+// Returns 0 if every destination succeeded.
+int sdc_burn_fanout(const char* image_path, const char* const* dev_paths, int ndev,
+                    const sdc_stream_opts* o, int* results);
+
+// Copy len bytes from the start of src_path into an existing (sparse) file
+// dst_path at dst_off. Ranges in unallocated (src offsets, may be NULL) are
+// never read; zero grains are left as holes in the destination.
+int sdc_copy_range(const char* src_path, uint64_t len, const char* dst_path, uint64_t dst_off,
+                   const sdc_extent_list* unallocated);
+
+// True if buf[0..len) is all zero bytes (AVX2/SSE2 when the CPU has them).
+bool sdc_is_zero(const void* buf, size_t len);
+
+// Deallocate all-zero SDC_SPARSE_GRAIN regions of an existing file in place.
+// *punched (optional) receives the number of bytes released.
+int sdc_punch_zero_holes(const char* path, uint64_t* punched);
@@ -0,0 +1,438 @@
+// sdcloner_probe.c
+// In-process device probing: sysfs, superblock magic, mountinfo.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <errno.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/socket.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+
+#include "sdcloner_engine.h"
+#include "sdcloner_internal.h"
+#include "sdcloner_probe.h"
+#include "sdcloner_ptable.h"
+
+static uint16_t le16(const unsigned char* p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// ---------------- sysfs -------------------------------
+// Read a single-line sysfs attribute, trailing whitespace stripped.
+static int sysfs_read(const char* path, char* out, size_t cap) {
+    FILE* fp = fopen(path, "r");
+    if (!fp) { if (cap) out[0] = '\0'; return -1; }
+    if (!fgets(out, (int)cap, fp)) out[0] = '\0';
+    fclose(fp);
+    size_t n = strlen(out);
+    while (n && isspace((unsigned char)out[n - 1])) out[--n] = '\0';
+    return 0;
+}
+
+static uint64_t sysfs_u64(const char* path) {
+    char buf[64];
+    if (sysfs_read(path, buf, sizeof(buf)) != 0) return 0;
+    return strtoull(buf, NULL, 10);
+}
+
+static const char* base_name(const char* path) {
+    const char* s = strrchr(path, '/');
+    return s ? s + 1 : path;
+}
+
+static bool skip_disk(const char* name) {
+    static const char* skip[] = { "loop", "ram", "zram", "dm-", "md", "sr", "fd", NULL };
+    for (int i = 0; skip[i]; i++)
+        if (!strncmp(name, skip[i], strlen(skip[i]))) return true;
+    return false;
+}
+
+// ---------------- Superblock magic --------------------
+int sdc_probe_fstype(const char* dev, char* out, size_t cap) {
+    out[0] = '\0';
+    int fd = open(dev, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    // 68 KiB covers every signature below (btrfs sits at 64 KiB + 0x40).
+    size_t len = 0x10000 + 4096;
+    unsigned char* b = calloc(1, len);
+    if (!b) { close(fd); return -1; }
+    ssize_t got = pread(fd, b, len, 0);
+    close(fd);
+    if (got < 4096) { free(b); return -1; }
+
+    const char* t = NULL;
+    if (le16(b + 1024 + 56) == 0xEF53) {
+        uint32_t compat = le32(b + 1024 + 92), incompat = le32(b + 1024 + 96);
+        // Anything beyond ext3's incompat set (filetype, recover, meta_bg) is ext4.
+        if (incompat & ~0x0016u) t = "ext4";
+        else if (compat & 0x0004) t = "ext3";
+        else t = "ext2";
+    } else if (!memcmp(b + 3, "EXFAT   ", 8)) {
+        t = "exfat";
+    } else if (!memcmp(b + 3, "NTFS    ", 8)) {
+        t = "ntfs";
+    } else if (b[510] == 0x55 && b[511] == 0xAA &&
+               (!memcmp(b + 54, "FAT", 3) || !memcmp(b + 82, "FAT32", 5))) {
+        t = "vfat";
+    } else if (!memcmp(b, "XFSB", 4)) {
+        t = "xfs";
+    } else if (!memcmp(b, "hsqs", 4)) {
+        t = "squashfs";
+    } else if (le32(b + 1024) == 0xF2F52010) {
+        t = "f2fs";
+    } else if ((size_t)got >= 0x10048 && !memcmp(b + 0x10040, "_BHRfS_M", 8)) {
+        t = "btrfs";
+    } else if (!memcmp(b + 4096 - 10, "SWAPSPACE2", 10) || !memcmp(b + 4096 - 10, "SWAP-SPACE", 10)) {
+        t = "swap";
+    }
+    free(b);
+    if (!t) return -1;
+    snprintf(out, cap, "%s", t);
+    return 0;
+}
+
+// ---------------- mountinfo ---------------------------
+// mountinfo escapes space, tab, newline and backslash as \ooo.
+static void unescape(char* s) {
+    char* w = s;
+    for (char* r = s; *r; ) {
+        if (r[0] == '\\' && isdigit((unsigned char)r[1]) && isdigit((unsigned char)r[2]) &&
+            isdigit((unsigned char)r[3])) {
+            *w++ = (char)((r[1] - '0') * 64 + (r[2] - '0') * 8 + (r[3] - '0'));
+            r += 4;
+        } else {
+            *w++ = *r++;
+        }
+    }
+    *w = '\0';
+}
+
+// Walk mountinfo entries backed by dev. cb returns true to stop.
+static int for_each_mount(const char* dev, bool (*cb)(const char* mnt, const char* opts, void* arg),
+                          void* arg) {
+    struct stat st;
+    if (stat(dev, &st) != 0 || !S_ISBLK(st.st_mode)) return -1;
+    FILE* fp = fopen("/proc/self/mountinfo", "r");
+    if (!fp) return -1;
+    char* line = NULL; size_t cap = 0;
+    while (getline(&line, &cap, fp) > 0) {
+        unsigned maj, min;
+        char mnt[4096], opts[1024];
+        // id parent maj:min root mountpoint options ...
+        if (sscanf(line, "%*u %*u %u:%u %*s %4095s %1023s", &maj, &min, mnt, opts) != 4) continue;
+        if (makedev(maj, min) != st.st_rdev) continue;
+        unescape(mnt);
+        if (cb(mnt, opts, arg)) break;
+    }
+    free(line);
+    fclose(fp);
+    return 0;
+}
+
+typedef struct { char* out; size_t cap; bool found; } mp_arg;
+
+static bool first_mount_cb(const char* mnt, const char* opts, void* arg) {
+    (void)opts;
+    mp_arg* a = arg;
+    snprintf(a->out, a->cap, "%s", mnt);
+    a->found = true;
+    return true;
+}
+
+int sdc_probe_mountpoint(const char* dev, char* out, size_t cap) {
+    out[0] = '\0';
+    mp_arg a = { out, cap, false };
+    for_each_mount(dev, first_mount_cb, &a);
+    return a.found ? 0 : -1;
+}
+
+typedef struct { char** out; int max; int n; } mps_arg;
+
+static bool all_mounts_cb(const char* mnt, const char* opts, void* arg) {
+    (void)opts;
+    mps_arg* a = arg;
+    if (a->n < a->max && (a->out[a->n] = strdup(mnt))) a->n++;
+    return a->n == a->max;
+}
+
+int sdc_probe_mountpoints(const char* dev, char** out, int max) {
+    mps_arg a = { out, max, 0 };
+    for_each_mount(dev, all_mounts_cb, &a);
+    return a.n;
+}
+
+// ---------------- Public enumeration ------------------
+int sdc_probe_card_id(const char* dev, char* out, size_t cap) {
+    char real[PATH_MAX], path[PATH_MAX + 32], cid[64];
+    if (cap) out[0] = '\0';
+    if (!realpath(dev, real)) return -1;
+    snprintf(path, sizeof(path), "/sys/class/block/%s/device/cid", base_name(real));
+    if (sysfs_read(path, cid, sizeof(cid)) != 0 || !cid[0]) return -1;
+    for (char* c = cid; *c; c++) if (!isxdigit((unsigned char)*c)) return -1;
+    snprintf(out, cap, "mmc-%s", cid);
+    return 0;
+}
+
+int sdcloner_list_devices(sdcloner_device** out, int* count) {
+    *out = NULL; *count = 0;
+    DIR* d = opendir("/sys/block");
+    if (!d) { sdc_loge("opendir(/sys/block): %s", strerror(errno)); return -1; }
+    int cap = 0, n = 0;
+    sdcloner_device* arr = NULL;
+    struct dirent* de;
+    while ((de = readdir(d))) {
+        if (de->d_name[0] == '.' || skip_disk(de->d_name)) continue;
+        char path[512], buf[128];
+        snprintf(path, sizeof(path), "/sys/block/%s/size", de->d_name);
+        uint64_t sectors = sysfs_u64(path);
+        if (!sectors) continue;   // empty card reader slot
+        if (n == cap) {
+            cap = cap ? cap * 2 : 16;
+            sdcloner_device* na = realloc(arr, sizeof(*arr) * (size_t)cap);
+            if (!na) { free(arr); closedir(d); return -1; }
+            arr = na;
+        }
+        sdcloner_device* dev = &arr[n++];
+        memset(dev, 0, sizeof(*dev));
+        snprintf(dev->path, sizeof(dev->path), "/dev/%.58s", de->d_name);
+        dev->size_bytes = sectors * 512ULL;   // sysfs size is always in 512-byte units
+        snprintf(path, sizeof(path), "/sys/block/%s/removable", de->d_name);
+        dev->removable = (int)sysfs_u64(path);
+        snprintf(path, sizeof(path), "/sys/block/%s/ro", de->d_name);
+        dev->readonly = (int)sysfs_u64(path);
+        char vendor[64] = "", model[64] = "";
+        snprintf(path, sizeof(path), "/sys/block/%s/device/vendor", de->d_name);
+        sysfs_read(path, vendor, sizeof(vendor));
+        snprintf(path, sizeof(path), "/sys/block/%s/device/model", de->d_name);
+        if (sysfs_read(path, model, sizeof(model)) != 0) {
+            snprintf(path, sizeof(path), "/sys/block/%s/device/name", de->d_name);  // mmc
+            sysfs_read(path, model, sizeof(model));
+        }
+        snprintf(buf, sizeof(buf), "%s%s%s", vendor, *vendor && *model ? " " : "", model);
+        snprintf(dev->model, sizeof(dev->model), "%.63s", buf);
+    }
+    closedir(d);
+    *out = arr; *count = n;
+    return 0;
+}
+
+// The sysfs path of a disk runs through its host controller:
+//   /sys/devices/pci0000:00/0000:00:14.0/usb2/2-1/.../block/sdb
+//   /sys/devices/platform/fe320000.mmc/mmc_host/mmc1/mmc1:0001/block/mmcblk1
+// The USB and USB 3 root hubs of one xHCI share the PCI function before
+// "usbN"; an MMC host is "mmcN". Anything else counts as its own bus.
+int sdcloner_device_bus(const char* dev, char* out, size_t cap) {
+    struct stat st;
+    if (stat(dev, &st) != 0 || !S_ISBLK(st.st_mode)) return -1;
+    char link[64], real[PATH_MAX];
+    snprintf(link, sizeof(link), "/sys/dev/block/%u:%u", major(st.st_rdev), minor(st.st_rdev));
+    if (!realpath(link, real)) return -1;
+    char* block = strstr(real, "/block/");
+    const char* prev = NULL;
+    char* save = NULL;
+    if (block) *block = '\0';
+    for (char* c = strtok_r(real, "/", &save); c; prev = c, c = strtok_r(NULL, "/", &save)) {
+        unsigned n; int end = 0;
+        if (prev && sscanf(c, "usb%u%n", &n, &end) == 1 && !c[end]) {
+            snprintf(out, cap, "%s", prev);
+            return 0;
+        }
+        end = 0;
+        if (sscanf(c, "mmc%u%n", &n, &end) == 1 && !c[end]) {
+            snprintf(out, cap, "%s", c);
+            return 0;
+        }
+    }
+    const char* disk = block ? block + 7 : base_name(dev);   // "sdb" of "sdb/sdb1"
+    snprintf(out, cap, "%.*s", (int)strcspn(disk, "/"), disk);
+    return 0;
+}
+
+// ---------------- Hotplug watch -----------------------
+#define WATCH_SETTLE_MS 150   // quiet time after the last event before rescanning
+
+struct sdcloner_device_watch {
+    sdcloner_devices_fn fn;
+    void*            user;
+    int              fd;          // netlink uevent socket, or inotify on /dev
+    bool             netlink;
+    int              stop[2];     // closing stop[1] ends the thread
+    pthread_t        th;
+    sdcloner_device* last;
+    int              nlast;
+    bool             scanned;
+};
+
+static void watch_rescan(sdcloner_device_watch* w) {
+    sdcloner_device* devs = NULL;
+    int n = 0;
+    if (sdcloner_list_devices(&devs, &n) != 0) return;
+    if (w->scanned && n == w->nlast && (n == 0 || memcmp(devs, w->last, sizeof(*devs) * (size_t)n) == 0)) {
+        free(devs);
+        return;
+    }
+    free(w->last);
+    w->last = devs;
+    w->nlast = n;
+    w->scanned = true;
+    w->fn(devs, n, w->user);
+}
+
+// Consume pending events. Returns true if any may concern a block device.
+static bool watch_drain(sdcloner_device_watch* w) {
+    char buf[8192] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool hit = false;
+    for (;;) {
+        ssize_t n = w->netlink ? recv(w->fd, buf, sizeof(buf) - 1, MSG_DONTWAIT)
+                               : read(w->fd, buf, sizeof(buf));
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && errno == ENOBUFS) { hit = true; continue; }   // overrun: rescan anyway
+        if (n <= 0) return hit;
+        if (!w->netlink) { hit = true; continue; }
+        // "action@devpath\0KEY=value\0...": only the block subsystem matters.
+        buf[n] = '\0';
+        for (char* p = buf; p < buf + n; p += strlen(p) + 1)
+            if (strcmp(p, "SUBSYSTEM=block") == 0) { hit = true; break; }
+    }
+}
+
+static void* watch_main(void* arg) {
+    sdcloner_device_watch* w = arg;
+    watch_rescan(w);
+    struct pollfd pf[2] = { { .fd = w->fd, .events = POLLIN }, { .fd = w->stop[0], .events = POLLIN } };
+    bool dirty = false;
+    for (;;) {
+        int r = poll(pf, 2, dirty ? WATCH_SETTLE_MS : -1);
+        if (r < 0 && errno == EINTR) continue;
+        if (r < 0 || pf[1].revents) return NULL;
+        if (r == 0) { dirty = false; watch_rescan(w); continue; }
+        if (watch_drain(w)) dirty = true;
+    }
+}
+
+// Kernel uevents (multicast group 1) need no udev daemon; some containers
+// refuse the socket, hence the inotify fallback.
+static int watch_open(sdcloner_device_watch* w) {
+    w->fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (w->fd >= 0) {
+        struct sockaddr_nl sa = { .nl_family = AF_NETLINK, .nl_groups = 1 };
+        if (bind(w->fd, (struct sockaddr*)&sa, sizeof(sa)) == 0) { w->netlink = true; return 0; }
+        close(w->fd);
+    }
+    w->fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if (w->fd >= 0 && inotify_add_watch(w->fd, "/dev", IN_CREATE | IN_DELETE) >= 0) {
+        sdc_logi("[WATCH] no uevents, watching /dev instead");
+        return 0;
+    }
+    sdc_loge("[WATCH] cannot watch for devices: %s", strerror(errno));
+    if (w->fd >= 0) close(w->fd);
+    return -1;
+}
+
+sdcloner_device_watch* sdcloner_watch_devices(sdcloner_devices_fn fn, void* user) {
+    sdcloner_device_watch* w = calloc(1, sizeof(*w));
+    if (!w) return NULL;
+    w->fn = fn;
+    w->user = user;
+    if (watch_open(w) != 0) { free(w); return NULL; }
+    if (pipe2(w->stop, O_CLOEXEC) != 0) { close(w->fd); free(w); return NULL; }
+    if (pthread_create(&w->th, NULL, watch_main, w) != 0) {
+        close(w->stop[0]); close(w->stop[1]); close(w->fd);
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+void sdcloner_unwatch_devices(sdcloner_device_watch* w) {
+    if (!w) return;
+    close(w->stop[1]);
+    pthread_join(w->th, NULL);
+    close(w->stop[0]);
+    close(w->fd);
+    free(w->last);
+    free(w);
+}
+
+static int part_cmp(const void* a, const void* b) {
+    const sdcloner_partition* x = a; const sdcloner_partition* y = b;
+    return x->index - y->index;
+}
+
+static void fill_fs(sdcloner_partition* p) {
+    sdc_probe_fstype(p->path, p->fstype, sizeof(p->fstype));
+    sdc_probe_mountpoint(p->path, p->mountpoint, sizeof(p->mountpoint));
+}
+
+int sdcloner_list_partitions(const char* disk, sdcloner_partition** out, int* count) {
+    *out = NULL; *count = 0;
+    const char* name = base_name(disk);
+    char dir[512];
+    snprintf(dir, sizeof(dir), "/sys/class/block/%s", name);
+
+    int cap = 0, n = 0;
+    sdcloner_partition* arr = NULL;
+    DIR* d = opendir(dir);
+    if (d) {
+        // Kernel view: /sys/class/block/<disk>/<part>/{partition,start,size}
+        struct dirent* de;
+        while ((de = readdir(d))) {
+            if (strncmp(de->d_name, name, strlen(name)) != 0) continue;
+            char path[1024];
+            snprintf(path, sizeof(path), "%s/%s/partition", dir, de->d_name);
+            uint64_t idx = sysfs_u64(path);
+            if (!idx) continue;
+            if (n == cap) {
+                cap = cap ? cap * 2 : 8;
+                sdcloner_partition* na = realloc(arr, sizeof(*arr) * (size_t)cap);
+                if (!na) { free(arr); closedir(d); return -1; }
+                arr = na;
+            }
+            sdcloner_partition* p = &arr[n++];
+            memset(p, 0, sizeof(*p));
+            p->index = (int)idx;
+            snprintf(p->path, sizeof(p->path), "/dev/%.58s", de->d_name);
+            snprintf(path, sizeof(path), "%s/%s/start", dir, de->d_name);
+            p->start_bytes = sysfs_u64(path) * 512ULL;
+            snprintf(path, sizeof(path), "%s/%s/size", dir, de->d_name);
+            p->size_bytes = sysfs_u64(path) * 512ULL;
+            fill_fs(p);
+        }
+        closedir(d);
+    } else {
+        // Image file (or no sysfs): parse the partition table directly.
+        sdc_ptable pt;
+        if (sdc_ptable_read(disk, &pt) != 0) return -1;
+        if (pt.n) {
+            arr = calloc((unsigned)pt.n, sizeof(*arr));
+            if (!arr) return -1;
+        }
+        for (int i = 0; i < pt.n; i++) {
+            sdcloner_partition* p = &arr[n++];
+            p->index = pt.part[i].index;
+            sdc_part_devnode(disk, p->index, p->path, sizeof(p->path));
+            p->start_bytes = pt.part[i].start * pt.sector_size;
+            p->size_bytes = pt.part[i].size * pt.sector_size;
+            if (access(p->path, R_OK) == 0) fill_fs(p);
+        }
+    }
+    if (n > 1) qsort(arr, (size_t)n, sizeof(*arr), part_cmp);
+    *out = arr; *count = n;
+    return 0;
+}
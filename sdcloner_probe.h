@@ -0,0 +1,25 @@
+// sdcloner_probe.h
+// In-process device probing: sysfs attributes, filesystem superblock magic and
+// /proc/self/mountinfo. Backs sdcloner_list_devices()/sdcloner_list_partitions().
+// License: GPLv3
+
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// blkid-style filesystem type name for dev ("ext4", "vfat", ...), written to
+// out; empty string if unrecognised. Returns 0 if a type was found.
+int sdc_probe_fstype(const char* dev, char* out, size_t cap);
+
+// First mountpoint of dev from /proc/self/mountinfo (matched by device
+// number). Empty string if not mounted. Returns 0 if mounted.
+int sdc_probe_mountpoint(const char* dev, char* out, size_t cap);
+
+// Identity of the medium in dev, stable across readers and reboots: the SD
+// card's CID ("mmc-<cid>") for cards in an MMC slot. USB readers only expose
+// the reader's serial, so no id is given there. Returns 0 if found.
+int sdc_probe_card_id(const char* dev, char* out, size_t cap);
+
+// Every mountpoint of dev (bind mounts included), up to max, strdup'd into
+// out; caller frees each. Returns the number found.
+int sdc_probe_mountpoints(const char* dev, char** out, int max);
@@ -0,0 +1,249 @@
+// sdcloner_ptable.c
+// Native MBR / GPT partition table reader and writer.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>          // crc32() — same polynomial as GPT
+
+#include "sdcloner_internal.h"
+#include "sdcloner_ptable.h"
+
+#define GPT_ENTRY_SIZE  128
+#define GPT_ENTRIES     128
+#define GPT_HDR_SIZE    92
+
+static uint16_t le16(const unsigned char* p) { return (uint16_t)(p[0] | p[1] << 8); }
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static uint64_t le64(const unsigned char* p) { return le32(p) | (uint64_t)le32(p + 4) << 32; }
+static void put16(unsigned char* p, uint16_t v) { p[0] = (unsigned char)v; p[1] = (unsigned char)(v >> 8); }
+static void put32(unsigned char* p, uint32_t v) { put16(p, (uint16_t)v); put16(p + 2, (uint16_t)(v >> 16)); }
+static void put64(unsigned char* p, uint64_t v) { put32(p, (uint32_t)v); put32(p + 4, (uint32_t)(v >> 32)); }
+
+static int pread_exact(int fd, void* buf, size_t len, uint64_t off) {
+    unsigned char* p = buf;
+    while (len) {
+        ssize_t n = pread(fd, p, len, (off_t)off);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        if (n == 0) { errno = EIO; return -1; }
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+static int pwrite_exact(int fd, const void* buf, size_t len, uint64_t off) {
+    const unsigned char* p = buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+static bool is_extended(uint8_t t) { return t == 0x05 || t == 0x0F || t == 0x85; }
+
+// ---------------- Reading -----------------------------
+static int read_gpt(int fd, sdc_ptable* pt, uint32_t ss) {
+    unsigned char hdr[512];
+    if (pread_exact(fd, hdr, sizeof(hdr), ss) != 0) return -1;
+    if (memcmp(hdr, "EFI PART", 8) != 0) return 1;
+    uint64_t ent_lba = le64(hdr + 72);
+    uint32_t nent = le32(hdr + 80), esz = le32(hdr + 84);
+    if (esz < GPT_ENTRY_SIZE || nent > 4096) return 1;
+    size_t bytes = (size_t)nent * esz;
+    unsigned char* ents = malloc(bytes);
+    if (!ents) return -1;
+    if (pread_exact(fd, ents, bytes, ent_lba * ss) != 0) { free(ents); return -1; }
+
+    pt->kind = SDC_PT_GPT;
+    pt->sector_size = ss;
+    memcpy(pt->disk_guid, hdr + 56, 16);
+    static const uint8_t zero[16];
+    for (uint32_t i = 0; i < nent && pt->n < SDC_MAX_PARTS; i++) {
+        const unsigned char* e = ents + (size_t)i * esz;
+        if (!memcmp(e, zero, 16)) continue;
+        sdc_part* p = &pt->part[pt->n++];
+        memset(p, 0, sizeof(*p));
+        p->index = (int)i + 1;
+        memcpy(p->type_guid, e, 16);
+        memcpy(p->uuid, e + 16, 16);
+        p->start = le64(e + 32);
+        p->size = le64(e + 40) - p->start + 1;
+        p->attrs = le64(e + 48);
+        for (int c = 0; c < 36; c++) p->name[c] = le16(e + 56 + 2 * c);
+    }
+    free(ents);
+    return 0;
+}
+
+// Logical partitions: follow the EBR chain inside an extended partition.
+static int read_ebr_chain(int fd, sdc_ptable* pt, uint64_t ext_start) {
+    uint64_t ebr = ext_start;
+    int index = 5;
+    for (int guard = 0; guard < SDC_MAX_PARTS && pt->n < SDC_MAX_PARTS; guard++) {
+        unsigned char s[512];
+        if (pread_exact(fd, s, sizeof(s), ebr * 512) != 0) return -1;
+        if (s[510] != 0x55 || s[511] != 0xAA) break;
+        const unsigned char* e0 = s + 446;
+        const unsigned char* e1 = s + 462;
+        if (e0[4] && le32(e0 + 12)) {
+            sdc_part* p = &pt->part[pt->n++];
+            memset(p, 0, sizeof(*p));
+            p->index = index++;
+            p->mbr_type = e0[4];
+            p->bootable = e0[0] == 0x80;
+            p->logical = true;
+            p->start = ebr + le32(e0 + 8);
+            p->size = le32(e0 + 12);
+        }
+        if (!is_extended(e1[4]) || !le32(e1 + 8)) break;
+        ebr = ext_start + le32(e1 + 8);
+    }
+    return 0;
+}
+
+int sdc_ptable_read(const char* path, sdc_ptable* pt) {
+    memset(pt, 0, sizeof(*pt));
+    pt->sector_size = 512;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { sdc_loge("open(%s): %s", path, strerror(errno)); return -1; }
+
+    unsigned char mbr[512];
+    int rc = pread_exact(fd, mbr, sizeof(mbr), 0);
+    if (rc != 0 || mbr[510] != 0x55 || mbr[511] != 0xAA) { close(fd); return rc; }
+    memcpy(pt->boot_code, mbr, sizeof(pt->boot_code));
+    pt->disk_sig = le32(mbr + 440);
+
+    bool protective = false;
+    for (int i = 0; i < 4; i++) if (mbr[446 + 16 * i + 4] == 0xEE) protective = true;
+    if (protective) {
+        rc = read_gpt(fd, pt, 512);
+        if (rc == 1) rc = read_gpt(fd, pt, 4096);
+        close(fd);
+        return rc < 0 ? -1 : 0;
+    }
+
+    pt->kind = SDC_PT_MBR;
+    for (int i = 0; i < 4 && rc == 0; i++) {
+        const unsigned char* e = mbr + 446 + 16 * i;
+        if (!e[4] || !le32(e + 12)) continue;
+        if (is_extended(e[4])) { rc = read_ebr_chain(fd, pt, le32(e + 8)); continue; }
+        sdc_part* p = &pt->part[pt->n++];
+        memset(p, 0, sizeof(*p));
+        p->index = i + 1;
+        p->mbr_type = e[4];
+        p->bootable = e[0] == 0x80;
+        p->start = le32(e + 8);
+        p->size = le32(e + 12);
+    }
+    close(fd);
+    return rc;
+}
+
+// ---------------- Writing -----------------------------
+// CHS fields are legacy; write the conventional "beyond 8 GB" marker.
+static void put_mbr_entry(unsigned char* e, uint8_t type, bool boot, uint64_t start, uint64_t size) {
+    memset(e, 0, 16);
+    e[0] = boot ? 0x80 : 0x00;
+    e[1] = 0xFE; e[2] = 0xFF; e[3] = 0xFF;
+    e[4] = type;
+    e[5] = 0xFE; e[6] = 0xFF; e[7] = 0xFF;
+    put32(e + 8, (uint32_t)start);
+    put32(e + 12, size > 0xFFFFFFFFULL ? 0xFFFFFFFFU : (uint32_t)size);
+}
+
+static void gpt_header(unsigned char* h, const sdc_ptable* pt, uint64_t self, uint64_t alt,
+                       uint64_t first, uint64_t last, uint64_t ent_lba, uint32_t ent_crc) {
+    memset(h, 0, 512);
+    memcpy(h, "EFI PART", 8);
+    put32(h + 8, 0x00010000);
+    put32(h + 12, GPT_HDR_SIZE);
+    put64(h + 24, self);
+    put64(h + 32, alt);
+    put64(h + 40, first);
+    put64(h + 48, last);
+    memcpy(h + 56, pt->disk_guid, 16);
+    put64(h + 72, ent_lba);
+    put32(h + 80, GPT_ENTRIES);
+    put32(h + 84, GPT_ENTRY_SIZE);
+    put32(h + 88, ent_crc);
+    put32(h + 16, (uint32_t)crc32(0L, h, GPT_HDR_SIZE));
+}
+
+int sdc_ptable_write(const char* path, const sdc_ptable* pt, uint64_t disk_bytes) {
+    uint32_t ss = pt->sector_size ? pt->sector_size : 512;
+    uint64_t total = disk_bytes / ss;
+    for (int i = 0; i < pt->n; i++) {
+        if (pt->part[i].logical) { sdc_loge("Logical MBR partitions are not supported"); return -1; }
+        if (pt->kind == SDC_PT_MBR && (pt->part[i].index < 1 || pt->part[i].index > 4)) return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) { sdc_loge("open(%s): %s", path, strerror(errno)); return -1; }
+
+    unsigned char mbr[512];
+    memset(mbr, 0, sizeof(mbr));
+    mbr[510] = 0x55; mbr[511] = 0xAA;
+    int rc = 0;
+    if (pt->kind == SDC_PT_MBR) {
+        memcpy(mbr, pt->boot_code, sizeof(pt->boot_code));
+        put32(mbr + 440, pt->disk_sig);
+        for (int i = 0; i < pt->n; i++) {
+            const sdc_part* p = &pt->part[i];
+            put_mbr_entry(mbr + 446 + 16 * (p->index - 1), p->mbr_type, p->bootable, p->start, p->size);
+        }
+        rc = pwrite_exact(fd, mbr, sizeof(mbr), 0);
+    } else if (pt->kind == SDC_PT_GPT) {
+        size_t ebytes = (size_t)GPT_ENTRIES * GPT_ENTRY_SIZE;
+        uint64_t elbas = ebytes / ss;
+        unsigned char* ents = calloc(1, ebytes);
+        unsigned char* hdr = malloc(ss < 512 ? 512 : ss);
+        if (!ents || !hdr || total < 2 * elbas + 4) { free(ents); free(hdr); close(fd); return -1; }
+        for (int i = 0; i < pt->n; i++) {
+            const sdc_part* p = &pt->part[i];
+            if (p->index < 1 || p->index > GPT_ENTRIES) continue;
+            unsigned char* e = ents + (size_t)(p->index - 1) * GPT_ENTRY_SIZE;
+            memcpy(e, p->type_guid, 16);
+            memcpy(e + 16, p->uuid, 16);
+            put64(e + 32, p->start);
+            put64(e + 40, p->start + p->size - 1);
+            put64(e + 48, p->attrs);
+            for (int c = 0; c < 36; c++) put16(e + 56 + 2 * c, p->name[c]);
+        }
+        uint32_t ecrc = (uint32_t)crc32(0L, ents, (uInt)ebytes);
+        uint64_t first = 2 + elbas, last = total - 2 - elbas;
+
+        put_mbr_entry(mbr + 446, 0xEE, false, 1, total - 1);
+        rc = pwrite_exact(fd, mbr, sizeof(mbr), 0);
+        memset(hdr, 0, ss);
+        gpt_header(hdr, pt, 1, total - 1, first, last, 2, ecrc);
+        if (!rc) rc = pwrite_exact(fd, hdr, ss, (uint64_t)ss);
+        if (!rc) rc = pwrite_exact(fd, ents, ebytes, 2ULL * ss);
+        memset(hdr, 0, ss);
+        gpt_header(hdr, pt, total - 1, 1, first, last, total - 1 - elbas, ecrc);
+        if (!rc) rc = pwrite_exact(fd, ents, ebytes, (total - 1 - elbas) * ss);
+        if (!rc) rc = pwrite_exact(fd, hdr, ss, (total - 1) * ss);
+        free(ents);
+        free(hdr);
+    }
+    if (rc != 0) sdc_loge("write(%s): %s", path, strerror(errno));
+    if (close(fd) != 0 && rc == 0) rc = -1;
+    return rc;
+}
+
+void sdc_part_devnode(const char* disk, int index, char* out, unsigned cap) {
+    size_t len = strlen(disk);
+    bool digit_end = len && isdigit((unsigned char)disk[len - 1]);
+    snprintf(out, cap, "%s%s%d", disk, digit_end ? "p" : "", index);
+}
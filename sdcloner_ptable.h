@@ -0,0 +1,48 @@
+// sdcloner_ptable.h
+// Native MBR / GPT partition table reader and writer.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SDC_MAX_PARTS 128
+
+typedef enum { SDC_PT_NONE = 0, SDC_PT_MBR, SDC_PT_GPT } sdc_pt_kind;
+
+typedef struct {
+    int      index;          // partition number as the kernel names it (1-based)
+    uint64_t start;          // first sector
+    uint64_t size;           // length in sectors
+    // MBR
+    uint8_t  mbr_type;
+    bool     bootable;
+    bool     logical;        // inside an extended partition (read-only support)
+    // GPT
+    uint8_t  type_guid[16];
+    uint8_t  uuid[16];
+    uint64_t attrs;
+    uint16_t name[36];       // UTF-16LE, as stored
+} sdc_part;
+
+typedef struct {
+    sdc_pt_kind kind;
+    uint32_t    sector_size;     // bytes per LBA (512 for SD cards)
+    uint32_t    disk_sig;        // MBR disk signature (PARTUUID prefix)
+    uint8_t     disk_guid[16];   // GPT disk GUID
+    uint8_t     boot_code[440];  // MBR bootstrap area, preserved on write
+    int         n;
+    sdc_part    part[SDC_MAX_PARTS];
+} sdc_ptable;
+
+// Read the partition table of a disk or image file. A disk without a table
+// yields kind == SDC_PT_NONE and n == 0. Returns 0 on success, -1 on I/O error.
+int sdc_ptable_read(const char* path, sdc_ptable* pt);
+
+// Write pt to an image file of disk_bytes (protective MBR + primary and backup
+// GPT for SDC_PT_GPT). Logical MBR partitions are not supported. Returns 0/-1.
+int sdc_ptable_write(const char* path, const sdc_ptable* pt, uint64_t disk_bytes);
+
+// Device node of partition `index` on disk: /dev/sdd + 2 → /dev/sdd2,
+// /dev/mmcblk0 + 2 → /dev/mmcblk0p2.
+void sdc_part_devnode(const char* disk, int index, char* out, unsigned cap);
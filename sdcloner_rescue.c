@@ -0,0 +1,278 @@
+// sdcloner_rescue.c
+// Error-tolerant imaging of failing cards with a bad-range map.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>     // BLKGETSIZE64, BLKSSZGET
+
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_rescue.h"
+
+#define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
+
+void sdc_rescue_opts_default(sdc_rescue_opts* o) {
+    memset(o, 0, sizeof(*o));
+    o->block_size = MB(4);
+    o->skip_max = MB(64);
+    o->retries = 3;
+}
+
+// ---------------- Bad-range map -----------------------
+int sdc_badmap_load(const char* path, sdc_extent_list* l, uint64_t* size) {
+    memset(l, 0, sizeof(*l));
+    *size = 0;
+    FILE* fp = fopen(path, "re");
+    if (!fp) return errno == ENOENT ? 1 : -1;
+    char line[256];
+    int rc = 0;
+    bool sized = false;
+    while (rc == 0 && fgets(line, sizeof(line), fp)) {
+        unsigned long long a, b;
+        if (line[0] == '#' || line[0] == '\n') continue;
+        if (sscanf(line, "size %llu", &a) == 1) { *size = a; sized = true; }
+        else if (sscanf(line, "%llx %llx", &a, &b) == 2 && b && a + b >= a)
+            rc = sdc_extents_add(l, a, b);
+        else rc = -1;
+    }
+    fclose(fp);
+    sdc_extents_normalize(l);
+    if (rc == 0 && (!sized || (l->n && l->ext[l->n - 1].off + l->ext[l->n - 1].len > *size)))
+        rc = -1;
+    if (rc != 0) {
+        sdc_loge("[RESCUE] bad-range map %s is malformed, ignored", path);
+        sdc_extents_free(l);
+    }
+    return rc;
+}
+
+int sdc_badmap_save(const char* path, const sdc_extent_list* l, uint64_t size) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE* fp = fopen(tmp, "we");
+    if (!fp) { sdc_loge("[RESCUE] cannot write %s: %s", tmp, strerror(errno)); return -1; }
+    fprintf(fp, "# sdcloner bad-range map: byte ranges of the image not read from the card\n");
+    fprintf(fp, "size %llu\n", (unsigned long long)size);
+    for (size_t i = 0; i < l->n; i++)
+        fprintf(fp, "0x%llx 0x%llx\n", (unsigned long long)l->ext[i].off, (unsigned long long)l->ext[i].len);
+    bool ok = fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+    if (fclose(fp) != 0) ok = false;
+    if (!ok || rename(tmp, path) != 0) {
+        sdc_loge("[RESCUE] cannot write %s: %s", path, strerror(errno));
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// ---------------- Passes ------------------------------
+typedef struct {
+    const sdc_rescue_opts* o;
+    const char*    path;
+    int            fd;
+    bool           direct;
+    int            out_fd;
+    unsigned char* buf;       // block_size, SDC_IO_ALIGN-aligned
+    uint64_t       size;
+    uint64_t       recovered;
+    uint64_t       settled;   // recovered or given up, for progress
+    uint64_t       todo;      // bytes this run set out to read
+    bool           gone;      // the source disappeared (reset, unplugged)
+} rescue;
+
+// One read attempt of [off, off+len). Returns the bytes read, which may be
+// short where a bad sector starts, or -1.
+static ssize_t rescue_read(rescue* r, uint64_t off, size_t len) {
+    for (;;) {
+        uint64_t t0 = sdc_trace_now();
+        ssize_t n = pread(r->fd, r->buf, len, (off_t)off);
+        if (n >= 0) {
+            sdc_trace_io(r->o->trace, SDC_TRACE_READ, t0, sdc_trace_now(), (uint64_t)n);
+            if (n == 0) r->gone = true;   // cut short before the recorded size
+            return n ? n : -1;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EINVAL && r->direct) {
+            int fl = fcntl(r->fd, F_GETFL);
+            if (fl >= 0 && fcntl(r->fd, F_SETFL, fl & ~O_DIRECT) == 0) { r->direct = false; continue; }
+        }
+        if (errno == ENODEV || errno == ENXIO || errno == ENOMEDIUM) r->gone = true;
+        return -1;
+    }
+}
+
+// Recovered bytes go to their own offset; zero grains stay holes.
+static int rescue_store(rescue* r, uint64_t off, size_t len) {
+    for (size_t i = 0; i < len; i += SDC_SPARSE_GRAIN) {
+        size_t n = len - i < SDC_SPARSE_GRAIN ? len - i : SDC_SPARSE_GRAIN;
+        if (sdc_is_zero(r->buf + i, n)) continue;
+        const unsigned char* p = r->buf + i;
+        uint64_t o = off + i;
+        while (n) {
+            ssize_t w = pwrite(r->out_fd, p, n, (off_t)o);
+            if (w < 0 && errno == EINTR) continue;
+            if (w <= 0) return -1;
+            p += w; o += (uint64_t)w; n -= (size_t)w;
+        }
+    }
+    r->recovered += len;
+    return 0;
+}
+
+// Read every range of in in unit-sized pieces, attempts times each; what
+// still fails goes to out. With skip, a failure jumps ahead by a distance
+// that doubles per consecutive failure (up to skip_max) and the jumped-over
+// range goes to out untried. Returns 0, or -1 if the source went away or
+// the image cannot be written (out then holds everything not yet read).
+static int rescue_pass(rescue* r, const char* name, const sdc_extent_list* in, size_t unit,
+                       unsigned attempts, bool skip, bool last, sdc_extent_list* out) {
+    uint64_t t0 = sdc_trace_now();
+    uint64_t before = r->recovered;
+    int rc = 0;
+    for (size_t i = 0; i < in->n; i++) {
+        uint64_t pos = in->ext[i].off, end = pos + in->ext[i].len;
+        uint64_t jump = unit;
+        while (pos < end) {
+            if (rc != 0) { sdc_extents_add(out, pos, end - pos); break; }
+            size_t len = end - pos < unit ? (size_t)(end - pos) : unit;
+            if (!sdc_ctl_gate(r->o->ctl, len)) {
+                sdc_loge("[JOB] %s: rescue cancelled at %llu", r->path, (unsigned long long)pos);
+                rc = -1;
+                continue;   // the rest goes to out
+            }
+            ssize_t n = -1;
+            for (unsigned a = 0; a < attempts && n < 0 && !r->gone; a++) n = rescue_read(r, pos, len);
+            if (n > 0) {
+                if (rescue_store(r, pos, (size_t)n) != 0) {
+                    sdc_loge("[RESCUE] write at %llu: %s", (unsigned long long)pos, strerror(errno));
+                    rc = -1;
+                    continue;
+                }
+                pos += (uint64_t)n;
+                r->settled += (uint64_t)n;
+                if ((size_t)n == len) jump = unit;
+            } else if (r->gone) {
+                sdc_loge("[RESCUE] %s stopped responding at %llu", r->path, (unsigned long long)pos);
+                rc = -1;
+            } else {
+                uint64_t skipped = skip ? (jump < end - pos ? jump : end - pos) : len;
+                sdc_extents_add(out, pos, skipped);
+                pos += skipped;
+                if (last) r->settled += skipped;
+                if (skip) jump = jump * 2 < r->o->skip_max ? jump * 2 : r->o->skip_max;
+            }
+            if (r->o->progress) r->o->progress(r->settled, r->todo, r->o->progress_user);
+        }
+    }
+    sdc_extents_normalize(out);
+    sdc_logi("[RESCUE] %s: %.2f MB recovered, %.2f MB left in %zu range(s) (%.1f s)", name,
+             (double)(r->recovered - before) / (double)MB(1), (double)out->total / (double)MB(1),
+             out->n, (double)(sdc_trace_now() - t0) / 1e9);
+    return rc;
+}
+
+static uint64_t source_size(int fd, unsigned* sector) {
+    struct stat st;
+    uint64_t size = 0;
+    int ss = 0;
+    if (fstat(fd, &st) != 0) return 0;
+    if (S_ISBLK(st.st_mode)) {
+        if (ioctl(fd, BLKGETSIZE64, &size) != 0) size = 0;
+        if (ioctl(fd, BLKSSZGET, &ss) == 0 && ss > 0) *sector = (unsigned)ss;
+    } else {
+        size = (uint64_t)st.st_size;
+    }
+    return size;
+}
+
+int sdc_rescue_image(const char* src_path, const char* out_path, const char* map_path,
+                     const sdc_rescue_opts* opts, sdc_rescue_stats* st) {
+    sdc_rescue_opts o;
+    if (opts) o = *opts; else sdc_rescue_opts_default(&o);
+    if (!o.block_size || o.block_size % SDC_IO_ALIGN || o.skip_max < o.block_size || !o.retries) {
+        sdc_loge("[RESCUE] invalid block size, skip or retry settings");
+        return -1;
+    }
+    memset(st, 0, sizeof(*st));
+    rescue r; memset(&r, 0, sizeof(r));
+    r.o = &o;
+    r.path = src_path;
+    r.out_fd = -1;
+    r.fd = open(src_path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (r.fd >= 0) r.direct = true;
+    else if (errno == EINVAL) r.fd = open(src_path, O_RDONLY | O_CLOEXEC);
+    if (r.fd < 0) { sdc_loge("open(%s): %s", src_path, strerror(errno)); return -1; }
+    unsigned sector = 512;
+    r.size = source_size(r.fd, &sector);
+    if (!r.size) { sdc_loge("[RESCUE] %s: size unknown", src_path); close(r.fd); return -1; }
+    st->size = r.size;
+
+    // An earlier rescue of a source of this size: retry only what it missed.
+    sdc_extent_list left = {0};
+    uint64_t map_size = 0;
+    struct stat ost;
+    bool again = sdc_badmap_load(map_path, &left, &map_size) == 0 && map_size == r.size &&
+                 stat(out_path, &ost) == 0 && (uint64_t)ost.st_size == r.size;
+    if (again) {
+        sdc_logi("[RESCUE] %s: retrying %.2f MB in %zu range(s) from %s", src_path,
+                 (double)left.total / (double)MB(1), left.n, map_path);
+    } else {
+        sdc_extents_free(&left);
+        sdc_extents_add(&left, 0, r.size);
+    }
+    r.out_fd = open(out_path, O_WRONLY | O_CREAT | O_CLOEXEC | (again ? 0 : O_TRUNC), 0644);
+    int rc = -1;
+    if (r.out_fd < 0 || ftruncate(r.out_fd, (off_t)r.size) != 0) {
+        sdc_loge("open(%s): %s", out_path, strerror(errno));
+        goto out;
+    }
+    if (posix_memalign((void**)&r.buf, SDC_IO_ALIGN, o.block_size) != 0) {
+        r.buf = NULL;
+        sdc_loge("[RESCUE] out of memory");
+        goto out;
+    }
+
+    // Each pass reads what the previous one left, in smaller pieces.
+    const struct { const char* name; size_t unit; unsigned attempts; bool skip; } pass[] = {
+        { "fast pass", o.block_size,    1,         true  },
+        { "trim",      SDC_RESCUE_TRIM, 1,         false },
+        { "scrape",    sector,          o.retries, false },
+    };
+    const size_t npass = sizeof(pass) / sizeof(pass[0]);
+    r.todo = left.total;
+    rc = 0;
+    for (size_t k = 0; k < npass && left.n && rc == 0; k++) {
+        sdc_extent_list next = {0};
+        rc = rescue_pass(&r, pass[k].name, &left, pass[k].unit, pass[k].attempts, pass[k].skip,
+                         k == npass - 1, &next);
+        sdc_extents_free(&left);
+        left = next;
+    }
+
+    if (fdatasync(r.out_fd) != 0) { sdc_loge("fdatasync(%s): %s", out_path, strerror(errno)); rc = -1; }
+    st->recovered = r.recovered;
+    st->bad = left.total;
+    st->ranges = left.n;
+    if (left.n) {
+        if (sdc_badmap_save(map_path, &left, r.size) != 0) rc = -1;
+    } else {
+        unlink(map_path);
+    }
+out:
+    if (r.out_fd >= 0) close(r.out_fd);
+    close(r.fd);
+    free(r.buf);
+    sdc_extents_free(&left);
+    return rc;
+}
@@ -0,0 +1,64 @@
+// sdcloner_rescue.h
+// Rescue imaging for failing cards: recover as much as possible, as early as
+// possible, without letting bad areas stall the job.
+//
+//  1. Fast pass: the whole source in large O_DIRECT reads. A read that fails
+//     marks its range pending and the reader jumps ahead, twice as far on
+//     every consecutive failure, so a damaged area costs a few timeouts
+//     instead of one per sector.
+//  2. Trim: pending ranges are read again in SDC_RESCUE_TRIM pieces.
+//  3. Scrape: pieces that still fail are read sector by sector, a bounded
+//     number of times each.
+//
+// Recovered data lands at its own offset in a sparse raw image; whatever
+// could not be read stays zero and is listed in a bad-range map beside it
+// (<image>.bad). Running the rescue again with the same image and map only
+// retries the listed ranges. Burns pick the map up as well (sdc_stream_opts.bad).
+//
+// Map format (text): "# sdcloner bad-range map", "size <bytes>", then one
+// "0x<offset> 0x<length>" line per unrecovered range, sorted.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdcloner_pipeline.h"
+
+#define SDC_BADMAP_EXT "bad"
+#define SDC_RESCUE_TRIM 65536
+
+typedef struct {
+    size_t   block_size;   // fast-pass read size (default 4 MiB)
+    uint64_t skip_max;     // longest jump after consecutive failures (default 64 MiB)
+    unsigned retries;      // scrape attempts per sector (default 3)
+    sdc_progress_fn progress;   // optional: bytes recovered or given up so far
+                                // of those the run set out to read
+    void*    progress_user;
+    sdc_trace* trace;      // optional: read latencies
+    sdc_ctl*   ctl;        // optional: scheduler pause / cancel / bandwidth per read
+} sdc_rescue_opts;
+
+typedef struct {
+    uint64_t size;         // source size
+    uint64_t recovered;    // bytes now in the image that were missing before
+    uint64_t bad;          // bytes still unrecovered
+    size_t   ranges;       // ... in this many ranges
+} sdc_rescue_stats;
+
+void sdc_rescue_opts_default(sdc_rescue_opts* o);
+
+// Rescue src_path into out_path, writing the map to map_path. If out_path and
+// map_path exist from an earlier rescue of a source of the same size, only
+// the mapped ranges are read again. Returns 0 if the job ran to the end
+// (bad sectors are not a failure; see st), -1 if it could not run, the
+// source went away or o->ctl cancelled it (the map then lists everything
+// still missing).
+int sdc_rescue_image(const char* src_path, const char* out_path, const char* map_path,
+                     const sdc_rescue_opts* o, sdc_rescue_stats* st);
+
+// Load a bad-range map into l (normalized) and the source size into *size.
+// Returns 0, 1 if there is no map, -1 if it is malformed (logged).
+int sdc_badmap_load(const char* path, sdc_extent_list* l, uint64_t* size);
+// Write l to path atomically. Returns 0 / -1 (logged).
+int sdc_badmap_save(const char* path, const sdc_extent_list* l, uint64_t size);
@@ -0,0 +1,342 @@
+// sdcloner_shrink.c
+// FS-aware shrink: mirror every source partition into a tightly sized image,
+// keeping the partition table type, partition types/IDs and filesystems.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>     // BLKGETSIZE64
+
+#include "sdcloner_internal.h"
+#include "sdcloner_fsmap.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_ptable.h"
+#include "sdcloner_shrink.h"
+
+#define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
+
+#define SHRINK_ALIGN         MB(1)   // partition start/size granularity
+#define SHRINK_HEADROOM_MIN  MB(32)  // free space left in a shrunk filesystem
+#define SHRINK_HEADROOM_DIV  20      // ... or 5% of its used data, if larger
+#define FAT16_MIN_CLUSTERS   4085    // fewer and mkfs.vfat -F 16 refuses
+#define FAT32_MIN_CLUSTERS   65525   // same for -F 32
+
+typedef enum {
+    PLAN_VERBATIM,     // allocated blocks copied at the same size
+    PLAN_EXT_SHRINK,   // ext2/3/4 relocated with resize2fs -M on a sparse copy
+    PLAN_FAT_REBUILD   // FAT recreated at a smaller size, files copied over
+} plan_kind;
+
+typedef struct {
+    char            dev[256];
+    sdc_fs_kind     fs;
+    plan_kind       plan;
+    uint64_t        src_bytes;
+    uint64_t        used_bytes;   // from allocation metadata
+    uint64_t        new_bytes;
+    char            tmp[768];     // shrunk ext copy
+    sdc_extent_list unalloc;      // partition-relative free extents
+    bool            mapped;
+} part_plan;
+
+static uint64_t align_up(uint64_t v, uint64_t a) { return (v + a - 1) / a * a; }
+
+static uint64_t headroom(uint64_t used) {
+    uint64_t h = used / SHRINK_HEADROOM_DIV;
+    return h > SHRINK_HEADROOM_MIN ? h : SHRINK_HEADROOM_MIN;
+}
+
+static uint64_t dev_size(const char* path) {
+    uint64_t bytes = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISBLK(st.st_mode)) {
+        if (ioctl(fd, BLKGETSIZE64, &bytes) != 0) bytes = 0;
+    } else if (fstat(fd, &st) == 0) {
+        bytes = (uint64_t)st.st_size;
+    }
+    close(fd);
+    return bytes;
+}
+
+// Size of the ext filesystem in path, from its superblock.
+static uint64_t ext_fs_bytes(const char* path, uint64_t* block_size) {
+    unsigned char sb[1024];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    ssize_t n = pread(fd, sb, sizeof(sb), 1024);
+    close(fd);
+    if (n != (ssize_t)sizeof(sb)) return 0;
+    uint32_t lo = (uint32_t)sb[4] | (uint32_t)sb[5] << 8 | (uint32_t)sb[6] << 16 | (uint32_t)sb[7] << 24;
+    uint32_t hi = (uint32_t)sb[336] | (uint32_t)sb[337] << 8 | (uint32_t)sb[338] << 16 | (uint32_t)sb[339] << 24;
+    uint32_t incompat = (uint32_t)sb[96] | (uint32_t)sb[97] << 8;
+    uint64_t bs = 1024ULL << sb[24];
+    uint64_t blocks = lo | ((incompat & 0x80) ? (uint64_t)hi << 32 : 0);
+    if (block_size) *block_size = bs;
+    return blocks * bs;
+}
+
+// Sparse copy of the allocated blocks, fsck, then resize2fs to the minimum
+// plus headroom. resize2fs does the block-level extent relocation.
+static int shrink_ext(part_plan* pp, const char* out_path, int idx) {
+    snprintf(pp->tmp, sizeof(pp->tmp), "%s.p%d.tmp", out_path, idx);
+    int fd = open(pp->tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)pp->src_bytes) != 0) {
+        sdc_loge("create(%s): %s", pp->tmp, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+    if (sdc_copy_range(pp->dev, pp->src_bytes, pp->tmp, 0, &pp->unalloc) != 0) return -1;
+
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "e2fsck -fy '%s' >/dev/null", pp->tmp);
+    int rc = sdc_run_cmd(cmd);
+    if (rc < 0 || rc >= 4) { sdc_loge("e2fsck failed on %s copy (rc=%d)", pp->dev, rc); return -1; }
+
+    snprintf(cmd, sizeof(cmd), "resize2fs -P '%s' 2>/dev/null", pp->tmp);
+    char* out = sdc_run_cmd_capture(cmd);
+    const char* key = "minimum size of the filesystem:";
+    char* at = out ? strstr(out, key) : NULL;
+    uint64_t min_blocks = at ? strtoull(at + strlen(key), NULL, 10) : 0;
+    free(out);
+    uint64_t bs = 0;
+    uint64_t cur = ext_fs_bytes(pp->tmp, &bs);
+    if (!min_blocks || !bs || !cur) { sdc_loge("resize2fs -P failed for %s", pp->dev); return -1; }
+
+    uint64_t want = align_up(min_blocks * bs + headroom(min_blocks * bs), SHRINK_ALIGN);
+    if (want < cur) {
+        snprintf(cmd, sizeof(cmd), "resize2fs '%s' %lluK >/dev/null",
+                 pp->tmp, (unsigned long long)(want / 1024));
+        if (sdc_run_cmd(cmd) != 0) { sdc_loge("resize2fs failed for %s", pp->dev); return -1; }
+    }
+    uint64_t fs = ext_fs_bytes(pp->tmp, NULL);
+    if (!fs) return -1;
+    pp->new_bytes = align_up(fs, SHRINK_ALIGN);
+    if (truncate(pp->tmp, (off_t)fs) != 0) return -1;
+
+    // Re-map the shrunk copy so only its allocated blocks get copied.
+    sdc_extents_free(&pp->unalloc);
+    pp->mapped = sdc_fsmap_partition(pp->tmp, 0, &pp->unalloc) == 0;
+    sdc_extents_normalize(&pp->unalloc);
+    return 0;
+}
+
+// FAT volume id, label and geometry, to recreate it faithfully.
+static int fat_params(const char* dev, unsigned* spc, unsigned* bps, unsigned* bits, uint32_t* volid,
+                      char label[12]) {
+    unsigned char bs[512];
+    int fd = open(dev, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    ssize_t n = pread(fd, bs, sizeof(bs), 0);
+    close(fd);
+    if (n != (ssize_t)sizeof(bs)) return -1;
+    bool fat32 = bs[22] == 0 && bs[23] == 0;
+    const unsigned char* ext = bs + (fat32 ? 64 : 36);   // extended BPB
+    *spc = bs[13];
+    *bps = (unsigned)bs[11] | (unsigned)bs[12] << 8;
+    if (!*spc || *bps < 512 || *bps > 4096 || (*bps & (*bps - 1))) return -1;
+    *bits = fat32 ? 32 : 16;
+    *volid = (uint32_t)ext[3] | (uint32_t)ext[4] << 8 | (uint32_t)ext[5] << 16 | (uint32_t)ext[6] << 24;
+    memcpy(label, ext + 7, 11);
+    label[11] = '\0';
+    for (int i = 10; i >= 0 && label[i] == ' '; i--) label[i] = '\0';
+    for (char* c = label; *c; c++) if (*c == '\'') *c = '_';
+    return 0;
+}
+
+// Size of a FAT volume with the source's geometry holding data_bytes of
+// clusters: reserved sectors, the FAT16 root directory, two FATs of 2- or
+// 4-byte entries, the clusters and one more for mkfs.vfat's alignment.
+static uint64_t fat_volume_bytes(uint64_t data_bytes, unsigned spc, unsigned bps, unsigned bits) {
+    uint64_t cs = (uint64_t)spc * bps;
+    uint64_t clusters = (data_bytes + cs - 1) / cs;
+    uint64_t min = bits == 32 ? FAT32_MIN_CLUSTERS : FAT16_MIN_CLUSTERS;
+    if (clusters < min) clusters = min;
+    uint64_t fat = align_up((clusters + 2) * (bits / 8), bps);
+    uint64_t meta = bits == 32 ? 32 * (uint64_t)bps : (uint64_t)bps + 512 * 32;
+    return meta + 2 * fat + (clusters + 1) * cs;
+}
+
+// mkfs a smaller FAT at its final image offset and copy files into it.
+static int rebuild_fat(const part_plan* pp, const char* out_path, uint64_t offset) {
+    unsigned spc = 0, bps = 512, bits = 32; uint32_t volid = 0; char label[12] = "";
+    if (fat_params(pp->dev, &spc, &bps, &bits, &volid, label) != 0) return -1;
+
+    char cmd[1536];
+    snprintf(cmd, sizeof(cmd), "sudo losetup --find --show --offset %llu --sizelimit %llu '%s'",
+             (unsigned long long)offset, (unsigned long long)pp->new_bytes, out_path);
+    char* loop = sdc_run_cmd_capture(cmd);
+    if (loop) { char* nl = strchr(loop, '\n'); if (nl) *nl = '\0'; }
+    if (!loop || !*loop) { free(loop); sdc_loge("losetup failed"); return -1; }
+
+    char msrc[] = "/tmp/sdcloner-src-XXXXXX", mtgt[] = "/tmp/sdcloner-img-XXXXXX";
+    int rc = -1;
+    bool src_mounted = false, tgt_mounted = false;
+    if (!mkdtemp(msrc) || !mkdtemp(mtgt)) goto out;
+
+    snprintf(cmd, sizeof(cmd), "sudo mkfs.vfat -F %u -s %u -i %08X %s%s%s '%s' >/dev/null",
+             bits, spc, volid, *label ? "-n '" : "", label, *label ? "'" : "", loop);
+    if (sdc_run_cmd(cmd) != 0) { sdc_loge("mkfs.vfat failed"); goto out; }
+    snprintf(cmd, sizeof(cmd), "sudo mount -o ro '%s' '%s'", pp->dev, msrc);
+    if (sdc_run_cmd(cmd) != 0) { sdc_loge("mount source failed"); goto out; }
+    src_mounted = true;
+    snprintf(cmd, sizeof(cmd), "sudo mount '%s' '%s'", loop, mtgt);
+    if (sdc_run_cmd(cmd) != 0) { sdc_loge("mount target failed"); goto out; }
+    tgt_mounted = true;
+    snprintf(cmd, sizeof(cmd), "sudo rsync -rt --modify-window=1 '%s/' '%s/'", msrc, mtgt);
+    rc = sdc_run_cmd(cmd) == 0 ? 0 : -1;
+
+out:
+    if (tgt_mounted) { snprintf(cmd, sizeof(cmd), "sudo umount '%s'", mtgt); sdc_run_cmd(cmd); }
+    if (src_mounted) { snprintf(cmd, sizeof(cmd), "sudo umount '%s'", msrc); sdc_run_cmd(cmd); }
+    rmdir(msrc);
+    rmdir(mtgt);
+    snprintf(cmd, sizeof(cmd), "sudo losetup -d '%s'", loop);
+    sdc_run_cmd(cmd);
+    free(loop);
+    return rc;
+}
+
+static void plans_free(part_plan* pp, int n) {
+    for (int i = 0; i < n; i++) {
+        if (pp[i].tmp[0]) unlink(pp[i].tmp);
+        sdc_extents_free(&pp[i].unalloc);
+    }
+    free(pp);
+}
+
+int sdc_shrink_image(const char* src_disk, uint64_t target_bytes, const char* out_path) {
+    sdc_ptable src, dst;
+    if (sdc_ptable_read(src_disk, &src) != 0) return -1;
+    if (src.kind == SDC_PT_NONE || src.n == 0) {
+        sdc_loge("No partition table found on %s", src_disk);
+        return -1;
+    }
+    uint32_t ss = src.sector_size;
+    for (int i = 0; i < src.n; i++) {
+        if (src.part[i].logical) {
+            sdc_loge("%s has logical partitions; FS-aware shrink supports primary/GPT only", src_disk);
+            return -1;
+        }
+    }
+
+    part_plan* pp = calloc((unsigned)src.n, sizeof(part_plan));
+    if (!pp) return -1;
+    int rc = 0;
+
+    // 1. Exact allocation per partition.
+    for (int i = 0; i < src.n && rc == 0; i++) {
+        part_plan* p = &pp[i];
+        sdc_part_devnode(src_disk, src.part[i].index, p->dev, sizeof(p->dev));
+        p->src_bytes = src.part[i].size * ss;
+        p->fs = sdc_fs_kind_of(p->dev);
+        int m = sdc_fsmap_partition(p->dev, 0, &p->unalloc);
+        if (m < 0) { rc = -1; break; }
+        sdc_extents_normalize(&p->unalloc);
+        p->mapped = (m == 0);
+        p->used_bytes = p->src_bytes - (p->unalloc.total < p->src_bytes ? p->unalloc.total : p->src_bytes);
+        p->plan = (p->fs == SDC_FS_EXT && p->mapped) ? PLAN_EXT_SHRINK : PLAN_VERBATIM;
+        p->new_bytes = p->src_bytes;
+        if (p->fs == SDC_FS_EXT && !p->mapped) {
+            sdc_loge("%s: ext filesystem cannot be mapped (mounted read-write, not clean or bigalloc); "
+                     "unmount and fsck it first", p->dev);
+            rc = -1;
+        }
+    }
+
+    // 2. Shrink ext filesystems on sparse copies.
+    for (int i = 0; i < src.n && rc == 0; i++) {
+        if (pp[i].plan != PLAN_EXT_SHRINK) continue;
+        sdc_logi("[SHRINK] %s: %.1f MB used of %.1f MB (ext)", pp[i].dev,
+                 (double)pp[i].used_bytes / (double)MB(1), (double)pp[i].src_bytes / (double)MB(1));
+        rc = shrink_ext(&pp[i], out_path, src.part[i].index);
+        if (rc == 0)
+            sdc_logi("[SHRINK] %s: filesystem now %.1f MB", pp[i].dev,
+                     (double)pp[i].new_bytes / (double)MB(1));
+    }
+
+    // 3. Lay out partitions in source order, first start kept (bootloader gap).
+    // Backup GPT: 128 x 128-byte entries plus the header sector.
+    uint64_t gpt_tail = src.kind == SDC_PT_GPT ? 128 * 128 + ss : 0;
+    uint64_t total = 0;
+    for (int pass = 0; pass < 2 && rc == 0; pass++) {
+        uint64_t pos = src.part[0].start * ss;
+        for (int i = 0; i < src.n; i++) {
+            if (i) pos = align_up(pos, SHRINK_ALIGN);
+            pos += pp[i].new_bytes;
+        }
+        total = align_up(pos + gpt_tail, SHRINK_ALIGN);
+        if (total <= target_bytes) break;
+        // Still too big: rebuild FAT partitions at their used size instead.
+        bool changed = false;
+        for (int i = 0; i < src.n; i++) {
+            part_plan* p = &pp[i];
+            if (p->fs != SDC_FS_FAT || !p->mapped || p->plan != PLAN_VERBATIM) continue;
+            unsigned spc, bps, bits; uint32_t volid; char label[12];
+            if (fat_params(p->dev, &spc, &bps, &bits, &volid, label) != 0) continue;
+            uint64_t want = align_up(fat_volume_bytes(p->used_bytes + headroom(p->used_bytes),
+                                                      spc, bps, bits), SHRINK_ALIGN);
+            if (want < p->new_bytes) { p->new_bytes = want; p->plan = PLAN_FAT_REBUILD; changed = true; }
+        }
+        if (!changed) break;
+    }
+    if (rc == 0 && total > target_bytes) {
+        sdc_loge("Destination capacity too small: need %llu MB, have %llu MB",
+                 (unsigned long long)(total / MB(1)), (unsigned long long)(target_bytes / MB(1)));
+        rc = -1;
+    }
+
+    // 4. Build the image: bootloader gap, partitions, new table.
+    if (rc == 0) {
+        int fd = open(out_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0 || ftruncate(fd, (off_t)total) != 0) {
+            sdc_loge("create(%s): %s", out_path, strerror(errno));
+            rc = -1;
+        }
+        if (fd >= 0) close(fd);
+    }
+    if (rc == 0) rc = sdc_copy_range(src_disk, src.part[0].start * ss, out_path, 0, NULL);
+
+    dst = src;
+    uint64_t pos = src.part[0].start * ss;
+    for (int i = 0; i < src.n && rc == 0; i++) {
+        part_plan* p = &pp[i];
+        if (i) pos = align_up(pos, SHRINK_ALIGN);
+        dst.part[i].start = pos / ss;
+        dst.part[i].size = p->new_bytes / ss;
+        switch (p->plan) {
+        case PLAN_EXT_SHRINK:
+            rc = sdc_copy_range(p->tmp, ext_fs_bytes(p->tmp, NULL), out_path, pos,
+                                p->mapped ? &p->unalloc : NULL);
+            break;
+        case PLAN_FAT_REBUILD:
+            sdc_logi("[SHRINK] %s: rebuilding FAT at %.1f MB", p->dev, (double)p->new_bytes / (double)MB(1));
+            rc = rebuild_fat(p, out_path, pos);
+            break;
+        default:
+            rc = sdc_copy_range(p->dev, p->src_bytes, out_path, pos, p->mapped ? &p->unalloc : NULL);
+            break;
+        }
+        pos += p->new_bytes;
+    }
+    if (rc == 0) rc = sdc_ptable_write(out_path, &dst, total);
+    if (rc == 0)
+        sdc_logi("[SHRINK] %d partition(s) → %.2f GB image (source %.2f GB)", src.n,
+                 (double)total / (double)(MB(1) * 1024), (double)dev_size(src_disk) / (double)(MB(1) * 1024));
+
+    plans_free(pp, src.n);
+    if (rc != 0) unlink(out_path);
+    return rc;
+}
@@ -0,0 +1,15 @@
+// sdcloner_shrink.h
+// FS-aware shrink that mirrors the source partition layout.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+
+// Write to out_path an image of src_disk holding every partition in the same
+// order, with the same table type, partition types/IDs and filesystems.
+// ext2/3/4 partitions are shrunk at block level (resize2fs on a sparse copy of
+// their allocated blocks); FAT and other partitions are copied block-for-block
+// (allocated clusters only), and FAT is rebuilt smaller only if the layout
+// would otherwise exceed target_bytes. Sizes come from allocation metadata.
+// Returns 0 on success, -1 on failure (out_path removed).
+int sdc_shrink_image(const char* src_disk, uint64_t target_bytes, const char* out_path);
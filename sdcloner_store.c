@@ -0,0 +1,492 @@
+// sdcloner_store.c
+// Content-defined chunking, the shared chunk directory and .sdref recipes.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_image.h"
+#include "sdcloner_verify.h"
+#include "sdcloner_store.h"
+
+static const unsigned char REF_MAGIC[8]   = { 'S','D','C','R','E','F', 0, 1 };
+static const unsigned char CHUNK_MAGIC[4] = { 'S','D','C','K' };
+
+// Cut when the top bits of the gear hash are zero: 2^-18 per byte before
+// the average size, 2^-14 after, which keeps sizes close to the average.
+#define CDC_MASK_S (~0ULL << (64 - 18))
+#define CDC_MASK_L (~0ULL << (64 - 14))
+#define CDC_WARMUP 64    // bytes until every hash bit depends on the data
+
+static void put_le32(unsigned char* d, uint32_t v) {
+    d[0] = (unsigned char)v; d[1] = (unsigned char)(v >> 8);
+    d[2] = (unsigned char)(v >> 16); d[3] = (unsigned char)(v >> 24);
+}
+static void put_le64(unsigned char* d, uint64_t v) {
+    put_le32(d, (uint32_t)v); put_le32(d + 4, (uint32_t)(v >> 32));
+}
+static uint32_t le32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+static uint64_t le64(const unsigned char* p) { return le32(p) | (uint64_t)le32(p + 4) << 32; }
+
+static int pwrite_exact(int fd, const void* buf, size_t len, uint64_t off) {
+    const unsigned char* p = buf;
+    while (len) {
+        ssize_t n = pwrite(fd, p, len, (off_t)off);
+        if (n < 0) { if (errno == EINTR) continue; return -1; }
+        p += n; len -= (size_t)n; off += (uint64_t)n;
+    }
+    return 0;
+}
+
+// ---------------- Chunking ----------------------------
+static uint64_t gear[256];
+static pthread_once_t gear_once = PTHREAD_ONCE_INIT;
+
+// Fixed pseudo-random table (splitmix64), identical on every run so equal
+// data always chunks the same way.
+static void gear_init(void) {
+    uint64_t x = 0x5344436c6f6e6572ULL;   // "SDCloner"
+    for (int i = 0; i < 256; i++) {
+        uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        gear[i] = z ^ (z >> 31);
+    }
+    // A zero run settles at -gear[0]; keep its top bit set so zeros never cut
+    // and zero runs come out as maximum-size chunks.
+    gear[0] = (gear[0] >> 1) | 1;
+}
+
+// Length of the next chunk of p[0..n).
+static size_t cdc_cut(const unsigned char* p, size_t n) {
+    if (n <= SDC_CDC_MIN) return n;
+    size_t end = n < SDC_CDC_MAX ? n : SDC_CDC_MAX;
+    size_t mid = end < SDC_CDC_AVG ? end : SDC_CDC_AVG;
+    uint64_t h = 0;
+    size_t i = SDC_CDC_MIN - CDC_WARMUP;
+    for (; i < SDC_CDC_MIN; i++) h = (h << 1) + gear[p[i]];
+    for (; i < mid; i++) {
+        h = (h << 1) + gear[p[i]];
+        if (!(h & CDC_MASK_S)) return i + 1;
+    }
+    for (; i < end; i++) {
+        h = (h << 1) + gear[p[i]];
+        if (!(h & CDC_MASK_L)) return i + 1;
+    }
+    return end;
+}
+
+// ---------------- Chunk ids ---------------------------
+static void chunk_path(const char* dir, const sdc_ref_entry* e, char* out, size_t cap) {
+    snprintf(out, cap, "%s/%02x/%016llx%08x%08x", dir, (unsigned)(e->h64 >> 56),
+             (unsigned long long)e->h64, e->crc, e->len);
+}
+
+static bool same_chunk(const sdc_ref_entry* a, const sdc_ref_entry* b) {
+    return a->h64 == b->h64 && a->crc == b->crc && a->len == b->len;
+}
+
+// Open-addressing set of chunk ids; a slot with len 0 is empty.
+typedef struct {
+    sdc_ref_entry* e;
+    size_t         cap, n;
+} id_set;
+
+static size_t set_slot(const id_set* s, const sdc_ref_entry* e) {
+    size_t j = (size_t)e->h64 & (s->cap - 1);
+    while (s->e[j].len && !same_chunk(&s->e[j], e)) j = (j + 1) & (s->cap - 1);
+    return j;
+}
+
+static bool set_has(const id_set* s, const sdc_ref_entry* e) {
+    return s->cap && s->e[set_slot(s, e)].len;
+}
+
+// Returns 1 if e was already present, 0 if added, -1 when out of memory.
+static int set_add(id_set* s, const sdc_ref_entry* e) {
+    if ((s->n + 1) * 2 > s->cap) {
+        id_set ns = { calloc(s->cap ? s->cap * 2 : 4096, sizeof(sdc_ref_entry)),
+                      s->cap ? s->cap * 2 : 4096, s->n };
+        if (!ns.e) return -1;
+        for (size_t i = 0; i < s->cap; i++)
+            if (s->e[i].len) ns.e[set_slot(&ns, &s->e[i])] = s->e[i];
+        free(s->e);
+        *s = ns;
+    }
+    size_t j = set_slot(s, e);
+    if (s->e[j].len) return 1;
+    s->e[j] = *e;
+    s->n++;
+    return 0;
+}
+
+// ---------------- Recipes -----------------------------
+void sdc_ref_chunk_dir(const char* ref_path, char* out, size_t cap) {
+    const char* slash = strrchr(ref_path, '/');
+    if (!slash) snprintf(out, cap, "%s", SDC_STORE_DIR);
+    else snprintf(out, cap, "%.*s/%s", (int)(slash - ref_path), ref_path, SDC_STORE_DIR);
+}
+
+int sdc_ref_finish(int fd, uint64_t image_size, const sdc_ref_entry* e, uint64_t n) {
+    size_t elen = (size_t)n * SDC_REF_ENTRY;
+    unsigned char* buf = malloc(elen + 4);
+    if (!buf) return -1;
+    uint32_t max_len = 0;
+    for (uint64_t i = 0; i < n; i++) {
+        unsigned char* d = buf + i * SDC_REF_ENTRY;
+        put_le64(d, e[i].h64);
+        put_le32(d + 8, e[i].crc);
+        put_le32(d + 12, e[i].len);
+        put_le32(d + 16, e[i].flags);
+        if (e[i].len > max_len) max_len = e[i].len;
+    }
+    put_le32(buf + elen, sdc_crc32c(0, buf, elen));
+    int rc = pwrite_exact(fd, buf, elen + 4, SDC_REF_HDR_LEN);
+    free(buf);
+    if (rc != 0 || fdatasync(fd) != 0) return -1;
+    unsigned char h[SDC_REF_HDR_LEN];
+    memset(h, 0, sizeof(h));
+    memcpy(h, REF_MAGIC, 8);
+    put_le32(h + 8, 1);                       // version
+    put_le64(h + 16, image_size);
+    put_le64(h + 24, n);
+    put_le32(h + 32, max_len);
+    put_le32(h + 44, sdc_crc32c(0, h, 44));
+    if (pwrite_exact(fd, h, sizeof(h), 0) != 0) return -1;
+    return ftruncate(fd, (off_t)(SDC_REF_HDR_LEN + elen + 4));
+}
+
+int sdc_ref_open(const char* path, sdc_ref* r) {
+    memset(r, 0, sizeof(*r));
+    FILE* fp = fopen(path, "rbe");
+    if (!fp) { sdc_loge("open(%s): %s", path, strerror(errno)); return -1; }
+    unsigned char h[SDC_REF_HDR_LEN], *buf = NULL;
+    if (fread(h, 1, sizeof(h), fp) != sizeof(h) || memcmp(h, REF_MAGIC, 8) != 0 ||
+        le32(h + 44) != sdc_crc32c(0, h, 44) || le32(h + 8) != 1) {
+        sdc_loge("%s: not an .sdref recipe, incomplete or damaged", path);
+        goto fail;
+    }
+    r->image_size = le64(h + 16);
+    r->n = le64(h + 24);
+    r->max_len = le32(h + 32);
+    if (r->max_len > SDC_CDC_MAX || r->n > r->image_size) {
+        sdc_loge("%s: inconsistent .sdref header", path);
+        goto fail;
+    }
+    size_t elen = (size_t)r->n * SDC_REF_ENTRY;
+    buf = malloc(elen + 4);
+    r->e = calloc(r->n ? r->n : 1, sizeof(sdc_ref_entry));
+    char dir[PATH_MAX];
+    sdc_ref_chunk_dir(path, dir, sizeof(dir));
+    r->chunk_dir = strdup(dir);
+    if (!buf || !r->e || !r->chunk_dir) { sdc_loge("out of memory loading %s", path); goto fail; }
+    if (fread(buf, 1, elen + 4, fp) != elen + 4 || le32(buf + elen) != sdc_crc32c(0, buf, elen)) {
+        sdc_loge("%s: chunk list damaged", path);
+        goto fail;
+    }
+    uint64_t total = 0;
+    for (uint64_t i = 0; i < r->n; i++) {
+        const unsigned char* d = buf + i * SDC_REF_ENTRY;
+        sdc_ref_entry* e = &r->e[i];
+        e->h64 = le64(d);
+        e->crc = le32(d + 8);
+        e->len = le32(d + 12);
+        e->flags = le32(d + 16);
+        total += e->len;
+        if (!e->len || e->len > r->max_len) { sdc_loge("%s: chunk list damaged", path); goto fail; }
+    }
+    if (total != r->image_size) { sdc_loge("%s: chunk list does not add up", path); goto fail; }
+    free(buf);
+    fclose(fp);
+    return 0;
+fail:
+    free(buf);
+    fclose(fp);
+    sdc_ref_close(r);
+    return -1;
+}
+
+void sdc_ref_close(sdc_ref* r) {
+    free(r->chunk_dir);
+    free(r->e);
+    memset(r, 0, sizeof(*r));
+}
+
+size_t sdc_ref_scratch(const sdc_ref* r) {
+    return compressBound(r->max_len ? r->max_len : 1) + SDC_CHUNK_HDR_LEN;
+}
+
+int sdc_ref_read_chunk(const sdc_ref* r, uint64_t i, unsigned char* out, unsigned char* scratch) {
+    const sdc_ref_entry* e = &r->e[i];
+    if (e->flags & SDC_CHUNK_ZERO) { memset(out, 0, e->len); return 0; }
+    char path[PATH_MAX];
+    chunk_path(r->chunk_dir, e, path, sizeof(path));
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) { sdc_loge("[STORE] chunk missing: %s", path); return -1; }
+    size_t cap = sdc_ref_scratch(r), got = 0;
+    for (;;) {
+        ssize_t n = read(fd, scratch + got, cap - got);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        got += (size_t)n;
+    }
+    close(fd);
+    if (got < SDC_CHUNK_HDR_LEN || memcmp(scratch, CHUNK_MAGIC, 4) != 0 ||
+        le32(scratch + 8) != e->len || le32(scratch + 12) != e->crc)
+        goto bad;
+    const unsigned char* data = scratch + SDC_CHUNK_HDR_LEN;
+    size_t dlen = got - SDC_CHUNK_HDR_LEN;
+    if (le32(scratch + 4) & SDC_CHUNK_STORED) {
+        if (dlen != e->len) goto bad;
+        memcpy(out, data, dlen);
+    } else {
+        z_stream zs; memset(&zs, 0, sizeof(zs));
+        if (inflateInit2(&zs, -15) != Z_OK) return -1;
+        zs.next_in = (unsigned char*)data; zs.avail_in = (uInt)dlen;
+        zs.next_out = out;                 zs.avail_out = e->len;
+        int zrc = inflate(&zs, Z_FINISH);
+        size_t olen = e->len - zs.avail_out;
+        inflateEnd(&zs);
+        if (zrc != Z_STREAM_END || olen != e->len) goto bad;
+    }
+    if (sdc_crc32c(0, out, e->len) == e->crc) return 0;
+bad:
+    sdc_loge("[STORE] chunk damaged: %s", path);
+    errno = EIO;
+    return -1;
+}
+
+// ---------------- Chunk directory ---------------------
+struct sdc_store {
+    char            dir[PATH_MAX - 64];   // room for "/xx/<id>.tmp<tid>"
+    pthread_mutex_t mu;
+    id_set          known;       // ids seen this run, stored or found on disk
+    uint64_t        chunks, bytes;
+    uint64_t        new_chunks, new_bytes, stored_bytes;
+};
+
+sdc_store* sdc_store_open(const char* chunk_dir) {
+    pthread_once(&gear_once, gear_init);
+    sdc_store* s = calloc(1, sizeof(*s));
+    if (!s) return NULL;
+    if (strlen(chunk_dir) >= sizeof(s->dir)) {
+        sdc_loge("%s: path too long", chunk_dir);
+        free(s);
+        return NULL;
+    }
+    snprintf(s->dir, sizeof(s->dir), "%s", chunk_dir);
+    if (mkdir(s->dir, 0755) != 0 && errno != EEXIST) {
+        sdc_loge("mkdir(%s): %s", s->dir, strerror(errno));
+        free(s);
+        return NULL;
+    }
+    pthread_mutex_init(&s->mu, NULL);
+    return s;
+}
+
+// Write one chunk file: temp name, then rename into place, so a reader
+// never sees a partial chunk. Two writers of the same id race harmlessly.
+static int store_chunk(sdc_store* s, z_stream* zs, const sdc_ref_entry* e, const unsigned char* data,
+                       unsigned char* zbuf, size_t zcap, uint64_t* stored) {
+    unsigned char* h = zbuf;
+    size_t clen = 0;
+    uint32_t flags = SDC_CHUNK_STORED;
+    if (zs && deflateReset(zs) == Z_OK) {
+        zs->next_in = (unsigned char*)data;
+        zs->avail_in = e->len;
+        zs->next_out = zbuf + SDC_CHUNK_HDR_LEN;
+        zs->avail_out = (uInt)(zcap - SDC_CHUNK_HDR_LEN);
+        if (deflate(zs, Z_FINISH) == Z_STREAM_END) {
+            clen = zcap - SDC_CHUNK_HDR_LEN - zs->avail_out;
+            if (clen < e->len) flags = 0;
+        }
+    }
+    memcpy(h, CHUNK_MAGIC, 4);
+    put_le32(h + 4, flags);
+    put_le32(h + 8, e->len);
+    put_le32(h + 12, e->crc);
+    if (flags & SDC_CHUNK_STORED) clen = e->len;
+
+    char path[PATH_MAX], tmp[PATH_MAX + 32];
+    chunk_path(s->dir, e, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.tmp%ld", path, (long)gettid());
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0 && errno == ENOENT) {
+        char sub[PATH_MAX];
+        snprintf(sub, sizeof(sub), "%s/%02x", s->dir, (unsigned)(e->h64 >> 56));
+        if (mkdir(sub, 0755) != 0 && errno != EEXIST) return -1;
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) return -1;
+    bool ok = pwrite_exact(fd, h, SDC_CHUNK_HDR_LEN, 0) == 0 &&
+              pwrite_exact(fd, flags ? data : zbuf + SDC_CHUNK_HDR_LEN, clen, SDC_CHUNK_HDR_LEN) == 0;
+    if (close(fd) != 0) ok = false;
+    if (!ok || rename(tmp, path) != 0) {
+        int err = errno;
+        unlink(tmp);
+        errno = err;
+        return -1;
+    }
+    *stored = SDC_CHUNK_HDR_LEN + clen;
+    return 0;
+}
+
+int sdc_store_put(sdc_store* s, z_stream* zs, const unsigned char* buf, size_t len,
+                  sdc_ref_entry* refs, size_t* nrefs, unsigned char* zbuf, size_t zcap) {
+    *nrefs = 0;
+    uint64_t new_chunks = 0, new_bytes = 0, stored_bytes = 0;
+    for (size_t off = 0; off < len; ) {
+        size_t n = cdc_cut(buf + off, len - off);
+        const unsigned char* p = buf + off;
+        sdc_ref_entry* e = &refs[(*nrefs)++];
+        e->len = (uint32_t)n;
+        e->flags = 0;
+        off += n;
+        if (sdc_is_zero(p, n)) {
+            e->h64 = 0; e->crc = 0;
+            e->flags = SDC_CHUNK_ZERO;
+            continue;
+        }
+        e->h64 = sdc_hash64(p, n);
+        e->crc = sdc_crc32c(0, p, n);
+
+        // Claim the id; the first claimant checks the disk and writes it.
+        pthread_mutex_lock(&s->mu);
+        int seen = set_add(&s->known, e);
+        pthread_mutex_unlock(&s->mu);
+        if (seen > 0) continue;   // on -1, at worst written twice
+        char path[PATH_MAX];
+        chunk_path(s->dir, e, path, sizeof(path));
+        if (access(path, F_OK) == 0) continue;
+        uint64_t stored = 0;
+        if (store_chunk(s, zs, e, p, zbuf, zcap, &stored) != 0) {
+            sdc_loge("[STORE] cannot write %s: %s", path, strerror(errno));
+            return -1;
+        }
+        new_chunks++;
+        new_bytes += n;
+        stored_bytes += stored;
+    }
+    pthread_mutex_lock(&s->mu);
+    s->chunks += *nrefs;
+    s->bytes += len;
+    s->new_chunks += new_chunks;
+    s->new_bytes += new_bytes;
+    s->stored_bytes += stored_bytes;
+    pthread_mutex_unlock(&s->mu);
+    return 0;
+}
+
+int sdc_store_sync(sdc_store* s) {
+    int fd = open(s->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) return -1;
+    int rc = syncfs(fd);
+    close(fd);
+    return rc;
+}
+
+void sdc_store_close(sdc_store* s) {
+    if (!s) return;
+    sdc_logi("[STORE] %llu chunks, %llu new: %.2f of %.2f MB new data, %.2f MB written",
+             (unsigned long long)s->chunks, (unsigned long long)s->new_chunks,
+             (double)s->new_bytes / 1048576.0, (double)s->bytes / 1048576.0,
+             (double)s->stored_bytes / 1048576.0);
+    pthread_mutex_destroy(&s->mu);
+    free(s->known.e);
+    free(s);
+}
+
+// ---------------- Garbage collection ------------------
+static bool has_ext(const char* name, const char* ext) {
+    size_t n = strlen(name), m = strlen(ext);
+    return n > m + 1 && name[n - m - 1] == '.' && strcmp(name + n - m, ext) == 0;
+}
+
+int sdc_store_gc(const char* dir, uint64_t* freed) {
+    if (freed) *freed = 0;
+    DIR* d = opendir(dir);
+    if (!d) { sdc_loge("opendir(%s): %s", dir, strerror(errno)); return -1; }
+    id_set live = { 0 };
+    int rc = 0, images = 0;
+    struct dirent* de;
+    while (rc == 0 && (de = readdir(d))) {
+        if (!has_ext(de->d_name, SDC_REF_EXT)) continue;
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        sdc_ref r;
+        if (sdc_ref_open(path, &r) != 0) {
+            // Its chunks are unknown, so none can be proven unreferenced.
+            sdc_loge("[STORE] cannot read recipe %s; move or delete it, then run GC again", path);
+            rc = -1;
+            break;
+        }
+        for (uint64_t i = 0; i < r.n && rc == 0; i++) {
+            if (r.e[i].flags & SDC_CHUNK_ZERO) continue;
+            if (set_add(&live, &r.e[i]) < 0) { sdc_loge("out of memory"); rc = -1; }
+        }
+        sdc_ref_close(&r);
+        images++;
+    }
+    closedir(d);
+    if (rc != 0) {
+        sdc_loge("[STORE] garbage collection aborted, nothing deleted");
+        free(live.e);
+        return -1;
+    }
+
+    char cdir[PATH_MAX];
+    snprintf(cdir, sizeof(cdir), "%s/%s", dir, SDC_STORE_DIR);
+    uint64_t kept = 0, removed = 0, bytes = 0;
+    DIR* top = opendir(cdir);
+    for (struct dirent* sub; top && (sub = readdir(top)); ) {
+        if (sub->d_name[0] == '.') continue;
+        char sdir[PATH_MAX + 320];
+        snprintf(sdir, sizeof(sdir), "%s/%s", cdir, sub->d_name);
+        DIR* cd = opendir(sdir);
+        for (struct dirent* ce; cd && (ce = readdir(cd)); ) {
+            if (ce->d_name[0] == '.') continue;
+            unsigned long long h64;
+            unsigned crc, len;
+            char rest;
+            sdc_ref_entry e = { 0 };
+            bool is_chunk = sscanf(ce->d_name, "%16llx%8x%8x%c", &h64, &crc, &len, &rest) == 3 &&
+                            strlen(ce->d_name) == 32;
+            if (is_chunk) {
+                e.h64 = h64; e.crc = crc; e.len = len;
+                if (set_has(&live, &e)) { kept++; continue; }
+            }
+            char cpath[PATH_MAX + 640];
+            snprintf(cpath, sizeof(cpath), "%s/%s", sdir, ce->d_name);
+            struct stat st;
+            if (stat(cpath, &st) == 0 && unlink(cpath) == 0) {
+                removed++;
+                bytes += (uint64_t)st.st_size;
+            }
+        }
+        if (cd) closedir(cd);
+    }
+    if (top) closedir(top);
+    free(live.e);
+    sdc_logi("[STORE] %d image(s) keep %llu chunks; %llu unreferenced removed (%.2f MB)",
+             images, (unsigned long long)kept, (unsigned long long)removed,
+             (double)bytes / 1048576.0);
+    if (freed) *freed = bytes;
+    return 0;
+}
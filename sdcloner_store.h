@@ -0,0 +1,90 @@
+// sdcloner_store.h
+// Content-addressed image store. An image is a small recipe (.sdref) listing
+// content-defined chunks; each distinct chunk is kept once, deflated, in the
+// chunk directory next to the recipe (<dir>/.chunks/<xx>/<id>), so images
+// that share most of their data cost only their differences.
+//
+// Chunk boundaries come from a gear rolling hash (FastCDC-style normalised
+// chunking, 16 KiB min / 64 KiB average / 256 KiB max), so an edit moves
+// only the boundaries around it. A cut is also forced at every pipeline
+// block boundary, which lets blocks be chunked on the worker pool; disk
+// images do not shift data across those offsets. A chunk's id is its XXH64,
+// CRC32C and length; all-zero chunks are recipe flags and never stored.
+//
+// Recipe layout (little-endian): 48-byte header "SDCREF\0\1", version, image
+// size, chunk count, largest chunk, CRC32C of the header; then 20 bytes per
+// chunk (XXH64, CRC32C, length, flags) and a CRC32C of the entries. The
+// header is written last, so an interrupted recipe is never mistaken for a
+// valid one.
+//
+// Chunk file: "SDCK", flags (SDC_CHUNK_STORED or 0 = raw deflate), length,
+// CRC32C, then the data.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <zlib.h>
+
+#define SDC_REF_EXT        "sdref"
+#define SDC_REF_HDR_LEN    48
+#define SDC_REF_ENTRY      20
+#define SDC_STORE_DIR      ".chunks"
+#define SDC_CDC_MIN        (16u * 1024)
+#define SDC_CDC_AVG        (64u * 1024)
+#define SDC_CDC_MAX        (256u * 1024)
+#define SDC_CHUNK_HDR_LEN  16
+
+typedef struct {
+    uint64_t h64;      // sdc_hash64 of the chunk
+    uint32_t crc;      // sdc_crc32c of the chunk
+    uint32_t len;
+    uint32_t flags;    // SDC_CHUNK_ZERO or 0
+} sdc_ref_entry;
+
+typedef struct {
+    char*          chunk_dir;
+    uint64_t       image_size;
+    uint64_t       n;
+    sdc_ref_entry* e;
+    uint32_t       max_len;    // largest chunk, for buffers
+} sdc_ref;
+
+// Chunk directory belonging to the recipe at ref_path.
+void sdc_ref_chunk_dir(const char* ref_path, char* out, size_t cap);
+
+// Load a recipe. Returns 0 / -1 (logged).
+int  sdc_ref_open(const char* path, sdc_ref* r);
+void sdc_ref_close(sdc_ref* r);
+// Scratch bytes sdc_ref_read_chunk() needs for r.
+size_t sdc_ref_scratch(const sdc_ref* r);
+// Fetch chunk i into out (max_len bytes), checking its CRC32C. Thread-safe
+// for distinct buffers. Returns 0 / -1.
+int  sdc_ref_read_chunk(const sdc_ref* r, uint64_t i, unsigned char* out, unsigned char* scratch);
+
+// Writer side, used by the imaging pipeline: write the entries and trailer
+// after the header space, sync, then the header. Returns 0 / -1.
+int  sdc_ref_finish(int fd, uint64_t image_size, const sdc_ref_entry* e, uint64_t n);
+
+typedef struct sdc_store sdc_store;
+
+// Open (creating) the chunk directory. Returns NULL on failure (logged).
+sdc_store* sdc_store_open(const char* chunk_dir);
+// Split one pipeline block into chunks and store those the directory does
+// not have yet, deflated with zs (a raw-deflate stream, NULL = uncompressed)
+// through zbuf (compressBound(SDC_CDC_MAX) + SDC_CHUNK_HDR_LEN bytes or more).
+// refs needs room for len / SDC_CDC_MIN + 1 entries. Thread-safe.
+// Returns 0 / -1 (errno set).
+int  sdc_store_put(sdc_store* s, z_stream* zs, const unsigned char* buf, size_t len,
+                   sdc_ref_entry* refs, size_t* nrefs, unsigned char* zbuf, size_t zcap);
+// Make every chunk written so far durable. Returns 0 / -1.
+int  sdc_store_sync(sdc_store* s);
+// Log chunk / new-data totals and free s.
+void sdc_store_close(sdc_store* s);
+
+// Delete chunks of dir's store that no *.sdref in dir refers to any more.
+// Refuses to delete anything if a recipe cannot be read. Must not run while
+// an image is being written to dir. *freed (optional) gets the bytes
+// released. Returns 0 / -1.
+int  sdc_store_gc(const char* dir, uint64_t* freed);
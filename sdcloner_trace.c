@@ -0,0 +1,314 @@
+// sdcloner_trace.c
+// Stage timing, I/O latency histograms, stall counters and Chrome-trace
+// timelines behind sdcloner_trace.h.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "sdcloner_internal.h"
+#include "sdcloner_trace.h"
+
+#define TRACE_NAMES 64      // distinct stages / phases / stall points per job
+#define TRACE_NAME_LEN 48
+
+typedef struct {
+    char     name[TRACE_NAME_LEN];
+    unsigned threads;
+    uint64_t wall_ns, cpu_ns, bytes;
+} trace_stage;
+
+typedef struct {
+    char     name[TRACE_NAME_LEN];
+    uint64_t waits, wait_ns;
+} trace_stall;
+
+typedef struct {
+    uint64_t count, bytes, total_ns, max_ns;
+    uint64_t hist[SDC_TRACE_BUCKETS];
+} trace_io;
+
+typedef struct {
+    char     name[TRACE_NAME_LEN];
+    int      tid;
+    uint64_t ts, dur;       // ns since the trace began
+} trace_event;
+
+typedef struct {
+    int  tid;
+    char name[TRACE_NAME_LEN];
+} trace_thread;
+
+struct sdc_trace {
+    char            job[32];
+    uint64_t        t0;
+    pthread_mutex_t mu;
+    trace_stage     stage[TRACE_NAMES];
+    unsigned        nstage;
+    trace_stage     phase[TRACE_NAMES];    // threads unused; cpu in ns
+    unsigned        nphase;
+    trace_stall     stall[TRACE_NAMES];
+    unsigned        nstall;
+    trace_io        io[2];                 // updated with atomics
+    bool            timeline;
+    trace_event*    ev;
+    size_t          nev, cap;
+    uint64_t        dropped;
+    trace_thread    thr[TRACE_NAMES];
+    unsigned        nthr;
+};
+
+uint64_t sdc_trace_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+sdc_trace* sdc_trace_new(const char* job, bool timeline) {
+    sdc_trace* t = calloc(1, sizeof(*t));
+    if (!t) return NULL;
+    snprintf(t->job, sizeof(t->job), "%s", job);
+    t->t0 = sdc_trace_now();
+    t->timeline = timeline;
+    pthread_mutex_init(&t->mu, NULL);
+    return t;
+}
+
+void sdc_trace_free(sdc_trace* t) {
+    if (!t) return;
+    pthread_mutex_destroy(&t->mu);
+    free(t->ev);
+    free(t);
+}
+
+// Entry for name in a table, added if new; NULL when the table is full.
+static void* named(void* table, size_t elem, unsigned* n, const char* name) {
+    char* p = table;
+    for (unsigned i = 0; i < *n; i++)
+        if (strcmp(p + i * elem, name) == 0) return p + i * elem;
+    if (*n == TRACE_NAMES) return NULL;
+    char* e = p + (*n)++ * elem;
+    memset(e, 0, elem);
+    snprintf(e, TRACE_NAME_LEN, "%s", name);
+    return e;
+}
+
+void sdc_trace_stage_begin(sdc_trace_clock* c) {
+    c->t0 = sdc_trace_now();
+    c->cpu0 = thread_cpu_ns();
+}
+
+void sdc_trace_stage_end(sdc_trace* t, const sdc_trace_clock* c, const char* stage, uint64_t bytes) {
+    if (!t) return;
+    uint64_t wall = sdc_trace_now() - c->t0, cpu = thread_cpu_ns() - c->cpu0;
+    int tid = (int)gettid();
+    pthread_mutex_lock(&t->mu);
+    trace_stage* s = named(t->stage, sizeof(trace_stage), &t->nstage, stage);
+    if (s) {
+        s->threads++;
+        if (wall > s->wall_ns) s->wall_ns = wall;
+        s->cpu_ns += cpu;
+        s->bytes += bytes;
+    }
+    // Thread names for the timeline.
+    if (t->timeline && t->nthr < TRACE_NAMES) {
+        t->thr[t->nthr].tid = tid;
+        snprintf(t->thr[t->nthr].name, TRACE_NAME_LEN, "%s", stage);
+        t->nthr++;
+    }
+    pthread_mutex_unlock(&t->mu);
+}
+
+void sdc_trace_phase(sdc_trace* t, const char* phase, uint64_t start_ns, uint64_t end_ns,
+                     double cpu_s, uint64_t bytes) {
+    if (!t) return;
+    pthread_mutex_lock(&t->mu);
+    trace_stage* s = named(t->phase, sizeof(trace_stage), &t->nphase, phase);
+    if (s) {
+        s->wall_ns += end_ns - start_ns;
+        s->cpu_ns += (uint64_t)(cpu_s * 1e9);
+        s->bytes += bytes;
+    }
+    pthread_mutex_unlock(&t->mu);
+    sdc_trace_span(t, phase, 1, start_ns, end_ns);
+}
+
+void sdc_trace_io(sdc_trace* t, sdc_trace_io_kind kind, uint64_t start_ns, uint64_t end_ns,
+                  uint64_t bytes) {
+    if (!t) return;
+    trace_io* io = &t->io[kind];
+    uint64_t ns = end_ns > start_ns ? end_ns - start_ns : 0;
+    uint64_t us = ns / 1000;
+    unsigned b = 0;
+    while (b + 1 < SDC_TRACE_BUCKETS && us >= (1ULL << b)) b++;
+    __atomic_fetch_add(&io->count, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->bytes, bytes, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->total_ns, ns, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&io->hist[b], 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&io->max_ns, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&io->max_ns, &max, ns, true,
+                                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {}
+}
+
+void sdc_trace_stall(sdc_trace* t, const char* what, uint64_t waits, uint64_t wait_ns) {
+    if (!t || !waits) return;
+    pthread_mutex_lock(&t->mu);
+    trace_stall* s = named(t->stall, sizeof(trace_stall), &t->nstall, what);
+    if (s) { s->waits += waits; s->wait_ns += wait_ns; }
+    pthread_mutex_unlock(&t->mu);
+}
+
+void sdc_trace_span(sdc_trace* t, const char* name, unsigned lane, uint64_t start_ns, uint64_t end_ns) {
+    if (!t || !t->timeline) return;
+    // Lanes get thread ids no real thread has (pid_max is at most 2^22).
+    int tid = lane ? (int)(1u << 23) + (int)lane : (int)gettid();
+    pthread_mutex_lock(&t->mu);
+    if (t->nev == t->cap && t->cap < SDC_TRACE_MAX_EVENTS) {
+        size_t cap = t->cap ? t->cap * 2 : 4096;
+        trace_event* e = realloc(t->ev, cap * sizeof(trace_event));
+        if (e) { t->ev = e; t->cap = cap; }
+    }
+    if (t->nev < t->cap) {
+        trace_event* e = &t->ev[t->nev++];
+        snprintf(e->name, sizeof(e->name), "%s", name);
+        e->tid = tid;
+        e->ts = start_ns > t->t0 ? start_ns - t->t0 : 0;
+        e->dur = end_ns > start_ns ? end_ns - start_ns : 0;
+    } else {
+        t->dropped++;
+    }
+    pthread_mutex_unlock(&t->mu);
+}
+
+static void json_str(FILE* fp, const char* s) {
+    fputc('"', fp);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\') fprintf(fp, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20) fprintf(fp, "\\u%04x", *s);
+        else fputc(*s, fp);
+    }
+    fputc('"', fp);
+}
+
+// Upper bound (µs) of the bucket holding the q-quantile.
+static uint64_t quantile_us(const trace_io* io, double q) {
+    uint64_t want = (uint64_t)((double)io->count * q + 0.5), seen = 0;
+    if (!want) want = 1;
+    for (unsigned b = 0; b < SDC_TRACE_BUCKETS; b++) {
+        seen += io->hist[b];
+        if (seen >= want) return 1ULL << b;
+    }
+    return 1ULL << (SDC_TRACE_BUCKETS - 1);
+}
+
+static void write_io(FILE* fp, const char* name, const trace_io* io) {
+    fprintf(fp, "    \"%s\": {\"calls\": %llu, \"bytes\": %llu, \"total_s\": %.6f, \"mean_us\": %.1f, "
+                "\"max_us\": %.1f, \"p50_us\": %llu, \"p99_us\": %llu,\n      \"histogram_us\": [",
+            name, (unsigned long long)io->count, (unsigned long long)io->bytes, (double)io->total_ns / 1e9,
+            io->count ? (double)io->total_ns / 1e3 / (double)io->count : 0.0, (double)io->max_ns / 1e3,
+            (unsigned long long)(io->count ? quantile_us(io, 0.5) : 0),
+            (unsigned long long)(io->count ? quantile_us(io, 0.99) : 0));
+    bool first = true;
+    for (unsigned b = 0; b < SDC_TRACE_BUCKETS; b++) {
+        if (!io->hist[b]) continue;
+        if (b + 1 < SDC_TRACE_BUCKETS)
+            fprintf(fp, "%s{\"lt\": %llu, \"n\": %llu}", first ? "" : ", ",
+                    (unsigned long long)(1ULL << b), (unsigned long long)io->hist[b]);
+        else
+            fprintf(fp, "%s{\"lt\": null, \"n\": %llu}", first ? "" : ", ", (unsigned long long)io->hist[b]);
+        first = false;
+    }
+    fprintf(fp, "]}");
+}
+
+static void write_stages(FILE* fp, const char* key, const trace_stage* s, unsigned n, bool threads) {
+    fprintf(fp, "  \"%s\": [", key);
+    for (unsigned i = 0; i < n; i++) {
+        double wall = (double)s[i].wall_ns / 1e9;
+        fprintf(fp, "%s\n    {\"name\": ", i ? "," : "");
+        json_str(fp, s[i].name);
+        if (threads) fprintf(fp, ", \"threads\": %u", s[i].threads);
+        fprintf(fp, ", \"wall_s\": %.6f, \"cpu_s\": %.6f, \"bytes\": %llu, \"mb_s\": %.2f}",
+                wall, (double)s[i].cpu_ns / 1e9, (unsigned long long)s[i].bytes,
+                wall > 0 ? (double)s[i].bytes / 1048576.0 / wall : 0.0);
+    }
+    fprintf(fp, "%s],\n", n ? "\n  " : "");
+}
+
+static int write_summary(sdc_trace* t, int rc, const char* path) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) { sdc_loge("[TRACE] open(%s): %s", path, strerror(errno)); return -1; }
+    fprintf(fp, "{\n  \"job\": ");
+    json_str(fp, t->job);
+    fprintf(fp, ",\n  \"result\": %d,\n  \"wall_s\": %.6f,\n", rc, (double)(sdc_trace_now() - t->t0) / 1e9);
+    write_stages(fp, "phases", t->phase, t->nphase, false);
+    write_stages(fp, "stages", t->stage, t->nstage, true);
+    fprintf(fp, "  \"io\": {\n");
+    write_io(fp, "read", &t->io[SDC_TRACE_READ]);
+    fprintf(fp, ",\n");
+    write_io(fp, "write", &t->io[SDC_TRACE_WRITE]);
+    fprintf(fp, "\n  },\n  \"stalls\": [");
+    for (unsigned i = 0; i < t->nstall; i++) {
+        fprintf(fp, "%s\n    {\"name\": ", i ? "," : "");
+        json_str(fp, t->stall[i].name);
+        fprintf(fp, ", \"waits\": %llu, \"wait_s\": %.6f}", (unsigned long long)t->stall[i].waits,
+                (double)t->stall[i].wait_ns / 1e9);
+    }
+    fprintf(fp, "%s]\n}\n", t->nstall ? "\n  " : "");
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+static int write_timeline(sdc_trace* t, const char* path) {
+    FILE* fp = fopen(path, "w");
+    if (!fp) { sdc_loge("[TRACE] open(%s): %s", path, strerror(errno)); return -1; }
+    int pid = (int)getpid();
+    fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, \"args\": {\"name\": ", pid);
+    json_str(fp, t->job);
+    fprintf(fp, "}},\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+                "\"args\": {\"name\": \"phases\"}}", pid, (1 << 23) + 1);
+    for (unsigned i = 0; i < t->nthr; i++) {
+        fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+                pid, t->thr[i].tid);
+        json_str(fp, t->thr[i].name);
+        fprintf(fp, "}}");
+    }
+    for (size_t i = 0; i < t->nev; i++) {
+        const trace_event* e = &t->ev[i];
+        fprintf(fp, ",\n{\"name\": ");
+        json_str(fp, e->name);
+        fprintf(fp, ", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}",
+                pid, e->tid, (double)e->ts / 1e3, (double)e->dur / 1e3);
+    }
+    fprintf(fp, "\n]}\n");
+    if (t->dropped) sdc_logi("[TRACE] timeline full, %llu later events dropped", (unsigned long long)t->dropped);
+    return fclose(fp) == 0 ? 0 : -1;
+}
+
+int sdc_trace_write(sdc_trace* t, int rc, const char* summary_path, const char* timeline_path) {
+    if (!t) return 0;
+    pthread_mutex_lock(&t->mu);
+    int r = write_summary(t, rc, summary_path);
+    if (r == 0) sdc_logi("[TRACE] summary: %s", summary_path);
+    if (r == 0 && t->timeline && timeline_path) {
+        r = write_timeline(t, timeline_path);
+        if (r == 0) sdc_logi("[TRACE] timeline: %s", timeline_path);
+    }
+    pthread_mutex_unlock(&t->mu);
+    return r;
+}
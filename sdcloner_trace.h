@@ -0,0 +1,64 @@
+// sdcloner_trace.h
+// Per-job instrumentation: wall / CPU time and bytes per pipeline stage and
+// engine phase, a latency histogram of device I/O calls, stall counters for
+// the pipeline's buffer queues, and optionally a timeline of spans.
+//
+// Written at the end of a job as a JSON summary and, with a timeline, as a
+// Chrome trace ({"traceEvents": [...]}) that chrome://tracing and Perfetto
+// open directly. Every function accepts t == NULL and does nothing, so call
+// sites need no checks when tracing is off.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef enum {
+    SDC_TRACE_READ = 0,
+    SDC_TRACE_WRITE,
+} sdc_trace_io_kind;
+
+// Latency buckets: bucket b counts calls under 2^b microseconds; the last
+// one takes everything slower.
+#define SDC_TRACE_BUCKETS 28
+// Timeline events kept per job; later ones are counted as dropped.
+#define SDC_TRACE_MAX_EVENTS (1u << 20)
+
+typedef struct sdc_trace sdc_trace;
+
+// job names the operation ("clone", "burn", ...).
+sdc_trace* sdc_trace_new(const char* job, bool timeline);
+void       sdc_trace_free(sdc_trace* t);
+
+// CLOCK_MONOTONIC in nanoseconds.
+uint64_t sdc_trace_now(void);
+
+// One thread's share of a stage, measured from sdc_trace_stage_begin() on
+// that thread. Threads of the same stage add up CPU time and bytes; the
+// stage's wall time is the longest thread's.
+typedef struct {
+    uint64_t t0, cpu0;
+} sdc_trace_clock;
+void sdc_trace_stage_begin(sdc_trace_clock* c);
+void sdc_trace_stage_end(sdc_trace* t, const sdc_trace_clock* c, const char* stage, uint64_t bytes);
+
+// An engine phase; cpu_s includes child processes (mkfs, rsync, ...).
+void sdc_trace_phase(sdc_trace* t, const char* phase, uint64_t start_ns, uint64_t end_ns,
+                     double cpu_s, uint64_t bytes);
+
+// A device read or write call of bytes that ran from start_ns to end_ns.
+void sdc_trace_io(sdc_trace* t, sdc_trace_io_kind kind, uint64_t start_ns, uint64_t end_ns,
+                  uint64_t bytes);
+
+// waits blocking waits totalling wait_ns at a named point (a full or empty
+// queue). Repeated names add up.
+void sdc_trace_stall(sdc_trace* t, const char* what, uint64_t waits, uint64_t wait_ns);
+
+// Timeline span on the calling thread (lane 0) or on a numbered lane, for
+// work that overlaps on one thread such as queued asynchronous requests.
+// Ignored without a timeline.
+void sdc_trace_span(sdc_trace* t, const char* name, unsigned lane, uint64_t start_ns, uint64_t end_ns);
+
+// Write the summary (and the timeline, if recorded and timeline_path is
+// non-NULL). rc is the job's result. Returns 0 / -1 (logged).
+int sdc_trace_write(sdc_trace* t, int rc, const char* summary_path, const char* timeline_path);
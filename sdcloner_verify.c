@@ -0,0 +1,351 @@
+// sdcloner_verify.c
+// CRC32C block hashing and O_DIRECT read-back verification of burns.
+// License: GPLv3
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "sdcloner_internal.h"
+#include "sdcloner_pipeline.h"
+#include "sdcloner_verify.h"
+
+#define MB(x) ((uint64_t)(x) * 1024ULL * 1024ULL)
+
+#define VERIFY_RING       4     // read-ahead buffers per destination
+#define VERIFY_MAX_RANGES 32    // mismatch ranges logged individually
+
+// ---------------- CRC32C ------------------------------
+// Software fallback: slicing-by-8 over the reflected Castagnoli polynomial.
+static uint32_t crc_tab[8][256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static void crc_tab_init(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? (c >> 1) ^ 0x82F63B78u : c >> 1;
+        crc_tab[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; i++)
+        for (int t = 1; t < 8; t++)
+            crc_tab[t][i] = (crc_tab[t - 1][i] >> 8) ^ crc_tab[0][crc_tab[t - 1][i] & 0xff];
+}
+
+static uint32_t crc32c_sw(uint32_t c, const unsigned char* p, size_t len) {
+    pthread_once(&crc_once, crc_tab_init);
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= c;
+        c = crc_tab[7][w & 0xff] ^ crc_tab[6][(w >> 8) & 0xff] ^
+            crc_tab[5][(w >> 16) & 0xff] ^ crc_tab[4][(w >> 24) & 0xff] ^
+            crc_tab[3][(w >> 32) & 0xff] ^ crc_tab[2][(w >> 40) & 0xff] ^
+            crc_tab[1][(w >> 48) & 0xff] ^ crc_tab[0][w >> 56];
+        p += 8; len -= 8;
+    }
+    while (len--) c = (c >> 8) ^ crc_tab[0][(c ^ *p++) & 0xff];
+    return c;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t c, const unsigned char* p, size_t len) {
+    uint64_t c64 = c;
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c64 = _mm_crc32_u64(c64, w);
+        p += 8; len -= 8;
+    }
+    c = (uint32_t)c64;
+    while (len--) c = _mm_crc32_u8(c, *p++);
+    return c;
+}
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+static uint32_t crc32c_arm(uint32_t c, const unsigned char* p, size_t len) {
+    while (len >= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = __crc32cd(c, w);
+        p += 8; len -= 8;
+    }
+    while (len--) c = __crc32cb(c, *p++);
+    return c;
+}
+#endif
+
+uint32_t sdc_crc32c(uint32_t crc, const void* buf, size_t len) {
+    const unsigned char* p = buf;
+    uint32_t c = ~crc;
+#if defined(__x86_64__)
+    static int level = -1;   // benign race: every thread computes the same value
+    if (level < 0) {
+        __builtin_cpu_init();
+        level = __builtin_cpu_supports("sse4.2") ? 1 : 0;
+    }
+    if (level == 1) return ~crc32c_sse42(c, p, len);
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+    return ~crc32c_arm(c, p, len);
+#endif
+    return ~crc32c_sw(c, p, len);
+}
+
+// ---------------- XXH64 -------------------------------
+#define XXH_P1 11400714785074694791ull
+#define XXH_P2 14029467366897019727ull
+#define XXH_P3 1609587929392839161ull
+#define XXH_P4 9650029242287828579ull
+#define XXH_P5 2870177450012600261ull
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+static inline uint64_t rd64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t rd32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t in) {
+    acc += in * XXH_P2;
+    return rotl64(acc, 31) * XXH_P1;
+}
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t v) {
+    acc ^= xxh_round(0, v);
+    return acc * XXH_P1 + XXH_P4;
+}
+
+uint64_t sdc_hash64(const void* buf, size_t len) {
+    const unsigned char* p = buf;
+    const unsigned char* end = p + len;
+    uint64_t h;
+    if (len >= 32) {
+        uint64_t v1 = XXH_P1 + XXH_P2, v2 = XXH_P2, v3 = 0, v4 = (uint64_t)0 - XXH_P1;
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxh_round(v1, rd64(p));
+            v2 = xxh_round(v2, rd64(p + 8));
+            v3 = xxh_round(v3, rd64(p + 16));
+            v4 = xxh_round(v4, rd64(p + 24));
+            p += 32;
+        } while (p <= limit);
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1); h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3); h = xxh_merge(h, v4);
+    } else {
+        h = XXH_P5;
+    }
+    h += (uint64_t)len;
+    for (; p + 8 <= end; p += 8) h = rotl64(h ^ xxh_round(0, rd64(p)), 27) * XXH_P1 + XXH_P4;
+    if (p + 4 <= end) { h = rotl64(h ^ (uint64_t)rd32(p) * XXH_P1, 23) * XXH_P2 + XXH_P3; p += 4; }
+    for (; p < end; p++) h = rotl64(h ^ *p * XXH_P5, 11) * XXH_P1;
+    h ^= h >> 33; h *= XXH_P2;
+    h ^= h >> 29; h *= XXH_P3;
+    return h ^ (h >> 32);
+}
+
+// ---------------- Plan --------------------------------
+uint64_t* sdc_verify_plan(uint64_t nblocks, sdc_verify_mode mode, unsigned sample_pct, uint64_t* n) {
+    *n = 0;
+    if (mode == SDC_VERIFY_SKIP || !nblocks) return NULL;
+    uint64_t* plan = malloc(nblocks * sizeof(uint64_t));
+    if (!plan) return NULL;
+    if (mode == SDC_VERIFY_FULL || sample_pct >= 100) {
+        for (uint64_t i = 0; i < nblocks; i++) plan[i] = i;
+        *n = nblocks;
+        return plan;
+    }
+    // The partition table and the end of the image are always checked.
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    uint64_t x = (uint64_t)ts.tv_nsec ^ ((uint64_t)ts.tv_sec << 20) ^ (uint64_t)getpid();
+    if (!x) x = 0x9E3779B97F4A7C15ull;
+    for (uint64_t i = 0; i < nblocks; i++) {
+        x ^= x << 13; x ^= x >> 7; x ^= x << 17;   // xorshift64
+        if (i == 0 || i == nblocks - 1 || x % 1000 < (uint64_t)sample_pct * 10) plan[(*n)++] = i;
+    }
+    return plan;
+}
+
+// ---------------- Read-back --------------------------
+typedef struct {
+    int             fd;
+    bool            direct;
+    const uint64_t* plan;
+    uint64_t        nplan;
+    size_t          block_size;
+    uint64_t        image_size;
+    unsigned char*  buf[VERIFY_RING];
+    ssize_t         got[VERIFY_RING];
+    int             err[VERIFY_RING];
+    bool            full[VERIFY_RING];
+    pthread_mutex_t mu;
+    pthread_cond_t  cv;
+    sdc_ctl*        ctl;
+} verify_ctx;
+
+static size_t block_len(const verify_ctx* v, uint64_t blk) {
+    uint64_t off = blk * v->block_size;
+    return v->image_size - off < v->block_size ? (size_t)(v->image_size - off) : v->block_size;
+}
+
+static void* verify_reader_main(void* arg) {
+    verify_ctx* v = arg;
+    for (uint64_t k = 0; k < v->nplan; k++) {
+        unsigned r = (unsigned)(k % VERIFY_RING);
+        pthread_mutex_lock(&v->mu);
+        while (v->full[r]) pthread_cond_wait(&v->cv, &v->mu);
+        pthread_mutex_unlock(&v->mu);
+
+        uint64_t off = v->plan[k] * v->block_size;
+        size_t len = block_len(v, v->plan[k]);
+        if (v->direct) len = (len + SDC_IO_ALIGN - 1) / SDC_IO_ALIGN * SDC_IO_ALIGN;
+        size_t got = 0;
+        int err = sdc_ctl_gate(v->ctl, len) ? 0 : ECANCELED;
+        while (!err && got < len) {
+            ssize_t n = pread(v->fd, v->buf[r] + got, len - got, (off_t)(off + got));
+            if (n < 0) { if (errno == EINTR) continue; err = errno; break; }
+            if (n == 0) break;
+            got += (size_t)n;
+        }
+
+        pthread_mutex_lock(&v->mu);
+        v->got[r] = (ssize_t)got;
+        v->err[r] = err;
+        v->full[r] = true;
+        pthread_cond_broadcast(&v->cv);
+        pthread_mutex_unlock(&v->mu);
+        if (err == ECANCELED) break;
+    }
+    return NULL;
+}
+
+typedef struct {
+    uint64_t first, last;   // block numbers, inclusive
+    bool     unreadable;
+    bool     open;
+    unsigned count;
+} bad_range;
+
+static void range_flush(const char* dev, bad_range* br, size_t block_size, uint64_t image_size) {
+    if (!br->open) return;
+    br->open = false;
+    if (++br->count > VERIFY_MAX_RANGES) return;
+    uint64_t start = br->first * block_size;
+    uint64_t end = (br->last + 1) * block_size;
+    if (end > image_size) end = image_size;
+    sdc_loge("[VERIFY] %s: %s at bytes %llu-%llu (%.2f MiB)", dev,
+             br->unreadable ? "unreadable" : "mismatch",
+             (unsigned long long)start, (unsigned long long)end - 1,
+             (double)(end - start) / (double)MB(1));
+}
+
+int sdc_verify_dest(const char* dev_path, const uint32_t* crcs, size_t block_size,
+                    uint64_t image_size, const uint64_t* plan, uint64_t nplan,
+                    uint64_t* checked, sdc_ctl* ctl) {
+    if (!nplan) return 0;
+    verify_ctx v;
+    memset(&v, 0, sizeof(v));
+    v.plan = plan;
+    v.nplan = nplan;
+    v.block_size = block_size;
+    v.image_size = image_size;
+    v.ctl = ctl;
+    v.direct = true;
+    v.fd = open(dev_path, O_RDONLY | O_CLOEXEC | O_DIRECT);
+    if (v.fd < 0 && errno == EINVAL) {
+        // No O_DIRECT (tmpfs, some FUSE): at least make the kernel re-read.
+        v.direct = false;
+        v.fd = open(dev_path, O_RDONLY | O_CLOEXEC);
+        if (v.fd >= 0) (void)posix_fadvise(v.fd, 0, 0, POSIX_FADV_DONTNEED);
+    }
+    if (v.fd < 0) { sdc_loge("[VERIFY] open(%s): %s", dev_path, strerror(errno)); return -1; }
+
+    int rc = 0;
+    for (unsigned i = 0; i < VERIFY_RING; i++)
+        if (posix_memalign((void**)&v.buf[i], SDC_IO_ALIGN, block_size) != 0) {
+            v.buf[i] = NULL;
+            rc = -1;
+        }
+    pthread_mutex_init(&v.mu, NULL);
+    pthread_cond_init(&v.cv, NULL);
+    pthread_t th;
+    if (rc == 0 && sdc_thread_create(&th, verify_reader_main, &v) != 0) rc = -1;
+    if (rc != 0) {
+        sdc_loge("[VERIFY] %s: cannot start read-back", dev_path);
+        for (unsigned i = 0; i < VERIFY_RING; i++) free(v.buf[i]);
+        close(v.fd);
+        pthread_cond_destroy(&v.cv);
+        pthread_mutex_destroy(&v.mu);
+        return -1;
+    }
+
+    bad_range br;
+    memset(&br, 0, sizeof(br));
+    uint64_t bad_bytes = 0;
+    bool unreadable = false, mismatch = false, cancelled = false;
+    for (uint64_t k = 0; k < nplan; k++) {
+        unsigned r = (unsigned)(k % VERIFY_RING);
+        pthread_mutex_lock(&v.mu);
+        while (!v.full[r]) pthread_cond_wait(&v.cv, &v.mu);
+        pthread_mutex_unlock(&v.mu);
+        if (v.err[r] == ECANCELED) { cancelled = true; break; }   // the reader has stopped
+
+        uint64_t blk = plan[k];
+        size_t len = block_len(&v, blk);
+        bool bad_read = v.err[r] != 0 || (size_t)v.got[r] < len;
+        bool bad = bad_read || sdc_crc32c(0, v.buf[r], len) != crcs[blk];
+
+        pthread_mutex_lock(&v.mu);
+        v.full[r] = false;
+        pthread_cond_broadcast(&v.cv);
+        pthread_mutex_unlock(&v.mu);
+
+        if (bad) {
+            bad_bytes += len;
+            if (bad_read) unreadable = true; else mismatch = true;
+            if (br.open && br.last + 1 == blk && br.unreadable == bad_read) {
+                br.last = blk;
+            } else {
+                range_flush(dev_path, &br, block_size, image_size);
+                br.first = br.last = blk;
+                br.unreadable = bad_read;
+                br.open = true;
+            }
+        } else {
+            range_flush(dev_path, &br, block_size, image_size);
+        }
+        if (checked) __atomic_add_fetch(checked, len, __ATOMIC_RELAXED);
+    }
+    range_flush(dev_path, &br, block_size, image_size);
+    pthread_join(th, NULL);
+
+    if (br.count > VERIFY_MAX_RANGES)
+        sdc_loge("[VERIFY] %s: ... %u more bad ranges", dev_path, br.count - VERIFY_MAX_RANGES);
+    if (cancelled && !unreadable && !mismatch) {
+        sdc_loge("[JOB] %s: read-back cancelled", dev_path);
+    } else if (unreadable || mismatch) {
+        sdc_loge("[VERIFY] %s: FAILED, %.2f MiB in %u range(s) differ from the image%s", dev_path,
+                 (double)bad_bytes / (double)MB(1), br.count, v.direct ? "" : " (buffered read-back)");
+    } else {
+        sdc_logi("[VERIFY] %s: %llu block(s) match%s", dev_path, (unsigned long long)nplan,
+                 v.direct ? "" : " (buffered read-back)");
+    }
+    for (unsigned i = 0; i < VERIFY_RING; i++) free(v.buf[i]);
+    close(v.fd);
+    pthread_cond_destroy(&v.cv);
+    pthread_mutex_destroy(&v.mu);
+    return unreadable ? -1 : mismatch ? 1 : cancelled ? -2 : 0;
+}
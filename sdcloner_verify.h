@@ -0,0 +1,43 @@
+// sdcloner_verify.h
+// Write verification for burns. Every image block is hashed (CRC32C) as it
+// is handed to the writers; afterwards each destination is read back with
+// O_DIRECT, so the page cache cannot answer for the card, and compared block
+// by block. Read-back of the next block overlaps hashing of the current one.
+// License: GPLv3
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdcloner_jobs.h"
+
+typedef enum {
+    SDC_VERIFY_SKIP = 0,
+    SDC_VERIFY_SAMPLED,     // first and last block plus a random subset
+    SDC_VERIFY_FULL,
+} sdc_verify_mode;
+
+// CRC32C (Castagnoli) of buf, continuing from crc (0 to start). Uses the
+// SSE4.2 / ARMv8 CRC instructions when the CPU has them.
+uint32_t sdc_crc32c(uint32_t crc, const void* buf, size_t len);
+
+// 64-bit XXH64 (seed 0) of buf: block identity for differential burns and
+// manifests, where a 32-bit CRC would make false "unchanged" too likely.
+uint64_t sdc_hash64(const void* buf, size_t len);
+
+// Blocks to check out of nblocks: all (FULL), or blocks 0 and nblocks-1 plus
+// a random sample_pct percent of the rest (SAMPLED). Returns a malloc'd
+// ascending list and its length in *n, or NULL (with *n = 0) for SKIP / out
+// of memory.
+uint64_t* sdc_verify_plan(uint64_t nblocks, sdc_verify_mode mode, unsigned sample_pct, uint64_t* n);
+
+// Read the listed blocks of dev_path back and compare them with crcs (one per
+// block of block_size bytes, image_size in total). Mismatching blocks are
+// coalesced into byte ranges and logged. *checked (optional) is advanced
+// atomically by the bytes compared so far, for progress. Each block read
+// passes ctl's gate (may be NULL).
+// Returns 0 if all match, 1 on mismatch, -1 on I/O error, -2 if cancelled
+// before any difference was found.
+int sdc_verify_dest(const char* dev_path, const uint32_t* crcs, size_t block_size,
+                    uint64_t image_size, const uint64_t* plan, uint64_t nplan,
+                    uint64_t* checked, sdc_ctl* ctl);